@@ -0,0 +1,112 @@
+/*
+ bst_tk_map.c
+
+ This is part of the tree library
+
+ Copyright 2015 Ibrahim Umar (UiT the Arctic University of Norway)
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "bst.h"
+#include "bst_tk.h"
+#include "map.h"
+
+/*
+ map.h backend for BSTTK. INT_MIN/INT_MAX are the sentinels.
+
+ ssmem assumes a fixed set of threads that all register before the
+ first collection, so the allocators for tid 0..n-1 are set up once, by
+ the first map, and handed to whichever thread runs as that tid later.
+ A later map can not use more threads than the first one.
+ */
+
+extern __thread volatile ssmem_ts_t *ssmem_ts_local;
+
+static ssmem_allocator_t *bst_tk_map_allocs;
+static int bst_tk_map_nallocs;
+static __thread int bst_tk_map_ssalloc;
+
+static void *bst_tk_map_alloc(int nthreads)
+{
+	/* set_new() uses the creating thread's ssalloc */
+	if (!bst_tk_map_ssalloc) {
+		ssalloc_init();
+		bst_tk_map_ssalloc = 1;
+	}
+
+#if GC == 1
+	int i;
+
+	if (bst_tk_map_allocs == NULL) {
+		bst_tk_map_allocs = calloc(nthreads, sizeof(ssmem_allocator_t));
+		assert(bst_tk_map_allocs != NULL);
+
+		for (i = 0; i < nthreads; i++) {
+			/* Forces a new timestamp for each allocator */
+			ssmem_ts_local = NULL;
+			ssmem_alloc_init_fs_size(&bst_tk_map_allocs[i], SSMEM_DEFAULT_MEM_SIZE, SSMEM_GC_FREE_SET_SIZE, i);
+		}
+		ssmem_ts_local = NULL;
+		bst_tk_map_nallocs = nthreads;
+	} else if (nthreads > bst_tk_map_nallocs) {
+		return NULL;
+	}
+#endif
+
+	return set_new();
+}
+
+static void bst_tk_map_thread_init(void *tree, int tid)
+{
+#if GC == 1
+	alloc = &bst_tk_map_allocs[tid];
+	ssmem_ts_local = alloc->ts;
+#endif
+}
+
+static void bst_tk_map_free(void *tree)
+{
+	/* Nodes live in ssalloc/ssmem chunks that are never returned */
+}
+
+static void *bst_tk_map_lookup(void *tree, map_key_t key)
+{
+	return (void*) bst_tk_find(tree, key);
+}
+
+static int bst_tk_map_insert(void *tree, map_key_t key, void *data)
+{
+	return bst_tk_insert(tree, key, (sval_t) data);
+}
+
+static int bst_tk_map_remove(void *tree, map_key_t key)
+{
+	return bst_tk_delete(tree, key) != 0;
+}
+
+const struct map_ops bsttk_map_ops = {
+	.name		= "bsttk",
+	.flags		= MAP_VALUES | MAP_DELETE,
+	.max_key	= INT_MAX - 1,
+	.alloc		= bst_tk_map_alloc,
+	.free		= bst_tk_map_free,
+	.thread_init	= bst_tk_map_thread_init,
+	.lookup		= bst_tk_map_lookup,
+	.insert		= bst_tk_map_insert,
+	.remove		= bst_tk_map_remove,
+};
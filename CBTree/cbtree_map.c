@@ -0,0 +1,65 @@
+/*
+ cbtree_map.c
+
+ This is part of the tree library
+
+ Copyright 2015 Ibrahim Umar (UiT the Arctic University of Norway)
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+
+#include "common.h"
+#include "map.h"
+
+/* map.h backend for CBTree */
+
+static void *cbtree_map_alloc(int nthreads)
+{
+	return cbtree_alloc();
+}
+
+static void cbtree_map_free(void *tree)
+{
+	/* Also frees the data pointers, i.e. the map cells */
+	cbtree_free(tree);
+}
+
+static void *cbtree_map_lookup(void *tree, map_key_t key)
+{
+	return get_par(*(node**) tree, key);
+}
+
+static int cbtree_map_insert(void *tree, map_key_t key, void *data)
+{
+	return insert_par(tree, key, data);
+}
+
+static int cbtree_map_remove(void *tree, map_key_t key)
+{
+	return delete_par(*(node**) tree, key);
+}
+
+const struct map_ops cbtree_map_ops = {
+	.name		= "cbtree",
+	.flags		= MAP_VALUES | MAP_DELETE,
+	.max_key	= INT_MAX,
+	.alloc		= cbtree_map_alloc,
+	.free		= cbtree_map_free,
+	.thread_init	= NULL,
+	.lookup		= cbtree_map_lookup,
+	.insert		= cbtree_map_insert,
+	.remove		= cbtree_map_remove,
+};
@@ -64,25 +64,60 @@
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "locks.h"
 
+/* In-node key search, selected at build time with SEARCH= (see Makefile) */
+#define NODE_SEARCH_LINEAR	0
+#define NODE_SEARCH_BINARY	1
+#define NODE_SEARCH_SIMD	2
+
+#ifndef NODE_SEARCH
+#define NODE_SEARCH NODE_SEARCH_BINARY
+#endif
+
+#if NODE_SEARCH == NODE_SEARCH_SIMD && !defined(__AVX2__)
+#warning "SIMD node search needs AVX2 (-mavx2), using binary search"
+#undef NODE_SEARCH
+#define NODE_SEARCH NODE_SEARCH_BINARY
+#endif
+
 typedef struct node {
 
         void ** pointers;
         uintptr_t * keys;
         struct node * parent;
         bool is_leaf;
+        bool dead; // Merged into its left neighbour, right_link points there
+        int level; // Leaves are level 0
         int num_keys;
         struct node * next; // Used for queue.
 
         pthread_spinlock_t lock;
         struct node * right_link;
         uintptr_t high_key;
+        volatile unsigned int version; // Odd while a writer changes the node
+        unsigned char kfmt; // Key format, inner nodes may store deltas from kbase
+        uintptr_t kbase;
+
 
 } node;
 
 node** cbtree_alloc();
+void cbtree_free(node** root);  // Also frees the values
+
+/* Node order (pointers per node), settable before the first tree is made */
+#define CBTREE_FIT_PAGE 0   // One node per page
+#define CBTREE_FIT_L1   1   // CBTREE_FIT_L1_NODES nodes fill L1
+#define CBTREE_FIT_L2   2   // CBTREE_FIT_L2_NODES nodes fill L2
+#define CBTREE_FIT_L1_NODES 8
+#define CBTREE_FIT_L2_NODES 32
+
+int cbtree_get_order(void);
+int cbtree_set_order(int order);          // -1 if out of range
+int cbtree_order_for_size(size_t bytes);  // Largest order fitting in bytes
+int cbtree_auto_order(int fit);           // Sets and returns the order
 int search_par(struct node* root, uintptr_t key);
 void* get_par(struct node* root, uintptr_t key);
 
@@ -90,4 +125,26 @@ int delete_par(struct node* root, uintptr_t key);
 int insert_par(struct node** root, uintptr_t key, void* value);
 node * destroy_tree(node * root);
 
+/* Keys in [lo, hi] in ascending order, at most max of them. Each leaf is
+ * copied consistently, the scan as a whole is not atomic.
+ * out_keys or out_vals may be NULL. Returns the number of keys copied.
+ */
+int range_par(struct node* root, uintptr_t lo, uintptr_t hi,
+              uintptr_t* out_keys, void** out_vals, int max);
+
+/* Streaming range scan, fetches a leaf's worth of keys at a time */
+typedef struct cbtree_cursor {
+        node ** root;
+        uintptr_t next;     // Lowest key not handed out yet
+        uintptr_t hi;
+        bool done;
+        int pos, count, size;
+        uintptr_t * keys;
+        void ** vals;
+} cbtree_cursor;
+
+cbtree_cursor* cbtree_cursor_open(node** root, uintptr_t lo, uintptr_t hi);
+int cbtree_cursor_next(cbtree_cursor* c, uintptr_t* key, void** val);
+void cbtree_cursor_close(cbtree_cursor* c);
+
 #endif
@@ -63,13 +63,19 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <unistd.h>
 
 #include <sys/time.h>
 #include "common.h"
 #include "locks.h"
 
+#if NODE_SEARCH == NODE_SEARCH_SIMD
+#include <immintrin.h>
+#endif
+
 #ifdef WINDOWS
 #define bool char
 #define false 0
@@ -78,12 +84,17 @@
 
 
 // Default order is 4.
+#ifndef DEFAULT_ORDER
 #define DEFAULT_ORDER 336
+#endif
 
 // Minimum order is necessarily 3.  We set the maximum
 // order arbitrarily.  You may change the maximum order.
+// It is large enough for a node to fill a 16K page.
 #define MIN_ORDER 3
-#define MAX_ORDER 400
+#define MAX_ORDER 4096
+
+#define CACHE_LINE 64
 
 // Constants for printing part or all of the GPL license.
 #define LICENSE_FILE "LICENSE.txt"
@@ -185,9 +196,6 @@ node * queue = NULL;
  */
 bool verbose_output = false;
 
-// GLOBAL LOCK
-pthread_spinlock_t global_lock;
-
 // GLOBAL ROOT
 //node * root;
 
@@ -217,6 +225,7 @@ int cut( int length );
 void * make_record(uintptr_t value);
 node * make_node( void );
 node * make_leaf( void );
+void node_free( node * n );
 int get_left_index(node * parent, node * left);
 node * insert_into_parent(node * root, node * left, int key, node * right);
 node * insert_into_new_root(node * left, int key, node * right);
@@ -280,46 +289,348 @@ struct node* Stack_Pop(Stack *S)
         return S->data[--(S->size)];
 }
 
+/* Deferred reclamation.
+ * Every operation runs inside a read-side section, the thread's time is
+ * odd while inside. Leaves that were merged away are retired to a
+ * per-thread list and only freed, in batches, once every thread that
+ * was inside has left (same scheme as citrus' URCU). Slots are handed
+ * out on first use and given back when the thread exits.
+ */
+#define CBTREE_MAX_THREADS 512
+#define RETIRE_BATCH 64
+
+struct cb_thread {
+    volatile unsigned long time;
+    volatile int used;
+    node * retired;
+    int nretired;
+} __attribute__ ((aligned(CACHE_LINE)));
+
+static struct cb_thread cb_threads[CBTREE_MAX_THREADS];
+static volatile int cb_nthreads = 0;
+static __thread struct cb_thread * cb_self = NULL;
+static pthread_key_t cb_key;
+static pthread_once_t cb_key_once = PTHREAD_ONCE_INIT;
+
+static void cb_synchronize( void ) {
+    unsigned long snap[CBTREE_MAX_THREADS];
+    int i, n = cb_nthreads;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (i = 0; i < n; i++)
+        snap[i] = cb_threads[i].time;
+
+    for (i = 0; i < n; i++) {
+        if (!(snap[i] & 1))
+            continue;
+        while (cb_threads[i].time == snap[i])
+            __asm__ __volatile__ ("" ::: "memory");
+    }
+}
+
+static void cb_reclaim(struct cb_thread * t) {
+    node * n, * next;
+
+    cb_synchronize();
+    for (n = t->retired; n != NULL; n = next) {
+        next = n->next;
+        node_free(n);
+    }
+    t->retired = NULL;
+    t->nretired = 0;
+}
+
+static void node_pool_exit( void );
+static void split_scratch_free( void );
+
+static void cb_thread_exit(void * arg) {
+    struct cb_thread * t = arg;
+
+    if (t->retired != NULL)
+        cb_reclaim(t);
+    node_pool_exit();
+    split_scratch_free();
+    __atomic_store_n(&t->used, 0, __ATOMIC_RELEASE);
+}
+
+static void cb_key_init( void ) {
+    pthread_key_create(&cb_key, cb_thread_exit);
+}
+
+static struct cb_thread * cb_register( void ) {
+    int i, n;
+
+    pthread_once(&cb_key_once, cb_key_init);
+
+    for (i = 0; i < CBTREE_MAX_THREADS; i++) {
+        if (cb_threads[i].used || !__sync_bool_compare_and_swap(&cb_threads[i].used, 0, 1))
+            continue;
+        while ((n = cb_nthreads) <= i && !__sync_bool_compare_and_swap(&cb_nthreads, n, i + 1))
+            ;
+        cb_self = &cb_threads[i];
+        pthread_setspecific(cb_key, cb_self);
+        return cb_self;
+    }
+    fprintf(stderr, "Error: more than %d CBTree threads\n", CBTREE_MAX_THREADS);
+    exit(EXIT_FAILURE);
+}
+
+static inline struct cb_thread * cb_enter( void ) {
+    struct cb_thread * t = cb_self ? cb_self : cb_register();
+
+    /* Must be visible before we read any node pointer */
+    __atomic_store_n(&t->time, t->time + 1, __ATOMIC_SEQ_CST);
+    return t;
+}
+
+static inline void cb_leave(struct cb_thread * t) {
+    __atomic_store_n(&t->time, t->time + 1, __ATOMIC_RELEASE);
+
+    if (t->nretired >= RETIRE_BATCH)
+        cb_reclaim(t);
+}
+
+static inline void cb_retire(struct cb_thread * t, node * n) {
+    n->next = t->retired;
+    t->retired = n;
+    t->nretired++;
+}
+
+/* Version-validated (seqlock) node access.
+ * Writers hold the node spinlock and additionally make the version odd
+ * for as long as the node is inconsistent. Readers never lock: they
+ * wait for an even version, copy out what they need and retry when the
+ * version moved in the meantime.
+ */
+static inline void node_write_begin(struct node *n){
+    __atomic_store_n(&n->version, n->version + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void node_write_end(struct node *n){
+    __atomic_store_n(&n->version, n->version + 1, __ATOMIC_RELEASE);
+}
+
+static inline unsigned int node_read_begin(struct node *n){
+    unsigned int v;
+
+    while ((v = __atomic_load_n(&n->version, __ATOMIC_ACQUIRE)) & 1)
+        __asm__ __volatile__ ("" ::: "memory");
+    return v;
+}
+
+static inline int node_read_retry(struct node *n, unsigned int v){
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&n->version, __ATOMIC_RELAXED) != v;
+}
+
+/* Inner key formats.
+ * An inner node may keep its keys as 32 or 16 bit deltas from kbase when
+ * they span a narrow enough range, which dense key spaces give all but
+ * the top levels. Every format uses the same block, so narrower keys
+ * leave room for more of them and their pointers: more fanout, fewer
+ * levels, and more keys per line for the search. Leaves always store
+ * full keys. Capacities and pointer offsets follow from the order.
+ */
+#define KEYS_64 0
+#define KEYS_32 1
+#define KEYS_16 2
+#define KEY_FORMATS 3
+
+static const int key_width[KEY_FORMATS] = { 8, 4, 2 };
+static int key_cap[KEY_FORMATS];     // Keys per node
+static int key_ptr_off[KEY_FORMATS]; // Byte offset of the pointers from the keys
+static int layout_order = 0;
+
+static void node_layout( void ) {
+    int f, c, area = (order - 1) * sizeof(uintptr_t) + order * sizeof(void *);
+
+    for (f = 0; f < KEY_FORMATS; f++) {
+        c = (area - sizeof(void *)) / (key_width[f] + sizeof(void *));
+        while (((c * key_width[f] + 7) & ~7) + (c + 1) * (int)sizeof(void *) > area)
+            c--;
+        key_cap[f] = c;
+        key_ptr_off[f] = (c * key_width[f] + 7) & ~7;
+    }
+    layout_order = order;
+}
+
+/* Readers take the layout from one read of kfmt, so even a torn read
+ * of a node being repacked stays inside it.
+ */
+static inline void ** node_pointers(struct node *A, int fmt){
+    return (void **)((char *)(A + 1) + key_ptr_off[fmt]);
+}
+
+/* Key i of a node the caller has locked */
+static inline uintptr_t node_key(struct node *n, int i){
+    switch (n->kfmt) {
+        case KEYS_32: return n->kbase + ((uint32_t *)n->keys)[i];
+        case KEYS_16: return n->kbase + ((uint16_t *)n->keys)[i];
+        default: return n->keys[i];
+    }
+}
+
+/* Number of keys in keys[0, n) that are <= key, for each key width */
+#if NODE_SEARCH == NODE_SEARCH_BINARY
+/* Branchless: the loop trip count depends only on n */
+#define KEY_SEARCH(name, type) \
+static inline int name(const type *keys, int n, type key){ \
+    const type *base = keys; \
+    int half; \
+    while (n > 1) { \
+        half = n / 2; \
+        __builtin_prefetch(base + half / 2); \
+        __builtin_prefetch(base + half + half / 2); \
+        base = (base[half] <= key) ? base + half : base; \
+        n -= half; \
+    } \
+    return (base - keys) + (n == 1 && *base <= key); \
+}
+#else
+#define KEY_SEARCH(name, type) \
+static inline int name(const type *keys, int n, type key){ \
+    int i = 0; \
+    while (i < n && keys[i] <= key) \
+        i++; \
+    return i; \
+}
+#endif
+
+#if NODE_SEARCH == NODE_SEARCH_SIMD
+/* Signed compares only, flip the sign bit for unsigned order */
+static inline int keys_search64(const uintptr_t *keys, int n, uintptr_t key){
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i k = _mm256_xor_si256(_mm256_set1_epi64x(key), sign);
+    int i = 0, mask;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(keys + i)), sign);
+        mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, k)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    while (i < n && keys[i] <= key)
+        i++;
+    return i;
+}
+
+static inline int keys_search32(const uint32_t *keys, int n, uint32_t key){
+    const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+    const __m256i k = _mm256_xor_si256(_mm256_set1_epi32(key), sign);
+    int i = 0, mask;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(keys + i)), sign);
+        mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, k)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    while (i < n && keys[i] <= key)
+        i++;
+    return i;
+}
+
+/* Two mask bits per 16 bit lane */
+static inline int keys_search16(const uint16_t *keys, int n, uint16_t key){
+    const __m256i sign = _mm256_set1_epi16(INT16_MIN);
+    const __m256i k = _mm256_xor_si256(_mm256_set1_epi16(key), sign);
+    int i = 0, mask;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(keys + i)), sign);
+        mask = _mm256_movemask_epi8(_mm256_cmpgt_epi16(v, k));
+        if (mask)
+            return i + __builtin_ctz(mask) / 2;
+    }
+    while (i < n && keys[i] <= key)
+        i++;
+    return i;
+}
+#else
+KEY_SEARCH(keys_search64, uintptr_t)
+KEY_SEARCH(keys_search32, uint32_t)
+KEY_SEARCH(keys_search16, uint16_t)
+#endif
+
+/* Returns the number of keys in A that are <= key, i.e. the child to
+ * follow in an internal node; in a leaf, key is present iff it sits
+ * just before that index. fmt is A's key format.
+ * Readers do not lock, so num_keys is read once and clamped: the keys
+ * may be shifting under us, but we never index outside the node.
+ */
+static inline int node_search_fmt(struct node *A, int fmt, uintptr_t key){
+
+    int n = A->num_keys;
+    uintptr_t base;
+
+    if (n > key_cap[fmt]) n = key_cap[fmt];
+    if (n < 0) n = 0;
+
+    if (fmt == KEYS_64)
+        return keys_search64((const uintptr_t *)(A + 1), n, key);
+
+    /* Every key is >= base and within the format's range of it */
+    base = A->kbase;
+    if (key < base)
+        return 0;
+    key -= base;
+    if (fmt == KEYS_32)
+        return key > UINT32_MAX ? n : keys_search32((const uint32_t *)(A + 1), n, key);
+    return key > UINT16_MAX ? n : keys_search16((const uint16_t *)(A + 1), n, key);
+}
+
+static inline int node_search(struct node *A, uintptr_t key){
+    return node_search_fmt(A, A->kfmt, key);
+}
+
 int scannode(uintptr_t key, struct node** temp, int leaf){
     
-    int i = 0;
+    int i, moved, fmt;
+    unsigned int v;
     
-    struct node *A = *temp;
+    struct node *A = *temp, *next;
     
-    while (i < A->num_keys) {
-        if (key >= A->keys[i]) i++;
-        else break;
-    }
-    
-    /* Follow next_right if high_key is less than searched value*/
-    if(A->high_key > 0 && A->high_key <= key){
-        *temp = A->right_link;
-        return 1;
-    }else{
-        if(leaf){
-            for (i = 0; i < A->num_keys; i++)
-                if (A->keys[i] == key) break;
-            if (i == A->num_keys)
-                *temp = 0;
-            else
-                *temp = (node *)A->pointers[i];
+    do {
+        v = node_read_begin(A);
+        
+        fmt = A->kfmt;
+        i = node_search_fmt(A, fmt, key);
+        
+        /* A merged node hands its range over to its left neighbour */
+        if(A->dead){
+            next = A->right_link;
+            moved = 1;
+        /* Follow next_right if high_key is less than searched value*/
+        }else if(A->high_key > 0 && A->high_key <= key){
+            next = A->right_link;
+            moved = 1;
         }else{
-            //if(i == A->num_keys)
-            //     *temp = 0;
-            //else
-                *temp =  (node *)A->pointers[i];
+            if(leaf){
+                if (i > 0 && A->keys[i - 1] == key)
+                    next = (node *)A->pointers[i - 1];
+                else
+                    next = 0;
+            }else{
+                next = (node *)node_pointers(A, fmt)[i];
+            }
+            moved = 0;
         }
-        return 0;
-    }
+    } while (node_read_retry(A, v));
     
+    *temp = next;
+    return moved;
 }
 
 int search_par(struct node* root, uintptr_t key)
 {
     struct node *current = root;
+    struct cb_thread *self;
     
     if(root == NULL) return 0;
     
+    self = cb_enter();
+    
     while (!current->is_leaf) {
         scannode(key, &current, 0);
     }
@@ -328,6 +639,8 @@ int search_par(struct node* root, uintptr_t key)
     
     }
     
+    cb_leave(self);
+    
     if(current){
         //struct record *rec = (struct record*) current;
         //if (rec->value == key)
@@ -340,9 +653,12 @@ int search_par(struct node* root, uintptr_t key)
 void* get_par(struct node* root, uintptr_t key)
 {
     struct node *current = root;
+    struct cb_thread *self;
 
     if(root == NULL) return 0;
 
+    self = cb_enter();
+
     while (!current->is_leaf) {
         scannode(key, &current, 0);
     }
@@ -350,6 +666,8 @@ void* get_par(struct node* root, uintptr_t key)
     while ((scannode(key, &current, 1))) {
     }
 
+    cb_leave(self);
+
     if(current){
         return (void*)current;
     }
@@ -357,65 +675,310 @@ void* get_par(struct node* root, uintptr_t key)
     return 0;
 }
 
+int range_par(struct node* root, uintptr_t lo, uintptr_t hi,
+              uintptr_t* out_keys, void** out_vals, int max)
+{
+    struct node *current = root, *next;
+    struct cb_thread *self;
+    uintptr_t k, high;
+    unsigned int v;
+    int i, nk, n = 0, start = 0;
+    bool dead;
+
+    if(root == NULL || lo > hi || max <= 0) return 0;
+
+    self = cb_enter();
+
+    while (!current->is_leaf) {
+        scannode(lo, &current, 0);
+    }
+
+    while (1) {
+        /* Copy this leaf's share, starting over if a writer got in */
+        do {
+            v = node_read_begin(current);
+            n = start;
+            dead = current->dead;
+            high = current->high_key;
+            next = current->right_link;
+            if (dead)
+                continue;
+
+            nk = current->num_keys;
+            if (nk > order - 1) nk = order - 1;
+            for (i = lo ? node_search(current, lo - 1) : 0; i < nk && n < max; i++) {
+                k = current->keys[i];
+                if (k > hi)
+                    break;
+                if (out_keys) out_keys[n] = k;
+                if (out_vals) out_vals[n] = current->pointers[i];
+                n++;
+            }
+        } while (node_read_retry(current, v));
+
+        /* Back to the left neighbour, keys below lo are skipped there */
+        if (!dead) {
+            if (n == max || high == 0 || high > hi)
+                break;
+            if (high > lo)
+                lo = high;
+            start = n;
+        }
+        current = next;
+    }
+
+    cb_leave(self);
+    return n;
+}
+
+cbtree_cursor* cbtree_cursor_open(node** root, uintptr_t lo, uintptr_t hi)
+{
+    cbtree_cursor *c = malloc(sizeof(cbtree_cursor));
+
+    if (c == NULL) {
+        perror("Cursor creation.");
+        exit(EXIT_FAILURE);
+    }
+    c->root = root;
+    c->next = lo;
+    c->hi = hi;
+    c->done = lo > hi;
+    c->pos = c->count = 0;
+    c->size = order;
+    c->keys = malloc(c->size * sizeof(uintptr_t));
+    c->vals = malloc(c->size * sizeof(void *));
+    if (c->keys == NULL || c->vals == NULL) {
+        perror("Cursor buffers.");
+        exit(EXIT_FAILURE);
+    }
+    return c;
+}
+
+/* Each refill descends again from the root, so a cursor holds on to no
+ * node between calls and may live for as long as the caller likes.
+ * Returns 0 when the range is exhausted.
+ */
+int cbtree_cursor_next(cbtree_cursor* c, uintptr_t* key, void** val)
+{
+    if (c->pos == c->count) {
+        if (c->done)
+            return 0;
+        c->count = range_par(*c->root, c->next, c->hi, c->keys, c->vals, c->size);
+        c->pos = 0;
+        if (c->count < c->size || c->keys[c->count - 1] == c->hi)
+            c->done = true;
+        else
+            c->next = c->keys[c->count - 1] + 1;
+        if (c->count == 0)
+            return 0;
+    }
+    if (key) *key = c->keys[c->pos];
+    if (val) *val = c->vals[c->pos];
+    c->pos++;
+    return 1;
+}
+
+void cbtree_cursor_close(cbtree_cursor* c)
+{
+    free(c->keys);
+    free(c->vals);
+    free(c);
+}
+
+/* Called with t locked, returns the locked node that covers key.
+ * Locks are only taken left to right while another is held; a dead
+ * node is let go before we step back to its left neighbour.
+ */
 struct node* move_right(uintptr_t key, struct node* t)
 {
-    struct node* current = t;
-    if(current->high_key>0){
-    while (scannode(key, &t, 0)) {
-        pthread_spin_lock(&t->lock);
-        pthread_spin_unlock(&current->lock);
-        current = t;
+    struct node* next;
+    
+    while (1) {
+        if (t->dead) {
+            next = t->right_link;
+            pthread_spin_unlock(&t->lock);
+            pthread_spin_lock(&next->lock);
+        } else if (t->high_key > 0 && t->high_key <= key) {
+            next = t->right_link;
+            pthread_spin_lock(&next->lock);
+            pthread_spin_unlock(&t->lock);
+        } else
+            return t;
+        t = next;
     }
+}
+
+
+
+/* Per-thread scratch arrays for splits and inner node repacking,
+ * (re)allocated only when they have to grow. They hold one key and one
+ * pointer more than the widest node, a leaf of order - 1 keys or an
+ * inner node of the narrowest format.
+ */
+static __thread uintptr_t * split_keys = NULL;
+static __thread void ** split_pointers = NULL;
+static __thread int split_size = 0;
+
+static void split_scratch(uintptr_t ** keys, void *** pointers) {
+    int size = key_cap[KEYS_16] + 1 > order ? key_cap[KEYS_16] + 1 : order;
+
+    if (split_size < size) {
+        free(split_keys);
+        free(split_pointers);
+        split_keys = malloc( size * sizeof(uintptr_t) );
+        split_pointers = malloc( (size + 1) * sizeof(void *) );
+        if (split_keys == NULL || split_pointers == NULL) {
+            perror("Split scratch arrays.");
+            exit(EXIT_FAILURE);
+        }
+        split_size = size;
     }
-    return current;
+    *keys = split_keys;
+    *pointers = split_pointers;
 }
 
+static void split_scratch_free( void ) {
+    free(split_keys);
+    free(split_pointers);
+    split_keys = NULL;
+    split_pointers = NULL;
+    split_size = 0;
+}
 
+/* Copies the locked inner node n out as full keys, returns the count */
+static int inner_unpack(node * n, uintptr_t * keys, void ** pointers) {
+    int i;
 
-int insert_par( node ** root, uintptr_t key, void* value ) {
+    for (i = 0; i < n->num_keys; i++) {
+        keys[i] = node_key(n, i);
+        pointers[i] = n->pointers[i];
+    }
+    pointers[i] = n->pointers[i];
+    return n->num_keys;
+}
+
+/* Narrowest format that holds the sorted keys, -1 if none does */
+static int inner_format(const uintptr_t * keys, int nkeys) {
+    uintptr_t span = nkeys > 0 ? keys[nkeys - 1] - keys[0] : 0;
+
+#ifdef CBTREE_PACKED_INNER
+    if (span <= UINT16_MAX && nkeys <= key_cap[KEYS_16])
+        return KEYS_16;
+    if (span <= UINT32_MAX && nkeys <= key_cap[KEYS_32])
+        return KEYS_32;
+#else
+    (void)span;
+#endif
+    if (nkeys <= key_cap[KEYS_64])
+        return KEYS_64;
+    return -1;
+}
+
+/* Rewrites inner node n from full keys and nkeys + 1 pointers in its
+ * narrowest format; n is new or between node_write_begin/end. Returns
+ * 0, leaving n untouched, if they do not fit.
+ */
+static int inner_pack(node * n, const uintptr_t * keys, void * const * pointers, int nkeys) {
+    int i, fmt = inner_format(keys, nkeys);
+    uintptr_t base = nkeys > 0 ? keys[0] : 0;
+
+    if (fmt < 0)
+        return 0;
+
+    n->kfmt = fmt;
+    n->kbase = base;
+    n->pointers = node_pointers(n, fmt);
+    for (i = 0; i < nkeys; i++) {
+        switch (fmt) {
+            case KEYS_32: ((uint32_t *)n->keys)[i] = keys[i] - base; break;
+            case KEYS_16: ((uint16_t *)n->keys)[i] = keys[i] - base; break;
+            default: n->keys[i] = keys[i];
+        }
+        n->pointers[i] = pointers[i];
+    }
+    n->pointers[i] = pointers[i];
+    n->num_keys = nkeys;
+    return 1;
+}
+
+/* Returns the node one level above n that covers key, for a split that
+ * went past the top of the descent path. While the root is still at
+ * n's level, a new root is built over that level (the root is always
+ * its leftmost node) and installed with a CAS; then NULL is returned,
+ * as the new root already covers the split. Nobody waits for
+ * a lagging root: the loser of the CAS just descends from the winner's.
+ */
+static node * parent_level(node ** root, node * n, uintptr_t key) {
     
-	void * pointer;
+    node *r, *c, *next, *newroot;
+    uintptr_t high;
+    unsigned int v;
+    int k;
+    
+    while (1) {
+        r = __atomic_load_n(root, __ATOMIC_ACQUIRE);
+        
+        if (r->level > n->level) {
+            while (r->level > n->level + 1)
+                scannode(key, &r, 0);
+            return r;
+        }
+        
+        newroot = make_node();
+        newroot->level = r->level + 1;
+        
+        for (c = r, k = 0; ; c = next) {
+            do {
+                v = node_read_begin(c);
+                high = c->high_key;
+                next = c->right_link;
+            } while (node_read_retry(c, v));
+            
+            newroot->pointers[k] = c;
+            if (high == 0 || next == NULL || k == order - 1)
+                break;
+            newroot->keys[k++] = high;
+        }
+        newroot->num_keys = k;
+        
+        /* A level wider than a node only gets its first order nodes
+         * under the new root. The rest stay reachable through the
+         * right links of the last one, and enter the root as they split.
+         */
+        if (__sync_bool_compare_and_swap(root, r, newroot))
+            return NULL;
+        
+        node_free(newroot);
+    }
+}
 
-	node* oldroot;
+static int insert_op( node ** root, uintptr_t key, void* value ) {
+    
+	void * pointer;
 	
-	node *temp = NULL, *current = NULL, *new_leaf = NULL, *old_leaf = NULL, *child = NULL;
+	node *leaf, *temp = NULL, *current = NULL, *new_leaf = NULL, *old_leaf = NULL, *child = NULL;
 
-    int * temp_keys;
+    uintptr_t * temp_keys;
     void ** temp_pointers;
-    int insertion_index, split, i, j;
+    int insertion_index, split, total, i, j;
 
 
 	/* Case: the tree does not exist yet.
 	 * Start a new tree.
 	 */
 
-	if (*root == NULL){
-		//printf("Try\n");
-        //Try lock the global tree
-        if(pthread_spin_trylock(&global_lock)==0){
-			if(*root == NULL){
-				//printf("Proceed\n");
-				pointer = value;
-        		*root = start_new_tree(key, pointer);
-        		pthread_spin_unlock(&global_lock);
-        		return 1;
-			}else{
-				pthread_spin_unlock(&global_lock);
-				//printf("LEaf?%d\n", (*root)->is_leaf);
-			}
-        }else{
-			//printf("Wait\n");
-            //Wait here first
-            while(global_lock!=0){};
-        }
+	if (__atomic_load_n(root, __ATOMIC_ACQUIRE) == NULL){
+        leaf = start_new_tree(key, value);
+        if (__sync_bool_compare_and_swap(root, NULL, leaf))
+            return 1;
+        node_free(leaf);
     }
 	
     Stack Nstack;
     
     Stack_Init(&Nstack);
     
-    current = *root;
-	oldroot = current;
+    current = __atomic_load_n(root, __ATOMIC_ACQUIRE);
     
     while (!current->is_leaf) {
         temp = current;
@@ -426,13 +989,12 @@ int insert_par( node ** root, uintptr_t key, void* value ) {
     pthread_spin_lock(&current->lock);
     current = move_right(key, current);
     
-    //Now check whether the value exists
-    for (i = 0; i < current->num_keys; i++){
-        if (current->keys[i] == key) {
-            pthread_spin_unlock(&current->lock);
-            return 0;
-        }
-	}
+    //Now check whether the value exists, the index is reused below
+    insertion_index = node_search(current, key);
+    if (insertion_index > 0 && current->keys[insertion_index - 1] == key) {
+        pthread_spin_unlock(&current->lock);
+        return 0;
+    }
     /*
     if (i != current->num_keys){
         pointer = current->pointers[i];
@@ -446,253 +1008,319 @@ int insert_par( node ** root, uintptr_t key, void* value ) {
     
     while(1){
         
-        if (current->num_keys < order - 1) {
+        if (current->is_leaf && current->num_keys < order - 1) {
             //insert_into_leaf(current, key, pointer);
             
-            if(current->is_leaf){
-                insertion_index = 0;
-                while (insertion_index < current->num_keys && current->keys[insertion_index] < key)
-                    insertion_index++;
-                
-                for (i = current->num_keys; i > insertion_index; i--) {
-                    current->keys[i] = current->keys[i - 1];
-                    current->pointers[i] = current->pointers[i - 1];
-                }
-                current->keys[insertion_index] = key;
-                current->pointers[insertion_index] = pointer;
-                current->num_keys++;
-                
-            }else{
-                insertion_index = 0;
-                
-                while (insertion_index <= current->num_keys &&
-                       current->pointers[insertion_index] != old_leaf)
-                    insertion_index++;
-                
-                for (i = current->num_keys; i > insertion_index; i--) {
-                    current->pointers[i + 1] = current->pointers[i];
-                    current->keys[i] = current->keys[i - 1];
-                }
-                current->pointers[insertion_index + 1] = pointer;
-                current->keys[insertion_index] = key;
-                current->num_keys++;
+            node_write_begin(current);
+            for (i = current->num_keys; i > insertion_index; i--) {
+                current->keys[i] = current->keys[i - 1];
+                current->pointers[i] = current->pointers[i - 1];
             }
-             pthread_spin_unlock(&current->lock);
+            current->keys[insertion_index] = key;
+            current->pointers[insertion_index] = pointer;
+            current->num_keys++;
+            node_write_end(current);
+            pthread_spin_unlock(&current->lock);
             return 1;
-        } else {  // split
+        }
+        
+        if (!current->is_leaf) {
+            /* Inner nodes are rebuilt with the new entry right of
+             * old_leaf, in whichever format still fits; if none
+             * does, the same arrays are split below.
+             */
+            split_scratch(&temp_keys, &temp_pointers);
             
-            if(current->is_leaf){
-                
-                new_leaf = make_leaf();
-                
-                temp_keys = malloc( order * sizeof(uintptr_t) );
-                if (temp_keys == NULL) {
-                    perror("Temporary keys array.");
-                    exit(EXIT_FAILURE);
-                }
-                
-                temp_pointers = malloc( order * sizeof(void *) );
-                if (temp_pointers == NULL) {
-                    perror("Temporary pointers array.");
-                    exit(EXIT_FAILURE);
-                }
-                
-                insertion_index = 0;
-                while (insertion_index < order - 1 && current->keys[insertion_index] < key)
-                    insertion_index++;
-                
-                for (i = 0, j = 0; i < current->num_keys; i++, j++) {
-                    if (j == insertion_index) j++;
-                    temp_keys[j] = current->keys[i];
-                    temp_pointers[j] = current->pointers[i];
-                }
-                
-                temp_keys[insertion_index] = key;
-                temp_pointers[insertion_index] = pointer;
-                
-                current->num_keys = 0;
-                
-                split = cut(order - 1);
-                
-                for (i = 0; i < split; i++) {
-                    current->pointers[i] = temp_pointers[i];
-                    current->keys[i] = temp_keys[i];
-                    current->num_keys++;
-                }
-                
-                for (i = split, j = 0; i < order; i++, j++) {
-                    new_leaf->pointers[j] = temp_pointers[i];
-                    new_leaf->keys[j] = temp_keys[i];
-                    new_leaf->num_keys++;
-                }
-                
-                free(temp_pointers);
-                free(temp_keys);
-                
-                new_leaf->pointers[order - 1] = current->pointers[order - 1];
-                current->pointers[order - 1] = new_leaf;
-                
-                for (i = current->num_keys; i < order - 1; i++)
-                    current->pointers[i] = NULL;
-                for (i = new_leaf->num_keys; i < order - 1; i++)
-                    new_leaf->pointers[i] = NULL;
-                
-                new_leaf->parent = current->parent;
-                
-                /* High Keys */
-                new_leaf->high_key = current->high_key;
-                current->high_key = (new_leaf->keys[0]);
-                new_leaf->right_link = current->right_link;
-                current->right_link = new_leaf;
-                
-                old_leaf = current;
-                
-                pointer = (struct record*) new_leaf;
-                key = new_leaf->keys[0];
-            }else{
-                /* First create a temporary set of keys and pointers
-                 * to hold everything in order, including
-                 * the new key and pointer, inserted in their
-                 * correct places.
-                 * Then create a new node and copy half of the
-                 * keys and pointers to the old node and
-                 * the other half to the new.
-                 */
-                
-                temp_pointers = malloc( (order + 1) * sizeof(node *) );
-                if (temp_pointers == NULL) {
-                    perror("Temporary pointers array for splitting nodes.");
-                    exit(EXIT_FAILURE);
-                }
-                temp_keys = malloc( order * sizeof(uintptr_t) );
-                if (temp_keys == NULL) {
-                    perror("Temporary keys array for splitting nodes.");
-                    exit(EXIT_FAILURE);
-                }
-                
-                insertion_index = 0;
-                
-                while (insertion_index <= current->num_keys &&
-                       current->pointers[insertion_index] != old_leaf)
-                    insertion_index++;
-                
-                for (i = 0, j = 0; i < current->num_keys + 1; i++, j++) {
-                    if (j == insertion_index  + 1) j++;
-                    temp_pointers[j] = current->pointers[i];
-                }
-                
-                for (i = 0, j = 0; i < current->num_keys; i++, j++) {
-                    if (j == insertion_index ) j++;
-                    temp_keys[j] = current->keys[i];
-                }
-                
-                temp_pointers[insertion_index  + 1] = pointer;
-                temp_keys[insertion_index ] = key;
-                
-                /* Create the new node and copy
-                 * half the keys and pointers to the
-                 * old and half to the new.
-                 */
-                split = cut(order);
-                new_leaf = make_node();
-                current->num_keys = 0;
-                for (i = 0; i < split - 1; i++) {
-                    current->pointers[i] = temp_pointers[i];
-                    current->keys[i] = temp_keys[i];
-                    current->num_keys++;
-                }
+            insertion_index = 0;
+            
+            while (insertion_index <= current->num_keys &&
+                   current->pointers[insertion_index] != old_leaf)
+                insertion_index++;
+            
+            total = inner_unpack(current, temp_keys, temp_pointers);
+            
+            for (i = total; i > insertion_index; i--) {
+                temp_keys[i] = temp_keys[i - 1];
+                temp_pointers[i + 1] = temp_pointers[i];
+            }
+            temp_pointers[insertion_index + 1] = pointer;
+            temp_keys[insertion_index] = key;
+            total++;
+            
+            if (inner_format(temp_keys, total) >= 0) {
+                node_write_begin(current);
+                inner_pack(current, temp_keys, temp_pointers, total);
+                node_write_end(current);
+                pthread_spin_unlock(&current->lock);
+                return 1;
+            }
+        }
+        
+        // Split
+        if(current->is_leaf){
+            
+            new_leaf = make_leaf();
+            
+            split_scratch(&temp_keys, &temp_pointers);
+            
+            for (i = 0, j = 0; i < current->num_keys; i++, j++) {
+                if (j == insertion_index) j++;
+                temp_keys[j] = current->keys[i];
+                temp_pointers[j] = current->pointers[i];
+            }
+            
+            temp_keys[insertion_index] = key;
+            temp_pointers[insertion_index] = pointer;
+            
+            node_write_begin(current);
+            current->num_keys = 0;
+            
+            split = cut(order - 1);
+            
+            for (i = 0; i < split; i++) {
                 current->pointers[i] = temp_pointers[i];
-                key = temp_keys[split - 1];
-                for (++i, j = 0; i < order; i++, j++) {
-                    new_leaf->pointers[j] = temp_pointers[i];
-                    new_leaf->keys[j] = temp_keys[i];
-                    new_leaf->num_keys++;
-                }
+                current->keys[i] = temp_keys[i];
+                current->num_keys++;
+            }
+            
+            for (i = split, j = 0; i < order; i++, j++) {
                 new_leaf->pointers[j] = temp_pointers[i];
-                
-                
-                
-                free(temp_pointers);
-                free(temp_keys);
-                new_leaf->parent = current->parent;
-                for (i = 0; i <= new_leaf->num_keys; i++) {
-                    child = new_leaf->pointers[i];
-                    child->parent = new_leaf;
-                }
-                
-                /* High Keys & Links */
-                new_leaf->high_key = current->high_key;
-                current->high_key = (new_leaf->keys[0]);
-                new_leaf->right_link = current->right_link;
-                current->right_link = new_leaf;
-                
-                
-                /* Insert a new key into the parent of the two
-                 * nodes resulting from the split, with
-                 * the old node to the left and the new to the right.
-                 */
-                
-                //return insert_into_parent(root, old_node, k_prime, new_node);
-                old_leaf = current;
-                
-                pointer = new_leaf;
-                //key = new_leaf->keys[0];
-                
-                
+                new_leaf->keys[j] = temp_keys[i];
+                new_leaf->num_keys++;
             }
-            //Now we have to create a new root, restrict only 1 thread
-            if(Nstack.size == 0){
-                if(pthread_spin_trylock(&global_lock)==0){
-					if(oldroot == *root){
-						*root = make_node();
-                		(*root)->keys[0] = key;
-                		(*root)->pointers[0] = old_leaf;
-                		(*root)->pointers[1] = new_leaf;
-                		(*root)->num_keys++;
-                		(*root)->parent = NULL;
-                		current->parent = *root;
-                		new_leaf->parent = *root;
-                		pthread_spin_unlock(&old_leaf->lock);
-                		pthread_spin_unlock(&global_lock);
-                		return 1;
-					}else{
-						oldroot = *root;
-						current = oldroot;
-						pthread_spin_unlock(&global_lock);
-					}
-                }else{
-                    //Others wait here first
-                    while(global_lock!=0){};
-                }
-            }else
-				current = Stack_Pop(&Nstack);
-
+            
+            new_leaf->pointers[order - 1] = current->pointers[order - 1];
+            current->pointers[order - 1] = new_leaf;
+            
+            for (i = current->num_keys; i < order - 1; i++)
+                current->pointers[i] = NULL;
+            for (i = new_leaf->num_keys; i < order - 1; i++)
+                new_leaf->pointers[i] = NULL;
+            
+            new_leaf->parent = current->parent;
+            
+            /* High Keys */
+            new_leaf->high_key = current->high_key;
+            current->high_key = (new_leaf->keys[0]);
+            new_leaf->right_link = current->right_link;
+            current->right_link = new_leaf;
+            node_write_end(current);
+            
+            old_leaf = current;
+            
+            pointer = (struct record*) new_leaf;
+            key = new_leaf->keys[0];
+        }else{
+            /* Create the new node and copy
+             * half the keys and pointers to the
+             * old and half to the new. The
+             * separator temp_keys[split - 1] moves up.
+             * Either half fits a node of full keys.
+             */
+            split = cut(total);
+            new_leaf = make_node();
+            new_leaf->level = current->level;
+            inner_pack(new_leaf, temp_keys + split, temp_pointers + split, total - split);
+            key = temp_keys[split - 1];
+            node_write_begin(current);
+            inner_pack(current, temp_keys, temp_pointers, split - 1);
+            
+            new_leaf->parent = current->parent;
+            for (i = 0; i <= new_leaf->num_keys; i++) {
+                child = new_leaf->pointers[i];
+                child->parent = new_leaf;
+            }
+            
+            /* High Keys & Links, the separator moves up and is the
+             * lowest key the new node covers */
+            new_leaf->high_key = current->high_key;
+            current->high_key = key;
+            new_leaf->right_link = current->right_link;
+            current->right_link = new_leaf;
+            node_write_end(current);
+            
+            
+            /* Insert a new key into the parent of the two
+             * nodes resulting from the split, with
+             * the old node to the left and the new to the right.
+             */
+            
+            //return insert_into_parent(root, old_node, k_prime, new_node);
+            old_leaf = current;
+            
+            pointer = new_leaf;
+            //key = new_leaf->keys[0];
+            
+            
+        }
+        //Went past the top of the descent path, the root may have to grow
+        if(Nstack.size == 0){
+            current = parent_level(root, old_leaf, key);
+            if (current == NULL) {
+                pthread_spin_unlock(&old_leaf->lock);
+                return 1;
+            }
+            
             pthread_spin_lock(&current->lock);
+            current = move_right(key, current);
+            pthread_spin_unlock(&old_leaf->lock);
             
-            move_right(key, current);
+            /* A root that another thread built over our level may
+             * already point to the new node */
+            for (i = 0; i <= current->num_keys; i++)
+                if (current->pointers[i] == pointer) {
+                    pthread_spin_unlock(&current->lock);
+                    return 1;
+                }
+            continue;
+        }
+        
+        current = Stack_Pop(&Nstack);
+        
+        pthread_spin_lock(&current->lock);
+        
+        current = move_right(key, current);
 			
-            pthread_spin_unlock(&old_leaf->lock);            
+        pthread_spin_unlock(&old_leaf->lock);            
 
-        }
     }
     return 1;
     
 }
 
+/* Master insertion function, see insert_op().
+ */
+int insert_par( node ** root, uintptr_t key, void* value ) {
+    
+    struct cb_thread *self = cb_enter();
+    int ret = insert_op(root, key, value);
+    
+    cb_leave(self);
+    return ret;
+}
+
+/* Leaf underflow (Lanin & Shasha). n and its right sibling r are both
+ * locked; when they fit together in half a node and share the parent p,
+ * r is folded into n and its entry removed from p. r is marked dead and
+ * its right_link turned into an outlink to n, so anyone still holding r
+ * moves back to n; r itself is retired and freed after a grace period.
+ * The parent is locked last, like in insert_op.
+ */
+static void merge_locked(struct cb_thread *self, node *p, node *n, node *r) {
+    
+    uintptr_t * temp_keys;
+    void ** temp_pointers;
+    int i, j, total;
+    
+    if (n->num_keys + r->num_keys > (order - 1) / 2)
+        return;
+    
+    /* n's high key is r's separator in the parent */
+    pthread_spin_lock(&p->lock);
+    p = move_right(n->high_key, p);
+    
+    for (j = 1; j <= p->num_keys; j++)
+        if (p->pointers[j] == r)
+            break;
+    if (j > p->num_keys || p->pointers[j - 1] != n) {
+        pthread_spin_unlock(&p->lock);
+        return;
+    }
+    
+    node_write_begin(n);
+    node_write_begin(r);
+    node_write_begin(p);
+    
+    for (i = 0; i < r->num_keys; i++) {
+        n->keys[n->num_keys + i] = r->keys[i];
+        n->pointers[n->num_keys + i] = r->pointers[i];
+    }
+    n->num_keys += r->num_keys;
+    n->pointers[order - 1] = r->pointers[order - 1];
+    n->high_key = r->high_key;
+    n->right_link = r->right_link;
+    
+    r->dead = true;
+    r->right_link = n;
+    
+    /* Fewer keys within the same span always fit p's format */
+    split_scratch(&temp_keys, &temp_pointers);
+    total = inner_unpack(p, temp_keys, temp_pointers);
+    for (i = j; i < total; i++) {
+        temp_keys[i - 1] = temp_keys[i];
+        temp_pointers[i] = temp_pointers[i + 1];
+    }
+    inner_pack(p, temp_keys, temp_pointers, total - 1);
+    
+    node_write_end(p);
+    node_write_end(r);
+    node_write_end(n);
+    
+    pthread_spin_unlock(&p->lock);
+    
+    cb_retire(self, r);
+}
+
+/* Called with the underflowing leaf n locked, p is the parent n was
+ * reached from. n first tries to take in its right sibling; failing
+ * that it offers itself to its left sibling, whose lock would be out of
+ * order, so that one is only tried.
+ */
+static void merge_leaf(struct cb_thread *self, node *p, node *n) {
+    
+    node *l = NULL, *r = n->right_link;
+    void **pointers;
+    unsigned int v;
+    int j, nk, fmt;
+    
+    if (p == NULL)
+        return;
+    
+    if (r != NULL && n->high_key != 0) {
+        pthread_spin_lock(&r->lock);
+        merge_locked(self, p, n, r);
+        pthread_spin_unlock(&r->lock);
+        if (n->right_link != r)
+            return;
+    }
+    
+    do {
+        v = node_read_begin(p);
+        l = NULL;
+        fmt = p->kfmt;
+        pointers = node_pointers(p, fmt);
+        nk = p->num_keys;
+        for (j = 1; j <= nk && j <= key_cap[fmt]; j++)
+            if (pointers[j] == n) {
+                l = pointers[j - 1];
+                break;
+            }
+    } while (node_read_retry(p, v));
+    
+    if (l == NULL || pthread_spin_trylock(&l->lock) != 0)
+        return;
+    if (!l->dead && l->right_link == n)
+        merge_locked(self, p, l, n);
+    pthread_spin_unlock(&l->lock);
+}
+
 /* Master deletion function.
  */
 int delete_par(node * root, uintptr_t key) {
     
 	int j = 0, i = 0, num_pointers;
 
-    struct node* current = NULL;
-    void* pointer = NULL;
+    struct node *current = NULL, *parent = NULL;
+    struct cb_thread *self;
     
     current = root;
     
     if(current == NULL) return 0;
 
+    self = cb_enter();
+
     while (!current->is_leaf) {
+        parent = current;
         scannode(key, &current, 0);
     }
     
@@ -700,26 +1328,18 @@ int delete_par(node * root, uintptr_t key) {
     current = move_right(key, current);
     
     //Now check whether the value exists
-    for (j = 0; j < current->num_keys; j++){
-        if (current->keys[j] == key){ //break;
-    
-    //if (j != current->num_keys){
-        pointer = current->pointers[j];
-        //if (pointer->value == key){
+    j = node_search(current, key) - 1;
+    if (j >= 0 && current->keys[j] == key){
+            node_write_begin(current);
+            
             // Remove the key and shift other keys accordingly.
-            i = 0;
-            while (current->keys[i] != key)
-                i++;
-            for (++i; i < current->num_keys; i++)
+            for (i = j + 1; i < current->num_keys; i++)
                 current->keys[i - 1] = current->keys[i];
             
             // Remove the pointer and shift other pointers accordingly.
             // First determine number of pointers.
             num_pointers = current->is_leaf ? current->num_keys : current->num_keys + 1;
-            i = 0;
-            while (current->pointers[i] != pointer)
-                i++;
-            for (++i; i < num_pointers; i++)
+            for (i = j + 1; i < num_pointers; i++)
                 current->pointers[i - 1] = current->pointers[i];
             
             
@@ -734,11 +1354,17 @@ int delete_par(node * root, uintptr_t key) {
             else
                 for (i = current->num_keys + 1; i < order; i++)
                     current->pointers[i] = NULL;
+            node_write_end(current);
+            
+            if (current->num_keys <= (order - 1) / 4)
+                merge_leaf(self, parent, current);
+            
             pthread_spin_unlock(&current->lock);
+            cb_leave(self);
             return 1;
-        }
     }
     pthread_spin_unlock(&current->lock);
+    cb_leave(self);
     
 	return 0;
 }
@@ -969,7 +1595,7 @@ void print_tree( node * root ) {
 		for (i = 0; i < n->num_keys; i++) {
 			if (verbose_output)
 				printf("%lx ", (unsigned long)n->pointers[i]);
-			printf("%lu ", n->keys[i]);
+			printf("%lu ", node_key(n, i));
 		}
 		if (!n->is_leaf)
 			for (i = 0; i <= n->num_keys; i++)
@@ -1018,27 +1644,310 @@ void * make_record(uintptr_t value) {
 }
 
 
-/* Creates a new general node, which can be adapted
- * to serve as either a leaf or an internal node.
+/* Node pool.
+ * A node is a single cache-aligned block: the header, then the keys,
+ * then the pointers. Blocks are carved from per-thread slabs and freed
+ * nodes go to the freeing thread's list for reuse, so splits never
+ * contend on malloc. A thread keeps at most NODE_POOL_MAX free nodes,
+ * extra ones (and all of them when it exits) move to a shared list the
+ * other threads refill from, so memory freed by one thread is reused
+ * by those that allocate. Slabs are freed once the last tree is gone.
  */
-node * make_node( void ) {
-	node * new_node;
-	new_node = malloc(sizeof(node));
-	if (new_node == NULL) {
-		perror("Node creation.");
-		exit(EXIT_FAILURE);
+#define NODE_SLAB 64
+#define NODE_POOL_MAX (4 * NODE_SLAB)
+
+struct node_slab {
+	char * mem;
+	struct node_slab * next;
+};
+
+static pthread_mutex_t node_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct node_slab * node_slabs = NULL;
+static node * node_shared_free = NULL;
+static size_t node_shared_size = 0;
+static volatile unsigned long node_pool_gen = 0; // Bumped when the slabs are freed
+static volatile long cbtree_live = 0;
+
+static __thread node * node_pool_free = NULL;
+static __thread int node_pool_count = 0;
+static __thread char * node_pool_cur = NULL;
+static __thread char * node_pool_end = NULL;
+static __thread size_t node_pool_size = 0;
+static __thread unsigned long node_pool_tgen = 0;
+
+static inline size_t node_size_for( int ord ) {
+	size_t size = sizeof(node) + (ord - 1) * sizeof(uintptr_t) + ord * sizeof(void *);
+	return (size + CACHE_LINE - 1) & ~((size_t)CACHE_LINE - 1);
+}
+
+static inline size_t node_block_size( void ) {
+	return node_size_for(order);
+}
+
+/* A node's own layout tells its order, even after the order changed */
+static inline size_t node_size_of( node * n ) {
+	return node_size_for((int)((uintptr_t *)n->pointers - n->keys) + 1);
+}
+
+/* Page-sized blocks are carved from page-aligned slabs, so such a node
+ * is exactly one page; anything else is aligned to the cache line.
+ */
+static size_t page_size( void ) {
+	static size_t page = 0;
+	long p;
+
+	if (page == 0) {
+		p = sysconf(_SC_PAGESIZE);
+		page = p > 0 ? (size_t)p : 4096;
 	}
-	new_node->keys = malloc( (order - 1) * sizeof(uintptr_t) );
-	if (new_node->keys == NULL) {
-		perror("New node keys array.");
-		exit(EXIT_FAILURE);
+	return page;
+}
+
+static inline size_t node_block_align( size_t size ) {
+	return size % page_size() == 0 ? page_size() : CACHE_LINE;
+}
+
+/* Drops this thread's blocks when they are of another size or their
+ * slabs were freed since.
+ */
+static inline void node_pool_check( size_t size ) {
+	if (node_pool_size == size && node_pool_tgen == node_pool_gen)
+		return;
+	node_pool_free = NULL;
+	node_pool_count = 0;
+	node_pool_cur = node_pool_end = NULL;
+	node_pool_size = size;
+	node_pool_tgen = node_pool_gen;
+}
+
+/* Moves the first count nodes of this thread's list to the shared one */
+static void node_pool_spill( int count ) {
+	node * first = node_pool_free, * last = first;
+	int i;
+
+	for (i = 1; i < count; i++)
+		last = last->next;
+	node_pool_free = last->next;
+	node_pool_count -= count;
+
+	pthread_mutex_lock(&node_shared_lock);
+	if (node_shared_size != node_pool_size) {
+		node_shared_free = NULL;
+		node_shared_size = node_pool_size;
 	}
-	new_node->pointers = malloc( order * sizeof(void *) );
-	if (new_node->pointers == NULL) {
-		perror("New node pointers array.");
+	last->next = node_shared_free;
+	node_shared_free = first;
+	pthread_mutex_unlock(&node_shared_lock);
+}
+
+/* Takes up to NODE_SLAB nodes from the shared list */
+static void node_pool_refill( size_t size ) {
+	node * n;
+
+	pthread_mutex_lock(&node_shared_lock);
+	if (node_shared_size == size) {
+		while (node_pool_count < NODE_SLAB && (n = node_shared_free) != NULL) {
+			node_shared_free = n->next;
+			n->next = node_pool_free;
+			node_pool_free = n;
+			node_pool_count++;
+		}
+	}
+	pthread_mutex_unlock(&node_shared_lock);
+}
+
+static void node_slab_new( size_t size ) {
+	struct node_slab * slab = malloc(sizeof(struct node_slab));
+
+	if (slab == NULL || posix_memalign((void **)&node_pool_cur, node_block_align(size), NODE_SLAB * size)) {
+		perror("Node slab creation.");
 		exit(EXIT_FAILURE);
 	}
+	node_pool_end = node_pool_cur + NODE_SLAB * size;
+
+	slab->mem = node_pool_cur;
+	pthread_mutex_lock(&node_shared_lock);
+	slab->next = node_slabs;
+	node_slabs = slab;
+	pthread_mutex_unlock(&node_shared_lock);
+}
+
+static node * node_alloc( void ) {
+	size_t size = node_block_size();
+	node * n;
+
+	node_pool_check(size);
+
+	if (node_pool_free == NULL && node_pool_cur == node_pool_end)
+		node_pool_refill(size);
+
+	/* Recycled blocks keep their version, it only ever grows */
+	if (node_pool_free != NULL) {
+		n = node_pool_free;
+		node_pool_free = n->next;
+		node_pool_count--;
+		return n;
+	}
+
+	if (node_pool_cur == node_pool_end)
+		node_slab_new(size);
+
+	n = (node *)node_pool_cur;
+	node_pool_cur += size;
+	n->version = 0;
+	return n;
+}
+
+void node_free( node * n ) {
+	size_t size = node_size_of(n);
+
+	node_pool_check(node_block_size());
+
+	/* Left from before an order change, it stays in its slab */
+	if (size != node_pool_size)
+		return;
+
+	n->next = node_pool_free;
+	node_pool_free = n;
+	if (++node_pool_count > NODE_POOL_MAX)
+		node_pool_spill(NODE_SLAB);
+}
+
+/* Hands the free nodes and the rest of the slab of an exiting thread
+ * over to the shared list.
+ */
+static void node_pool_exit( void ) {
+	node * n;
+
+	if (node_pool_tgen != node_pool_gen || node_pool_size != node_block_size())
+		return;
+
+	while (node_pool_cur != node_pool_end) {
+		n = (node *)node_pool_cur;
+		node_pool_cur += node_pool_size;
+		n->version = 0;
+		n->next = node_pool_free;
+		node_pool_free = n;
+		node_pool_count++;
+	}
+	if (node_pool_count > 0)
+		node_pool_spill(node_pool_count);
+}
+
+/* Frees every slab. No tree is left, so no node is in use; threads drop
+ * their own lists the next time they allocate.
+ */
+static void node_pool_release( void ) {
+	struct node_slab * slab, * next;
+	int i;
+
+	pthread_mutex_lock(&node_shared_lock);
+	for (slab = node_slabs; slab != NULL; slab = next) {
+		next = slab->next;
+		free(slab->mem);
+		free(slab);
+	}
+	node_slabs = NULL;
+	node_shared_free = NULL;
+	node_shared_size = 0;
+	__sync_fetch_and_add(&node_pool_gen, 1);
+	pthread_mutex_unlock(&node_shared_lock);
+
+	/* Retired leaves all belonged to the trees that are gone */
+	for (i = 0; i < cb_nthreads; i++) {
+		cb_threads[i].retired = NULL;
+		cb_threads[i].nretired = 0;
+	}
+}
+
+
+/* Node sizing.
+ * The order is global and only read when nodes are made or split, so it
+ * can be picked at run time, before the first tree is created. Trees
+ * built with another order must not be used once it has changed, other
+ * than to be freed; their blocks are kept until the last tree is gone.
+ */
+int cbtree_get_order( void ) {
+	return order;
+}
+
+int cbtree_set_order( int new_order ) {
+	if (new_order < MIN_ORDER || new_order > MAX_ORDER)
+		return -1;
+	order = new_order;
+	node_layout();
+	if (cbtree_live == 0)
+		node_pool_release();
+	return order;
+}
+
+/* Largest order whose block (header, order - 1 keys, order pointers)
+ * fits in bytes.
+ */
+int cbtree_order_for_size( size_t bytes ) {
+	long n = ((long)bytes - (long)sizeof(node) + (long)sizeof(uintptr_t))
+			/ (long)(sizeof(uintptr_t) + sizeof(void *));
+
+	if (n < MIN_ORDER) n = MIN_ORDER;
+	if (n > MAX_ORDER) n = MAX_ORDER;
+	return (int)n;
+}
+
+static long cache_param( int name, long fallback ) {
+	long v = sysconf(name);
+	return v > 0 ? v : fallback;
+}
+
+/* Picks the order from the machine: one page per node, or small enough
+ * that CBTREE_FIT_L1_NODES (CBTREE_FIT_L2_NODES) nodes, i.e. a search
+ * path and its neighbours, stay in L1 (L2). Cache sizes are rounded
+ * down to whole lines. Returns the new order.
+ */
+int cbtree_auto_order( int fit ) {
+	long line = CACHE_LINE, bytes;
+
+#ifdef _SC_LEVEL1_DCACHE_LINESIZE
+	line = cache_param(_SC_LEVEL1_DCACHE_LINESIZE, CACHE_LINE);
+#endif
+
+	switch (fit) {
+	case CBTREE_FIT_L1:
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+		bytes = cache_param(_SC_LEVEL1_DCACHE_SIZE, 32 * 1024) / CBTREE_FIT_L1_NODES;
+#else
+		bytes = 32 * 1024 / CBTREE_FIT_L1_NODES;
+#endif
+		break;
+	case CBTREE_FIT_L2:
+#ifdef _SC_LEVEL2_CACHE_SIZE
+		bytes = cache_param(_SC_LEVEL2_CACHE_SIZE, 256 * 1024) / CBTREE_FIT_L2_NODES;
+#else
+		bytes = 256 * 1024 / CBTREE_FIT_L2_NODES;
+#endif
+		break;
+	default:
+		bytes = (long)page_size();
+	}
+
+	bytes -= bytes % line;
+	return cbtree_set_order(cbtree_order_for_size((size_t)bytes));
+}
+
+/* Creates a new general node, which can be adapted
+ * to serve as either a leaf or an internal node.
+ */
+node * make_node( void ) {
+	node * new_node;
+	if (layout_order != order)
+		node_layout();
+	new_node = node_alloc();
+	new_node->keys = (uintptr_t *)(new_node + 1);
+	new_node->pointers = (void **)(new_node->keys + (order - 1));
+	new_node->kfmt = KEYS_64;
+	new_node->kbase = 0;
 	new_node->is_leaf = false;
+	new_node->dead = false;
+	new_node->level = 0;
 	new_node->num_keys = 0;
 	new_node->parent = NULL;
 	new_node->next = NULL;
@@ -1147,6 +2056,7 @@ node * insert_into_node_after_splitting(node * root, node * old_node, int left_i
 	 */
 	split = cut(order);
 	new_node = make_node();
+	new_node->level = old_node->level;
 	old_node->num_keys = 0;
 	for (i = 0; i < split - 1; i++) {
 		old_node->pointers[i] = temp_pointers[i];
@@ -1240,6 +2150,7 @@ node * insert_into_parent(node * root, node * left, int key, node * right) {
 node * insert_into_new_root(node * left, int key, node * right) {
     
 	node * root = make_node();
+	root->level = left->level + 1;
 	root->keys[0] = key;
 	root->pointers[0] = left;
 	root->pointers[1] = right;
@@ -1370,9 +2281,7 @@ node * adjust_root(node * root) {
 	else
 		new_root = NULL;
     
-	free(root->keys);
-	free(root->pointers);
-	free(root);
+	node_free(root);
     
 	return new_root;
 }
@@ -1463,9 +2372,7 @@ void destroy_tree_nodes(node * root) {
 	else
 		for (i = 0; i < root->num_keys + 1; i++)
 			destroy_tree_nodes(root->pointers[i]);
-	free(root->pointers);
-	free(root->keys);
-	free(root);
+	node_free(root);
 }
 
 
@@ -1479,10 +2386,27 @@ node** cbtree_alloc()
 	node **root = malloc(sizeof(void*));
 	*root = NULL;
 
-	pthread_spin_init(&global_lock, PTHREAD_PROCESS_PRIVATE);
+	__sync_fetch_and_add(&cbtree_live, 1);
 	return root;
 }
 
+/* Frees a tree from cbtree_alloc, its values included. No thread may be
+ * inside it. Freeing the last tree frees the node slabs.
+ */
+void cbtree_free(node **root)
+{
+	/* Registered, so this thread's free list is handed over when it exits */
+	if (cb_self == NULL)
+		cb_register();
+
+	if (*root)
+		destroy_tree(*root);
+	free(root);
+
+	if (__sync_sub_and_fetch(&cbtree_live, 1) == 0)
+		node_pool_release();
+}
+
 
 void initial_add (struct node **root, int num, int range) {
     int i = 0, j = 0;
@@ -1526,8 +2450,17 @@ fprintf(stderr,"NOTE: No parameters supplied, will continue with defaults\n");
 fprintf(stderr,"Use -h switch for help.\n\n");
 
 while( EOF != myopt ) {
-    myopt = getopt(argc,argv,"r:n:i:u:s:hb:");
+    myopt = getopt(argc,argv,"r:n:i:u:s:hb:o:");
     switch( myopt ) {
+            case 'o':
+                if (strcmp(optarg, "page") == 0) cbtree_auto_order(CBTREE_FIT_PAGE);
+                else if (strcmp(optarg, "l1") == 0) cbtree_auto_order(CBTREE_FIT_L1);
+                else if (strcmp(optarg, "l2") == 0) cbtree_auto_order(CBTREE_FIT_L2);
+                else if (cbtree_set_order(atoi(optarg)) < 0) {
+                    fprintf(stderr, "Order must be page, l1, l2 or %d..%d\n", MIN_ORDER, MAX_ORDER);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'r': r = atoi( optarg ); break;
             case 'n': n = atoi( optarg ); break;
             case 'i': i = atoi( optarg ); break;
@@ -1539,6 +2472,7 @@ while( EOF != myopt ) {
             fprintf(stderr,"-i <NUM>    : Initial tree size (inital pre-filled element count)\n");
             fprintf(stderr,"-n <NUM>    : Number of threads\n");
             fprintf(stderr,"-s <NUM>    : Random seed. 0 = using time as seed\n");
+            fprintf(stderr,"-o <NUM>    : Node order, or page, l1, l2 to size nodes to the page or cache\n");
             fprintf(stderr,"-h          : This help\n\n");
             fprintf(stderr,"Benchmark output format: \n\"0: range, insert ratio, delete ratio, #threads, attempted insert, attempted delete, attempted search, effective insert, effective delete, effective search, time (in msec)\"\n\n");
             exit(0);
@@ -1556,10 +2490,8 @@ srand((int)time(0));
 else
 srand(s);
 
-    fprintf(stderr, "Node size: %lu bytes\n", sizeof(node) + ((order - 1) * sizeof(int)) + (order * sizeof(void *)) );
+    fprintf(stderr, "Node size: %lu bytes (order %d)\n", node_block_size(), order);
 
-    
-    pthread_spin_init(&global_lock, PTHREAD_PROCESS_SHARED);
 
 #if !defined(__TEST)
 
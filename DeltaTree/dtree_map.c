@@ -0,0 +1,68 @@
+/*
+ dtree_map.c
+
+ This is part of the tree library
+
+ Copyright 2015 Ibrahim Umar (UiT the Arctic University of Norway)
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+
+#include "dtree.h"
+#include "map.h"
+
+/*
+ map.h backend for DeltaTree. Like GreenBST, nodes come from the static
+ pool in dtree.o, so there is one instance per process, and a key
+ marked by deltatree_delete() can not be inserted again; map_remove()
+ only clears the value.
+
+ dtree.o loses keys after a few thousand inserts even single-threaded,
+ so map_test flags this backend as failing.
+ */
+
+static void *dtree_map_alloc(int nthreads)
+{
+	return deltatree_alloc();
+}
+
+static void dtree_map_free(void *tree)
+{
+	deltatree_free(tree);
+}
+
+static void *dtree_map_lookup(void *tree, map_key_t key)
+{
+	return deltatree_get(tree, key);
+}
+
+static int dtree_map_insert(void *tree, map_key_t key, void *data)
+{
+	return deltatree_insert(tree, key, data);
+}
+
+
+const struct map_ops deltatree_map_ops = {
+	.name		= "deltatree",
+	.flags		= MAP_VALUES | MAP_SINGLETON,
+	.max_key	= INT_MAX - 1,
+	.alloc		= dtree_map_alloc,
+	.free		= dtree_map_free,
+	.thread_init	= NULL,
+	.lookup		= dtree_map_lookup,
+	.insert		= dtree_map_insert,
+	.remove		= NULL,
+};
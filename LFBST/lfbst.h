@@ -0,0 +1,52 @@
+#ifndef lfbst_h
+#define lfbst_h
+
+/*
+ Shared tree handle for the lock-free BST, callable from C.
+
+ Threads do not need to be known up front: the first operation of a
+ thread on a tree registers a context for it (seek records, epoch slot,
+ free nodes) and caches it in TLS. lfbst_thread_init does the same
+ eagerly, lfbst_thread_exit hands the context back for reuse by a later
+ thread. Keys are in [0, LFBST_MAX_KEY].
+ */
+
+#include <limits.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// INT_MAX - 1 and INT_MAX are the sentinel keys
+#define LFBST_MAX_KEY (INT_MAX - 2)
+
+typedef struct lfbst lfbst_t;
+
+lfbst_t * lfbst_create(void);
+
+// Nothing may be inside the tree any more
+void lfbst_destroy(lfbst_t * tree);
+
+void lfbst_thread_init(lfbst_t * tree);
+
+void lfbst_thread_exit(lfbst_t * tree);
+
+int lfbst_search(lfbst_t * tree, size_t key);
+
+int lfbst_insert(lfbst_t * tree, size_t key);
+
+int lfbst_delete(lfbst_t * tree, size_t key);
+
+/*
+ Keys in [low, high] in ascending order, at most max of them, taken as
+ one atomic snapshot of the tree. Walking the whole key space in chunks
+ gives a snapshot per chunk. Returns the number of keys copied.
+ */
+int lfbst_range(lfbst_t * tree, size_t low, size_t high, size_t * out_keys, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
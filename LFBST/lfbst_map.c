@@ -0,0 +1,69 @@
+/*
+ lfbst_map.c
+
+ This is part of the tree library
+
+ Copyright 2015 Ibrahim Umar (UiT the Arctic University of Norway)
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "lfbst.h"
+#include "map.h"
+
+/*
+ map.h backend for LFBST, a set. Threads register with the tree on
+ their first operation, thread_init only does it up front.
+ */
+
+static void *lfbst_map_alloc(int nthreads)
+{
+	return lfbst_create();
+}
+
+static void lfbst_map_free(void *tree)
+{
+	lfbst_destroy((lfbst_t*) tree);
+}
+
+static void lfbst_map_thread_init(void *tree, int tid)
+{
+	lfbst_thread_init((lfbst_t*) tree);
+}
+
+static void *lfbst_map_lookup(void *tree, map_key_t key)
+{
+	return lfbst_search((lfbst_t*) tree, key) ? MAP_PRESENT : NULL;
+}
+
+static int lfbst_map_insert(void *tree, map_key_t key, void *data)
+{
+	return lfbst_insert((lfbst_t*) tree, key);
+}
+
+static int lfbst_map_remove(void *tree, map_key_t key)
+{
+	return lfbst_delete((lfbst_t*) tree, key);
+}
+
+extern "C" const struct map_ops lfbst_map_ops = {
+	"lfbst",
+	MAP_DELETE,
+	LFBST_MAX_KEY,
+	lfbst_map_alloc,
+	lfbst_map_free,
+	lfbst_map_thread_init,
+	lfbst_map_lookup,
+	lfbst_map_insert,
+	lfbst_map_remove,
+};
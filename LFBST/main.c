@@ -56,7 +56,7 @@ inline long rand_range_re(unsigned int *seed, long r) {
 int main(int argc, char **argv)
 {
 
-	thread_data_t *data;
+	lfbst_t *tree;
     pthread_t *threads;
 	unsigned int global_seed;
 	
@@ -112,35 +112,9 @@ int main(int argc, char **argv)
 
 	fprintf(stderr, "Node size: %lu bytes\n", sizeof(node_t));
 
-	data = (thread_data_t *)xmalloc(n * sizeof(thread_data_t));
 	threads = (pthread_t *)xmalloc(n * sizeof(pthread_t));
 
-	node_t * newRT = (node_t*)xmalloc(sizeof(node_t));
-	node_t * newLC = (node_t*)xmalloc(sizeof(node_t));
-	node_t * newRC = (node_t*)xmalloc(sizeof(node_t));
-
-	/// Sentinel keys are larger than all other keys in the tree
-	newRT->key = r+2;
-	newLC->key = r+1;
-	newRC->key = r+2;
-
-	newRT->child.AO_val1 = create_child_word(newLC,UNMARK, UNFLAG);
-	newRT->child.AO_val2 = create_child_word(newRC,UNMARK, UNFLAG);
-	/*
-	j = 0;
-
-    	data[j].rootOfTree = newRT;
-	data[j].recycledNodes.reserve(RECYCLED_VECTOR_RESERVE);
-    	data[j].sr = new seekRecord_t;
-    	data[j].ssr = new seekRecord_t;
-*/
-
-	for (j = 0; j < n; j++) {
-		data[j].rootOfTree = newRT;
-  		data[j].recycledNodes.reserve(RECYCLED_VECTOR_RESERVE);
-  		data[j].sr = new seekRecord_t;
-  		data[j].ssr = new seekRecord_t;
-	}
+	tree = lfbst_create();
 
 #if !defined(__TEST)
 	
@@ -151,24 +125,25 @@ int main(int argc, char **argv)
 	j = 0;
 	while (j < i) {
 		val = rand_range_re(&global_seed, r);
-		if (insert(&data[0], val)) {
+		if (lfbst_insert(tree, val)) {
 			j++;
 		}
 	}
 
-	start_benchmark(data, r, u, n, 0);
+	start_benchmark(tree, r, u, n, 0);
 
 #else
 
-	testpar(data, u, n, 1);
-	testseq(data, 1);
+	testpar(tree, u, n, 1);
+	testseq(tree, 1);
 
 #endif
 
-	in_order_visit((newRT));
+	in_order_visit(tree->root);
+
+	lfbst_destroy(tree);
 
 	free(threads);
-	free(data);
 
 	return 0;
 }
@@ -3,21 +3,284 @@
 #include "operations.h"
 
 /*************************************************************************************************/
-int perform_one_insert_window_operation(thread_data_t* data, seekRecord_t * R, size_t newKey){
-  node_t *newInt ;
-	node_t *newLeaf;
-  if(data->recycledNodes.empty()){
-	  node_t * allocedNodeArr =(node_t *)xmalloc(2*sizeof(node_t));
-    newInt = &allocedNodeArr[0];
-    newLeaf = &allocedNodeArr[1]; 
+// Epoch-based reclamation
+
+static unsigned long tree_ids = 0;
+
+static __thread lfbst_t * tlsTree = NULL;
+static __thread unsigned long tlsTreeId = 0;
+static __thread thread_data_t * tlsData = NULL;
+
+lfbst_t * lfbst_create(void){
+  lfbst_t * tree;
+  node_t * newRT = (node_t *)xmalloc(sizeof(node_t));
+  node_t * newLC = (node_t *)xmalloc(sizeof(node_t));
+  node_t * newRC = (node_t *)xmalloc(sizeof(node_t));
+
+  if(posix_memalign((void **)&tree, CACHE_LINE, sizeof(lfbst_t)) != 0){
+    perror("malloc");
+    exit(1);
+  }
+
+  /// Sentinel keys are larger than all other keys in the tree
+  newRT->key = INT_MAX;
+  newLC->key = INT_MAX - 1;
+  newRC->key = INT_MAX;
+
+  newLC->child.AO_val1 = newLC->child.AO_val2 = 0;
+  newRC->child.AO_val1 = newRC->child.AO_val2 = 0;
+  newRT->child.AO_val1 = create_child_word(newLC, UNMARK, UNFLAG);
+  newRT->child.AO_val2 = create_child_word(newRC, UNMARK, UNFLAG);
+
+  tree->root = newRT;
+  tree->id = __sync_add_and_fetch(&tree_ids, 1);
+  tree->threads = NULL;
+  tree->epoch = 0;
+  tree->scanners = 0;
+  return tree;
+}
+
+static void free_subtree(node_t * n){
+  if(n == NULL){
+    return;
+  }
+  free_subtree((node_t *)get_addr(n->child.AO_val1));
+  free_subtree((node_t *)get_addr(n->child.AO_val2));
+  free(n);
+}
+
+static void free_thread_data(thread_data_t * data){
+  node_t * n;
+  for(int i = 0; i < 3; i++){
+    for(size_t j = 0; j < data->limbo[i].size(); j++){
+      free(data->limbo[i][j]);
+    }
+  }
+  while((n = data->freeNodes) != NULL){
+    data->freeNodes = (node_t *)n->child.AO_val1;
+    free(n);
+  }
+  data->~thread_data_t();
+  free(data);
+}
+
+void lfbst_destroy(lfbst_t * tree){
+  thread_data_t * data = tree->threads;
+  thread_data_t * next;
+  while(data != NULL){
+    next = data->next;
+    free_thread_data(data);
+    data = next;
+  }
+  free_subtree(tree->root);
+  if(tlsTree == tree){
+    tlsTree = NULL;
+  }
+  free(tree);
+}
+
+/*
+ A thread first looks for the context it registered before (it may
+ have lost the TLS entry to another tree), then for one given back by
+ an exited thread, and only then adds a new one to the registry.
+ */
+static thread_data_t * register_thread(lfbst_t * tree){
+  pthread_t self = pthread_self();
+  thread_data_t * data;
+
+  for(data = tree->threads; data != NULL; data = data->next){
+    if(data->inUse && pthread_equal(data->owner, self)){
+      break;
+    }
+  }
+  if(data == NULL){
+    for(data = tree->threads; data != NULL; data = data->next){
+      if(!data->inUse && __sync_bool_compare_and_swap(&data->inUse, 0, 1)){
+        data->owner = self;
+        break;
+      }
+    }
+  }
+  if(data == NULL){
+    if(posix_memalign((void **)&data, CACHE_LINE, sizeof(thread_data_t)) != 0){
+      perror("malloc");
+      exit(1);
+    }
+    new (data) thread_data_t();
+    data->announce = 0;
+    data->changes = 0;
+    data->inUse = 1;
+    data->owner = self;
+    data->tree = tree;
+    data->nb_added = 0;
+    data->nb_removed = 0;
+    data->rootOfTree = tree->root;
+    data->epoch = 0;
+    data->ops = 0;
+    data->freeNodes = NULL;
+    data->nbFree = 0;
+    do{
+      data->next = tree->threads;
+    }while(!__sync_bool_compare_and_swap(&tree->threads, data->next, data));
+  }
+
+  tlsTree = tree;
+  tlsTreeId = tree->id;
+  tlsData = data;
+  return data;
+}
+
+static inline thread_data_t * lfbst_self(lfbst_t * tree){
+  if(tlsTree == tree && tlsTreeId == tree->id){
+    return tlsData;
+  }
+  return register_thread(tree);
+}
+
+void lfbst_thread_init(lfbst_t * tree){
+  lfbst_self(tree);
+}
+
+void lfbst_thread_exit(lfbst_t * tree){
+  thread_data_t * data = lfbst_self(tree);
+  tlsTree = NULL;
+  // its limbo and free nodes go with it to the next owner
+  __atomic_store_n(&data->inUse, 0, __ATOMIC_RELEASE);
+}
+
+static node_t * alloc_node(thread_data_t * data){
+  node_t * n = data->freeNodes;
+  if(n == NULL){
+    return (node_t *)xmalloc(sizeof(node_t));
+  }
+  data->freeNodes = (node_t *)n->child.AO_val1;
+  data->nbFree--;
+  return n;
+}
+
+// Only for nodes no other thread can reach
+static void free_node(thread_data_t * data, node_t * n){
+  if(data->nbFree >= FREE_NODES_MAX){
+    free(n);
+    return;
+  }
+  n->child.AO_val1 = (AO_t)data->freeNodes;
+  data->freeNodes = n;
+  data->nbFree++;
+}
+
+static inline void retire_node(thread_data_t * data, node_t * n){
+  data->limbo[(data->epoch >> 1) % 3].push_back(n);
+}
+
+static void reclaim(thread_data_t * data, std::vector<node_t *> & limbo){
+  for(size_t j = 0; j < limbo.size(); j++){
+    free_node(data, limbo[j]);
+  }
+  limbo.clear();
+}
+
+static void ebr_try_advance(lfbst_t * tree, unsigned long epoch){
+  for(thread_data_t * d = tree->threads; d != NULL; d = d->next){
+    unsigned long e = d->announce;
+    if((e & 1) && e != (epoch | 1)){
+      return;
+    }
+  }
+  __sync_bool_compare_and_swap(&tree->epoch, epoch, epoch + 2);
+}
+
+static inline void ebr_enter(thread_data_t * data){
+  unsigned long epoch = data->tree->epoch;
+  data->announce = epoch | 1;
+  __sync_synchronize();
+
+  if(epoch != data->epoch){
+    if(epoch - data->epoch >= 6){
+      reclaim(data, data->limbo[0]);
+      reclaim(data, data->limbo[1]);
+      reclaim(data, data->limbo[2]);
+    }
+    else{
+      // the bucket about to be filled again was retired three epochs ago
+      reclaim(data, data->limbo[(epoch >> 1) % 3]);
+    }
+    data->epoch = epoch;
+  }
+
+  if(++data->ops % EBR_SCAN_EVERY == 0){
+    ebr_try_advance(data->tree, epoch);
   }
-  else{ 
-    // reuse memory of previously allocated nodes.
-    newInt = data->recycledNodes.back();
-    data->recycledNodes.pop_back();
-    newLeaf = data->recycledNodes.back();
-    data->recycledNodes.pop_back();
+}
+
+static inline void ebr_exit(thread_data_t * data){
+  __atomic_store_n(&data->announce, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ Brackets the CAS an insert or delete takes effect at, see lfbst_range.
+ A scan that keeps failing holds new brackets back: the odd counter is
+ published before the flag is read, so either the scan waits for this
+ bracket or this bracket waits for the scan.
+ */
+static inline void change_begin(thread_data_t * data){
+  lfbst_t * tree = data->tree;
+  while(true){
+    __atomic_store_n(&data->changes, data->changes + 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&tree->scanners, __ATOMIC_SEQ_CST) == 0){
+      return;
+    }
+    __atomic_store_n(&data->changes, data->changes + 1, __ATOMIC_RELEASE);
+    while(tree->scanners != 0){
+      __asm__ __volatile__ ("" ::: "memory");
+    }
   }
+}
+
+static inline void change_end(thread_data_t * data){
+  __atomic_store_n(&data->changes, data->changes + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ The window CAS at lum swung its child from `removed` to `kept`, taking
+ every node from `removed` down to the parent of `kept` out of the
+ tree. On the way down each of them has its path edge marked and the
+ other child a flagged leaf; the last one has `kept` and the deleted
+ leaf as children. All of these edges are marked or flagged, so they
+ cannot change, and only the thread whose CAS succeeded walks them.
+ */
+static void retire_window(thread_data_t * data, AO_t removed, AO_t kept){
+  node_t * n = (node_t *)get_addr(removed);
+  node_t * s = (node_t *)get_addr(kept);
+  while(n != NULL && n != s){
+    AO_t l = n->child.AO_val1;
+    AO_t r = n->child.AO_val2;
+    node_t * ln = (node_t *)get_addr(l);
+    node_t * rn = (node_t *)get_addr(r);
+    retire_node(data, n);
+    if(ln == s){
+      retire_node(data, rn);
+      break;
+    }
+    if(rn == s){
+      retire_node(data, ln);
+      break;
+    }
+    if(is_flagged(l)){
+      retire_node(data, ln);
+      n = rn;
+    }
+    else{
+      retire_node(data, rn);
+      n = ln;
+    }
+  }
+}
+
+/*************************************************************************************************/
+int perform_one_insert_window_operation(thread_data_t* data, seekRecord_t * R, size_t newKey){
+  node_t *newInt = alloc_node(data);
+	node_t *newLeaf = alloc_node(data);
 		
   newLeaf->child.AO_val1 = 0;
   newLeaf->child.AO_val2 = 0;
@@ -44,12 +307,14 @@ int perform_one_insert_window_operation(thread_data_t* data, seekRecord_t * R, s
   newCasField = create_child_word(newInt,UNMARK,UNFLAG);
   int result;
 		
+  change_begin(data);
   if(R->isLeftL){
     result = atomic_cas_full(&R->parent->child.AO_val1, R->pL, newCasField);
   }
   else{
     result = atomic_cas_full(&R->parent->child.AO_val2, R->pL, newCasField);
   }
+  change_end(data);
 		
   if(result == 1){
     // successfully inserted.
@@ -57,9 +322,9 @@ int perform_one_insert_window_operation(thread_data_t* data, seekRecord_t * R, s
     return 1;
   }
   else{
-    // reuse data and pointer nodes
-    data->recycledNodes.push_back(newInt);
-    data->recycledNodes.push_back(newLeaf);
+    // never published, reuse data and pointer nodes
+    free_node(data, newInt);
+    free_node(data, newLeaf);
     return 0; 
   }
 }
@@ -99,6 +364,10 @@ int perform_one_delete_window_operation(thread_data_t* data, seekRecord_t * R, s
     result = atomic_cas_full(&R->lum->child.AO_val2, R->lumC, newWord);
   }
 
+  if(result){
+    retire_window(data, R->lumC, newWord);
+  }
+
   return result;	
 }
 
@@ -167,7 +436,7 @@ seekRecord_t * insseek(thread_data_t * data, size_t key, int op){
 	  return NULL;
 	}
 	
-	seekRecord_t * R = data->sr;
+	seekRecord_t * R = &data->sr;
 	
 	R->leafKey = leaf->key;
 		
@@ -249,7 +518,7 @@ seekRecord_t * delseek(thread_data_t * data, size_t key, int op){
 		return NULL;
 	}
 		
-	seekRecord_t * R = data->sr;
+	seekRecord_t * R = &data->sr;
 	
 	R->leafKey = leaf->key;
 		
@@ -328,7 +597,7 @@ seekRecord_t * secondary_seek(thread_data_t * data, size_t key, seekRecord_t * s
 		return NULL;		
 	 }
 	
-	seekRecord_t * R = data->ssr;
+	seekRecord_t * R = &data->ssr;
 	
 	R->leafKey = leaf->key;
 		
@@ -346,7 +615,7 @@ seekRecord_t * secondary_seek(thread_data_t * data, size_t key, seekRecord_t * s
   return R;
 }
 
-bool search(thread_data_t * data, size_t key){
+static bool search_op(thread_data_t * data, size_t key){
 	
 	node_t * cur = (node_t *)get_addr(data->rootOfTree->child.AO_val1);
 	size_t lastKey;	
@@ -400,6 +669,10 @@ int help_conflicting_operation (thread_data_t * data, seekRecord_t * R){
 			 result = atomic_cas_full(&R->lum->child.AO_val2, R->lumC, newWord);
 		}
 		
+		if(result){
+			retire_window(data, R->lumC, newWord);
+		}
+		
 		return result; 
 		
 	}
@@ -425,6 +698,10 @@ int help_conflicting_operation (thread_data_t * data, seekRecord_t * R){
 			result = atomic_cas_full(&R->lum->child.AO_val2, R->lumC, newWord);
 		}
 		
+		if(result){
+			retire_window(data, R->lumC, newWord);
+		}
+		
     return result; 
 	}	
 		
@@ -444,6 +721,7 @@ int inject(thread_data_t * data, seekRecord_t * R, int op){
 		
 		int result; 
 		
+		change_begin(data);
 		if(R->isLeftL){
 			result = atomic_cas_full(&R->parent->child.AO_val1, R->pL, newWord);
 			
@@ -451,11 +729,12 @@ int inject(thread_data_t * data, seekRecord_t * R, int op){
 		else{
 			result = atomic_cas_full(&R->parent->child.AO_val2, R->pL, newWord);
 		}
+		change_end(data);
 		
 		return result;
 }
 
-bool insert(thread_data_t * data, size_t key){
+static bool insert_op(thread_data_t * data, size_t key){
   int injectResult;
 	
 	while(true){
@@ -483,7 +762,7 @@ bool insert(thread_data_t * data, size_t key){
 	// execute insert window operation.	
 } 
 
-bool delete_node(thread_data_t * data, size_t key){
+static bool delete_op(thread_data_t * data, size_t key){
 	int injectResult;
 	while(true){
 		seekRecord_t * R = delseek(data, key, DEL);
@@ -522,8 +801,9 @@ bool delete_node(thread_data_t * data, size_t key){
 					R = secondary_seek(data, key, R);
 					
 					if(R == NULL){
-						// flagged leaf not found. Operation has been executed by some other process.
-						return false;
+						// flagged leaf not found. Operation has been executed by some other process,
+						// but it was ours since the flag was injected.
+						return true;
 					}
 					
 					res = perform_one_delete_window_operation(data, R, key);
@@ -538,6 +818,146 @@ bool delete_node(thread_data_t * data, size_t key){
 	}
 }
 
+int lfbst_search(lfbst_t * tree, size_t key){
+	thread_data_t * data = lfbst_self(tree);
+	ebr_enter(data);
+	bool result = search_op(data, key);
+	ebr_exit(data);
+	return result;
+}
+
+int lfbst_insert(lfbst_t * tree, size_t key){
+	thread_data_t * data = lfbst_self(tree);
+	ebr_enter(data);
+	bool result = insert_op(data, key);
+	ebr_exit(data);
+	return result;
+}
+
+int lfbst_delete(lfbst_t * tree, size_t key){
+	thread_data_t * data = lfbst_self(tree);
+	ebr_enter(data);
+	bool result = delete_op(data, key);
+	ebr_exit(data);
+	return result;
+}
+
+/*************************************************************************************************/
+// Range scans
+
+/*
+ An insert takes effect at its window CAS and a delete when it flags
+ the leaf, and each thread's `changes` is odd while it may still execute
+ one of those CASes. A walk that starts with all of them even and finds
+ them unchanged at its end overlapped no update, so what it saw is a
+ snapshot. A thread caught in the middle can still execute its one CAS,
+ but it cannot undo it: two walks in a row that return the same keys,
+ with no counter moving from the start of the first to the end of the
+ second, agree with the tree at the moment between them.
+
+ Unlinking a window only removes flagged leaves, so it does not matter
+ on which side of it the walk passes.
+
+ Under steady updates the walks could fail forever, so after
+ LFBST_SCAN_RETRIES of them the scan raises tree->scanners, waits for
+ the brackets already open to close and walks once more while no
+ update can take effect.
+ */
+#ifndef LFBST_SCAN_RETRIES
+#define LFBST_SCAN_RETRIES 8
+#endif
+
+static unsigned long changes_snapshot(lfbst_t * tree, bool * pending){
+  unsigned long sum = 0;
+  *pending = false;
+  __sync_synchronize();
+  for(thread_data_t * d = tree->threads; d != NULL; d = d->next){
+    unsigned long c = d->changes;
+    *pending |= (c & 1);
+    sum += c;
+  }
+  __sync_synchronize();
+  return sum;
+}
+
+// Keys of the unflagged leaves in [low, high], in order and up to max of them
+static void collect(thread_data_t * data, size_t low, size_t high, size_t max, std::vector<size_t> & keys){
+  std::vector<AO_t> & stack = data->scanStack;
+  keys.clear();
+  stack.clear();
+  stack.push_back(create_child_word(data->rootOfTree, UNMARK, UNFLAG));
+
+  while(!stack.empty() && keys.size() < max){
+    AO_t word = stack.back();
+    stack.pop_back();
+
+    node_t * n = (node_t *)get_addr(word);
+    size_t key = n->key;
+    AO_t l = n->child.AO_val1;
+    AO_t r = n->child.AO_val2;
+
+    if(get_addr(l) == 0){
+      if(!is_flagged(word) && key >= low && key <= high){
+        keys.push_back(key);
+      }
+      continue;
+    }
+    // right first, so the left subtree comes off the stack first
+    if(high >= key){
+      stack.push_back(r);
+    }
+    if(low < key){
+      stack.push_back(l);
+    }
+  }
+}
+
+int lfbst_range(lfbst_t * tree, size_t low, size_t high, size_t * out_keys, int max){
+  thread_data_t * data = lfbst_self(tree);
+  std::vector<size_t> * keys = &data->scanKeys[0];
+  std::vector<size_t> * last = &data->scanKeys[1];
+  unsigned long start, end, lastStart = 0;
+  bool pending, ignore, haveLast = false;
+
+  if(high > LFBST_MAX_KEY){
+    high = LFBST_MAX_KEY;
+  }
+  if(max <= 0 || low > high){
+    return 0;
+  }
+
+  // nothing the walks pass is reused before they are done
+  ebr_enter(data);
+  for(int attempt = 0; ; attempt++){
+    if(attempt == LFBST_SCAN_RETRIES){
+      __sync_fetch_and_add(&tree->scanners, 1);
+      for(thread_data_t * d = tree->threads; d != NULL; d = d->next){
+        while(d->changes & 1){
+          __asm__ __volatile__ ("" ::: "memory");
+        }
+      }
+      collect(data, low, high, max, *keys);
+      __sync_fetch_and_sub(&tree->scanners, 1);
+      break;
+    }
+
+    start = changes_snapshot(tree, &pending);
+    collect(data, low, high, max, *keys);
+    end = changes_snapshot(tree, &ignore);
+
+    if(start == end && (!pending || (haveLast && lastStart == start && *keys == *last))){
+      break;
+    }
+    std::swap(keys, last);
+    lastStart = start;
+    haveLast = true;
+  }
+  ebr_exit(data);
+
+  std::copy(keys->begin(), keys->end(), out_keys);
+  return keys->size();
+}
+
 inline bool SetBit(volatile AO_t *array, int bit) {
 
      bool flag;
@@ -14,7 +14,15 @@
 #include "atomic_ops.h"
 #include "atomic_ops/sysdeps/standard_ao_double_t.h"
 
-#define RECYCLED_VECTOR_RESERVE 5000000
+#include "lfbst.h"
+
+// Nodes a thread keeps for reuse, the rest go back to malloc
+#define FREE_NODES_MAX 4096
+
+// Operations between attempts to advance the global epoch
+#define EBR_SCAN_EVERY 64
+
+#define CACHE_LINE 64
 
 #define MARK_BIT 1
 #define FLAG_BIT 0
@@ -46,15 +54,51 @@ typedef struct seekRecord{
 
 typedef uintptr_t val_t;
 
+/*
+ Epoch-based reclamation. The global epoch moves in steps of 2, a thread
+ announces the epoch it entered with and the low bit while it is inside
+ an operation. The global epoch only advances when every active thread
+ has entered with the current one. A reader can enter with e + 2 while
+ a node retired in e is still linked, so that node is reused once the
+ epoch has moved on three times (e + 6); by then every thread that
+ could hold a reference has left.
+ */
+
+// Per-thread context, registered with the tree and never freed before it
 typedef struct thread_data {
+  volatile unsigned long announce; // read by other threads, the owner writes this line only
+  volatile unsigned long changes; // odd around an insert or delete CAS, see lfbst_range
+
+  struct thread_data * next __attribute__ ((aligned(CACHE_LINE))); // registry
+  volatile int inUse;
+  pthread_t owner;
+  struct lfbst * tree;
+
   unsigned long nb_added;
   unsigned long nb_removed;
   node_t* rootOfTree;
-  std::vector<node_t *> recycledNodes;
-  seekRecord_t * sr; // seek record
-  seekRecord_t * ssr; // secondary seek record
 
-} thread_data_t;
+  unsigned long epoch; // last global epoch seen
+  unsigned ops;
+  std::vector<node_t *> limbo[3]; // retired, by epoch
+  node_t * freeNodes; // linked through child.AO_val1
+  size_t nbFree;
+
+  std::vector<AO_t> scanStack; // range scans
+  std::vector<size_t> scanKeys[2];
+
+  seekRecord_t sr __attribute__ ((aligned(CACHE_LINE))); // seek record
+  seekRecord_t ssr; // secondary seek record
+
+} __attribute__ ((aligned(CACHE_LINE))) thread_data_t;
+
+struct lfbst {
+  node_t * root;
+  unsigned long id; // tells TLS caches of an earlier tree at this address apart
+  thread_data_t * volatile threads;
+  volatile unsigned long epoch __attribute__ ((aligned(CACHE_LINE)));
+  volatile int scanners __attribute__ ((aligned(CACHE_LINE))); // range scans holding updates back, see lfbst_range
+} __attribute__ ((aligned(CACHE_LINE)));
 
 
 inline void *xmalloc(size_t size) {
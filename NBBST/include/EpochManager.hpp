@@ -0,0 +1,194 @@
+#ifndef EPOCH_MANAGER
+#define EPOCH_MANAGER
+
+#include <cassert>
+#include <utility>
+#include <vector>
+
+#include "PerThread.hpp"
+#include "Utils.hpp"
+
+/*!
+ * A manager for epoch based reclamation, for the structures whose nodes can still be reached, or
+ * compared and swapped against, after their release.
+ *
+ * Every operation is bracketed by enter() and leave(). A released node is kept with the epoch it
+ * was released in and is only reused once every operation that could have reached it has ended:
+ * the epoch moves forward when every thread inside an operation entered it in the current epoch,
+ * so two epochs after the release, no operation started before it is left. An operation still
+ * running at the release can therefore finish unlinking the node, or help an old update on it.
+ *
+ * With Threads = DynamicThreads, the number of threads is given to the constructor instead.
+ *
+ * \param Node The type of node to manage.
+ * \param Threads The maximum number of threads.
+ * \param Prefill The number of nodes to precreate in the queue.
+ * \param Batch The number of released nodes between two attempts to reclaim.
+ */
+template<typename Node, unsigned int Threads, unsigned int Prefill = 50, unsigned int Batch = 64>
+class EpochManager {
+    public:
+        explicit EpochManager(unsigned int threads = Threads);
+        ~EpochManager();
+
+        EpochManager(const EpochManager& rhs) = delete;
+        EpochManager& operator=(const EpochManager& rhs) = delete;
+
+        /*!
+         * Start an operation of the calling thread, the nodes it reaches from now on stay valid.
+         */
+        void enter();
+
+        /*!
+         * End the operation of the calling thread.
+         */
+        void leave();
+
+        /*!
+         * Release a node unlinked by the calling thread.
+         */
+        void releaseNode(Node* node);
+
+        /*!
+         * Return a free node for the calling thread.
+         * \return A free node
+         */
+        Node* getFreeNode();
+
+        /*!
+         * Return a reference to the internal free stack of the given thread.
+         * \return A reference to the free stack of the given thread.
+         */
+        std::vector<Node*>& direct_free(unsigned int t);
+
+    private:
+        struct Stacks {
+            volatile unsigned long epoch;                           //Epoch of the current operation, 0 outside of one
+            unsigned int count;                                     //Releases since the last reclaim
+            std::vector<std::pair<Node*, unsigned long>> local;     //Released, with their epoch
+            std::vector<Node*> free;                                //Safe to reuse
+
+            Stacks() : epoch(0), count(0) {}
+        };
+
+        PerThread<Stacks, Threads> Queues;
+
+        volatile unsigned long epoch;
+
+        void reclaim(Stacks& own);
+
+        Stacks& stacks(unsigned int t);
+
+        /* Verify the template parameters */
+        static_assert(Batch > 0, "The reclaim batch must be greater than 0");
+};
+
+template<typename Node, unsigned int Threads, unsigned int Prefill, unsigned int Batch>
+EpochManager<Node, Threads, Prefill, Batch>::EpochManager(unsigned int threads) : Queues(threads), epoch(1) {
+    for(unsigned int tid = 0; tid < threads; ++tid){
+        stacks(tid).free.reserve(Prefill);
+
+        for(unsigned int i = 0; i < Prefill; i++){
+            stacks(tid).free.push_back(new Node());
+        }
+    }
+}
+
+template<typename Node, unsigned int Threads, unsigned int Prefill, unsigned int Batch>
+EpochManager<Node, Threads, Prefill, Batch>::~EpochManager(){
+    for(unsigned int tid = 0; tid < Queues.size(); ++tid){
+        for(auto& node : stacks(tid).local){
+            delete node.first;
+        }
+
+        for(Node* node : stacks(tid).free){
+            delete node;
+        }
+    }
+}
+
+template<typename Node, unsigned int Threads, unsigned int Prefill, unsigned int Batch>
+inline typename EpochManager<Node, Threads, Prefill, Batch>::Stacks& EpochManager<Node, Threads, Prefill, Batch>::stacks(unsigned int t){
+    return Queues[t];
+}
+
+template<typename Node, unsigned int Threads, unsigned int Prefill, unsigned int Batch>
+std::vector<Node*>& EpochManager<Node, Threads, Prefill, Batch>::direct_free(unsigned int t){
+    return stacks(t).free;
+}
+
+template<typename Node, unsigned int Threads, unsigned int Prefill, unsigned int Batch>
+inline void EpochManager<Node, Threads, Prefill, Batch>::enter(){
+    //Full barrier, the epoch is published before any node is read
+    __atomic_store_n(&stacks(thread_num).epoch, epoch, __ATOMIC_SEQ_CST);
+}
+
+template<typename Node, unsigned int Threads, unsigned int Prefill, unsigned int Batch>
+inline void EpochManager<Node, Threads, Prefill, Batch>::leave(){
+    __atomic_store_n(&stacks(thread_num).epoch, 0, __ATOMIC_RELEASE);
+}
+
+template<typename Node, unsigned int Threads, unsigned int Prefill, unsigned int Batch>
+void EpochManager<Node, Threads, Prefill, Batch>::releaseNode(Node* node){
+    //If the node is null, we have nothing to do
+    if(node){
+        Stacks& own = stacks(thread_num);
+
+        own.local.push_back(std::make_pair(node, epoch));
+
+        if(++own.count >= Batch){
+            own.count = 0;
+            reclaim(own);
+        }
+    }
+}
+
+template<typename Node, unsigned int Threads, unsigned int Prefill, unsigned int Batch>
+Node* EpochManager<Node, Threads, Prefill, Batch>::getFreeNode(){
+    Stacks& own = stacks(thread_num);
+
+    if(!own.free.empty()){
+        Node* free = own.free.back();
+        own.free.pop_back();
+
+        return free;
+    }
+
+    //There was no way to get a free node, allocate a new one
+    return new Node();
+}
+
+/*!
+ * Move the epoch forward if no thread is behind, then move the local nodes released two epochs
+ * ago to the free stack.
+ */
+template<typename Node, unsigned int Threads, unsigned int Prefill, unsigned int Batch>
+void EpochManager<Node, Threads, Prefill, Batch>::reclaim(Stacks& own){
+    unsigned long current = epoch;
+    bool quiet = true;
+
+    for(unsigned int tid = 0; tid < Queues.size() && quiet; ++tid){
+        unsigned long entered = stacks(tid).epoch;
+        quiet = !entered || entered == current;
+    }
+
+    if(quiet){
+        CAS(&epoch, current, current + 1);
+    }
+
+    current = epoch;
+
+    //The oldest nodes are at the bottom of the stack
+    std::size_t kept = 0;
+    for(std::size_t i = 0; i < own.local.size(); ++i){
+        if(own.local[i].second + 2 <= current){
+            own.free.push_back(own.local[i].first);
+        } else {
+            own.local[kept++] = own.local[i];
+        }
+    }
+
+    own.local.resize(kept);
+}
+
+#endif
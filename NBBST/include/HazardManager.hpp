@@ -3,312 +3,274 @@
 
 #include <cassert>
 
-//#define DEBUG //Indicates that the at() function is used for array accesses
+//#define DEBUG //Indicates that the per-thread accesses are bounds checked
 
-//Thread local id
-//Note: __thread is GCC specific
-extern __thread unsigned int thread_num;
-
-#include <list>
-#include <array>
+#include <vector>
 #include <algorithm>
 #include <iostream>
 
+#include "PerThread.hpp"
+
 /*!
- * A manager for Hazard Pointers manipulation. 
- * \param Node The type of node to manage. 
- * \param Threads The maximum number of threads. 
- * \param Size The number of hazard pointers per thread. 
+ * A manager for Hazard Pointers manipulation.
+ *
+ * Each thread keeps its released nodes on an array-based stack. Only when it holds
+ * Batch * Size * Threads of them are they checked against the hazard pointers: the published
+ * pointers are gathered and sorted once, and each released node is looked up by binary search.
+ * The unreferenced ones move to the free stack of the thread, which getFreeNode() pops. The
+ * stacks are sized for a full batch up front, so neither path allocates once warmed up.
+ *
+ * With Threads = DynamicThreads, the number of threads is given to the constructor instead.
+ *
+ * \param Node The type of node to manage.
+ * \param Threads The maximum number of threads.
+ * \param Size The number of hazard pointers per thread.
  * \param Prefill The number of nodes to precreate in the queue.
+ * \param Batch The number of released nodes that triggers a scan, in multiples of the hazard pointers.
  */
-template<typename Node, unsigned int Threads, unsigned int Size = 2, unsigned int Prefill = 50>
+template<typename Node, unsigned int Threads, unsigned int Size = 2, unsigned int Prefill = 50, unsigned int Batch = 2>
 class HazardManager {
     public:
-        HazardManager();
+        explicit HazardManager(unsigned int threads = Threads);
         ~HazardManager();
 
         HazardManager(const HazardManager& rhs) = delete;
         HazardManager& operator=(const HazardManager& rhs) = delete;
 
         /*!
-         * Release the node. 
+         * Release the node.
          */
         void releaseNode(Node* node);
 
         /*!
-         * \brief Release the node by checking first if it is not already in the queue. 
-         * This method can be slow depending on the number of nodes already released. 
-         * \param node The node to release. 
+         * \brief Release the node by checking first if it is not already in the queue.
+         * This method can be slow depending on the number of nodes already released.
+         * \param node The node to release.
          */
         void safe_release_node(Node* node);
 
         /*!
-         * Return a free node for the calling thread. 
+         * Return a free node for the calling thread.
          * \return A free node
          */
         Node* getFreeNode();
 
         /*!
-         * Publish a reference to the given Node using ith Hazard Pointer. 
+         * Publish a reference to the given Node using ith Hazard Pointer.
          * \param node The node to be published
-         * \param i The index of the pointer to use. 
+         * \param i The index of the pointer to use.
          */
         void publish(Node* node, unsigned int i);
 
         /*!
-         * Release the ith reference of the calling thread. 
-         * \param i The reference index. 
+         * Release the ith reference of the calling thread.
+         * \param i The reference index.
          */
         void release(unsigned int i);
 
         /*!
-         * Release all the hazard points of the calling thread. 
+         * Release all the hazard points of the calling thread.
          */
         void releaseAll();
 
         /*!
-         * Return a reference to the internal free queue of the given thread. 
-         * \return A reference to the free queue of the given thread. 
+         * Return a reference to the internal free stack of the given thread.
+         * \return A reference to the free stack of the given thread.
          */
-        std::list<Node*>& direct_free(unsigned int t);
+        std::vector<Node*>& direct_free(unsigned int t);
 
         /*!
-         * Return a reference to the internal local queue of the given thread. 
-         * \return A reference to the local queue of the given thread. 
+         * Return a reference to the internal local stack of the given thread.
+         * \return A reference to the local stack of the given thread.
          */
-        std::list<Node*>& direct_local(unsigned int t);
+        std::vector<Node*>& direct_local(unsigned int t);
 
     private:
-        std::array<std::array<Node*, Size>, Threads> Pointers;
-        std::array<std::list<Node*>, Threads> LocalQueues;
-        std::array<std::list<Node*>, Threads> FreeQueues;
-        
-        bool isReferenced(Node* node);
+        /* The hazard pointers of a thread, alone on their cache lines as every other thread reads them */
+        struct Pointers {
+            Node* volatile pointers[Size];
+        };
+
+        /* Only touched by the owner */
+        struct Stacks {
+            std::vector<Node*> local;       //Released, maybe still referenced
+            std::vector<Node*> free;        //Safe to reuse
+            std::vector<Node*> hazards;     //Scratch for scan()
+        };
+
+        PerThread<Pointers, Threads> Hazards;
+        PerThread<Stacks, Threads> Queues;
+
+        const unsigned int Scan;            //Batch * Size * threads
+
+        void scan(Stacks& stacks);
+
+        Pointers& pointers(unsigned int t);
+        Stacks& stacks(unsigned int t);
 
         /* Verify the template parameters */
-        static_assert(Threads > 0, "The number of threads must be greater than 0");
         static_assert(Size > 0, "The number of hazard pointers must greater than 0");
+        static_assert(Batch > 0, "The scan batch must be greater than 0");
 };
 
-template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill>
-HazardManager<Node, Threads, Size, Prefill>::HazardManager(){
-    for(unsigned int tid = 0; tid < Threads; ++tid){
+template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill, unsigned int Batch>
+HazardManager<Node, Threads, Size, Prefill, Batch>::HazardManager(unsigned int threads) : Hazards(threads), Queues(threads), Scan(Batch * Size * threads) {
+    for(unsigned int tid = 0; tid < threads; ++tid){
         for(unsigned int j = 0; j < Size; ++j){
-#ifdef DEBUG
-            Pointers.at(tid).at(j) = nullptr;
-#else
-            Pointers[tid][j] = nullptr;
-#endif
+            pointers(tid).pointers[j] = nullptr;
         }
 
-        if(Prefill > 0){
-            for(unsigned int i = 0; i < Prefill; i++){
-#ifdef DEBUG
-                FreeQueues.at(tid).push_back(new Node());
-#else
-                FreeQueues[tid].push_back(new Node());
-#endif
-            }
-        } 
+        //A scan leaves at most Size * threads nodes behind
+        stacks(tid).local.reserve(Scan + Size * threads);
+        stacks(tid).free.reserve(std::max(Scan, Prefill));
+        stacks(tid).hazards.reserve(Size * threads);
+
+        for(unsigned int i = 0; i < Prefill; i++){
+            stacks(tid).free.push_back(new Node());
+        }
     }
 }
 
-template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill>
-HazardManager<Node, Threads, Size, Prefill>::~HazardManager(){
-    for(unsigned int tid = 0; tid < Threads; ++tid){
+template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill, unsigned int Batch>
+HazardManager<Node, Threads, Size, Prefill, Batch>::~HazardManager(){
+    for(unsigned int tid = 0; tid < Queues.size(); ++tid){
         //No need to delete Hazard Pointers because each thread need to release its published references
 
-#ifdef DEBUG
-        while(!LocalQueues.at(tid).empty()){
-            delete LocalQueues.at(tid).front();
-            LocalQueues.at(tid).pop_front();
+        for(Node* node : stacks(tid).local){
+            delete node;
         }
-        
-        while(!FreeQueues.at(tid).empty()){
-            delete FreeQueues.at(tid).front();
-            FreeQueues.at(tid).pop_front();
-        }
-#else
-        while(!LocalQueues[tid].empty()){
-            delete LocalQueues[tid].front();
-            LocalQueues[tid].pop_front();
-        }
-        
-        while(!FreeQueues[tid].empty()){
-            delete FreeQueues[tid].front();
-            FreeQueues[tid].pop_front();
+
+        for(Node* node : stacks(tid).free){
+            delete node;
         }
-#endif
     }
 }
-        
-template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill>
-std::list<Node*>& HazardManager<Node, Threads, Size, Prefill>::direct_free(unsigned int t){
-#ifdef DEBUG
-    return FreeQueues.at(t);
-#else
-    return FreeQueues[t];
-#endif
+
+template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill, unsigned int Batch>
+inline typename HazardManager<Node, Threads, Size, Prefill, Batch>::Pointers& HazardManager<Node, Threads, Size, Prefill, Batch>::pointers(unsigned int t){
+    return Hazards[t];
 }
-        
-template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill>
-std::list<Node*>& HazardManager<Node, Threads, Size, Prefill>::direct_local(unsigned int t){
-#ifdef DEBUG
-    return LocalQueues.at(t);
-#else
-    return LocalQueues[t];
-#endif
+
+template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill, unsigned int Batch>
+inline typename HazardManager<Node, Threads, Size, Prefill, Batch>::Stacks& HazardManager<Node, Threads, Size, Prefill, Batch>::stacks(unsigned int t){
+    return Queues[t];
+}
+
+template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill, unsigned int Batch>
+std::vector<Node*>& HazardManager<Node, Threads, Size, Prefill, Batch>::direct_free(unsigned int t){
+    return stacks(t).free;
+}
+
+template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill, unsigned int Batch>
+std::vector<Node*>& HazardManager<Node, Threads, Size, Prefill, Batch>::direct_local(unsigned int t){
+    return stacks(t).local;
 }
 
-template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill>
-void HazardManager<Node, Threads, Size, Prefill>::safe_release_node(Node* node){
+template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill, unsigned int Batch>
+void HazardManager<Node, Threads, Size, Prefill, Batch>::safe_release_node(Node* node){
     //If the node is null, we have nothing to do
     if(node){
-        if(std::find(LocalQueues.at(thread_num).begin(), LocalQueues.at(thread_num).end(), node) != LocalQueues.at(thread_num).end()){
+        std::vector<Node*>& local = stacks(thread_num).local;
+
+        if(std::find(local.begin(), local.end(), node) != local.end()){
             return;
         }
 
-        //Add the node to the localqueue
-        LocalQueues.at(thread_num).push_back(node);
+        releaseNode(node);
     }
 }
 
-template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill>
-void HazardManager<Node, Threads, Size, Prefill>::releaseNode(Node* node){
+template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill, unsigned int Batch>
+void HazardManager<Node, Threads, Size, Prefill, Batch>::releaseNode(Node* node){
     //If the node is null, we have nothing to do
     if(node){
-#ifdef DEBUG
-        //Add the node to the localqueue
-        LocalQueues.at(thread_num).push_back(node);
-#else
-        //Add the node to the localqueue
-        LocalQueues[thread_num].push_back(node);
-#endif
-    }
-}
-
-template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill>
-Node* HazardManager<Node, Threads, Size, Prefill>::getFreeNode(){
-    int tid = thread_num;
+        Stacks& own = stacks(thread_num);
 
-#ifdef DEBUG
-    //First, try to get a free node from the free queue
-    if(!FreeQueues.at(tid).empty()){
-        Node* free = FreeQueues.at(tid).front();
-        FreeQueues.at(tid).pop_front();
+        //Add the node to the local stack
+        own.local.push_back(node);
 
-        return free;
-    }
-
-    //If there are enough local nodes, move then to the free queue
-    if(LocalQueues.at(tid).size() > (Size + 1) * Threads){
-        typename std::list<Node*>::iterator it = LocalQueues.at(tid).begin();
-        typename std::list<Node*>::iterator end = LocalQueues.at(tid).end();
-
-        while(it != end){
-            if(!isReferenced(*it)){
-                FreeQueues.at(tid).push_back(*it);
-
-                it = LocalQueues.at(tid).erase(it);
-            }
-            else {
-                ++it;
-            }
+        if(own.local.size() >= Scan){
+            scan(own);
         }
-        
-        Node* free = FreeQueues.at(tid).front();
-        FreeQueues.at(tid).pop_front();
-
-        return free;
-    }
-#else
-    //First, try to get a free node from the free queue
-    if(!FreeQueues[tid].empty()){
-        Node* free = FreeQueues[tid].front();
-        FreeQueues[tid].pop_front();
-
-        return free;
     }
+}
 
-    //If there are enough local nodes, move then to the free queue
-    if(LocalQueues[tid].size() > (Size + 1) * Threads){
-        typename std::list<Node*>::iterator it = LocalQueues[tid].begin();
-        typename std::list<Node*>::iterator end = LocalQueues[tid].end();
+template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill, unsigned int Batch>
+Node* HazardManager<Node, Threads, Size, Prefill, Batch>::getFreeNode(){
+    Stacks& own = stacks(thread_num);
 
-        while(it != end){
-            if(!isReferenced(*it)){
-                FreeQueues[tid].push_back(*it);
-
-                it = LocalQueues[tid].erase(it);
-            }
-            else {
-                ++it;
-            }
-        }
-        
-        Node* free = FreeQueues[tid].front();
-        FreeQueues[tid].pop_front();
+    if(!own.free.empty()){
+        Node* free = own.free.back();
+        own.free.pop_back();
 
         return free;
     }
-#endif
 
     //There was no way to get a free node, allocate a new one
     return new Node();
 }
 
-template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill>
-bool HazardManager<Node, Threads, Size, Prefill>::isReferenced(Node* node){
-#ifdef DEBUG
-    for(unsigned int tid = 0; tid < Threads; ++tid){
+/*!
+ * Move the local nodes that no hazard pointer references to the free stack.
+ */
+template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill, unsigned int Batch>
+void HazardManager<Node, Threads, Size, Prefill, Batch>::scan(Stacks& own){
+    std::vector<Node*>& hazards = own.hazards;
+
+    hazards.clear();
+
+    for(unsigned int tid = 0; tid < Hazards.size(); ++tid){
         for(unsigned int i = 0; i < Size; ++i){
-            if(Pointers.at(tid).at(i) == node){
-                return true;
+            Node* node = pointers(tid).pointers[i];
+
+            if(node){
+                hazards.push_back(node);
             }
         }
     }
-#else
-    for(unsigned int tid = 0; tid < Threads; ++tid){
-        for(unsigned int i = 0; i < Size; ++i){
-            if(Pointers[tid][i] == node){
-                return true;
-            }
+
+    std::sort(hazards.begin(), hazards.end());
+
+    //Keep the referenced nodes in place, at the bottom of the stack
+    std::size_t kept = 0;
+    for(std::size_t i = 0; i < own.local.size(); ++i){
+        Node* node = own.local[i];
+
+        if(std::binary_search(hazards.begin(), hazards.end(), node)){
+            own.local[kept++] = node;
+        } else {
+            own.free.push_back(node);
         }
     }
-#endif
 
-    return false;
+    own.local.resize(kept);
 }
 
-template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill>
-void HazardManager<Node, Threads, Size, Prefill>::publish(Node* node, unsigned int i){
+template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill, unsigned int Batch>
+void HazardManager<Node, Threads, Size, Prefill, Batch>::publish(Node* node, unsigned int i){
 #ifdef DEBUG
-    Pointers.at(thread_num).at(i) = node;
-#else
-    Pointers[thread_num][i] = node;
+    assert(i < Size);
 #endif
+
+    pointers(thread_num).pointers[i] = node;
 }
 
-template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill>
-void HazardManager<Node, Threads, Size, Prefill>::release(unsigned int i){
+template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill, unsigned int Batch>
+void HazardManager<Node, Threads, Size, Prefill, Batch>::release(unsigned int i){
 #ifdef DEBUG
-    Pointers.at(thread_num).at(i) = nullptr;
-#else
-    Pointers[thread_num][i] = nullptr;
+    assert(i < Size);
 #endif
+
+    pointers(thread_num).pointers[i] = nullptr;
 }
 
-template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill>
-void HazardManager<Node, Threads, Size, Prefill>::releaseAll(){
-#ifdef DEBUG
-    for(unsigned int i = 0; i < Size; ++i){
-        Pointers.at(thread_num).at(i) = nullptr;
-    }
-#else
+template<typename Node, unsigned int Threads, unsigned int Size, unsigned int Prefill, unsigned int Batch>
+void HazardManager<Node, Threads, Size, Prefill, Batch>::releaseAll(){
+    Pointers& own = pointers(thread_num);
+
     for(unsigned int i = 0; i < Size; ++i){
-        Pointers[thread_num][i] = nullptr;
+        own.pointers[i] = nullptr;
     }
-#endif
 }
 
 #endif
@@ -0,0 +1,104 @@
+#ifndef KEYS
+#define KEYS
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+/*!
+ * Order of the keys of a tree, given as its Compare parameter.
+ * less() is a strict weak order and equal() holds when neither key is less than the other.
+ * The generic version only needs operator< and takes the keys by reference.
+ * \param K The type of key.
+ */
+template<typename K, typename Enable = void>
+struct key_compare {
+    typedef const K& param_type;
+
+    static bool less(param_type lhs, param_type rhs){
+        return lhs < rhs;
+    }
+
+    static bool equal(param_type lhs, param_type rhs){
+        return !(lhs < rhs) && !(rhs < lhs);
+    }
+};
+
+/*!
+ * Integral keys are passed in registers and compared for equality directly.
+ */
+template<typename K>
+struct key_compare<K, typename std::enable_if<std::is_integral<K>::value>::type> {
+    typedef K param_type;
+
+    static bool less(K lhs, K rhs){
+        return lhs < rhs;
+    }
+
+    static bool equal(K lhs, K rhs){
+        return lhs == rhs;
+    }
+};
+
+/*!
+ * A string key of at most N characters, stored inline and padded with zeros.
+ * The keys are ordered bytewise, like strcmp() orders the strings.
+ * \param N The length of the key in bytes.
+ */
+template<std::size_t N>
+struct fixed_string {
+    char data[N];
+
+    fixed_string(){
+        std::memset(data, 0, N);
+    }
+
+    /*!
+     * Longer strings are truncated to N characters.
+     */
+    fixed_string(const char* value){
+        std::memset(data, 0, N);
+        std::memcpy(data, value, strnlen(value, N));
+    }
+
+    fixed_string(const std::string& value){
+        std::memset(data, 0, N);
+        std::memcpy(data, value.data(), value.size() < N ? value.size() : N);
+    }
+
+    std::string str() const {
+        return std::string(data, strnlen(data, N));
+    }
+
+    bool operator<(const fixed_string& rhs) const {
+        return std::memcmp(data, rhs.data, N) < 0;
+    }
+
+    bool operator==(const fixed_string& rhs) const {
+        return std::memcmp(data, rhs.data, N) == 0;
+    }
+};
+
+/*!
+ * The padding makes equality a single memcmp, which the compiler inlines for small N.
+ */
+template<std::size_t N>
+struct key_compare<fixed_string<N>> {
+    typedef const fixed_string<N>& param_type;
+
+    static bool less(param_type lhs, param_type rhs){
+        return std::memcmp(lhs.data, rhs.data, N) < 0;
+    }
+
+    static bool equal(param_type lhs, param_type rhs){
+        return std::memcmp(lhs.data, rhs.data, N) == 0;
+    }
+};
+
+/*!
+ * Value type of a tree used as a set.
+ */
+struct no_value {};
+
+#endif
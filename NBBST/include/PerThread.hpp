@@ -0,0 +1,116 @@
+#ifndef PER_THREAD
+#define PER_THREAD
+
+#include <array>
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+//Thread local id
+//Note: __thread is GCC specific
+extern __thread unsigned int thread_num;
+
+/*!
+ * Value of the Threads template parameter of the trees (and of the HazardManager) asking for a
+ * thread count given to the constructor instead of fixed at compile time.
+ */
+static const int DynamicThreads = 0;
+
+/*!
+ * Give the calling thread the lowest id that no other registered thread holds and store it in
+ * thread_num. The ids are dense, so a tree built for n threads can be used by any n threads
+ * registered at the same time.
+ * \return The id of the calling thread.
+ */
+unsigned int register_thread();
+
+/*!
+ * Give the id of the calling thread back. The thread must not be inside an operation on a tree.
+ */
+void unregister_thread();
+
+/*!
+ * One slot per thread, each slot on its own cache lines.
+ *
+ * \param T The type of a slot.
+ * \param Threads The number of threads, DynamicThreads to give it to the constructor.
+ */
+template<typename T, unsigned int Threads>
+class PerThread {
+    public:
+        explicit PerThread(unsigned int threads = Threads){
+            assert(threads == Threads);
+            (void) threads;
+        }
+
+        unsigned int size() const {
+            return Threads;
+        }
+
+        T& operator[](unsigned int t){
+#ifdef DEBUG
+            assert(t < Threads);
+#endif
+
+            return slots[t].value;
+        }
+
+    private:
+        struct alignas(64) Slot {
+            T value;
+        };
+
+        std::array<Slot, Threads> slots;
+};
+
+template<typename T>
+class PerThread<T, DynamicThreads> {
+    public:
+        explicit PerThread(unsigned int threads) : count(threads) {
+            assert(threads > 0);
+
+            void* memory;
+            if(posix_memalign(&memory, alignof(Slot), threads * sizeof(Slot))){
+                throw std::bad_alloc();
+            }
+
+            slots = static_cast<Slot*>(memory);
+
+            for(unsigned int t = 0; t < threads; ++t){
+                new (&slots[t]) Slot();
+            }
+        }
+
+        ~PerThread(){
+            for(unsigned int t = 0; t < count; ++t){
+                slots[t].~Slot();
+            }
+
+            free(slots);
+        }
+
+        PerThread(const PerThread& rhs) = delete;
+        PerThread& operator=(const PerThread& rhs) = delete;
+
+        unsigned int size() const {
+            return count;
+        }
+
+        T& operator[](unsigned int t){
+#ifdef DEBUG
+            assert(t < count);
+#endif
+
+            return slots[t].value;
+        }
+
+    private:
+        struct alignas(64) Slot {
+            T value;
+        };
+
+        Slot* slots;
+        const unsigned int count;
+};
+
+#endif
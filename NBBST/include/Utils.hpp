@@ -13,4 +13,16 @@ bool inline CASPTR(T** ptr, T* old, T* value){
     return __sync_bool_compare_and_swap(ptr, old, value);
 }
 
+/*!
+ * Compare and Swap a value. 
+ * \param ptr The address of the value to swap.
+ * \param old The expected value.
+ * \param value The new value to set. 
+ * \return true if the CAS suceeded, otherwise false. 
+ */
+template<typename T>
+bool inline CAS(volatile T* ptr, T old, T value){
+    return __sync_bool_compare_and_swap(ptr, old, value);
+}
+
 #endif
@@ -71,7 +71,10 @@ enum Result {
 template<typename T, int Threads>
 class AVLTree {
     public:
-        AVLTree();
+        /*!
+         * \param threads The number of threads using the tree, only to give with Threads = DynamicThreads.
+         */
+        explicit AVLTree(unsigned int threads = Threads);
         ~AVLTree();
         
         bool contains(T value);
@@ -115,7 +118,7 @@ class AVLTree {
 
         HazardManager<Node, Threads, 6> hazard;
         
-        unsigned int Current[Threads];
+        PerThread<unsigned int, Threads> Current;
 };
 
 static Node* fixHeight_nl(Node* n);
@@ -123,10 +126,10 @@ static int height(Node* node);
 static int nodeCondition(Node* node);
 
 template<typename T, int Threads>
-AVLTree<T, Threads>::AVLTree(){
+AVLTree<T, Threads>::AVLTree(unsigned int threads) : hazard(threads), Current(threads) {
     rootHolder = newNode(std::numeric_limits<int>::min());
 
-    for(unsigned int i = 0; i < Threads; ++i){
+    for(unsigned int i = 0; i < threads; ++i){
         Current[i] = 0;
     }
 }
@@ -117,7 +117,10 @@ enum Result {
 template<typename T, int Threads>
 class CBTree {
     public:
-        CBTree();
+        /*!
+         * \param threads The number of threads using the tree, only to give with Threads = DynamicThreads.
+         */
+        explicit CBTree(unsigned int threads = Threads);
         ~CBTree();
 
         bool add(T value);
@@ -129,7 +132,7 @@ class CBTree {
 
         std::atomic<int> size;
         std::atomic<int> logSize;
-        int local_size[Threads];
+        PerThread<int, Threads> local_size;
 
         int NEW_LOG_CALCULATION_THRESHOLD;
         
@@ -138,7 +141,7 @@ class CBTree {
 
         HazardManager<Node, Threads, 5> hazard;
         
-        unsigned int Current[Threads];
+        PerThread<unsigned int, Threads> Current;
         void deep_release(Node* node);
         
         /* Allocate new nodes */
@@ -167,14 +170,14 @@ class CBTree {
 };
 
 template<typename T, int Threads>
-CBTree<T, Threads>::CBTree(){
+CBTree<T, Threads>::CBTree(unsigned int threads) : local_size(threads), hazard(threads), Current(threads) {
     rootHolder = newNode(std::numeric_limits<int>::min(), false, nullptr, 0L, nullptr, nullptr); 
     rootHolder->ncnt = std::numeric_limits<int>::max();
 
     size.store(0);
     logSize.store(-1);
 
-    for(int i = 0; i < Threads; ++i){
+    for(unsigned int i = 0; i < threads; ++i){
         local_size[i] = 0;
         Current[i] = 0;
     }
@@ -336,7 +339,7 @@ bool CBTree<T, Threads>::add(T value){
         } else {
             ++local_size[thread_num];
 
-            if(local_size[thread_num] >= Threads){
+            if(local_size[thread_num] >= (int) local_size.size()){
                 int new_size = (size += local_size[thread_num]);
                 local_size[thread_num] = 0;
                 int next_log_size = log_size + 1;
@@ -380,7 +383,7 @@ bool CBTree<T, Threads>::remove(T value){
                             }
                         } else {
                             --local_size[thread_num];
-                            if(local_size[thread_num] <= -Threads){
+                            if(local_size[thread_num] <= -(int) local_size.size()){
                                 int new_size = (size += local_size[thread_num]);
                                 local_size[thread_num] = 0;
                                 if(new_size < (1 << log_size)){
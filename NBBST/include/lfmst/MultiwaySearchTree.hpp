@@ -5,17 +5,26 @@
 #include <algorithm>
 #include <array>
 #include <unordered_set>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "hash.hpp"
 #include "Utils.hpp"
 #include "HazardManager.hpp"
+#include "EpochManager.hpp"
 
 //Lock-Free Multiway Search Tree
 namespace lfmst {
 
-//Constants to manage array of search
-#define FIRST   6
-#define MAX     8
+//Number of lookups in flight in a batched contains
+#define BATCH   8
 
 struct Node;
 
@@ -42,56 +51,61 @@ struct Key {
     }
 };
     
-static void verify(int index, int length){
-    assert(index < length);
-}
-
-//Hold a set of key include the length of the set
-struct Keys {
-    int length;
-    Key* elements;
+/*!
+ * The keys, the children and the link of a node in a single block of whole cache lines, replaced
+ * as a whole by a CAS on the node.
+ *
+ * The keys start right after the header, the children of a non-leaf node follow the keys (one per
+ * key). Only the last key of a node can be +∞, it is then flagged by infinite and its slot in keys
+ * is not used.
+ */
+struct Contents {
+    Node* link;             //The next node
+    int length;             //The number of keys, and of children in a non-leaf node
+    bool leaf;
+    bool infinite;          //The last key is +∞
+    unsigned short lines;   //The size of the block
+    int keys[1];
 
-    Keys() : length(0), elements(nullptr) {
-        //Nothing
+    Key key(int index) const {
+        return {infinite && index == length - 1 ? KeyFlag::INF : KeyFlag::NORMAL, keys[index]};
     }
 
-    ~Keys(){
-        if(elements){
-            free(elements);
-        }
+    Node** children(){
+        return reinterpret_cast<Node**>(reinterpret_cast<char*>(this) + childrenOffset(length));
     }
 
-    Key& operator[](int index){
-        verify(index, length);
-        return elements[index];
+    static std::size_t childrenOffset(int length){
+        return (offsetof(Contents, keys) + length * sizeof(int) + sizeof(Node*) - 1) & ~(sizeof(Node*) - 1);
     }
-};
+    
+    //The number of cache lines of a block holding length keys
+    static unsigned int linesFor(int length, bool leaf){
+        std::size_t size = leaf ? offsetof(Contents, keys) + length * sizeof(int) : childrenOffset(length) + length * sizeof(Node*);
 
-//Hold a set of key including the lenght of the set
-struct Children {
-    int length;
-    Node** elements;
+        return (size + 63) / 64;
+    }
 
-    Children() : length(0), elements(nullptr) {
-        //Nothing
+    static void* operator new(std::size_t size){
+        return operator new(size, (size + 63) / 64);
     }
-    
-    ~Children(){
-        if(elements){
-            free(elements);
+
+    static void* operator new(std::size_t, unsigned int lines){
+        void* memory;
+        if(posix_memalign(&memory, 64, lines * 64)){
+            throw std::bad_alloc();
         }
+
+        return memory;
     }
 
-    Node*& operator[](int index){
-        verify(index, length);
-        return elements[index];
+    static void operator delete(void* contents){
+        free(contents);
     }
-};
 
-struct Contents {
-    Keys* items;
-    Children* children;
-    Node* link; //The next node
+    static void operator delete(void* contents, unsigned int){
+        free(contents);
+    }
 };
 
 struct Node {
@@ -113,39 +127,127 @@ struct HeadNode {
     int height;
 };
 
+/*!
+ * Allocation of the contents, which can only be reused for the same number of cache lines: the
+ * contents released by the epoch manager are sorted into one free stack per size and per thread.
+ *
+ * \param Threads The number of threads, DynamicThreads to give it to the constructor.
+ */
+template<int Threads>
+class Blocks {
+    public:
+        explicit Blocks(unsigned int threads = Threads) : pools(threads) {}
+        ~Blocks();
+
+        Blocks(const Blocks& rhs) = delete;
+        Blocks& operator=(const Blocks& rhs) = delete;
+
+        /*!
+         * Return contents of the given size for the calling thread.
+         * \param lines The number of cache lines of the contents.
+         * \param released The free stack of the epoch manager of the calling thread, emptied into the pools.
+         */
+        Contents* get(unsigned int lines, std::vector<Contents*>& released);
+
+    private:
+        PerThread<std::vector<std::vector<Contents*>>, Threads> pools;
+};
+
+template<int Threads>
+Blocks<Threads>::~Blocks(){
+    for(unsigned int t = 0; t < pools.size(); ++t){
+        for(auto& free : pools[t]){
+            for(Contents* contents : free){
+                delete contents;
+            }
+        }
+    }
+}
+
+template<int Threads>
+Contents* Blocks<Threads>::get(unsigned int lines, std::vector<Contents*>& released){
+    std::vector<std::vector<Contents*>>& pool = pools[thread_num];
+
+    if(lines >= pool.size() || pool[lines].empty()){
+        for(Contents* contents : released){
+            if(contents->lines >= pool.size()){
+                pool.resize(contents->lines + 1);
+            }
+
+            pool[contents->lines].push_back(contents);
+        }
+
+        released.clear();
+    }
+
+    Contents* contents;
+
+    if(lines >= pool.size() || pool[lines].empty()){
+        contents = new (lines) Contents();
+    } else {
+        contents = pool[lines].back();
+        pool[lines].pop_back();
+    }
+
+    contents->lines = lines;
+
+    return contents;
+}
+
 template<typename T, int Threads>
 class MultiwaySearchTree {
     public:
-        MultiwaySearchTree();
+        /*!
+         * \param threads The number of threads using the tree, only to give with Threads = DynamicThreads.
+         */
+        explicit MultiwaySearchTree(unsigned int threads = Threads);
         ~MultiwaySearchTree();
         
         bool contains(T value);
         bool add(T value);
         bool remove(T value);
 
+        /*!
+         * Look for several values at once. Up to BATCH lookups go down the tree in turns, each one
+         * prefetching the next node or contents it reads, so that their cache misses overlap.
+         * \param values The values to look for.
+         * \param count The number of values.
+         * \param results Set to true for each value in the tree, false for the others.
+         */
+        void contains(const T* values, std::size_t count, bool* results);
+
     private:
         HeadNode* root;
 
         int randomSeed;
         
-        HazardManager<HeadNode, Threads, 1, 1> roots;
-        HazardManager<Node, Threads,        4 + MAX> nodes;
-        HazardManager<Contents, Threads,    4 + MAX> nodeContents;
-        HazardManager<Keys, Threads,        4 + MAX> nodeKeys;
-        HazardManager<Children, Threads,    4 + MAX> nodeChildren;
-        HazardManager<Search, Threads,      1> searches;
+        //A replaced root or contents can still be read, or compared and swapped against, by an older operation
+        EpochManager<HeadNode, Threads, 1> roots;
+        EpochManager<Contents, Threads, 0> nodeContents;
+
+        //Only the nodes that were never linked are released before the tree, the operations do not enter this one
+        EpochManager<Node, Threads> nodes;
 
-        std::array<std::vector<Node*>, Threads> trash;
+        //The searches never leave their thread
+        HazardManager<Search, Threads, 1> searches;
+
+        //The contents are created by the blocks, the epoch manager only recycles them
+        Blocks<Threads> blocks;
+
+        /* Brackets the public operations, none of the roots and contents they reach is reused before they end */
+        struct EpochScope {
+            MultiwaySearchTree* tree;
+
+            EpochScope(MultiwaySearchTree* tree);
+            ~EpochScope();
+        };
+
+        PerThread<std::vector<Node*>, Threads> trash;
 
         HeadNode* newHeadNode(Node* node, int height);
         Search* newSearch(Node* node, Contents* contents, int index);
-        Contents* newContents(Keys* items, Children* children, Node* link);
+        Contents* newContents(int length, bool leaf, Node* link);
         Node* newNode(Contents* contents);
-        Keys* newKeys(int length);
-        Children* newChildren(int length);
-
-        Keys* removeSingleItem(Keys* a, int index);
-        Children* removeSingleItem(Children* a, int index);
 
         bool attemptSlideKey(Node* node, Contents* contents);
         bool shiftChild(Node* node, Contents* contents, int index, Node* adjustedChild);
@@ -166,15 +268,11 @@ class MultiwaySearchTree {
         Search* goodSamaritanCleanNeighbor(Key key, Search* results);
         bool removeFromNode(Key key, Search* results);
 
-        Search* moveForward(Node* node, Key key, int hint);
+        Search* moveForward(Node* node, Key key);
 
-        Keys* generateNewItems(Key key, Keys* keys, int index);
-        Keys* generateLeftItems(Keys* children, int index);
-        Keys* generateRightItems(Keys* children, int index);
-        Children* generateNewChildren(Node* child, Children* children, int index);
-        Children* generateLeftChildren(Children* children, int index);
-        Children* generateRightChildren(Children* children, int index);
-        Children* copyChildren(Children* rhs);
+        Contents* slice(Contents* contents, int begin, int end, Node* link);
+        Contents* insertItem(Contents* contents, int index, Key key, int childIndex, Node* child);
+        Contents* removeItem(Contents* contents, int index, int childIndex);
 
         //These methods can only be called from add
         char insertLeafLevel(Key key, Search* results, int length);
@@ -191,6 +289,12 @@ static const int avgLength = 32;
 static const int avgLengthMinusOne = 31;
 static const int logAvgLength = 5; // log_2 of the average node length
 
+//Above this number of keys, a node is first narrowed down by a binary search
+static const int searchWindow = 32;
+
+//Cache lines of the contents fetched ahead by a batched lookup, enough for the keys of an average node
+static const int prefetchLines = 3;
+
 template<typename T, int Threads>
 HeadNode* MultiwaySearchTree<T, Threads>::newHeadNode(Node* node, int height){
     HeadNode* root = roots.getFreeNode();
@@ -216,15 +320,18 @@ Search* MultiwaySearchTree<T, Threads>::newSearch(Node* node, Contents* contents
     return search;
 }
 
+/*!
+ * Return contents with room for length keys (and as many children if not leaf), the keys and
+ * the children are left to the caller.
+ */
 template<typename T, int Threads>
-Contents* MultiwaySearchTree<T, Threads>::newContents(Keys* items, Children* children, Node* link){
-    Contents* contents = nodeContents.getFreeNode();
-
-    assert(contents);
+Contents* MultiwaySearchTree<T, Threads>::newContents(int length, bool leaf, Node* link){
+    Contents* contents = blocks.get(Contents::linesFor(length, leaf), nodeContents.direct_free(thread_num));
 
-    contents->items = items;
-    contents->children = children;
     contents->link = link;
+    contents->length = length;
+    contents->leaf = leaf;
+    contents->infinite = false;
 
     return contents;
 }
@@ -239,51 +346,22 @@ Node* MultiwaySearchTree<T, Threads>::newNode(Contents* contents){
 
     return node;
 }
-    
-template<typename T, int Threads>
-Keys* MultiwaySearchTree<T, Threads>::newKeys(int length){
-    Keys* keys = nodeKeys.getFreeNode();
-
-    assert(keys);
-
-    keys->length = length;
-
-    //TODO A little optimization would be to keep the array if the sizes are the same (or even if the old length is greater)
 
-    //If the object has already been used
-    if(keys->elements){
-        free(keys->elements);
-    }
-
-    keys->elements = static_cast<Key*>(calloc(length, sizeof(Key))); 
-
-    return keys;
+template<typename T, int Threads>
+MultiwaySearchTree<T, Threads>::EpochScope::EpochScope(MultiwaySearchTree* tree) : tree(tree) {
+    tree->roots.enter();
+    tree->nodeContents.enter();
 }
 
 template<typename T, int Threads>
-Children* MultiwaySearchTree<T, Threads>::newChildren(int length){
-    Children* children = nodeChildren.getFreeNode();
-
-    assert(children);
-
-    children->length = length;
-
-    //TODO A little optimization would be to keep the array if the sizes are the same (or even if the old length is greater)
-    
-    //If the object has already been used
-    if(children->elements){
-        free(children->elements);
-    }
-
-    children->elements = static_cast<Node**>(calloc(length, sizeof(Node*)));
-
-    return children;
+MultiwaySearchTree<T, Threads>::EpochScope::~EpochScope(){
+    tree->nodeContents.leave();
+    tree->roots.leave();
 }
 
 /* Some internal utilities */ 
 
-static int search(Keys* items, Key key);
-static int searchWithHint(Keys* items, Key key, int hint);
+static int search(Contents* contents, Key key);
 static int compare(Key k1, Key k2);
 
 template<typename T>
@@ -294,11 +372,12 @@ Key special_hash(T value){
 }
 
 template<typename T, int Threads>
-MultiwaySearchTree<T, Threads>::MultiwaySearchTree(){
-    Keys* keys = newKeys(1);
-    (*keys)[0] = {KeyFlag::INF, 0};
+MultiwaySearchTree<T, Threads>::MultiwaySearchTree(unsigned int threads) :
+        roots(threads), nodeContents(threads), nodes(threads), searches(threads), blocks(threads), trash(threads) {
+    Contents* contents = newContents(1, true, nullptr);
+    contents->keys[0] = 0;
+    contents->infinite = true;
 
-    Contents* contents = newContents(keys, nullptr, nullptr);
     Node* node = newNode(contents);
 
     root = newHeadNode(node, 0);
@@ -308,14 +387,6 @@ MultiwaySearchTree<T, Threads>::MultiwaySearchTree(){
     randomSeed = distribution(engine) | 0x0100;
 }
 
-template<typename Node>
-inline void transfer(std::list<Node*>& source, std::unordered_set<Node*>& target){
-    for(auto j : source){
-        target.insert(j);
-    }
-    source.clear();
-}
-
 template<typename HP, typename Node>
 inline void release_all(std::unordered_set<Node*>& nodes, HP& hazard){
     auto nodes_it = nodes.begin();
@@ -331,12 +402,10 @@ inline void release_all(std::unordered_set<Node*>& nodes, HP& hazard){
 template<typename T, int Threads>
 MultiwaySearchTree<T, Threads>::~MultiwaySearchTree(){
     std::unordered_set<Node*> set_nodes;
-    std::unordered_set<Keys*> set_keys;
     std::unordered_set<Contents*> set_contents;
-    std::unordered_set<Children*> set_children;
     
     //Get the trashed nodes
-    for(unsigned int i = 0; i < Threads; ++i){
+    for(unsigned int i = 0; i < trash.size(); ++i){
         auto it = trash[i].begin();
         auto end = trash[i].end();
 
@@ -357,16 +426,12 @@ MultiwaySearchTree<T, Threads>::~MultiwaySearchTree(){
         stack.pop_back();
 
         if(n->contents){
-            if(n->contents->items){
-                set_keys.insert(n->contents->items);
-            }
+            if(!n->contents->leaf){
+                Node** children = n->contents->children();
 
-            if(n->contents->children){
-                for(int i = 0; i < n->contents->children->length; ++i){
-                    stack.push_back((*n->contents->children)[i]);
+                for(int i = 0; i < n->contents->length; ++i){
+                    stack.push_back(children[i]);
                 }
-
-                set_children.insert(n->contents->children);
             }
 
             set_contents.insert(n->contents);
@@ -377,103 +442,152 @@ MultiwaySearchTree<T, Threads>::~MultiwaySearchTree(){
         set_nodes.insert(n);
     }
 
-    for(unsigned int i = 0; i < Threads; ++i){
-        transfer(nodes.direct_free(i), set_nodes);
-        transfer(nodes.direct_local(i), set_nodes);
-        
-        transfer(nodeContents.direct_free(i), set_contents);
-        transfer(nodeContents.direct_local(i), set_contents);
-        
-        transfer(nodeKeys.direct_free(i), set_keys);
-        transfer(nodeKeys.direct_local(i), set_keys);
-        
-        transfer(nodeChildren.direct_free(i), set_children);
-        transfer(nodeChildren.direct_local(i), set_children);
-    }
-
+    //The nodes and contents already released are freed by their manager
     release_all(set_nodes, nodes);
-    release_all(set_keys, nodeKeys);
     release_all(set_contents, nodeContents);
-    release_all(set_children, nodeChildren);
 }
 
 template<typename T, int Threads>
 bool MultiwaySearchTree<T, Threads>::contains(T value){
+    EpochScope scope(this);
+
     Key key = special_hash(value);
 
     Node* node = this->root->node;
-    nodes.publish(node, 0);
     
     Contents* contents = node->contents;
-    nodeContents.publish(contents, 0);
-    nodeKeys.publish(contents->items, 0);
-    nodeChildren.publish(contents->children, 0);
     
-    int index = search(contents->items, key);
-    while(contents->children){
-        if(-index -1 == contents->items->length){
+    int index = search(contents, key);
+    while(!contents->leaf){
+        if(-index -1 == contents->length){
             node = contents->link;
         } else if(index < 0){
-            node = (*contents->children)[-index -1];
+            node = contents->children()[-index -1];
         } else {
-            node = (*contents->children)[index];
+            node = contents->children()[index];
         }
-    
-        nodes.publish(node, 0);
 
         contents = node->contents;
-        nodeContents.publish(contents, 0);
-        nodeKeys.publish(contents->items, 0);
-        nodeChildren.publish(contents->children, 0);
         
-        index = search(contents->items, key);
+        index = search(contents, key);
     }
 
     while(true){
-        if(-index - 1 == contents->items->length){
+        if(-index - 1 == contents->length){
             node = contents->link;
         } else {
-            nodeContents.release(0);
-            nodeKeys.release(0);
-            nodeChildren.release(0);
-            nodes.release(0);
-
             return index >= 0;
         }
-        
-        nodes.publish(node, 0);
-        
+
         contents = node->contents;
-        nodeContents.publish(contents, 0);
-        nodeKeys.publish(contents->items, 0);
-        nodeChildren.publish(contents->children, 0);
 
-        index = search(contents->items, key);
+        index = search(contents, key);
+    }
+}
+
+//Fetch the header and the first keys of the contents
+static inline void prefetch(Contents* contents){
+    const char* block = reinterpret_cast<const char*>(contents);
+
+    //The blocks are aligned on cache lines, a prefetch past the end of a small one is harmless
+    for(int line = 0; line < prefetchLines; ++line){
+        __builtin_prefetch(block + line * 64);
+    }
+}
+
+template<typename T, int Threads>
+void MultiwaySearchTree<T, Threads>::contains(const T* values, std::size_t count, bool* results){
+    EpochScope scope(this);
+
+    //A lookup alternates between reading the contents of its node and searching them
+    struct Lookup {
+        std::size_t value;
+        Key key;
+        Node* node;
+        Contents* contents;
+    };
+
+    Lookup lookups[BATCH];
+    unsigned int active = 0;
+    std::size_t next = 0;
+
+    auto start = [&](Lookup& lookup){
+        lookup.value = next;
+        lookup.key = special_hash(values[next]);
+        lookup.node = this->root->node;
+        lookup.contents = nullptr;
+
+        __builtin_prefetch(lookup.node);
+
+        ++next;
+    };
+
+    while(active < BATCH && next < count){
+        start(lookups[active++]);
+    }
+
+    while(active > 0){
+        for(unsigned int i = 0; i < active;){
+            Lookup& lookup = lookups[i];
+
+            if(!lookup.contents){
+                //The node has been prefetched during the previous turn
+                lookup.contents = lookup.node->contents;
+                prefetch(lookup.contents);
+
+                ++i;
+                continue;
+            }
+
+            Contents* contents = lookup.contents;
+            int index = search(contents, lookup.key);
+
+            if(-index - 1 == contents->length){
+                lookup.node = contents->link;
+            } else if(!contents->leaf){
+                lookup.node = contents->children()[index < 0 ? -index - 1 : index];
+            } else {
+                results[lookup.value] = index >= 0;
+
+                if(next == count){
+                    //The last lookup takes the place of the finished one
+                    lookup = lookups[--active];
+
+                    continue;
+                }
+
+                start(lookup);
+
+                ++i;
+                continue;
+            }
+
+            lookup.contents = nullptr;
+            __builtin_prefetch(lookup.node);
+
+            ++i;
+        }
     }
 }
 
 template<typename T, int Threads>
 bool MultiwaySearchTree<T, Threads>::add(T value){
+    EpochScope scope(this);
+
     Key key = special_hash(value);
 
     unsigned int height = randomLevel();
     if(height == 0){
         Search* results = traverseLeaf(key, false);
         
-        char inserted = insertLeafLevel(key, results, results->contents->items->length);
+        char inserted = insertLeafLevel(key, results, results->contents->length);
 
         //Retry
         if(inserted == 2){
             return add(value);
         }
 
-        //results is released in insertLeafLevel
-    
-        //Release references from traverseLeaf
-        nodes.release(FIRST);
-        nodeContents.release(FIRST);
-        nodeKeys.release(FIRST);
-        nodeChildren.release(FIRST);
+        //results is released in insertLeafLevel, also before a retry
 
         return inserted;
     } else {
@@ -500,10 +614,6 @@ bool MultiwaySearchTree<T, Threads>::add(T value){
 
             free(results);
 
-            nodeContents.releaseAll();
-            nodeChildren.releaseAll();
-            nodeKeys.releaseAll();
-
             return false;
         }
 
@@ -520,10 +630,6 @@ bool MultiwaySearchTree<T, Threads>::add(T value){
 
         free(results);
 
-        nodeContents.releaseAll();
-        nodeChildren.releaseAll();
-        nodeKeys.releaseAll();
-
         return true;
     }
 }
@@ -531,20 +637,16 @@ bool MultiwaySearchTree<T, Threads>::add(T value){
 template<typename T, int Threads>
 Search* MultiwaySearchTree<T, Threads>::traverseLeaf(Key key, bool cleanup){
     Node* node = this->root->node;
-    nodes.publish(node, 0);
 
     Contents* contents = node->contents;
-    nodeContents.publish(contents, 0);
-    nodeKeys.publish(contents->items, 0);
-    nodeChildren.publish(contents->children, 0);
 
-    int index = search(contents->items, key);
+    int index = search(contents, key);
     Key leftBarrier = {KeyFlag::EMPTY, 0};
 
-    while(contents->children){
-        if(-index - 1 == contents->items->length){
-            if(contents->items->length > 0){
-                leftBarrier = (*contents->items)[contents->items->length - 1];
+    while(!contents->leaf){
+        if(-index - 1 == contents->length){
+            if(contents->length > 0){
+                leftBarrier = contents->key(contents->length - 1);
             }
             
             node = cleanLink(node, contents)->link;
@@ -557,45 +659,25 @@ Search* MultiwaySearchTree<T, Threads>::traverseLeaf(Key key, bool cleanup){
                 cleanNode(key, node, contents, index, leftBarrier);
             }
             
-            node = (*contents->children)[index];
+            node = contents->children()[index];
             leftBarrier = {KeyFlag::EMPTY, 0};
         }
-    
-        nodes.publish(node, 0);
-        
+
         contents = node->contents;
-        nodeContents.publish(contents, 0);
-        nodeKeys.publish(contents->items, 0);
-        nodeChildren.publish(contents->children, 0);
 
-        index = search(contents->items, key);
+        index = search(contents, key);
     }
 
     while(true){
-        if(index > -contents->items->length -1){
-            nodeContents.release(0);
-            nodeKeys.release(0);
-            nodeChildren.release(0);
-            nodes.release(0);
-        
-            nodes.publish(node, FIRST);
-            nodeContents.publish(contents, FIRST);
-            nodeKeys.publish(contents->items, FIRST);
-            nodeChildren.publish(contents->children, FIRST);
-
+        if(index > -contents->length -1){
             return newSearch(node, contents, index);
         } else {
             node = cleanLink(node, contents)->link;
         }
-        
-        nodes.publish(node, 0);
 
         contents = node->contents;
-        nodeContents.publish(contents, 0);
-        nodeKeys.publish(contents->items, 0);
-        nodeChildren.publish(contents->children, 0);
 
-        index = search(contents->items, key);
+        index = search(contents, key);
     }
 }
 
@@ -611,56 +693,29 @@ void MultiwaySearchTree<T, Threads>::traverseNonLeaf(Key key, int target, Search
     Node* node = root->node;
 
     while(true){
-        nodes.publish(node, 0);
-
         Contents* contents = node->contents;
-        nodeContents.publish(contents, 0);
-        nodeKeys.publish(contents->items, 0);
-        nodeChildren.publish(contents->children, 0);
 
-        int index = search(contents->items, key);
+        int index = search(contents, key);
 
-        if(-index - 1 == contents->items->length){
+        if(-index - 1 == contents->length){
             node = contents->link;
         } else if(height == 0){
-            //Publish references to the contents contained in the Search
-            nodes.publish(node, FIRST);
-            nodeContents.publish(contents, FIRST);
-            nodeKeys.publish(contents->items, FIRST);
-            nodeChildren.publish(contents->children, FIRST);
-
             if(storeResults[0]){
                 searches.releaseNode(storeResults[0]);
             }
             
             storeResults[0] = newSearch(node, contents, index);
 
-            nodeContents.release(0);
-            nodeKeys.release(0);
-            nodeChildren.release(0);
-            nodes.release(0);
-
             return;
         } else {
             Search* first_results = newSearch(node, contents, index);
             Search* results = goodSamaritanCleanNeighbor(key, first_results);
-            
-            //Releases the references from the good samaritan
-            nodeContents.release(2);
-            nodeKeys.release(2);
-            nodeChildren.release(2);
 
             if(results != first_results){
                 searches.releaseNode(first_results);
             }
 
             if(height <= target){
-                //Publish references to the contents contained in the Search
-                nodes.publish(results->node, FIRST + height);
-                nodeContents.publish(results->contents, FIRST + height);
-                nodeKeys.publish(results->contents->items, FIRST + height);
-                nodeChildren.publish(results->contents->children, FIRST + height);
-            
                 storeResults[height] = results;
             } else {
                 searches.releaseNode(results);
@@ -670,7 +725,7 @@ void MultiwaySearchTree<T, Threads>::traverseNonLeaf(Key key, int target, Search
                 index = -index - 1;
             }
 
-            node = (*contents->children)[index];
+            node = contents->children()[index];
             height = height - 1;
         }
     }
@@ -678,6 +733,8 @@ void MultiwaySearchTree<T, Threads>::traverseNonLeaf(Key key, int target, Search
 
 template<typename T, int Threads>
 bool MultiwaySearchTree<T, Threads>::remove(T value){
+    EpochScope scope(this);
+
     Key key = special_hash(value);
 
     Search* results = traverseLeaf(key, true);
@@ -686,12 +743,6 @@ bool MultiwaySearchTree<T, Threads>::remove(T value){
 
     //results is released in removeFromNode
 
-    //Release references from traverseLeaf
-    nodes.release(FIRST);
-    nodeContents.release(FIRST);
-    nodeKeys.release(FIRST);
-    nodeChildren.release(FIRST);
-
     return removed;
 }
 
@@ -708,83 +759,44 @@ bool MultiwaySearchTree<T, Threads>::removeFromNode(Key key, Search* results){
             
             return false;
         } else {
-            nodes.publish(node, 0);
-            nodeContents.publish(contents, 0);
-            nodeKeys.publish(contents->items, 0);
-            nodeChildren.publish(contents->children, 0);
-
-            Keys* newKeys = removeSingleItem(contents->items, index);
-
-            Contents* update = newContents(newKeys, nullptr, contents->link);
-
-            //Note : contents->children is always empty here
+            //Note : contents is always a leaf here
+            Contents* update = removeItem(contents, index, index);
 
             if(node->casContents(contents, update)){
                 nodeContents.releaseNode(contents);
-                nodeChildren.releaseNode(contents->children);
-                nodeKeys.releaseNode(contents->items);
-                
-                nodeContents.release(0);
-                nodeKeys.release(0);
-                nodeChildren.release(0);
-                nodes.release(0);
 
                 searches.releaseNode(results);
 
                 return true;
             } else {
-                nodeKeys.releaseNode(newKeys);
                 nodeContents.releaseNode(update);
-                
-                nodeContents.release(0);
-                nodeKeys.release(0);
-                nodeChildren.release(0);
-                nodes.release(0);
 
                 searches.releaseNode(results);
 
-                results = moveForward(node, key, index);
+                results = moveForward(node, key);
             }
         }
     }
 }
 
-//node must be published by parent
 template<typename T, int Threads>
 Contents* MultiwaySearchTree<T, Threads>::cleanLink(Node* node, Contents* contents){
     while(true){
-        nodeContents.publish(contents, 1);
-        
         Node* newLink = pushRight(contents->link, {KeyFlag::EMPTY, 0});
 
         if(newLink == contents->link){
-            nodeContents.release(1);
-            nodeKeys.release(1);
-            nodeChildren.release(1);
-
             return contents;
         }
         
-        nodeKeys.publish(contents->items, 1);
-        nodeChildren.publish(contents->children, 1);
-
-        Contents* update = newContents(contents->items, contents->children, newLink);
+        Contents* update = slice(contents, 0, contents->length, newLink);
         if(node->casContents(contents, update)){
             nodeContents.releaseNode(contents);
-            
-            nodeContents.release(1);
-            nodeKeys.release(1);
-            nodeChildren.release(1);
 
             return update;
         } else {
             nodeContents.releaseNode(update);
         }
 
-        nodeContents.release(1);
-        nodeKeys.release(1);
-        nodeChildren.release(1);
-
         contents = node->contents;
     }
 }
@@ -798,58 +810,38 @@ int compare(Key k1, Key k2){
         return -1;
     }
 
-    return k1.key - k2.key;
+    //Not a subtraction, it would overflow for keys far apart
+    return (k1.key > k2.key) - (k1.key < k2.key);
 }
 
-//node must be published by parent
 template<typename T, int Threads>
 void MultiwaySearchTree<T, Threads>::cleanNode(Key key, Node* node, Contents* contents, int index, Key leftBarrier){
     while(true){
-        nodeContents.publish(contents, 1);
-        nodeKeys.publish(contents->items, 1);
-        nodeChildren.publish(contents->children, 1);
-
-        int length = contents->items->length;
+        int length = contents->length;
 
         if(length == 0){
             return;
         } else if(length == 1){
             if(cleanNode1(node, contents, leftBarrier)){
-                nodeContents.release(1);
-                nodeKeys.release(1);
-                nodeChildren.release(1);
-
                 //Note : It is not interesting to remove contents[0] here
 
                 return;
             }
         } else if(length == 2){
             if(cleanNode2(node, contents, leftBarrier)){
-                nodeContents.release(1);
-                nodeKeys.release(1);
-                nodeChildren.release(1);
                 return;
             }
         } else {
             if(cleanNodeN(node, contents, index, leftBarrier)){
-                nodeContents.release(1);
-                nodeKeys.release(1);
-                nodeChildren.release(1);
                 return;
             }
         }
 
         contents = node->contents;
-        nodeContents.publish(contents, 1);
-        nodeKeys.publish(contents->items, 1);
-        nodeChildren.publish(contents->children, 1);
         
-        index = search(contents->items, key);
+        index = search(contents, key);
 
-        if(-index - 1 == contents->items->length){
-            nodeContents.release(1);
-            nodeKeys.release(1);
-            nodeChildren.release(1);
+        if(-index - 1 == contents->length){
             return;
         } else if(index < 0){
             index = -index -1;
@@ -857,10 +849,6 @@ void MultiwaySearchTree<T, Threads>::cleanNode(Key key, Node* node, Contents* co
     }
 }
 
-//node must be published by parent
-//contents must be published
-//contents->items must be published
-//contents->children must be published
 template<typename T, int Threads>
 bool MultiwaySearchTree<T, Threads>::cleanNode1(Node* node, Contents* contents, Key leftBarrier){
     bool success = attemptSlideKey(node, contents);
@@ -869,13 +857,13 @@ bool MultiwaySearchTree<T, Threads>::cleanNode1(Node* node, Contents* contents,
         return true;
     }
 
-    Key key = (*contents->items)[0];
+    Key key = contents->key(0);
 
     if(leftBarrier.flag != KeyFlag::EMPTY && compare(key, leftBarrier) <= 0){
         leftBarrier = {KeyFlag::EMPTY, 0};
     }
 
-    Node* childNode = (*contents->children)[0];
+    Node* childNode = contents->children()[0];
     Node* adjustedChild = pushRight(childNode, leftBarrier);
 
     if(adjustedChild == childNode){
@@ -886,10 +874,6 @@ bool MultiwaySearchTree<T, Threads>::cleanNode1(Node* node, Contents* contents,
     return shiftChild(node, contents, 0, adjustedChild);
 }
 
-//node must be published by parent
-//contents must be published by parent
-//contents->items must be published
-//contents->children must be published
 template<typename T, int Threads>
 bool MultiwaySearchTree<T, Threads>::cleanNode2(Node* node, Contents* contents, Key leftBarrier){
     bool success = attemptSlideKey(node, contents);
@@ -898,16 +882,16 @@ bool MultiwaySearchTree<T, Threads>::cleanNode2(Node* node, Contents* contents,
         return true;
     }
 
-    Key key = (*contents->items)[0];
+    Key key = contents->key(0);
 
     if(leftBarrier.flag != KeyFlag::EMPTY && compare(key, leftBarrier) <= 0){
         leftBarrier = {KeyFlag::EMPTY, 0};
     }
 
-    Node* childNode1 = (*contents->children)[0];
+    Node* childNode1 = contents->children()[0];
     Node* adjustedChild1 = pushRight(childNode1, leftBarrier);
-    leftBarrier = (*contents->items)[0];
-    Node* childNode2 = (*contents->children)[1];
+    leftBarrier = contents->key(0);
+    Node* childNode2 = contents->children()[1];
     Node* adjustedChild2 = pushRight(childNode2, leftBarrier);
 
     if((adjustedChild1 == childNode1) && (adjustedChild2 == childNode2)){
@@ -918,24 +902,20 @@ bool MultiwaySearchTree<T, Threads>::cleanNode2(Node* node, Contents* contents,
     return shiftChildren(node, contents, adjustedChild1, adjustedChild2);
 }
 
-//node must be published by parent
-//contents must be published by parent
-//contents->items must be published
-//contents->children must be published
 template<typename T, int Threads>
 bool MultiwaySearchTree<T, Threads>::cleanNodeN(Node* node, Contents* contents, int index, Key leftBarrier){
-    Key key0 = (*contents->items)[0];
+    Key key0 = contents->key(0);
 
     if(index > 0){
-        leftBarrier = (*contents->items)[index - 1];
+        leftBarrier = contents->key(index - 1);
     } else if(leftBarrier.flag != KeyFlag::EMPTY && compare(key0, leftBarrier) <= 0){
         leftBarrier = {KeyFlag::EMPTY, 0};
     }
 
-    Node* childNode = (*contents->children)[index];
+    Node* childNode = contents->children()[index];
     Node* adjustedChild = pushRight(childNode, leftBarrier);
 
-    if(index == 0 || index == contents->children->length - 1){
+    if(index == 0 || index == contents->length - 1){
         if(adjustedChild == childNode){
             return true;
         }
@@ -944,7 +924,7 @@ bool MultiwaySearchTree<T, Threads>::cleanNodeN(Node* node, Contents* contents,
         return shiftChild(node, contents, index, adjustedChild);
     }
 
-    Node* adjustedNeighbor = pushRight((*contents->children)[index + 1], (*contents->items)[index]);
+    Node* adjustedNeighbor = pushRight(contents->children()[index + 1], contents->key(index));
 
     if(adjustedNeighbor == adjustedChild){
         return dropChild(node, contents, index, adjustedChild);
@@ -958,24 +938,15 @@ bool MultiwaySearchTree<T, Threads>::cleanNodeN(Node* node, Contents* contents,
 template<typename T, int Threads>
 Node* MultiwaySearchTree<T, Threads>::pushRight(Node* node, Key leftBarrier){
     while(true){
-        nodes.publish(node, 0);
-
         Contents* contents = node->contents;
-        nodeContents.publish(contents, 2);
-        nodeKeys.publish(contents->items, 2);
 
-        int length = contents->items->length;
+        int length = contents->length;
 
         if(length == 0){
             //It is a good idea to release contents->link afterward
             node = contents->link;
             trash[thread_num].push_back(node);
-        } else if(leftBarrier.flag == KeyFlag::EMPTY || compare((*contents->items)[length - 1], leftBarrier) > 0){
-            nodeContents.release(2);
-            nodeKeys.release(2);
-
-            nodes.release(0);
-
+        } else if(leftBarrier.flag == KeyFlag::EMPTY || compare(contents->key(length - 1), leftBarrier) > 0){
             return node;
         } else {
             node = contents->link;
@@ -1006,284 +977,198 @@ unsigned int MultiwaySearchTree<T, Threads>::randomLevel(){
     return (level - 1);
 }
 
-//The Contents containing items should have been published
-//items should have been published
-int search(Keys* items, Key key){
+/*!
+ * Return the number of keys smaller than key among the count sorted keys. A large node is first
+ * narrowed down to searchWindow keys by a binary search, the window is then scanned several keys
+ * at a time (8 with AVX2, 4 with SSE2).
+ */
+static inline int rank(const int* keys, int count, int key){
     int low = 0;
-    int high = items->length - 1;
+    int high = count;
 
-    if(low > high){
-        return -1;
-    }
-
-    if((*items)[high].flag == KeyFlag::INF){
-        high--;
-    }
-
-    while(low <= high){
+    while(high - low > searchWindow){
         int mid = (low + high) >> 1;
-        Key midVal = (*items)[mid];
 
-        int cmp = compare(key, midVal);
-        if(cmp > 0){
+        if(keys[mid] < key){
             low = mid + 1;
-        } else if(cmp < 0){
-            high = mid - 1;
         } else {
-            return mid;
+            high = mid;
         }
     }
     
-    return -(low + 1); //not found
-}
+#if defined(__AVX2__)
+    const __m256i k = _mm256_set1_epi32(key);
 
-//The Contents containing items should have been published
-//items should have been published
-int searchWithHint(Keys* items, Key key, int hint){
-    int low = 0;
-    int mid = hint;
-    int high = items->length - 1;
+    for(; low + 8 <= high; low += 8){
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + low));
+        int smaller = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, v)));
 
-    if(low > high){
-        return -1;
+        if(smaller != 0xFF){
+            return low + __builtin_ctz(~smaller);
+        }
     }
+#elif defined(__SSE2__)
+    const __m128i k = _mm_set1_epi32(key);
+
+    for(; low + 4 <= high; low += 4){
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + low));
+        int smaller = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, v)));
 
-    if((*items)[high].flag == KeyFlag::INF){
-        high--;
+        if(smaller != 0xF){
+            return low + __builtin_ctz(~smaller);
+        }
     }
+#endif
 
-    if(mid > high){
-        mid = (low + high) >> 1;
+    while(low < high && keys[low] < key){
+        ++low;
     }
 
-    while(low <= high){
-        Key midVal = (*items)[mid];
+    return low;
+}
 
-        int cmp = compare(key, midVal);
-        if(cmp > 0){
-            low = mid + 1;
-        } else if(cmp < 0){
-            high = mid - 1;
-        } else {
-            return mid;
-        }
+int search(Contents* contents, Key key){
+    //The +∞ key is never found
+    int length = contents->length - contents->infinite;
 
-        mid = (low + high) >> 1;
+    if(key.flag == KeyFlag::INF){
+        return -(length + 1);
     }
-    
-    return -(low + 1); //not found
+
+    int index = rank(contents->keys, length, key.key);
+
+    if(index < length && contents->keys[index] == key.key){
+        return index;
+    }
+
+    return -(index + 1); //not found
 }
 
 template<typename T, int Threads>
 HeadNode* MultiwaySearchTree<T, Threads>::increaseRootHeight(int target){
     HeadNode* root = this->root;
-    roots.publish(root, 0);
-    nodes.publish(root->node, 0);
 
     int height = root->height;
 
     while(height < target){
-        Keys* keys = newKeys(1);
-        (*keys)[0].flag = KeyFlag::INF;
+        Contents* contents = newContents(1, false, nullptr);
+        contents->keys[0] = 0;
+        contents->infinite = true;
+        contents->children()[0] = root->node;
 
-        Children* children = newChildren(1); 
-        (*children)[0] = root->node;
-        
-        Contents* contents = newContents(keys, children, nullptr);
         Node* newHeadNodeNode = newNode(contents);
         HeadNode* update = newHeadNode(newHeadNodeNode, height + 1);
         
         if(CASPTR(&this->root, root, update)){
             roots.releaseNode(root);
         } else {
-            nodeChildren.releaseNode(children);
-            nodeKeys.releaseNode(keys);
             nodeContents.releaseNode(contents);
             nodes.releaseNode(newHeadNodeNode);
             roots.releaseNode(update);
         }
 
         root = this->root;
-        roots.publish(root, 0);
-        nodes.publish(root->node, 0);
 
         height = root->height;
     }
 
-    roots.release(0);
-    nodes.release(0);
-
     return root;
 }
 
-//node must be published by parent as 0
 template<typename T, int Threads>
-Search* MultiwaySearchTree<T, Threads>::moveForward(Node* node, Key key, int hint){
+Search* MultiwaySearchTree<T, Threads>::moveForward(Node* node, Key key){
     while(true){
         Contents* contents = node->contents;
-        nodeContents.publish(contents, 1);
-        nodeKeys.publish(contents->items, 1);
-
-        int index = searchWithHint(contents->items, key, hint);
-        if(index > -contents->items->length - 1){
-            nodeContents.release(1);
-            nodeKeys.release(1);
 
+        int index = search(contents, key);
+        if(index > -contents->length - 1){
             return newSearch(node, contents, index);
         } else {
             node = contents->link;
-
-            //erase the reference of the parent
-            nodes.publish(node, 0);
         }
     }
 }
 
-//node must be published by parent
-//contents must be published by parent
-//contents->items must be published
-//contents->children must be published
 template<typename T, int Threads>
 bool MultiwaySearchTree<T, Threads>::shiftChild(Node* node, Contents* contents, int index, Node* adjustedChild){
-    Children* children = copyChildren(contents->children);
-    (*children)[index] = adjustedChild;
+    Contents* update = slice(contents, 0, contents->length, contents->link);
+    update->children()[index] = adjustedChild;
 
-    Contents* update = newContents(contents->items, children, contents->link);
     if(node->casContents(contents, update)){
         nodeContents.releaseNode(contents);
-        nodeChildren.releaseNode(contents->children);
 
         return true;
     } else {
-        nodeChildren.releaseNode(children);
         nodeContents.releaseNode(update);
 
         return false;
     }
 }
 
-//node must be published by parent
-//contents must be published by parent
-//contents->items must be published
-//contents->children must be published
 template<typename T, int Threads>
 bool MultiwaySearchTree<T, Threads>::shiftChildren(Node* node, Contents* contents, Node* child1, Node* child2){
-    Children* children = newChildren(2);
-    (*children)[0] = child1;
-    (*children)[1] = child2;
+    Contents* update = slice(contents, 0, contents->length, contents->link);
+    update->children()[0] = child1;
+    update->children()[1] = child2;
 
-    Contents* update = newContents(contents->items, children, contents->link);
     if(node->casContents(contents, update)){
         nodeContents.releaseNode(contents);
-        nodeChildren.releaseNode(contents->children);
 
         return true;
     } else {
-        nodeChildren.releaseNode(children);
         nodeContents.releaseNode(update);
 
         return false;
     }
 }
 
-//node must be published by parent
-//contents must be published by parent
-//contents->children must be published
-//contents->item must be published
 template<typename T, int Threads>
 bool MultiwaySearchTree<T, Threads>::dropChild(Node* node, Contents* contents, int index, Node* adjustedChild){
-    int length = contents->items->length;
+    //The key index goes with the child index + 1, whose keys the adjusted child now covers
+    Contents* update = removeItem(contents, index, index + 1);
+    update->children()[index] = adjustedChild;
 
-    Keys* keys = newKeys(length - 1);
-    Children* children = newChildren(length - 1);
-
-    for(int i = 0; i < index; ++i){
-        (*keys)[i] = (*contents->items)[i];
-        (*children)[i] = (*contents->children)[i];
-    }
-    
-    (*children)[index] = adjustedChild;
-
-    for(int i = index + 1; i < length; ++i){
-        (*keys)[i - 1] = (*contents->items)[i];
-    }
-    
-    for(int i = index + 2; i < length; ++i){
-        (*children)[i - 1] = (*contents->children)[i];
-    }
-
-    Contents* update = newContents(keys, children, contents->link);
     if(node->casContents(contents, update)){
         nodeContents.releaseNode(contents);
-        nodeChildren.releaseNode(contents->children);
-        nodeKeys.releaseNode(contents->items);
 
         return true;
     } else {
-        nodeChildren.releaseNode(children);
-        nodeKeys.releaseNode(keys);
         nodeContents.releaseNode(update);
 
         return false;
     }
 }
 
-//node must be published by parent
-//contents is published by parent
-//contents->items is published
-//contents->children is published
 template<typename T, int Threads>
 bool MultiwaySearchTree<T, Threads>::attemptSlideKey(Node* node, Contents* contents){
     if(!contents->link){
         return false;
     }
 
-    int length = contents->items->length;
-    Key kkey = (*contents->items)[length - 1];
+    int length = contents->length;
+    Key kkey = contents->key(length - 1);
     
-    Node* child = (*contents->children)[length - 1];
-    nodes.publish(child, 2);
+    Node* child = contents->children()[length - 1];
     
     Node* sibling = pushRight(contents->link, {KeyFlag::EMPTY, 0});
-    nodes.publish(sibling, 3);
     
+    //Not in 2, which pushRight overwrites
     Contents* siblingContents = sibling->contents;
-    nodeContents.publish(siblingContents, 2);
-    nodeKeys.publish(siblingContents->items, 2);
-    nodeChildren.publish(siblingContents->children, 2);
 
     Node* nephew = nullptr;
-    if(siblingContents->children->length == 0){
-        nodeContents.release(2);
-        nodeKeys.release(2);
-        nodeChildren.release(2);
-
-        nodes.release(2);
-        nodes.release(3);
-
+    if(siblingContents->length == 0){
         return false;
     } else {
-        nephew = (*siblingContents->children)[0];
-        nodes.publish(nephew, 1);
+        nephew = siblingContents->children()[0];
     }
 
-    if(compare((*siblingContents->items)[0], kkey) > 0){
+    if(compare(siblingContents->key(0), kkey) > 0){
         nephew = pushRight(nephew, kkey);
-        nodes.publish(nephew, 1);
     } else {
         nephew = pushRight(nephew, {KeyFlag::EMPTY, 0});
-        nodes.publish(nephew, 1);
     }
 
     if(nephew != child){
-        nodeContents.release(2);
-        nodeKeys.release(2);
-        nodeChildren.release(2);
-        
-        nodes.release(1);
-        nodes.release(2);
-        nodes.release(3);
-
         return false;
     }
 
@@ -1294,76 +1179,46 @@ bool MultiwaySearchTree<T, Threads>::attemptSlideKey(Node* node, Contents* conte
 
     //Note: oldNephew cannot be released here
     //Note: oldLink  cannot be released here
-    
-    nodeContents.release(2);
-    nodeKeys.release(2);
-    nodeChildren.release(2);
-
-    nodes.release(1);
-    nodes.release(2);
-    nodes.release(3);
 
     return true;
 }
 
-//sibling must be published by parent
-//sibContents is published by parent
-//sibContents->items is published
-//sibContents->children is published
 template<typename T, int Threads>
 bool MultiwaySearchTree<T, Threads>::slideToNeighbor(Node* sibling, Contents* sibContents, Key kkey, Key key, Node* child){
-    int index = search(sibContents->items, key);
+    int index = search(sibContents, key);
     if(index >= 0){
         return true;
     } else if(index < -1){
         return false;
     }
 
-    Keys* keys = generateNewItems(kkey, sibContents->items, 0);
-    Children* children = generateNewChildren(child, sibContents->children, 0);
-
-    Contents* update = newContents(keys, children, sibContents->link);
+    Contents* update = insertItem(sibContents, 0, kkey, 0, child);
     if(sibling->casContents(sibContents, update)){
         nodeContents.releaseNode(sibContents);
-        nodeKeys.releaseNode(sibContents->items);
-        nodeChildren.releaseNode(sibContents->children);
 
         return true;
     } else {
-        nodeKeys.releaseNode(keys);
-        nodeChildren.releaseNode(children);
         nodeContents.releaseNode(update);
 
         return false;
     }
 }
 
-//node must be published by parent
-//contents is published
-//contents->items is published
-//contents->children is published
 template<typename T, int Threads>
 Contents* MultiwaySearchTree<T, Threads>::deleteSlidedKey(Node* node, Contents* contents, Key key){
-    int index = search(contents->items, key);
+    int index = search(contents, key);
     if(index < 0){
         return contents;
     }
 
-    Keys* keys = removeSingleItem(contents->items, index);
-    Children* children = removeSingleItem(contents->children, index);
-
-    Contents* update = newContents(keys, children, contents->link);
+    Contents* update = removeItem(contents, index, index);
     if(node->casContents(contents, update)){
         nodeContents.releaseNode(contents);
-        nodeChildren.releaseNode(contents->children);
-        nodeKeys.releaseNode(contents->items);
 
-        //contents->children[index] cannot be released here
+        //contents->children()[index] cannot be released here
 
         return update;
     } else {
-        nodeKeys.releaseNode(keys);
-        nodeChildren.releaseNode(children);
         nodeContents.releaseNode(update);
 
         return contents;
@@ -1373,62 +1228,37 @@ Contents* MultiwaySearchTree<T, Threads>::deleteSlidedKey(Node* node, Contents*
 template<typename T, int Threads>
 Search* MultiwaySearchTree<T, Threads>::goodSamaritanCleanNeighbor(Key key, Search* results){
     Node* node = results->node;
-    nodes.publish(node, 1);
     
     Contents* contents = results->contents;
-    nodeContents.publish(contents, 2);
-
-    if(!contents->link || !contents->items || !contents->items){ //That's ugly
-        nodeContents.release(2);
-        nodes.release(1);
 
+    if(!contents->link){
         return results;
     }
     
-    nodeKeys.publish(contents->items, 2);
-    nodeChildren.publish(contents->children, 2);
-
-    int length = contents->items->length;
-    Key leftBarrier = (*contents->items)[length - 1];
-    Node* child = (*contents->children)[length - 1];
-    nodes.publish(child, 2);
+    int length = contents->length;
+    Key leftBarrier = contents->key(length - 1);
+    Node* child = contents->children()[length - 1];
     
     Node* sibling = pushRight(contents->link, {KeyFlag::EMPTY, 0});
-    nodes.publish(sibling, 3);
 
     Contents* siblingContents = sibling->contents;
-    nodeContents.publish(siblingContents, 3);
-    nodeKeys.publish(siblingContents->items, 3);
-    nodeChildren.publish(siblingContents->children, 3);
 
     Node* nephew = nullptr;
     Node* adjustedNephew = nullptr;
 
-    if(siblingContents->children->length == 0){
+    if(siblingContents->length == 0){
         contents = cleanLink(node, node->contents);
-        int index = search(contents->items, key);
-        
-        nodeContents.release(3);
-        nodeKeys.release(3);
-        nodeChildren.release(3);
+        int index = search(contents, key);
 
-        nodes.release(1);
-        nodes.release(2);
-        nodes.release(3);
-
-        //References 2 are released by the caller
         return newSearch(node, contents, index);
     } else {
-        nephew = (*siblingContents->children)[0];
-        nodes.publish(nephew, 4);
+        nephew = siblingContents->children()[0];
     }
 
-    if(compare((*siblingContents->items)[0], leftBarrier) > 0){
+    if(compare(siblingContents->key(0), leftBarrier) > 0){
         adjustedNephew = pushRight(nephew, leftBarrier);
-        nodes.publish(adjustedNephew, 5);
     } else {
         adjustedNephew = pushRight(nephew, {KeyFlag::EMPTY, 0});
-        nodes.publish(adjustedNephew, 5);
     }
 
     if(nephew != child){
@@ -1439,39 +1269,12 @@ Search* MultiwaySearchTree<T, Threads>::goodSamaritanCleanNeighbor(Key key, Sear
         bool success = slideToNeighbor(sibling, siblingContents, leftBarrier, leftBarrier, child);
         if(success){
             contents = deleteSlidedKey(node, contents, leftBarrier);
-            nodeContents.publish(contents, 2);
-            nodeKeys.publish(contents->items, 2);
-            nodeChildren.publish(contents->children, 2);
-            
-            int index = search(contents->items, key);
             
-            nodeContents.release(3);
-            nodeKeys.release(3);
-            nodeChildren.release(3);
-        
-            nodes.release(1);
-            nodes.release(2);
-            nodes.release(3);
-            nodes.release(4);
-            nodes.release(5);
-            
-            //References 2 are released by the caller
+            int index = search(contents, key);
+
             return newSearch(node, contents, index);
         }
     }
-    
-    nodeContents.release(2);
-    nodeKeys.release(2);
-    nodeChildren.release(2);
-    nodeContents.release(3);
-    nodeKeys.release(3);
-    nodeChildren.release(3);
-        
-    nodes.release(1);
-    nodes.release(2);
-    nodes.release(3);
-    nodes.release(4);
-    nodes.release(5);
 
     return results;
 }
@@ -1482,33 +1285,19 @@ Node* MultiwaySearchTree<T, Threads>::splitOneLevel(Key key, Search* results){
 
     while(true){
         Node* node = results->node;
-        nodes.publish(node, 0);
         
         Contents* contents = results->contents;
-        nodeContents.publish(contents, 0);
-        nodeKeys.publish(contents->items, 0);
-        nodeChildren.publish(contents->children, 0);
         
         int index = results->index;
-        int length = contents->items->length;
+        int length = contents->length;
 
         if(index < 0){
-            nodeContents.release(0);
-            nodeKeys.release(0);
-            nodeChildren.release(0);
-            nodes.release(0);
-
             if(results != entry_results){
                 searches.releaseNode(results);
             }
             
             return nullptr;
         } else if(length < 2 || index == (length - 1)){
-            nodeContents.release(0);
-            nodeKeys.release(0);
-            nodeChildren.release(0);
-            nodes.release(0);
-
             if(results != entry_results){
                 searches.releaseNode(results);
             }
@@ -1516,24 +1305,12 @@ Node* MultiwaySearchTree<T, Threads>::splitOneLevel(Key key, Search* results){
             return nullptr;
         }
 
-        Keys* leftKeys = generateLeftItems(contents->items, index);
-        Keys* rightKeys = generateRightItems(contents->items, index);
-        Children* leftChildren = generateLeftChildren(contents->children, index);
-        Children* rightChildren = generateRightChildren(contents->children, index);
-        
-        Contents* rightContents = newContents(rightKeys, rightChildren, contents->link);
+        Contents* rightContents = slice(contents, index + 1, length, contents->link);
         Node* right = newNode(rightContents);
-        Contents* left = newContents(leftKeys, leftChildren, right);
+        Contents* left = slice(contents, 0, index + 1, right);
 
         if(node->casContents(contents, left)){
             nodeContents.releaseNode(contents);
-            nodeChildren.releaseNode(contents->children);
-            nodeKeys.releaseNode(contents->items);
-            
-            nodeContents.release(0);
-            nodeKeys.release(0);
-            nodeChildren.release(0);
-            nodes.release(0);
 
             if(results != entry_results){
                 searches.releaseNode(results);
@@ -1541,11 +1318,6 @@ Node* MultiwaySearchTree<T, Threads>::splitOneLevel(Key key, Search* results){
 
             return right;
         } else {
-            nodeKeys.releaseNode(leftKeys);
-            nodeKeys.releaseNode(rightKeys);
-            nodeChildren.releaseNode(leftChildren);
-            nodeChildren.releaseNode(rightChildren);
-
             nodeContents.releaseNode(rightContents);
             nodes.releaseNode(right);
             nodeContents.releaseNode(left);
@@ -1554,13 +1326,8 @@ Node* MultiwaySearchTree<T, Threads>::splitOneLevel(Key key, Search* results){
                 searches.releaseNode(results);
             }
 
-            results = moveForward(node, key, index);
+            results = moveForward(node, key);
         }
-        
-        nodeContents.release(0);
-        nodeKeys.release(0);
-        nodeChildren.release(0);
-        nodes.release(0);
     }
 }
 
@@ -1570,64 +1337,40 @@ char MultiwaySearchTree<T, Threads>::insertLeafLevel(Key key, Search* results, i
 
     while(true){
         Node* node = results->node;
-        nodes.publish(node, 0);
         
         Contents* contents = results->contents;
-        nodeContents.publish(contents, 0);
-        nodeChildren.publish(contents->children, 0);
-        
-        Keys* keys = contents->items;
-        nodeKeys.publish(keys, 0);
         
         int index = results->index;
 
         if(index >= 0){
-            nodes.release(0);
-            nodeContents.release(0);
-            nodeKeys.release(0);
-            nodeChildren.release(0);
-            
             searches.releaseNode(results);
 
             return false;
         } else {
             index = -index - 1;
 
-            if(keys->length != back_length || index >= back_length){
+            if(contents->length != back_length || index >= back_length){
+                searches.releaseNode(results);
+
                 return 2; //RETRY
             }
 
-            Keys* newKeys = generateNewItems(key, keys, index);
-            
-            Contents* update = newContents(newKeys, nullptr, contents->link);
+            Contents* update = insertItem(contents, index, key, 0, nullptr);
             if(node->casContents(contents, update)){
                 nodeContents.releaseNode(contents);
-                nodeChildren.releaseNode(contents->children);
-                nodeKeys.releaseNode(contents->items);
-                
-                nodes.release(0);
-                nodeContents.release(0);
-                nodeKeys.release(0);
-                nodeChildren.release(0);
-                
+
                 searches.releaseNode(results);
                 
                 return true;
             } else {
-                nodeKeys.releaseNode(newKeys);
                 nodeContents.releaseNode(update);
 
                 searches.releaseNode(results);
 
-                results = moveForward(node, key, index);
+                results = moveForward(node, key);
 
-                back_length = results->contents->items->length;
+                back_length = results->contents->length;
             }
-
-            nodes.release(0);
-            nodeContents.release(0);
-            nodeKeys.release(0);
-            nodeChildren.release(0);
         }
     }
 }
@@ -1638,22 +1381,12 @@ bool MultiwaySearchTree<T, Threads>::beginInsertOneLevel(Key key, Search** resul
 
     while(true){
         Node* node = results->node;
-        nodes.publish(node, 0);
         
         Contents* contents = results->contents;
-        nodeContents.publish(contents, 0);
-        nodeKeys.publish(contents->items, 0);
-        nodeChildren.publish(contents->children, 0);
 
         int index = results->index;
-        Keys* keys = contents->items;
 
         if(index >= 0){
-            nodeContents.release(0);
-            nodeKeys.release(0);
-            nodeChildren.release(0);
-            nodes.release(0);
-                
             //If we return false, the value in resultsStore will never be used
             searches.releaseNode(results);
             
@@ -1661,43 +1394,23 @@ bool MultiwaySearchTree<T, Threads>::beginInsertOneLevel(Key key, Search** resul
         } else {
             index = -index - 1;
 
-            Keys* newKeys = generateNewItems(key, keys, index);
-            
-            Contents* update = newContents(newKeys, nullptr, contents->link);
+            Contents* update = insertItem(contents, index, key, 0, nullptr);
+
             if(node->casContents(contents, update)){
                 nodeContents.releaseNode(contents);
-                nodeChildren.releaseNode(contents->children);
-                nodeKeys.releaseNode(contents->items);
-                
-                nodeContents.release(0);
-                nodeKeys.release(0);
-                nodeChildren.release(0);
-                nodes.release(0);
-                
+
                 searches.releaseNode(results);
-                
-                //Publish references to the contents contained in the Search
-                nodes.publish(node, FIRST);
-                nodeContents.publish(update, FIRST);
-                nodeKeys.publish(update->items, FIRST);
-                nodeChildren.publish(update->children, FIRST);
 
                 resultsStore[0] = newSearch(node, update, index);
 
                 return true;
             } else {
-                nodeKeys.releaseNode(newKeys);
                 nodeContents.releaseNode(update);
                 
                 searches.releaseNode(results);
                 
-                results = moveForward(node, key, index);
+                results = moveForward(node, key);
             }
-
-            nodeContents.release(0);
-            nodeKeys.release(0);
-            nodeChildren.release(0);
-            nodes.release(0);
         }
     }
 }
@@ -1713,12 +1426,8 @@ void MultiwaySearchTree<T, Threads>::insertOneLevel(Key key, Search** resultsSto
 
     while(true){
         Node* node = results->node;
-        nodes.publish(node, 0);
         
         Contents* contents = results->contents;
-        nodeContents.publish(contents, 0);
-        nodeKeys.publish(contents->items, 0);
-        nodeChildren.publish(contents->children, 0);
 
         int index = results->index;
 
@@ -1727,214 +1436,113 @@ void MultiwaySearchTree<T, Threads>::insertOneLevel(Key key, Search** resultsSto
                 searches.releaseNode(results);
             }
 
-            nodes.release(0);
-            nodeContents.release(0);
-            nodeKeys.release(0);
-            nodeChildren.release(0);
-
             return;
-        } else if(index > -contents->items->length - 1){
+        } else if(index > -contents->length - 1){
             index = -index -1;
 
-            Keys* newKeys = generateNewItems(key, contents->items, index);
-            Children* newChildren = generateNewChildren(child, contents->children, index + 1);
-            
-            Contents* update = newContents(newKeys, newChildren, contents->link);
+            Contents* update = insertItem(contents, index, key, index + 1, child);
+
             if(node->casContents(contents, update)){
                 if(results != entry_results){
                     searches.releaseNode(results);
                 }
 
                 nodeContents.releaseNode(contents);
-                nodeChildren.releaseNode(contents->children);
-                nodeKeys.releaseNode(contents->items);
-                
-                nodes.release(0);
-                nodeContents.release(0);
-                nodeKeys.release(0);
-                nodeChildren.release(0);
 
                 searches.releaseNode(resultsStore[target]);
-                
-                //Publish references to the contents contained in the Search
-                nodes.publish(node, FIRST + target);
-                nodeContents.publish(update, FIRST + target);
-                nodeKeys.publish(update->items, FIRST + target);
-                nodeChildren.publish(update->children, FIRST + target);
 
                 resultsStore[target] = newSearch(node, update, index);
                 
                 return;
             } else {
-                nodeKeys.releaseNode(newKeys);
-                nodeChildren.releaseNode(newChildren);
                 nodeContents.releaseNode(update);
             
                 if(results != entry_results){
                     searches.releaseNode(results);
                 }
                 
-                results = moveForward(node, key, index);
+                results = moveForward(node, key);
             }
         } else {
             if(results != entry_results){
                 searches.releaseNode(results);
             }
 
-            results = moveForward(node, key, -index - 1);
+            results = moveForward(node, key);
         }
-        
-        nodes.release(0);
-        nodeContents.release(0);
-        nodeKeys.release(0);
-        nodeChildren.release(0);
     }
 }
 
-/* Utility methods to manipulate arrays */
+/* Utility methods to build new contents */
 
+/*!
+ * Copy the keys in [begin, end) of the contents, with their children.
+ */
 template<typename T, int Threads>
-Children* MultiwaySearchTree<T, Threads>::copyChildren(Children* rhs){
-    Children* copy = newChildren(rhs->length);
+Contents* MultiwaySearchTree<T, Threads>::slice(Contents* contents, int begin, int end, Node* link){
+    Contents* slice = newContents(end - begin, contents->leaf, link);
     
-    for(int i = 0; i < copy->length; ++i){
-        (*copy)[i] = (*rhs)[i];
-    }
-
-    return copy;
-}
-
-template<typename T, int Threads>
-Keys* MultiwaySearchTree<T, Threads>::removeSingleItem(Keys* a, int index){
-    int length = a->length;
-    Keys* newArray = newKeys(length - 1);
-
-    for(int i = 0; i < index; ++i){
-        (*newArray)[i] = (*a)[i];
-    }
-
-    for(int i = index + 1; i < length; ++i){
-        (*newArray)[i - 1] = (*a)[i];
-    }
-
-    return newArray;
-}
-
-template<typename T, int Threads>
-Children* MultiwaySearchTree<T, Threads>::removeSingleItem(Children* a, int index){
-    int length = a->length;
-    Children* newArray = newChildren(length - 1);
-
-    for(int i = 0; i < index; ++i){
-        (*newArray)[i] = (*a)[i];
-    }
+    std::copy(contents->keys + begin, contents->keys + end, slice->keys);
+    slice->infinite = contents->infinite && end == contents->length;
 
-    for(int i = index + 1; i < length; ++i){
-        (*newArray)[i - 1] = (*a)[i];
+    if(!contents->leaf){
+        Node** children = contents->children();
+        std::copy(children + begin, children + end, slice->children());
     }
 
-    return newArray;
+    return slice;
 }
 
+/*!
+ * Copy the contents with the key inserted at index and, if not a leaf, the child at childIndex.
+ */
 template<typename T, int Threads>
-Keys* MultiwaySearchTree<T, Threads>::generateNewItems(Key key, Keys* items, int index){
-    if(!items){
-        return nullptr;
-    }
+Contents* MultiwaySearchTree<T, Threads>::insertItem(Contents* contents, int index, Key key, int childIndex, Node* child){
+    int length = contents->length;
+    Contents* update = newContents(length + 1, contents->leaf, contents->link);
 
-    int length = items->length;
-    Keys* newItems = newKeys(length + 1);
+    std::copy(contents->keys, contents->keys + index, update->keys);
+    update->keys[index] = key.key;
+    std::copy(contents->keys + index, contents->keys + length, update->keys + index + 1);
 
-    for(int i = 0; i < index; ++i){
-        (*newItems)[i] = (*items)[i];
-    }
-    (*newItems)[index] = key;
-    for(int i = index; i < length; i++){
-        (*newItems)[i + 1] = (*items)[i];
-    }
-    
-    return newItems;
-}
+    //The key is inserted before +∞, which stays the last one
+    update->infinite = contents->infinite;
 
-template<typename T, int Threads>
-Children* MultiwaySearchTree<T, Threads>::generateNewChildren(Node* child, Children* children, int index){
-    if(!children){
-        return nullptr;
-    }
-
-    int length = children->length;
-    Children* newItems = newChildren(length + 1);
-
-    for(int i = 0; i < index; i++){
-        (*newItems)[i] = (*children)[i];
-    }
-    (*newItems)[index] = child;
-    for(int i = index; i < length; i++){
-        (*newItems)[i + 1] = (*children)[i];
-    }
-    
-    return newItems;
-}
+    if(!contents->leaf){
+        Node** children = contents->children();
+        Node** newChildren = update->children();
 
-template<typename T, int Threads>
-Keys* MultiwaySearchTree<T, Threads>::generateLeftItems(Keys* items, int index){
-    if(!items){
-        return nullptr;
+        std::copy(children, children + childIndex, newChildren);
+        newChildren[childIndex] = child;
+        std::copy(children + childIndex, children + length, newChildren + childIndex + 1);
     }
 
-    Keys* newItems = newKeys(index + 1);
-    
-    for(int i = 0; i <= index; ++i){
-        (*newItems)[i] = (*items)[i];
-    }
-    
-    return newItems;
+    return update;
 }
 
+/*!
+ * Copy the contents without the key at index and, if not a leaf, without the child at childIndex.
+ */
 template<typename T, int Threads>
-Keys* MultiwaySearchTree<T, Threads>::generateRightItems(Keys* items, int index){
-    if(!items){
-        return nullptr;
-    }
+Contents* MultiwaySearchTree<T, Threads>::removeItem(Contents* contents, int index, int childIndex){
+    int length = contents->length;
+    Contents* update = newContents(length - 1, contents->leaf, contents->link);
 
-    int length = items->length;
-    Keys* newItems = newKeys(length - index - 1);
+    std::copy(contents->keys, contents->keys + index, update->keys);
+    std::copy(contents->keys + index + 1, contents->keys + length, update->keys + index);
 
-    for(int i = 0, j = index + 1; j < length; ++i, ++j){
-        (*newItems)[i] = (*items)[j];
-    }
+    //+∞ is never removed
+    update->infinite = contents->infinite;
 
-    return newItems;
-}
-template<typename T, int Threads>
-Children* MultiwaySearchTree<T, Threads>::generateLeftChildren(Children* children, int index){
-    if(!children){
-        return nullptr;
-    }
+    if(!contents->leaf){
+        Node** children = contents->children();
+        Node** newChildren = update->children();
 
-    Children* newItems = newChildren(index + 1);
-    
-    for(int i = 0; i <= index; ++i){
-        (*newItems)[i] = (*children)[i];
-    }
-    
-    return newItems;
-}
-
-template<typename T, int Threads>
-Children* MultiwaySearchTree<T, Threads>::generateRightChildren(Children* children, int index){
-    if(!children){
-        return nullptr;
+        std::copy(children, children + childIndex, newChildren);
+        std::copy(children + childIndex + 1, children + length, newChildren + childIndex);
     }
 
-    int length = children->length;
-    Children* newItems = newChildren(length - index - 1);
-    
-    for(int i = 0, j = index + 1; j < length; ++i, ++j){
-        (*newItems)[i] = (*children)[j];
-    }
-    
-    return newItems;
+    return update;
 }
 
 } //end of lfmst
@@ -2,9 +2,12 @@
 #define NBBST_TREE
 
 #include <cassert>
+#include <vector>
+#include <thread>
 
-#include "hash.hpp"
+#include "Keys.hpp"
 #include "Utils.hpp"
+#include "EpochManager.hpp"
 
 namespace nbbst {
     
@@ -15,77 +18,123 @@ enum UpdateState {
     MARK  = 3
 };
 
-struct Node;
-
-struct Info;
-typedef Info* Update;
-
-struct Info {
-    Node* gp;               //Internal
-    Node* p;                //Internal
-    Node* newInternal;      //Internal
-    Node* l;                //Leaf
-    Update pupdate;
-
-    Info() : gp(nullptr), p(nullptr), newInternal(nullptr), l(nullptr), pupdate(nullptr) {}
-};
-
-typedef Info* Update; 
-
+template<typename Update>
 inline UpdateState getState(Update update){
    return static_cast<UpdateState>(reinterpret_cast<unsigned long>(update) & 3l);
 }
 
+template<typename Update>
 inline Update Unmark(Update info){
     return reinterpret_cast<Update>(reinterpret_cast<unsigned long>(info) & (~0l - 3));
 }
 
+template<typename Update>
 inline Update Mark(Update info, UpdateState state){
     return reinterpret_cast<Update>((reinterpret_cast<unsigned long>(info) & (~0l - 3)) | static_cast<unsigned int>(state));
 }
 
-struct Node {
-    bool internal;
-    int key;
-    
-    Update update;
-    Node* left;
-    Node* right;
-
-    Node() : internal(internal), key(key), update(nullptr), left(nullptr), right(nullptr) {};
-};
-
-struct SearchResult {
-    Node* gp;       //Internal
-    Node* p;        //Internal
-    Node* l;        //Leaf
-    Update pupdate;
-    Update gpupdate;
-
-    SearchResult() : gp(nullptr), p(nullptr), l(nullptr), pupdate(nullptr), gpupdate(nullptr) {}
-};
-
-template<typename T, int Threads>
+/*!
+ * Non-Blocking Binary Search Tree, the keys are in the leaves with their value. 
+ * The two sentinel leaves have keys greater than any other (∞1 < ∞2), so every value of K can be stored. 
+ * \param K The type of key. 
+ * \param Threads The number of threads, DynamicThreads to give it to the constructor. 
+ * \param V The type of value, no_value to use the tree as a set. 
+ * \param Compare The order of the keys, see key_compare. 
+ */
+template<typename K, int Threads, typename V = no_value, typename Compare = key_compare<K>>
 class NBBST {
     public:
-        NBBST();
+        typedef typename Compare::param_type Key;
+
+        /*!
+         * \param threads The number of threads using the tree, only to give with Threads = DynamicThreads.
+         */
+        explicit NBBST(unsigned int threads = Threads);
         ~NBBST();
 
-        bool contains(T value);
-        bool add(T value);
-        bool remove(T value);
+        bool contains(Key key);
+        bool add(Key key);
+        bool remove(Key key);
+
+        /*!
+         * Insert the key with the given value, if it is not already in the tree. 
+         * \return true if the key was inserted.
+         */
+        bool add(Key key, const V& value);
+
+        /*!
+         * Get the value of the given key. 
+         * \param value Set to the value of the key, if it is found. 
+         * \return true if the key is in the tree.
+         */
+        bool find(Key key, V& value);
+
+        /*!
+         * Collect the keys in [low, high] in ascending order, as one atomic snapshot of the tree. 
+         * \param low The smallest key to return. 
+         * \param high The largest key to return. 
+         * \param keys Filled with the keys, previous content is discarded. 
+         * \return The number of keys found. 
+         */
+        std::size_t range(Key low, Key high, std::vector<K>& keys);
 
     private:
-        void Search(int key, SearchResult* result);      
+        struct Info;
+        typedef Info* Update;
+
+        struct Node {
+            bool internal;
+            unsigned char infinite;     //0 for a key, 1 and 2 for the sentinels ∞1 and ∞2
+            K key;
+            V value;
+
+            Update update;
+            Node* left;
+            Node* right;
+
+            Node() : internal(false), infinite(0), key(), value(), update(nullptr), left(nullptr), right(nullptr) {};
+        };
+
+        struct Info {
+            Node* gp;               //Internal
+            Node* p;                //Internal
+            Node* newInternal;      //Internal
+            Node* l;                //Leaf
+            Update pupdate;
+
+            Info() : gp(nullptr), p(nullptr), newInternal(nullptr), l(nullptr), pupdate(nullptr) {}
+        };
+
+        struct SearchResult {
+            Node* gp;       //Internal
+            Node* p;        //Internal
+            Node* l;        //Leaf
+            Update pupdate;
+            Update gpupdate;
+
+            SearchResult() : gp(nullptr), p(nullptr), l(nullptr), pupdate(nullptr), gpupdate(nullptr) {}
+        };
+
+        /* Order of the keys, with the sentinels above all of them */
+        static bool less(Key key, const Node* node);
+        static bool less(const Node* lhs, const Node* rhs);
+        static bool holds(const Node* leaf, Key key);
+
+        void Search(Key key, SearchResult* result);      
         void HelpInsert(Info* op);
         bool HelpDelete(Info* op);
         void HelpMarked(Info* op);
         void Help(Update u);
-        void CASChild(Node* parent, Node* old, Node* newNode);
+        bool CASChild(Node* parent, Node* old, Node* newNode);
 
-        /* Allocate stuff from the hazard manager  */
-        Node* newInternal(int key);
-        Node* newLeaf(int key);
+        /* Range queries */
+        unsigned long changesSnapshot(bool* pending);
+        void collect(Key low, Key high, std::vector<K>& keys);
+
+        /* Allocate stuff from the epoch managers  */
+        Node* newInternal(const Node* bound);
+        Node* newLeaf(Key key, const V& value);
+        Node* newSentinel(bool internal, unsigned char infinite);
         Info* newIInfo(Node* p, Node* newInternal, Node* l);
         Info* newDInfo(Node* gp, Node* p, Node* l, Update pupdate);
         
@@ -94,49 +143,158 @@ class NBBST {
 
         Node* root;
 
-        HazardManager<Node, Threads, 3> nodes;
-        HazardManager<Info, Threads, 3> infos;
+        /* 
+         * A helper can still compare and swap against the nodes of an old Info, 
+         * so neither is reused before the operations that could hold it end 
+         */
+        EpochManager<Node, Threads> nodes;
+        EpochManager<Info, Threads> infos;
+
+        /* Brackets every operation in the epochs of both managers */
+        struct EpochScope {
+            NBBST* tree;
+
+            EpochScope(NBBST* tree);
+            ~EpochScope();
+        };
+
+        /* Odd while the thread is around a child CAS, updating while it is in add() or remove() */
+        struct Changes {
+            volatile unsigned long count;
+            volatile bool updating;
+
+            Changes() : count(0), updating(false) {}
+        };
+
+        PerThread<Changes, Threads> changes;
+
+        /* Range queries holding the updates back, see range() */
+        volatile int scanners;
+
+        /* Brackets add() and remove(), waits while a range query holds the updates back */
+        struct UpdateScope {
+            volatile bool& updating;
+
+            UpdateScope(NBBST* tree);
+            ~UpdateScope();
+        };
+
+        /* Failed walks before a range query holds the updates back */
+        static const int RANGE_RETRIES = 8;
 };
 
-template<typename T, int Threads>
-NBBST<T, Threads>::NBBST(){
-    root = newInternal(std::numeric_limits<int>::max());
-    root->update = Mark(nullptr, CLEAN);
+template<typename K, int Threads, typename V, typename Compare>
+NBBST<K, Threads, V, Compare>::NBBST(unsigned int threads) : nodes(threads), infos(threads), changes(threads), scanners(0) {
+    root = newSentinel(true, 2);
+    root->update = Mark(Update(nullptr), CLEAN);
 
-    root->left = newLeaf(std::numeric_limits<int>::min());
-    root->right = newLeaf(std::numeric_limits<int>::max());
+    root->left = newSentinel(false, 1);
+    root->right = newSentinel(false, 2);
 }
 
-template<typename T, int Threads>
-NBBST<T, Threads>::~NBBST(){
+/*
+ * The thread is published as updating before the flag is read, so either a range query holding 
+ * the updates back waits for this update or this update waits for it. Waiting before the update 
+ * starts, rather than before one of its CAS, leaves no helper holding a stale operation. 
+ */
+template<typename K, int Threads, typename V, typename Compare>
+NBBST<K, Threads, V, Compare>::UpdateScope::UpdateScope(NBBST* tree) : updating(tree->changes[thread_num].updating) {
+    while(true){
+        __atomic_store_n(&updating, true, __ATOMIC_SEQ_CST);
+
+        if(!__atomic_load_n(&tree->scanners, __ATOMIC_SEQ_CST)){
+            return;
+        }
+
+        __atomic_store_n(&updating, false, __ATOMIC_RELEASE);
+
+        while(tree->scanners){
+            std::this_thread::yield();
+        }
+    }
+}
+
+template<typename K, int Threads, typename V, typename Compare>
+NBBST<K, Threads, V, Compare>::UpdateScope::~UpdateScope(){
+    __atomic_store_n(&updating, false, __ATOMIC_RELEASE);
+}
+
+template<typename K, int Threads, typename V, typename Compare>
+NBBST<K, Threads, V, Compare>::EpochScope::EpochScope(NBBST* tree) : tree(tree) {
+    tree->nodes.enter();
+    tree->infos.enter();
+}
+
+template<typename K, int Threads, typename V, typename Compare>
+NBBST<K, Threads, V, Compare>::EpochScope::~EpochScope(){
+    tree->infos.leave();
+    tree->nodes.leave();
+}
+
+template<typename K, int Threads, typename V, typename Compare>
+NBBST<K, Threads, V, Compare>::~NBBST(){
     //Remove the three nodes created in the constructor
     releaseNode(root->left);
     releaseNode(root->right);
     releaseNode(root);
 }
 
-template<typename T, int Threads>
-Node* NBBST<T, Threads>::newInternal(int key){
+template<typename K, int Threads, typename V, typename Compare>
+inline bool NBBST<K, Threads, V, Compare>::less(Key key, const Node* node){
+    return node->infinite || Compare::less(key, node->key);
+}
+
+template<typename K, int Threads, typename V, typename Compare>
+inline bool NBBST<K, Threads, V, Compare>::less(const Node* lhs, const Node* rhs){
+    if(lhs->infinite || rhs->infinite){
+        return lhs->infinite < rhs->infinite;
+    }
+
+    return Compare::less(lhs->key, rhs->key);
+}
+
+template<typename K, int Threads, typename V, typename Compare>
+inline bool NBBST<K, Threads, V, Compare>::holds(const Node* leaf, Key key){
+    return !leaf->infinite && Compare::equal(leaf->key, key);
+}
+
+template<typename K, int Threads, typename V, typename Compare>
+typename NBBST<K, Threads, V, Compare>::Node* NBBST<K, Threads, V, Compare>::newInternal(const Node* bound){
     Node* node = nodes.getFreeNode();
 
     node->internal = true;
-    node->key = key;
+    node->infinite = bound->infinite;
+    node->key = bound->key;
 
     return node;
 }
 
-template<typename T, int Threads>
-Node* NBBST<T, Threads>::newLeaf(int key){
+template<typename K, int Threads, typename V, typename Compare>
+typename NBBST<K, Threads, V, Compare>::Node* NBBST<K, Threads, V, Compare>::newLeaf(Key key, const V& value){
     Node* node = nodes.getFreeNode();
 
     node->internal = false;
+    node->infinite = 0;
     node->key = key;
+    node->value = value;
+    node->update = nullptr;     //A recycled node still points to its last Info
+
+    return node;
+}
+
+template<typename K, int Threads, typename V, typename Compare>
+typename NBBST<K, Threads, V, Compare>::Node* NBBST<K, Threads, V, Compare>::newSentinel(bool internal, unsigned char infinite){
+    Node* node = nodes.getFreeNode();
+
+    node->internal = internal;
+    node->infinite = infinite;
+    node->update = nullptr;
 
     return node;
 }
         
-template<typename T, int Threads>
-Info* NBBST<T, Threads>::newIInfo(Node* p, Node* newInternal, Node* l){
+template<typename K, int Threads, typename V, typename Compare>
+typename NBBST<K, Threads, V, Compare>::Info* NBBST<K, Threads, V, Compare>::newIInfo(Node* p, Node* newInternal, Node* l){
     Info* info = infos.getFreeNode();
 
     info->p = p;
@@ -146,8 +304,8 @@ Info* NBBST<T, Threads>::newIInfo(Node* p, Node* newInternal, Node* l){
     return info;
 }
 
-template<typename T, int Threads>
-Info* NBBST<T, Threads>::newDInfo(Node* gp, Node* p, Node* l, Update pupdate){
+template<typename K, int Threads, typename V, typename Compare>
+typename NBBST<K, Threads, V, Compare>::Info* NBBST<K, Threads, V, Compare>::newDInfo(Node* gp, Node* p, Node* l, Update pupdate){
     Info* info = infos.getFreeNode();
 
     info->gp = gp;
@@ -158,8 +316,8 @@ Info* NBBST<T, Threads>::newDInfo(Node* gp, Node* p, Node* l, Update pupdate){
     return info;
 }
 
-template<typename T, int Threads>
-void NBBST<T, Threads>::releaseNode(Node* node){
+template<typename K, int Threads, typename V, typename Compare>
+void NBBST<K, Threads, V, Compare>::releaseNode(Node* node){
     if(node){
         if(node->update){
             infos.releaseNode(Unmark(node->update));
@@ -169,8 +327,8 @@ void NBBST<T, Threads>::releaseNode(Node* node){
     }
 }
 
-template<typename T, int Threads>
-void NBBST<T, Threads>::Search(int key, SearchResult* result){
+template<typename K, int Threads, typename V, typename Compare>
+void NBBST<K, Threads, V, Compare>::Search(Key key, SearchResult* result){
     Node* l = root;
 
     while(l->internal){
@@ -179,7 +337,10 @@ void NBBST<T, Threads>::Search(int key, SearchResult* result){
         result->gpupdate = result->pupdate;
         result->pupdate = result->p->update;
 
-        if(key < l->key){
+        //The update field must be read before the child
+        __asm__ __volatile__("" ::: "memory");
+
+        if(less(key, l)){
             l = result->p->left;
         } else {
             l = result->p->right;
@@ -189,37 +350,52 @@ void NBBST<T, Threads>::Search(int key, SearchResult* result){
     result->l = l;
 }
 
-template<typename T, int Threads>
-bool NBBST<T, Threads>::contains(T value){
-    int key = hash(value);
+template<typename K, int Threads, typename V, typename Compare>
+bool NBBST<K, Threads, V, Compare>::contains(Key key){
+    EpochScope scope(this);
+
+    SearchResult result;
+    Search(key, &result);
+
+    return holds(result.l, key);
+}
+
+template<typename K, int Threads, typename V, typename Compare>
+bool NBBST<K, Threads, V, Compare>::find(Key key, V& value){
+    EpochScope scope(this);
 
     SearchResult result;
     Search(key, &result);
 
-    return result.l->key == key;
+    //The value of a leaf never changes once it is in the tree
+    if(holds(result.l, key)){
+        value = result.l->value;
+
+        return true;
+    }
+
+    return false;
 }
 
-template<typename T, int Threads>
-bool NBBST<T, Threads>::add(T value){
-    int key = hash(value);
+template<typename K, int Threads, typename V, typename Compare>
+bool NBBST<K, Threads, V, Compare>::add(Key key){
+    return add(key, V());
+}
+
+template<typename K, int Threads, typename V, typename Compare>
+bool NBBST<K, Threads, V, Compare>::add(Key key, const V& value){
+    UpdateScope scope(this);
+    EpochScope epochScope(this);
 
-    Node* newNode = newLeaf(key);
+    Node* newNode = newLeaf(key, value);
 
     SearchResult search;
 
     while(true){
         Search(key, &search);
 
-        nodes.publish(search.l, 0);
-            
-        infos.publish(search.p->update, 0);
-        infos.publish(search.pupdate, 1);
-
-        if(search.l->key == key){
+        if(holds(search.l, key)){
             nodes.releaseNode(newNode);
-            nodes.releaseAll();
-            
-            infos.releaseAll();
 
             return false; //Key already in the set
         }
@@ -227,12 +403,15 @@ bool NBBST<T, Threads>::add(T value){
         if(getState(search.pupdate) != CLEAN){
             Help(search.pupdate);
         } else {
-            Node* newSibling = newLeaf(search.l->key);
-            Node* newInt = newInternal(std::max(key, search.l->key));
-            newInt->update = Mark(nullptr, CLEAN);
+            Node* newSibling = search.l->infinite ? newSentinel(false, search.l->infinite) : newLeaf(search.l->key, search.l->value);
+            bool smaller = less(newNode, newSibling);
+
+            //The internal node takes the larger key
+            Node* newInt = newInternal(smaller ? newSibling : newNode);
+            newInt->update = Mark(Update(nullptr), CLEAN);
             
             //Put the smaller child on the left
-            if(newNode->key <= newSibling->key){
+            if(smaller){
                 newInt->left = newNode;
                 newInt->right = newSibling;
             } else {
@@ -241,7 +420,6 @@ bool NBBST<T, Threads>::add(T value){
             }
 
             Info* op = newIInfo(search.p, newInt, search.l);
-            infos.publish(op, 2);
 
             Update result = search.p->update;
             if(CASPTR(&search.p->update, search.pupdate, Mark(op, IFLAG))){
@@ -250,18 +428,13 @@ bool NBBST<T, Threads>::add(T value){
                 if(search.pupdate){
                     infos.releaseNode(Unmark(search.pupdate));
                 }
-                
-                nodes.releaseAll();
-                infos.releaseAll();
 
                 return true;
             } else {
                 nodes.releaseNode(newInt);
                 nodes.releaseNode(newSibling);
-                nodes.releaseAll();
                 
                 infos.releaseNode(op);
-                infos.releaseAll();
 
                 Help(result);
             }
@@ -269,17 +442,17 @@ bool NBBST<T, Threads>::add(T value){
     }
 }
 
-template<typename T, int Threads>
-bool NBBST<T, Threads>::remove(T value){
-    int key = hash(value);
+template<typename K, int Threads, typename V, typename Compare>
+bool NBBST<K, Threads, V, Compare>::remove(Key key){
+    UpdateScope scope(this);
+    EpochScope epochScope(this);
 
     SearchResult search;
 
     while(true){
         Search(key, &search);
-        nodes.publish(search.l, 0);
         
-        if(search.l->key != key){
+        if(!holds(search.l, key)){
             return false;
         }
 
@@ -288,39 +461,28 @@ bool NBBST<T, Threads>::remove(T value){
         } else if(getState(search.pupdate) != CLEAN){
             Help(search.pupdate);
         } else {
-            infos.publish(search.gp->update, 0);
-            infos.publish(search.gpupdate, 1);
-
             Info* op = newDInfo(search.gp, search.p, search.l, search.pupdate);
-            infos.publish(op, 2);
 
             Update result = search.gp->update;
             if(CASPTR(&search.gp->update, search.gpupdate, Mark(op, DFLAG))){
                 if(search.gpupdate){
                     infos.releaseNode(Unmark(search.gpupdate));
                 }
-                
-                infos.releaseAll();
 
                 if(HelpDelete(op)){
-                    nodes.releaseAll();
-                    
                     return true;
                 }
             } else {
                 infos.releaseNode(op);
-                infos.releaseAll();
 
                 Help(result);
             }
         }
-        
-        nodes.releaseAll();
     }
 }
 
-template<typename T, int Threads>
-void NBBST<T, Threads>::Help(Update u){
+template<typename K, int Threads, typename V, typename Compare>
+void NBBST<K, Threads, V, Compare>::Help(Update u){
     if(getState(u) == IFLAG){
         HelpInsert(Unmark(u));
     } else if(getState(u) == MARK){
@@ -330,23 +492,14 @@ void NBBST<T, Threads>::Help(Update u){
     }
 }
 
-template<typename T, int Threads>
-void NBBST<T, Threads>::HelpInsert(Info* op){
-    infos.publish(op, 0);
-    infos.publish(op->p->update, 1);
-
+template<typename K, int Threads, typename V, typename Compare>
+void NBBST<K, Threads, V, Compare>::HelpInsert(Info* op){
     CASChild(op->p, op->l, op->newInternal);
     CASPTR(&op->p->update, Mark(op, IFLAG), Mark(op, CLEAN));
-
-    infos.releaseAll();
 }
 
-template<typename T, int Threads>
-bool NBBST<T, Threads>::HelpDelete(Info* op){
-    infos.publish(op->p->update, 0);
-    infos.publish(op->pupdate, 1);
-    infos.publish(op, 2);
-
+template<typename K, int Threads, typename V, typename Compare>
+bool NBBST<K, Threads, V, Compare>::HelpDelete(Info* op){
     Update result = op->p->update;
 
     //If we succeed
@@ -355,31 +508,25 @@ bool NBBST<T, Threads>::HelpDelete(Info* op){
             infos.releaseNode(Unmark(op->pupdate));
         }
 
-        nodes.releaseNode(op->l);
         HelpMarked(Unmark(op));
-        infos.releaseAll();
         
         return true;
     } 
     //if another has succeeded for us
     else if(getState(op->p->update) == MARK && Unmark(op->p->update) == Unmark(op)){
         HelpMarked(Unmark(op));
-        infos.releaseAll();
         return true;
     } else {
         Help(result);
 
-        infos.publish(op->gp->update, 0);
-        infos.publish(op, 1);
         CASPTR(&op->gp->update, Mark(op, DFLAG), Mark(op, CLEAN));
-        infos.releaseAll();
 
         return false;
     }
 }
 
-template<typename T, int Threads>
-void NBBST<T, Threads>::HelpMarked(Info* op){
+template<typename K, int Threads, typename V, typename Compare>
+void NBBST<K, Threads, V, Compare>::HelpMarked(Info* op){
     Node* other;
 
     if(op->p->right == op->l){
@@ -388,36 +535,149 @@ void NBBST<T, Threads>::HelpMarked(Info* op){
         other = op->p->right;
     }
 
-    CASChild(op->gp, op->p, other);
+    //The leaf goes with its parent, only the thread unlinking them releases it
+    if(CASChild(op->gp, op->p, other)){
+        nodes.releaseNode(op->l);
+    }
 
-    infos.publish(op->gp->update, 0);
-    infos.publish(op, 1);
     CASPTR(&op->gp->update, Mark(op, DFLAG), Mark(op, CLEAN));
-    infos.releaseAll();
 }
         
-template<typename T, int Threads>
-void NBBST<T, Threads>::CASChild(Node* parent, Node* old, Node* newNode){
-    nodes.publish(old, 0);
-    nodes.publish(newNode, 1);
-
-    if(newNode->key < parent->key){
-        nodes.publish(parent->left, 2);
-        if(CASPTR(&parent->left, old, newNode)){
-            if(old){
-                nodes.releaseNode(old);
-            }
-        }
+template<typename K, int Threads, typename V, typename Compare>
+bool NBBST<K, Threads, V, Compare>::CASChild(Node* parent, Node* old, Node* newNode){
+    bool done;
+
+    //The insertions and deletions take effect here, see range()
+    volatile unsigned long& count = changes[thread_num].count;
+    count = count + 1;      //Ordered by the CAS, which is a full barrier
+
+    if(less(newNode, parent)){
+        done = CASPTR(&parent->left, old, newNode);
     } else {
-        nodes.publish(parent->right, 2);
-        if(CASPTR(&parent->right, old, newNode)){
-            if(old){
-                nodes.releaseNode(old);
+        done = CASPTR(&parent->right, old, newNode);
+    }
+
+    __atomic_store_n(&count, count + 1, __ATOMIC_RELEASE);
+
+    if(done){
+        nodes.releaseNode(old);
+    }
+
+    return done;
+}
+
+/*
+ * Every insertion and deletion takes effect at a child CAS, and the 
+ * counter of the thread executing it is odd around it. A walk that 
+ * starts with all the counters even and finds them unchanged at its end 
+ * overlapped no update, so it saw a snapshot. A thread caught in the 
+ * middle can still execute its one CAS but cannot undo it, so two walks 
+ * in a row that find the same keys, with no counter moving from the 
+ * start of the first to the end of the second, agree with the tree at 
+ * the moment between them. 
+ * 
+ * Under steady updates the walks could fail forever, so after 
+ * RANGE_RETRIES of them the query raises scanners, waits for the 
+ * updates already started to end and walks once more while no update 
+ * can take effect. 
+ * 
+ * The query stays in one epoch, so none of the nodes it walks is 
+ * recycled before it returns. 
+ */
+template<typename K, int Threads, typename V, typename Compare>
+std::size_t NBBST<K, Threads, V, Compare>::range(Key low, Key high, std::vector<K>& keys){
+    EpochScope scope(this);
+
+    std::vector<K> last;
+    unsigned long start, end, lastStart = 0;
+    bool pending, ignore, haveLast = false;
+
+    for(int attempt = 0; ; ++attempt){
+        if(attempt == RANGE_RETRIES){
+            __sync_fetch_and_add(&scanners, 1);
+
+            for(unsigned int i = 0; i < changes.size(); ++i){
+                while(changes[i].updating){
+                    std::this_thread::yield();
+                }
             }
+
+            collect(low, high, keys);
+
+            __sync_fetch_and_sub(&scanners, 1);
+
+            return keys.size();
         }
+
+        start = changesSnapshot(&pending);
+        collect(low, high, keys);
+        end = changesSnapshot(&ignore);
+
+        if(start == end && (!pending || (haveLast && lastStart == start && keys == last))){
+            return keys.size();
+        }
+
+        last.swap(keys);
+        lastStart = start;
+        haveLast = true;
     }
+}
+
+template<typename K, int Threads, typename V, typename Compare>
+unsigned long NBBST<K, Threads, V, Compare>::changesSnapshot(bool* pending){
+    unsigned long sum = 0;
+
+    *pending = false;
+    __sync_synchronize();
+
+    for(unsigned int i = 0; i < changes.size(); ++i){
+        unsigned long count = changes[i].count;
+
+        *pending |= count & 1;
+        sum += count;
+    }
+
+    __sync_synchronize();
 
-    nodes.releaseAll();
+    return sum;
+}
+
+template<typename K, int Threads, typename V, typename Compare>
+void NBBST<K, Threads, V, Compare>::collect(Key low, Key high, std::vector<K>& keys){
+    std::vector<Node*> stack;
+
+    keys.clear();
+    stack.push_back(root);
+
+    while(!stack.empty()){
+        Node* node = stack.back();
+        stack.pop_back();
+
+        if(!node->internal){
+            //The two sentinel leaves are above any key
+            if(!node->infinite && !Compare::less(node->key, low) && !Compare::less(high, node->key)){
+                keys.push_back(node->key);
+            }
+        } else {
+            Node* left = node->left;
+            Node* right = node->right;
+
+            //Only sentinels on the right of a sentinel
+            if(node->infinite){
+                stack.push_back(left);
+                continue;
+            }
+
+            //Right first, so the left subtree is walked first
+            if(!Compare::less(high, node->key)){
+                stack.push_back(right);
+            }
+
+            if(Compare::less(low, node->key)){
+                stack.push_back(left);
+            }
+        }
+    }
 }
 
 } //end of nbbst
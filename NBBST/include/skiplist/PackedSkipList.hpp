@@ -0,0 +1,457 @@
+#ifndef PACKED_SKIP_LIST
+#define PACKED_SKIP_LIST
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <thread>
+
+#include "hash.hpp"
+#include "Utils.hpp"
+#include "HazardManager.hpp"
+#include "skiplist/Towers.hpp"
+
+namespace skiplist {
+
+static const int SpinCount = 100;
+
+/*!
+ * A node of the packed skip list: a sorted run of keys filling Lines cache lines, followed by its tower.
+ *
+ * The node holds the keys in [low, next[0]->low). The version is a sequence lock, odd while a
+ * writer holds the node: the keys are read without locking and the read is retried if the version
+ * changed meanwhile.
+ *
+ * \param Lines The number of cache lines of the header and the keys.
+ */
+template<unsigned int Lines>
+struct PackedNode {
+    static const unsigned int Keys = (Lines * 64 - 12) / sizeof(int);
+
+    volatile unsigned int version;
+    int low;                        //Never changes while the node is in the list
+    volatile bool marked;           //Being unlinked, set under the lock
+    volatile bool linked;           //Linked at every level of its tower
+    unsigned char topLevel;
+    unsigned char count;
+    int keys[Keys];
+    PackedNode* next[1];
+
+    static void* operator new(std::size_t size){
+        return operator new(size, 0);
+    }
+
+    static void* operator new(std::size_t size, int topLevel){
+        void* memory;
+        if(posix_memalign(&memory, 64, size + topLevel * sizeof(PackedNode*))){
+            throw std::bad_alloc();
+        }
+
+        return memory;
+    }
+
+    static void operator delete(void* node){
+        free(node);
+    }
+
+    static void operator delete(void* node, int){
+        free(node);
+    }
+};
+
+/*!
+ * A skip list whose bottom level is made of cache-line sized runs of keys, the towers only index
+ * the runs. A full node is split in two, an empty one is unlinked.
+ *
+ * Updates lock the node holding the key, the towers are linked and unlinked one level at a time,
+ * each time under the lock of the predecessor at that level (lazy skip list). A search does not
+ * lock anything.
+ *
+ * \param T The type of value.
+ * \param Threads The number of threads, DynamicThreads to give it to the constructor.
+ * \param Lines The number of cache lines of the keys of a node.
+ */
+template<typename T, int Threads, unsigned int Lines = 1>
+class PackedSkipList {
+    public:
+        /*!
+         * \param threads The number of threads using the list, only to give with Threads = DynamicThreads.
+         */
+        explicit PackedSkipList(unsigned int threads = Threads);
+        ~PackedSkipList();
+
+        bool add(T value);
+        bool remove(T value);
+        bool contains(T value);
+
+    private:
+        typedef PackedNode<Lines> Node;
+
+        Node* locate(int key, int level, bool strict);
+        static bool covers(Node* node, int key);
+        static unsigned int position(Node* node, int key);
+
+        void split(Node* node, unsigned int index, int key);
+        void link(Node* node, int level);
+        void unlink(Node* node, int level);
+
+        void lock(Node* node);
+        void unlock(Node* node);
+
+        void raise(int topLevel);
+        Node* newNode(int low, int topLevel);
+
+        Node* head;
+
+        volatile int top;       //Highest level a node has been linked at, the searches start there
+
+        //The nodes are created by the towers, the hazard manager only recycles them
+        HazardManager<Node, Threads, 2, 0> hazard;
+        Towers<Node, Threads> towers;
+
+        /* Verify the template parameters */
+        static_assert(Lines > 0 && Lines <= 16, "The keys of a node must fill between 1 and 16 cache lines");
+        static_assert(offsetof(Node, next) == Lines * 64, "The keys must end on a cache line boundary");
+};
+
+template<typename T, int Threads, unsigned int Lines>
+PackedSkipList<T, Threads, Lines>::PackedSkipList(unsigned int threads) : top(0), hazard(threads), towers(threads) {
+    //The head holds the smallest keys and is never unlinked
+    head = newNode(std::numeric_limits<int>::min(), MAX_LEVEL);
+    head->linked = true;
+}
+
+template<typename T, int Threads, unsigned int Lines>
+PackedSkipList<T, Threads, Lines>::~PackedSkipList(){
+    //The unlinked nodes are with the hazard manager, only the linked ones are left
+    Node* node = head;
+
+    while(node){
+        Node* next = node->next[0];
+        delete node;
+        node = next;
+    }
+}
+
+template<typename T, int Threads, unsigned int Lines>
+typename PackedSkipList<T, Threads, Lines>::Node* PackedSkipList<T, Threads, Lines>::newNode(int low, int topLevel){
+    Node* node = towers.newNode(topLevel, hazard.direct_free(thread_num));
+
+    //The version is kept from the previous use of the node, it only grows
+    node->low = low;
+    node->marked = false;
+    node->linked = false;
+    node->count = 0;
+
+    std::fill(node->next, node->next + topLevel + 1, nullptr);
+
+    return node;
+}
+
+template<typename T, int Threads, unsigned int Lines>
+void PackedSkipList<T, Threads, Lines>::raise(int topLevel){
+    int current = top;
+
+    while(topLevel > current && !CAS(&top, current, topLevel)){
+        current = top;
+    }
+}
+
+template<typename T, int Threads, unsigned int Lines>
+void PackedSkipList<T, Threads, Lines>::lock(Node* node){
+    int spins = 0;
+
+    while(true){
+        unsigned int version = node->version;
+
+        if(!(version & 1) && CAS(&node->version, version, version + 1)){
+            return;
+        }
+
+        if(++spins == SpinCount){
+            spins = 0;
+            std::this_thread::yield();
+        }
+    }
+}
+
+template<typename T, int Threads, unsigned int Lines>
+inline void PackedSkipList<T, Threads, Lines>::unlock(Node* node){
+    //The writes of the holder must be visible before the version
+    __asm__ __volatile__("" ::: "memory");
+
+    node->version = node->version + 1;
+}
+
+/*!
+ * Find the last node with a low bound below key (or equal to key unless strict) at the given level.
+ * The node is left published in the hazard pointer 0.
+ */
+template<typename T, int Threads, unsigned int Lines>
+typename PackedSkipList<T, Threads, Lines>::Node* PackedSkipList<T, Threads, Lines>::locate(int key, int level, bool strict){
+    Node* pred = nullptr;
+    Node* curr = nullptr;
+
+retry:
+    pred = head;
+
+    for(int l = std::max(static_cast<int>(top), level); l >= level; --l){
+        curr = pred->next[l];
+        hazard.publish(curr, 1);
+
+        //An unmarked predecessor still links curr, which cannot have been released
+        if(pred->next[l] != curr || pred->marked){
+            goto retry;
+        }
+
+        while(curr && (curr->low < key || (!strict && curr->low == key))){
+            pred = curr;
+            hazard.publish(pred, 0);
+
+            curr = pred->next[l];
+            hazard.publish(curr, 1);
+
+            if(pred->next[l] != curr || pred->marked){
+                goto retry;
+            }
+        }
+    }
+
+    return pred;
+}
+
+/*!
+ * Indicates if the key belongs to the node, only stable under the lock of the node.
+ */
+template<typename T, int Threads, unsigned int Lines>
+inline bool PackedSkipList<T, Threads, Lines>::covers(Node* node, int key){
+    Node* next = node->next[0];
+
+    return !next || key < next->low;
+}
+
+/*!
+ * Return the index of the first key of the node not smaller than key.
+ */
+template<typename T, int Threads, unsigned int Lines>
+inline unsigned int PackedSkipList<T, Threads, Lines>::position(Node* node, int key){
+    unsigned int count = node->count;
+    unsigned int index = 0;
+
+    while(index < count && node->keys[index] < key){
+        ++index;
+    }
+
+    return index;
+}
+
+template<typename T, int Threads, unsigned int Lines>
+bool PackedSkipList<T, Threads, Lines>::contains(T value){
+    int key = hash(value);
+
+    while(true){
+        Node* node = locate(key, 0, false);
+
+        unsigned int version;
+        bool found;
+        bool moved;
+
+        do {
+            version = node->version;
+
+            if(version & 1){
+                continue;
+            }
+
+            __asm__ __volatile__("" ::: "memory");
+
+            unsigned int index = position(node, key);
+            found = index < node->count && node->keys[index] == key;
+
+            //Split or unlinked since the search
+            Node* next = node->next[0];
+            moved = node->marked || (next && next->low <= key);
+
+            __asm__ __volatile__("" ::: "memory");
+        } while((version & 1) || node->version != version);
+
+        if(!moved){
+            hazard.releaseAll();
+
+            return found;
+        }
+    }
+}
+
+template<typename T, int Threads, unsigned int Lines>
+bool PackedSkipList<T, Threads, Lines>::add(T value){
+    int key = hash(value);
+
+    while(true){
+        Node* node = locate(key, 0, false);
+        lock(node);
+
+        if(node->marked || !covers(node, key)){
+            unlock(node);
+            continue;
+        }
+
+        unsigned int index = position(node, key);
+
+        if(index < node->count && node->keys[index] == key){
+            unlock(node);
+            hazard.releaseAll();
+
+            return false;
+        }
+
+        if(node->count < Node::Keys){
+            std::copy_backward(node->keys + index, node->keys + node->count, node->keys + node->count + 1);
+            node->keys[index] = key;
+            ++node->count;
+
+            unlock(node);
+        } else {
+            split(node, index, key);
+        }
+
+        hazard.releaseAll();
+
+        return true;
+    }
+}
+
+/*!
+ * Insert the key in the full and locked node by moving its larger half to a new node.
+ * The node is unlocked once the new node is linked at the bottom level.
+ */
+template<typename T, int Threads, unsigned int Lines>
+void PackedSkipList<T, Threads, Lines>::split(Node* node, unsigned int index, int key){
+    int keys[Node::Keys + 1];
+
+    std::copy(node->keys, node->keys + index, keys);
+    keys[index] = key;
+    std::copy(node->keys + index, node->keys + Node::Keys, keys + index + 1);
+
+    const unsigned int half = (Node::Keys + 1) / 2;
+
+    int topLevel = towers.randomLevel();
+    raise(topLevel);
+
+    Node* right = newNode(keys[half], topLevel);
+    std::copy(keys + half, keys + Node::Keys + 1, right->keys);
+    right->count = Node::Keys + 1 - half;
+    right->next[0] = node->next[0];
+
+    std::copy(keys, keys + half, node->keys);
+    node->count = half;
+
+    //The new node must be complete before the searches can reach it
+    __asm__ __volatile__("" ::: "memory");
+
+    node->next[0] = right;
+    unlock(node);
+
+    //Until then, the searches reach the new node from the bottom level only
+    for(int level = 1; level <= topLevel; ++level){
+        link(right, level);
+    }
+
+    right->linked = true;
+}
+
+template<typename T, int Threads, unsigned int Lines>
+void PackedSkipList<T, Threads, Lines>::link(Node* node, int level){
+    while(true){
+        Node* pred = locate(node->low, level, true);
+        lock(pred);
+
+        Node* succ = pred->next[level];
+
+        if(!pred->marked && (!succ || node->low < succ->low)){
+            node->next[level] = succ;
+
+            __asm__ __volatile__("" ::: "memory");
+
+            pred->next[level] = node;
+            unlock(pred);
+
+            return;
+        }
+
+        unlock(pred);
+    }
+}
+
+template<typename T, int Threads, unsigned int Lines>
+void PackedSkipList<T, Threads, Lines>::unlink(Node* node, int level){
+    while(true){
+        Node* pred = locate(node->low, level, true);
+        lock(pred);
+
+        //The tower of a marked node does not change anymore
+        if(!pred->marked && pred->next[level] == node){
+            pred->next[level] = node->next[level];
+            unlock(pred);
+
+            return;
+        }
+
+        unlock(pred);
+    }
+}
+
+template<typename T, int Threads, unsigned int Lines>
+bool PackedSkipList<T, Threads, Lines>::remove(T value){
+    int key = hash(value);
+
+    while(true){
+        Node* node = locate(key, 0, false);
+        lock(node);
+
+        if(node->marked || !covers(node, key)){
+            unlock(node);
+            continue;
+        }
+
+        unsigned int index = position(node, key);
+
+        if(index == node->count || node->keys[index] != key){
+            unlock(node);
+            hazard.releaseAll();
+
+            return false;
+        }
+
+        std::copy(node->keys + index + 1, node->keys + node->count, node->keys + index);
+        --node->count;
+
+        //Its keys go to its predecessor at the bottom level, a node still being linked is left in place
+        bool empty = node->count == 0 && node != head && node->linked;
+
+        if(empty){
+            node->marked = true;
+        }
+
+        unlock(node);
+
+        if(empty){
+            for(int level = node->topLevel; level >= 0; --level){
+                unlink(node, level);
+            }
+
+            hazard.releaseAll();
+            hazard.releaseNode(node);
+        } else {
+            hazard.releaseAll();
+        }
+
+        return true;
+    }
+}
+
+}
+
+#endif
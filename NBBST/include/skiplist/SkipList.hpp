@@ -1,27 +1,45 @@
 #ifndef SKIP_LIST
 #define SKIP_LIST
 
+#include <cstdlib>
+#include <limits>
+#include <new>
+
 #include "hash.hpp"
 #include "Utils.hpp"
-#include "HazardManager.hpp"
-
-#define MAX_LEVEL 24 //Should be choosen as log(1/p)(n)
-#define P 0.5        //probability for randomLevel (geometric distribution)
+#include "EpochManager.hpp"
+#include "skiplist/Towers.hpp"
 
 namespace skiplist {
 
+/*!
+ * A node and its tower in a single allocation, new (topLevel) Node() makes room for topLevel + 1 next pointers.
+ */
 struct Node {
     int key;
     int topLevel;
-    Node** next;
-    
-    Node(){
-        //Fill the array with null pointers
-        next = static_cast<Node**>(calloc(MAX_LEVEL + 1, sizeof(Node *)));
+    Node* next[1];
+
+    static void* operator new(std::size_t size){
+        return operator new(size, 0);
+    }
+
+    static void* operator new(std::size_t size, int topLevel){
+        void* memory = malloc(size + topLevel * sizeof(Node*));
+
+        if(!memory){
+            throw std::bad_alloc();
+        }
+
+        return memory;
     }
 
-    ~Node(){
-        free(next);    
+    static void operator delete(void* node){
+        free(node);
+    }
+
+    static void operator delete(void* node, int){
+        free(node);
     }
 };
 
@@ -40,7 +58,10 @@ inline bool IsMarked(Node* node){
 template<typename T, int Threads>
 class SkipList {
     public:
-        SkipList();
+        /*!
+         * \param threads The number of threads using the list, only to give with Threads = DynamicThreads.
+         */
+        explicit SkipList(unsigned int threads = Threads);
         ~SkipList();
 
         bool add(T value);
@@ -48,37 +69,39 @@ class SkipList {
         bool contains(T value);
 
     private:
-        int randomLevel();
         bool find(int key, Node** preds, Node** succs);
+        void raise(int topLevel);
 
-        Node* newNode(int key, int height);
+        Node* newNode(int key, int topLevel);
 
         Node* head;
         Node* tail;
 
-        HazardManager<Node, Threads, 3> hazard;
+        volatile int top;       //Highest level a node has been linked at, the searches start there
 
-        std::mt19937_64 engine;
-        std::geometric_distribution<int> distribution;
+        //The nodes are created by the towers, the epoch manager only recycles them. A removed node 
+        //can still be linked at an upper level by the add() that raced with it, until its next find()
+        EpochManager<Node, Threads, 0> epochs;
+        Towers<Node, Threads> towers;
 };
 
 template<typename T, int Threads>
-Node* SkipList<T, Threads>::newNode(int key, int height){
-    Node* node = hazard.getFreeNode();
+Node* SkipList<T, Threads>::newNode(int key, int topLevel){
+    Node* node = towers.newNode(topLevel, epochs.direct_free(thread_num));
 
     node->key = key;
-    node->topLevel = height;
 
     //Make sure everything gets set to null
-    std::fill(node->next, node->next + MAX_LEVEL + 1, nullptr);
+    std::fill(node->next, node->next + topLevel + 1, nullptr);
 
     return node;
 }
 
 template<typename T, int Threads>
-SkipList<T, Threads>::SkipList() : engine(time(NULL)), distribution(P) {
+SkipList<T, Threads>::SkipList(unsigned int threads) : top(0), epochs(threads), towers(threads) {
+    //The sentinels are the only nodes of full height, the searches can reach them at any level
     head = newNode(std::numeric_limits<int>::min(), MAX_LEVEL);
-    tail = newNode(std::numeric_limits<int>::max(), 0);
+    tail = newNode(std::numeric_limits<int>::max(), MAX_LEVEL);
 
     for(int i = 0; i < MAX_LEVEL + 1; ++i){
         head->next[i] = tail;
@@ -87,33 +110,45 @@ SkipList<T, Threads>::SkipList() : engine(time(NULL)), distribution(P) {
 
 template<typename T, int Threads>
 SkipList<T, Threads>::~SkipList(){
-    hazard.releaseNode(tail);
-    hazard.releaseNode(head);
+    //Every removed node has been unlinked, the remaining ones are all at the bottom level
+    Node* node = head;
+
+    while(node){
+        Node* next = Unmark(node->next[0]);
+        delete node;
+        node = next;
+    }
 }
 
 template<typename T, int Threads>
-int SkipList<T, Threads>::randomLevel(){
-    int level = distribution(engine); 
-    
-    return (level >= MAX_LEVEL) ? MAX_LEVEL : level;
+void SkipList<T, Threads>::raise(int topLevel){
+    int current = top;
+
+    while(topLevel > current && !CAS(&top, current, topLevel)){
+        current = top;
+    }
 }
 
 template<typename T, int Threads>
 bool SkipList<T, Threads>::add(T value){
     int key = hash(value);
-    int topLevel = randomLevel();
+    int topLevel = towers.randomLevel();
+
+    //Before the search, so that it fills preds and succs up to topLevel
+    raise(topLevel);
 
     Node* preds[MAX_LEVEL + 1];
     Node* succs[MAX_LEVEL + 1];
             
+    epochs.enter();
+
     Node* newElement = newNode(key, topLevel);
-    hazard.publish(newElement, 0);
 
     while(true){
         if(find(key, preds, succs)){
-            hazard.releaseAll();
-            
-            hazard.releaseNode(newElement);
+            epochs.releaseNode(newElement);
+
+            epochs.leave();
 
             return false;
         } else {
@@ -121,16 +156,31 @@ bool SkipList<T, Threads>::add(T value){
                 newElement->next[level] = succs[level];
             }
 
-            hazard.publish(preds[0]->next[0], 1);
-            hazard.publish(succs[0], 2);
-            
             if(CASPTR(&preds[0]->next[0], succs[0], newElement)){
-                for(int level = 1; level <= topLevel; ++level){
+                bool removed = false;
+
+                for(int level = 1; level <= topLevel && !removed; ++level){
                     while(true){
-                        hazard.publish(preds[level]->next[level], 1);
-                        hazard.publish(succs[level], 2);
+                        //The successor may have changed since the tower was filled
+                        Node* next = newElement->next[level];
+
+                        if(IsMarked(next)){
+                            //A remove already started on the node, the rest of the tower stays unlinked
+                            removed = true;
+                            break;
+                        }
+
+                        if(next != succs[level] && !CASPTR(&newElement->next[level], next, succs[level])){
+                            continue;
+                        }
+
+                        if(CASPTR(&preds[level]->next[level], succs[level], newElement)){
+                            //A remove that marked the node meanwhile may have missed this level
+                            if(IsMarked(newElement->next[level])){
+                                find(key, preds, succs);
+                                removed = true;
+                            }
 
-                        if(CASPTR(&preds[level]->next[level], succs[level], newElement)){ 
                             break;
                         } else {
                             find(key, preds, succs);
@@ -138,7 +188,7 @@ bool SkipList<T, Threads>::add(T value){
                     }
                 }
             
-                hazard.releaseAll();
+                epochs.leave();
 
                 return true;
             }
@@ -153,21 +203,20 @@ bool SkipList<T, Threads>::remove(T value){
     Node* preds[MAX_LEVEL + 1];
     Node* succs[MAX_LEVEL + 1];
 
+    epochs.enter();
+
     while(true){
         if(!find(key, preds, succs)){
-            hazard.release(1);
-            hazard.release(0);
+            epochs.leave();
 
             return false;
         } else {
             Node* nodeToRemove = succs[0];
-            hazard.publish(nodeToRemove, 0);
 
             for(int level = nodeToRemove->topLevel; level > 0; --level){
                 Node* succ = nullptr;
                 do {
                     succ = nodeToRemove->next[level];
-                    hazard.publish(succ, 1);
 
                     if(IsMarked(succ)){
                         break;
@@ -177,17 +226,15 @@ bool SkipList<T, Threads>::remove(T value){
 
             while(true){
                 Node* succ = nodeToRemove->next[0];
-                hazard.publish(succ, 1);
 
                 if(IsMarked(succ)){
                     break;
                 } else if(CASPTR(&nodeToRemove->next[0], succ, Mark(succ))){
-                    hazard.release(1);
-                    hazard.release(0);
-                    
                     find(key, preds, succs);
                     
-                    hazard.releaseNode(nodeToRemove);
+                    epochs.releaseNode(nodeToRemove);
+
+                    epochs.leave();
 
                     return true;
                 }
@@ -200,11 +247,13 @@ template<typename T, int Threads>
 bool SkipList<T, Threads>::contains(T value){
     int key = hash(value);
 
+    epochs.enter();
+
     Node* pred = head;
     Node* curr = nullptr;
     Node* succ = nullptr;
 
-    for(int level = MAX_LEVEL; level >= 0; --level){
+    for(int level = top; level >= 0; --level){
         curr = Unmark(pred->next[level]);
 
         while(true){
@@ -226,6 +275,8 @@ bool SkipList<T, Threads>::contains(T value){
 
     bool found = curr->key == key;
 
+    epochs.leave();
+
     return found;
 }
 
@@ -236,15 +287,10 @@ bool SkipList<T, Threads>::find(int key, Node** preds, Node** succs){
     Node* succ = nullptr;
         
 retry:
-    //We must do to release after the goto
-    hazard.releaseAll();
-    
     pred = head;
-    hazard.publish(pred, 0);
 
-    for(int level = MAX_LEVEL; level >= 0; --level){
+    for(int level = top; level >= 0; --level){
         curr = pred->next[level];
-        hazard.publish(curr, 1);
 
         while(true){
             if(IsMarked(curr)){
@@ -252,7 +298,6 @@ retry:
             }
 
             succ = curr->next[level];
-            hazard.publish(succ, 2);
 
             while(IsMarked(succ)){
                 if(!CASPTR(&pred->next[level], curr, Unmark(succ))){
@@ -260,22 +305,17 @@ retry:
                 }
 
                 curr = pred->next[level];
-                hazard.publish(curr, 1);
 
                 if(IsMarked(curr)){
                     goto retry;
                 }
 
                 succ = curr->next[level];
-                hazard.publish(succ, 2);
             }
 
             if(curr->key < key){
                 pred = curr;
-                hazard.publish(pred, 0);
-                
                 curr = succ;
-                hazard.publish(curr, 1);
             } else {
                 break;
             }
@@ -286,8 +326,6 @@ retry:
     }
 
     bool found = curr->key == key;
-    
-    hazard.releaseAll();
 
     return found;
 }
@@ -0,0 +1,108 @@
+#ifndef SKIP_LIST_TOWERS
+#define SKIP_LIST_TOWERS
+
+#include <random>
+#include <vector>
+
+#include "PerThread.hpp"
+
+#define MAX_LEVEL 24 //Should be choosen as log(1/p)(n)
+
+namespace skiplist {
+
+/*!
+ * Allocation of the skip list nodes, whose tower of next pointers is allocated inline and sized
+ * to their level: a node of level l is created with new (l) Node() and holds l + 1 pointers.
+ *
+ * A node can only be reused at its own level, so the nodes released by the hazard manager are
+ * sorted into one free stack per level and per thread.
+ *
+ * \param Node The type of node, it needs a topLevel field and an operator new(size, level).
+ * \param Threads The number of threads, DynamicThreads to give it to the constructor.
+ */
+template<typename Node, int Threads>
+class Towers {
+    public:
+        explicit Towers(unsigned int threads = Threads);
+        ~Towers();
+
+        Towers(const Towers& rhs) = delete;
+        Towers& operator=(const Towers& rhs) = delete;
+
+        /*!
+         * Draw the level of a new node for the calling thread, level l with probability 1/2^(l+1).
+         */
+        int randomLevel();
+
+        /*!
+         * Return a node of the given level for the calling thread.
+         * \param level The top level of the node.
+         * \param released The free stack of the hazard manager of the calling thread, emptied into the pools.
+         */
+        Node* newNode(int level, std::vector<Node*>& released);
+
+    private:
+        struct Pool {
+            std::mt19937_64 engine;
+            std::vector<Node*> free[MAX_LEVEL + 1];
+        };
+
+        PerThread<Pool, Threads> pools;
+};
+
+template<typename Node, int Threads>
+Towers<Node, Threads>::Towers(unsigned int threads) : pools(threads) {
+    //Each thread draws its own levels, independently of any generator seeded by the caller
+    std::random_device device;
+
+    for(unsigned int t = 0; t < pools.size(); ++t){
+        pools[t].engine.seed(device());
+    }
+}
+
+template<typename Node, int Threads>
+Towers<Node, Threads>::~Towers(){
+    for(unsigned int t = 0; t < pools.size(); ++t){
+        for(auto& free : pools[t].free){
+            for(Node* node : free){
+                delete node;
+            }
+        }
+    }
+}
+
+template<typename Node, int Threads>
+inline int Towers<Node, Threads>::randomLevel(){
+    //Each bit is a fair coin, the bit MAX_LEVEL caps the level
+    return __builtin_ctzll(pools[thread_num].engine() | (1ull << MAX_LEVEL));
+}
+
+template<typename Node, int Threads>
+Node* Towers<Node, Threads>::newNode(int level, std::vector<Node*>& released){
+    Pool& pool = pools[thread_num];
+
+    if(pool.free[level].empty()){
+        for(Node* node : released){
+            pool.free[node->topLevel].push_back(node);
+        }
+
+        released.clear();
+    }
+
+    Node* node;
+
+    if(pool.free[level].empty()){
+        node = new (level) Node();
+    } else {
+        node = pool.free[level].back();
+        pool.free[level].pop_back();
+    }
+
+    node->topLevel = level;
+
+    return node;
+}
+
+}
+
+#endif
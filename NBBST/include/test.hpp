@@ -6,6 +6,9 @@
  */
 void test();
 
-void start_benchmark(int initial, int key_size, int updaterate, int num_thread, int treetype);
+/*!
+ * Bench the given tree type, sized for num_thread threads at runtime or, with fixed_threads, at compile time.
+ */
+void start_benchmark(int initial, int key_size, int updaterate, int num_thread, int treetype, bool fixed_threads);
 
 #endif
@@ -9,8 +9,14 @@ struct tree_type_traits {
     static const bool balanced = true;
 };
 
+template<typename K, int Threads, typename V, typename Compare>
+struct tree_type_traits<nbbst::NBBST<K, Threads, V, Compare>> {
+    static const bool balanced = false;
+};
+
+//The emptied leaves stay linked until an update passes by, a lookup can walk through all of them
 template<typename T, int Threads>
-struct tree_type_traits<nbbst::NBBST<T, Threads>> {
+struct tree_type_traits<lfmst::MultiwaySearchTree<T, Threads>> {
     static const bool balanced = false;
 };
 
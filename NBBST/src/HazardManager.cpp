@@ -1,3 +1,33 @@
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
 #include "HazardManager.hpp"
 
 __thread unsigned int thread_num;
+
+//The ids held by registered threads
+static std::mutex registry_lock;
+static std::vector<bool> registry;
+
+unsigned int register_thread(){
+    std::lock_guard<std::mutex> guard(registry_lock);
+
+    auto free = std::find(registry.begin(), registry.end(), false);
+
+    thread_num = free - registry.begin();
+
+    if(free == registry.end()){
+        registry.push_back(true);
+    } else {
+        *free = true;
+    }
+
+    return thread_num;
+}
+
+void unregister_thread(){
+    std::lock_guard<std::mutex> guard(registry_lock);
+
+    registry[thread_num] = false;
+}
@@ -6,6 +6,7 @@
 #include <atomic>
 #include <set>
 #include <vector>
+#include <functional>
 
 #include "bench.hpp"
 #include "file_distribution.hpp"
@@ -14,6 +15,7 @@
 
 //Include all the trees implementations
 #include "skiplist/SkipList.hpp"
+#include "skiplist/PackedSkipList.hpp"
 #include "nbbst/NBBST.hpp"
 #include "avltree/AVLTree.hpp"
 #include "lfmst/MultiwaySearchTree.hpp"
@@ -23,22 +25,23 @@
 #define OPERATIONS 1000000
 #define REPEAT 2
 #define SEARCH_BENCH_OPERATIONS 100000 
+#define SEARCH_BATCH 100                //Values given at once to the batched lookups
 
 //Chrono typedefs
 typedef std::chrono::high_resolution_clock Clock;
 typedef std::chrono::milliseconds milliseconds;
 typedef std::chrono::microseconds microseconds;
 
-template<typename Tree, unsigned int Threads>
-void random_bench(const std::string& name, unsigned int range, unsigned int add, unsigned int remove, Results& results){
-    Tree tree;
+template<typename Tree>
+void random_bench(const std::string& name, unsigned int threads, unsigned int range, unsigned int add, unsigned int remove, Results& results){
+    Tree tree(threads);
 
     Clock::time_point t0 = Clock::now();
 
-    std::vector<int> elements[Threads];
+    std::vector<std::vector<int>> elements(threads);
     
     std::vector<std::thread> pool;
-    for(unsigned int tid = 0; tid < Threads; ++tid){
+    for(unsigned int tid = 0; tid < threads; ++tid){
         pool.push_back(std::thread([&tree, &elements, range, add, remove, tid](){
             thread_num = tid;
 
@@ -72,14 +75,14 @@ void random_bench(const std::string& name, unsigned int range, unsigned int add,
     Clock::time_point t1 = Clock::now();
 
     milliseconds ms = std::chrono::duration_cast<milliseconds>(t1 - t0);
-    unsigned long throughput = (Threads * OPERATIONS) / ms.count();
+    unsigned long throughput = (threads * OPERATIONS) / ms.count();
 
-    std::cout << name << " througput with " << Threads << " threads = " << throughput << " operations / ms" << std::endl;
+    std::cout << name << " througput with " << threads << " threads = " << throughput << " operations / ms" << std::endl;
 
     results.add_result(name, throughput);
 
     pool.clear();
-    for(unsigned int tid = 0; tid < Threads; ++tid){
+    for(unsigned int tid = 0; tid < threads; ++tid){
         pool.push_back(std::thread([&tree, &elements, tid](){
             thread_num = tid;
 
@@ -93,13 +96,9 @@ void random_bench(const std::string& name, unsigned int range, unsigned int add,
 }
 
 #define BENCH(type, name, range, add, remove)\
-    random_bench<type<int, 1>, 1>(name, range, add, remove, results);\
-    random_bench<type<int, 2>, 2>(name, range, add, remove, results);\
-    random_bench<type<int, 3>, 3>(name, range, add, remove, results);\
-    random_bench<type<int, 4>, 4>(name, range, add, remove, results);\
-    random_bench<type<int, 8>, 8>(name, range, add, remove, results);\
-    random_bench<type<int, 16>, 16>(name, range, add, remove, results);\
-    random_bench<type<int, 32>, 32>(name, range, add, remove, results);
+    for(unsigned int threads : {1, 2, 3, 4, 8, 16, 32}){\
+        random_bench<type<int, DynamicThreads>>(name, threads, range, add, remove, results);\
+    }
 
 void random_bench(unsigned int range, unsigned int add, unsigned int remove){
     std::cout << "Bench with " << OPERATIONS << " operations/thread, range = " << range << ", " << add << "% add, " << remove << "% remove, " << (100 - add - remove) << "% contains" << std::endl;
@@ -113,6 +112,7 @@ void random_bench(unsigned int range, unsigned int add, unsigned int remove){
 
     for(int i = 0; i < REPEAT; ++i){
         BENCH(skiplist::SkipList, "skiplist", range, add, remove);
+        BENCH(skiplist::PackedSkipList, "packed-skiplist", range, add, remove);
         BENCH(nbbst::NBBST, "nbbst", range, add, remove);
         BENCH(avltree::AVLTree, "avltree", range, add, remove)
         BENCH(lfmst::MultiwaySearchTree, "lfmst", range, add, remove);
@@ -139,16 +139,16 @@ void random_bench(){
     random_bench(std::numeric_limits<int>::max() - 1);      //Key in {0, 2^32}
 }
 
-template<typename Tree, unsigned int Threads>
-void skewed_bench(const std::string& name, unsigned int range, unsigned int add, unsigned int remove, file_distribution<>& distribution, Results& results){
-    Tree tree;
+template<typename Tree>
+void skewed_bench(const std::string& name, unsigned int threads, unsigned int range, unsigned int add, unsigned int remove, file_distribution<>& distribution, Results& results){
+    Tree tree(threads);
 
-    std::vector<int> elements[Threads];
+    std::vector<std::vector<int>> elements(threads);
 
     Clock::time_point t0 = Clock::now();
     
     std::vector<std::thread> pool;
-    for(unsigned int tid = 0; tid < Threads; ++tid){
+    for(unsigned int tid = 0; tid < threads; ++tid){
         pool.push_back(std::thread([&tree, &elements, &distribution, range, add, remove, tid](){
             thread_num = tid;
 
@@ -186,13 +186,13 @@ void skewed_bench(const std::string& name, unsigned int range, unsigned int add,
     Clock::time_point t1 = Clock::now();
 
     milliseconds ms = std::chrono::duration_cast<milliseconds>(t1 - t0);
-    unsigned long throughput = (Threads * 2 * OPERATIONS) / ms.count();
+    unsigned long throughput = (threads * 2 * OPERATIONS) / ms.count();
 
-    std::cout << name << " througput with " << Threads << " threads = " << throughput << " operations / ms" << std::endl;
+    std::cout << name << " througput with " << threads << " threads = " << throughput << " operations / ms" << std::endl;
     results.add_result(name, throughput);
 
     pool.clear();
-    for(unsigned int tid = 0; tid < Threads; ++tid){
+    for(unsigned int tid = 0; tid < threads; ++tid){
         pool.push_back(std::thread([&tree, &elements, tid](){
             thread_num = tid;
 
@@ -209,11 +209,12 @@ void skewed_bench(unsigned int range, unsigned int add, unsigned int remove, fil
     std::cout << "Skewed Bench with " << OPERATIONS << " operations/thread, range = " << range << ", " << add << "% add, " << remove << "% remove, " << (100 - add - remove) << "% contains" << std::endl;
 
     for(int i = 0; i < REPEAT; ++i){
-        skewed_bench<skiplist::SkipList<int, 8>, 8>("skiplist", range, add, remove, distribution, results);
-        skewed_bench<nbbst::NBBST<int, 8>, 8>("nbbst", range, add, remove, distribution, results);
-        skewed_bench<avltree::AVLTree<int, 8>, 8>("avltree", range, add, remove, distribution, results);
-        skewed_bench<lfmst::MultiwaySearchTree<int, 8>, 8>("lfmst", range, add, remove, distribution, results);
-        skewed_bench<cbtree::CBTree<int, 8>, 8>("cbtree", range, add, remove, distribution, results);
+        skewed_bench<skiplist::SkipList<int, DynamicThreads>>("skiplist", 8, range, add, remove, distribution, results);
+        skewed_bench<skiplist::PackedSkipList<int, DynamicThreads>>("packed-skiplist", 8, range, add, remove, distribution, results);
+        skewed_bench<nbbst::NBBST<int, DynamicThreads>>("nbbst", 8, range, add, remove, distribution, results);
+        skewed_bench<avltree::AVLTree<int, DynamicThreads>>("avltree", 8, range, add, remove, distribution, results);
+        skewed_bench<lfmst::MultiwaySearchTree<int, DynamicThreads>>("lfmst", 8, range, add, remove, distribution, results);
+        skewed_bench<cbtree::CBTree<int, DynamicThreads>>("cbtree", 8, range, add, remove, distribution, results);
     }
 }
 
@@ -275,16 +276,16 @@ unsigned long get_duration(Clock::time_point t0, Clock::time_point t1){
     return ms.count();
 }
 
-template<typename Tree, unsigned int Threads>
-void seq_construction_bench(const std::string& name, unsigned int size, Results& results){
-    Tree tree;
+template<typename Tree>
+void seq_construction_bench(const std::string& name, unsigned int threads, unsigned int size, Results& results){
+    Tree tree(threads);
 
     Clock::time_point t0 = Clock::now();
     
-    unsigned int part = size / Threads;
+    unsigned int part = size / threads;
 
     std::vector<std::thread> pool;
-    for(unsigned int tid = 0; tid < Threads; ++tid){
+    for(unsigned int tid = 0; tid < threads; ++tid){
         pool.push_back(std::thread([&tree, part, size, tid](){
             thread_num = tid;
 
@@ -298,7 +299,7 @@ void seq_construction_bench(const std::string& name, unsigned int size, Results&
 
     Clock::time_point t1 = Clock::now();
 
-    std::cout << "Construction of " << name << " with " << size << " elements took " << get_duration(t0, t1) << " ms with " << Threads << " threads" << std::endl;
+    std::cout << "Construction of " << name << " with " << size << " elements took " << get_duration(t0, t1) << " ms with " << threads << " threads" << std::endl;
     results.add_result(name, get_duration(t0, t1));
 
     //Empty the tree
@@ -308,11 +309,9 @@ void seq_construction_bench(const std::string& name, unsigned int size, Results&
 }
 
 #define SEQ_CONSTRUCTION(type, name, size)\
-    seq_construction_bench<type<int, 1>, 1>(name, size, results);\
-    seq_construction_bench<type<int, 2>, 2>(name, size, results);\
-    seq_construction_bench<type<int, 3>, 3>(name, size, results);\
-    seq_construction_bench<type<int, 4>, 4>(name, size, results);\
-    seq_construction_bench<type<int, 8>, 8>(name, size, results);
+    for(unsigned int threads : {1, 2, 3, 4, 8}){\
+        seq_construction_bench<type<int, DynamicThreads>>(name, threads, size, results);\
+    }
 
 void seq_construction_bench(){
     std::cout << "Bench the sequential construction time of each data structure" << std::endl;
@@ -329,6 +328,7 @@ void seq_construction_bench(){
 
         for(int i = 0; i < REPEAT; ++i){
             SEQ_CONSTRUCTION(skiplist::SkipList, "skiplist", size);
+            SEQ_CONSTRUCTION(skiplist::PackedSkipList, "packed-skiplist", size);
             SEQ_CONSTRUCTION(nbbst::NBBST, "nbbst", size);
             SEQ_CONSTRUCTION(avltree::AVLTree, "avltree", size);
             SEQ_CONSTRUCTION(lfmst::MultiwaySearchTree, "lfmst", size);
@@ -352,6 +352,7 @@ void seq_construction_bench(){
         
         for(int i = 0; i < REPEAT; ++i){
             SEQ_CONSTRUCTION(skiplist::SkipList, "skiplist", size);
+            SEQ_CONSTRUCTION(skiplist::PackedSkipList, "packed-skiplist", size);
             //Too slow SEQ_CONSTRUCTION(nbbst::NBBST, "nbbst", size);
             SEQ_CONSTRUCTION(avltree::AVLTree, "avltree", size);
             SEQ_CONSTRUCTION(lfmst::MultiwaySearchTree, "lfmst", size);
@@ -364,9 +365,9 @@ void seq_construction_bench(){
     }
 }
 
-template<typename Tree, unsigned int Threads>
-void random_construction_bench(const std::string& name, unsigned int size, Results& results){
-    Tree tree;
+template<typename Tree>
+void random_construction_bench(const std::string& name, unsigned int threads, unsigned int size, Results& results){
+    Tree tree(threads);
 
     std::vector<int> elements;
     for(unsigned int i = 0; i < size; ++i){
@@ -377,10 +378,10 @@ void random_construction_bench(const std::string& name, unsigned int size, Resul
 
     Clock::time_point t0 = Clock::now();
     
-    unsigned int part = size / Threads;
+    unsigned int part = size / threads;
 
     std::vector<std::thread> pool;
-    for(unsigned int tid = 0; tid < Threads; ++tid){
+    for(unsigned int tid = 0; tid < threads; ++tid){
         pool.push_back(std::thread([&tree, &elements, part, size, tid](){
             thread_num = tid;
 
@@ -394,7 +395,7 @@ void random_construction_bench(const std::string& name, unsigned int size, Resul
 
     Clock::time_point t1 = Clock::now();
 
-    std::cout << "Construction of " << name << " with " << size << " elements took " << get_duration(t0, t1) << " ms with " << Threads << " threads" << std::endl;
+    std::cout << "Construction of " << name << " with " << size << " elements took " << get_duration(t0, t1) << " ms with " << threads << " threads" << std::endl;
     results.add_result(name, get_duration(t0, t1));
 
     //Empty the tree
@@ -404,11 +405,9 @@ void random_construction_bench(const std::string& name, unsigned int size, Resul
 }
 
 #define RANDOM_CONSTRUCTION(type, name, size)\
-    random_construction_bench<type<int, 1>, 1>(name, size, results);\
-    random_construction_bench<type<int, 2>, 2>(name, size, results);\
-    random_construction_bench<type<int, 3>, 3>(name, size, results);\
-    random_construction_bench<type<int, 4>, 4>(name, size, results);\
-    random_construction_bench<type<int, 8>, 8>(name, size, results);
+    for(unsigned int threads : {1, 2, 3, 4, 8}){\
+        random_construction_bench<type<int, DynamicThreads>>(name, threads, size, results);\
+    }
 
 void random_construction_bench(){
     std::cout << "Bench the random construction time of each data structure" << std::endl;
@@ -425,6 +424,7 @@ void random_construction_bench(){
 
         for(int i = 0; i < REPEAT; ++i){
             RANDOM_CONSTRUCTION(skiplist::SkipList, "skiplist", size);
+            RANDOM_CONSTRUCTION(skiplist::PackedSkipList, "packed-skiplist", size);
             RANDOM_CONSTRUCTION(nbbst::NBBST, "nbbst", size);
             RANDOM_CONSTRUCTION(avltree::AVLTree, "avltree", size);
             RANDOM_CONSTRUCTION(lfmst::MultiwaySearchTree, "lfmst", size);
@@ -437,20 +437,20 @@ void random_construction_bench(){
     }
 }
 
-template<typename Tree, unsigned int Threads>
-void seq_removal_bench(const std::string& name, unsigned int size, Results& results){
-    Tree tree;
+template<typename Tree>
+void seq_removal_bench(const std::string& name, unsigned int threads, unsigned int size, Results& results){
+    Tree tree(threads);
 
     for(unsigned int i = 0; i < size; ++i){
         tree.add(i);
     }
     
-    unsigned int part = size / Threads;
+    unsigned int part = size / threads;
 
     Clock::time_point t0 = Clock::now();
 
     std::vector<std::thread> pool;
-    for(unsigned int tid = 0; tid < Threads; ++tid){
+    for(unsigned int tid = 0; tid < threads; ++tid){
         pool.push_back(std::thread([&tree, part, size, tid](){
             thread_num = tid;
 
@@ -464,16 +464,14 @@ void seq_removal_bench(const std::string& name, unsigned int size, Results& resu
 
     Clock::time_point t1 = Clock::now();
 
-    std::cout << "Removal of " << name << " with " << size << " elements took " << get_duration(t0, t1) << " ms with " << Threads << " threads" << std::endl;
+    std::cout << "Removal of " << name << " with " << size << " elements took " << get_duration(t0, t1) << " ms with " << threads << " threads" << std::endl;
     results.add_result(name, get_duration(t0, t1));
 }
 
 #define SEQUENTIAL_REMOVAL(type, name, size)\
-    seq_removal_bench<type<int, 1>, 1>(name, size, results);\
-    seq_removal_bench<type<int, 2>, 2>(name, size, results);\
-    seq_removal_bench<type<int, 3>, 3>(name, size, results);\
-    seq_removal_bench<type<int, 4>, 4>(name, size, results);\
-    seq_removal_bench<type<int, 8>, 8>(name, size, results);
+    for(unsigned int threads : {1, 2, 3, 4, 8}){\
+        seq_removal_bench<type<int, DynamicThreads>>(name, threads, size, results);\
+    }
 
 void seq_removal_bench(){
     std::cout << "Bench the sequential removal time of each data structure" << std::endl;
@@ -490,6 +488,7 @@ void seq_removal_bench(){
         
         for(int i = 0; i < REPEAT; ++i){
             SEQUENTIAL_REMOVAL(skiplist::SkipList, "skiplist", size);
+            SEQUENTIAL_REMOVAL(skiplist::PackedSkipList, "packed-skiplist", size);
             SEQUENTIAL_REMOVAL(nbbst::NBBST, "nbbst", size);
             SEQUENTIAL_REMOVAL(avltree::AVLTree, "avltree", size);
             SEQUENTIAL_REMOVAL(lfmst::MultiwaySearchTree, "lfmst", size);
@@ -513,6 +512,7 @@ void seq_removal_bench(){
         
         for(int i = 0; i < REPEAT; ++i){
             SEQUENTIAL_REMOVAL(skiplist::SkipList, "skiplist", size);
+            SEQUENTIAL_REMOVAL(skiplist::PackedSkipList, "packed-skiplist", size);
             //Too slow SEQUENTIAL_REMOVAL(nbbst::NBBST, "NBBST", size);
             SEQUENTIAL_REMOVAL(avltree::AVLTree, "avltree", size);
             SEQUENTIAL_REMOVAL(lfmst::MultiwaySearchTree, "lfmst", size);
@@ -525,9 +525,9 @@ void seq_removal_bench(){
     }
 }
 
-template<typename Tree, unsigned int Threads>
-void random_removal_bench(const std::string& name, unsigned int size, Results& results){
-    Tree tree;
+template<typename Tree>
+void random_removal_bench(const std::string& name, unsigned int threads, unsigned int size, Results& results){
+    Tree tree(threads);
 
     std::vector<int> elements;
     for(unsigned int i = 0; i < size; ++i){
@@ -540,12 +540,12 @@ void random_removal_bench(const std::string& name, unsigned int size, Results& r
         tree.add(elements[i]);
     }
     
-    unsigned int part = size / Threads;
+    unsigned int part = size / threads;
 
     Clock::time_point t0 = Clock::now();
 
     std::vector<std::thread> pool;
-    for(unsigned int tid = 0; tid < Threads; ++tid){
+    for(unsigned int tid = 0; tid < threads; ++tid){
         pool.push_back(std::thread([&tree, &elements, part, size, tid](){
             thread_num = tid;
 
@@ -559,16 +559,14 @@ void random_removal_bench(const std::string& name, unsigned int size, Results& r
 
     Clock::time_point t1 = Clock::now();
 
-    std::cout << "Removal of " << name << " with " << size << " elements took " << get_duration(t0, t1) << " ms with " << Threads << " threads" << std::endl;
+    std::cout << "Removal of " << name << " with " << size << " elements took " << get_duration(t0, t1) << " ms with " << threads << " threads" << std::endl;
     results.add_result(name, get_duration(t0, t1));
 }
 
 #define RANDOM_REMOVAL(type, name, size)\
-    random_removal_bench<type<int, 1>, 1>(name, size, results);\
-    random_removal_bench<type<int, 2>, 2>(name, size, results);\
-    random_removal_bench<type<int, 3>, 3>(name, size, results);\
-    random_removal_bench<type<int, 4>, 4>(name, size, results);\
-    random_removal_bench<type<int, 8>, 8>(name, size, results);
+    for(unsigned int threads : {1, 2, 3, 4, 8}){\
+        random_removal_bench<type<int, DynamicThreads>>(name, threads, size, results);\
+    }
 
 void random_removal_bench(){
     std::cout << "Bench the random removal time of each data structure" << std::endl;
@@ -585,6 +583,7 @@ void random_removal_bench(){
 
         for(int i = 0; i < REPEAT; ++i){
             RANDOM_REMOVAL(skiplist::SkipList, "skiplist", size);
+            RANDOM_REMOVAL(skiplist::PackedSkipList, "packed-skiplist", size);
             RANDOM_REMOVAL(nbbst::NBBST, "nbbst", size);
             RANDOM_REMOVAL(avltree::AVLTree, "avltree", size);
             RANDOM_REMOVAL(lfmst::MultiwaySearchTree, "lfmst", size);
@@ -597,12 +596,12 @@ void random_removal_bench(){
     }
 }
 
-template<typename Tree, unsigned int Threads>
-void search_bench(const std::string& name, unsigned int size, Tree& tree, Results& results){
+template<typename Tree>
+void search_bench(const std::string& name, unsigned int threads, unsigned int size, Tree& tree, Results& results){
     Clock::time_point t0 = Clock::now();
 
     std::vector<std::thread> pool;
-    for(unsigned int tid = 0; tid < Threads; ++tid){
+    for(unsigned int tid = 0; tid < threads; ++tid){
         pool.push_back(std::thread([&tree, size, tid](){
             thread_num = tid;
     
@@ -620,9 +619,45 @@ void search_bench(const std::string& name, unsigned int size, Tree& tree, Result
     Clock::time_point t1 = Clock::now();
     
     milliseconds ms = std::chrono::duration_cast<milliseconds>(t1 - t0);
-    unsigned long throughput = (Threads * SEARCH_BENCH_OPERATIONS) / ms.count();
+    unsigned long throughput = (threads * SEARCH_BENCH_OPERATIONS) / ms.count();
 
-    std::cout << name << "-" << size << " search througput with " << Threads << " threads = " << throughput << " operations / ms" << std::endl;
+    std::cout << name << "-" << size << " search througput with " << threads << " threads = " << throughput << " operations / ms" << std::endl;
+    results.add_result(name, throughput);
+}
+
+template<typename Tree>
+void batch_search_bench(const std::string& name, unsigned int threads, unsigned int size, Tree& tree, Results& results){
+    Clock::time_point t0 = Clock::now();
+
+    std::vector<std::thread> pool;
+    for(unsigned int tid = 0; tid < threads; ++tid){
+        pool.push_back(std::thread([&tree, size, tid](){
+            thread_num = tid;
+    
+            std::mt19937_64 engine(time(0) + tid);
+            std::uniform_int_distribution<int> distribution(0, size);
+
+            int values[SEARCH_BATCH];
+            bool found[SEARCH_BATCH];
+
+            for(int s = 0; s < SEARCH_BENCH_OPERATIONS; s += SEARCH_BATCH){
+                for(int& value : values){
+                    value = distribution(engine);
+                }
+
+                tree.contains(values, SEARCH_BATCH, found);
+            }
+        }));
+    }
+
+    for_each(pool.begin(), pool.end(), [](std::thread& t){t.join();});
+
+    Clock::time_point t1 = Clock::now();
+    
+    milliseconds ms = std::chrono::duration_cast<milliseconds>(t1 - t0);
+    unsigned long throughput = (threads * SEARCH_BENCH_OPERATIONS) / ms.count();
+
+    std::cout << name << "-" << size << " batched search througput with " << threads << " threads = " << throughput << " operations / ms" << std::endl;
     results.add_result(name, throughput);
 }
 
@@ -647,13 +682,13 @@ void fill_sequential(Tree& tree, unsigned int size){
     }
 }
 
-template<typename Tree, unsigned int Threads>
-void search_random_bench(const std::string& name, unsigned int size, Results& results){
-    Tree tree;
+template<typename Tree>
+void search_random_bench(const std::string& name, unsigned int threads, unsigned int size, Results& results){
+    Tree tree(threads);
     
     fill_random(tree, size);
     
-    search_bench<Tree, Threads>(name, size, tree, results);
+    search_bench<Tree>(name, threads, size, tree, results);
 
     //Empty the tree
     for(unsigned int i = 0; i < size; ++i){
@@ -662,11 +697,28 @@ void search_random_bench(const std::string& name, unsigned int size, Results& re
 }
 
 #define SEARCH_RANDOM(type, name, size)\
-    search_random_bench<type<int, 1>, 1>(name, size, results);\
-    search_random_bench<type<int, 2>, 2>(name, size, results);\
-    search_random_bench<type<int, 3>, 3>(name, size, results);\
-    search_random_bench<type<int, 4>, 4>(name, size, results);\
-    search_random_bench<type<int, 8>, 8>(name, size, results);
+    for(unsigned int threads : {1, 2, 3, 4, 8}){\
+        search_random_bench<type<int, DynamicThreads>>(name, threads, size, results);\
+    }
+
+template<typename Tree>
+void batch_search_random_bench(const std::string& name, unsigned int threads, unsigned int size, Results& results){
+    Tree tree(threads);
+    
+    fill_random(tree, size);
+    
+    batch_search_bench<Tree>(name, threads, size, tree, results);
+
+    //Empty the tree
+    for(unsigned int i = 0; i < size; ++i){
+        tree.remove(i);
+    }
+}
+
+#define BATCH_SEARCH_RANDOM(type, name, size)\
+    for(unsigned int threads : {1, 2, 3, 4, 8}){\
+        batch_search_random_bench<type<int, DynamicThreads>>(name, threads, size, results);\
+    }
 
 void search_random_bench(){
     std::cout << "Bench the search performances of each data structure with random insertion" << std::endl;
@@ -683,9 +735,11 @@ void search_random_bench(){
 
         for(int i = 0; i < REPEAT; ++i){
             SEARCH_RANDOM(skiplist::SkipList, "skiplist", size);
+            SEARCH_RANDOM(skiplist::PackedSkipList, "packed-skiplist", size);
             SEARCH_RANDOM(nbbst::NBBST, "nbbst", size);
             SEARCH_RANDOM(avltree::AVLTree, "avltree", size);
             SEARCH_RANDOM(lfmst::MultiwaySearchTree, "lfmst", size);
+            BATCH_SEARCH_RANDOM(lfmst::MultiwaySearchTree, "lfmst-batch", size);
             SEARCH_RANDOM(cbtree::CBTree, "cbtree", size);
         }
 
@@ -695,13 +749,13 @@ void search_random_bench(){
     }
 }
 
-template<typename Tree, unsigned int Threads>
-void search_sequential_bench(const std::string& name, unsigned int size, Results& results){
-    Tree tree;
+template<typename Tree>
+void search_sequential_bench(const std::string& name, unsigned int threads, unsigned int size, Results& results){
+    Tree tree(threads);
     
     fill_sequential(tree, size);
     
-    search_bench<Tree, Threads>(name, size, tree, results);
+    search_bench<Tree>(name, threads, size, tree, results);
 
     //Empty the tree
     for(unsigned int i = 0; i < size; ++i){
@@ -710,11 +764,9 @@ void search_sequential_bench(const std::string& name, unsigned int size, Results
 }
 
 #define SEARCH_SEQUENTIAL(type, name, size)\
-    search_sequential_bench<type<int, 1>, 1>(name, size, results);\
-    search_sequential_bench<type<int, 2>, 2>(name, size, results);\
-    search_sequential_bench<type<int, 3>, 3>(name, size, results);\
-    search_sequential_bench<type<int, 4>, 4>(name, size, results);\
-    search_sequential_bench<type<int, 8>, 8>(name, size, results);
+    for(unsigned int threads : {1, 2, 3, 4, 8}){\
+        search_sequential_bench<type<int, DynamicThreads>>(name, threads, size, results);\
+    }
 
 void search_sequential_bench(){
     std::cout << "Bench the search performances of each data structure with sequential insertion" << std::endl;
@@ -731,6 +783,7 @@ void search_sequential_bench(){
 
         for(int i = 0; i < REPEAT; ++i){
             SEARCH_SEQUENTIAL(skiplist::SkipList, "skiplist", size);
+            SEARCH_SEQUENTIAL(skiplist::PackedSkipList, "packed-skiplist", size);
             SEARCH_SEQUENTIAL(nbbst::NBBST, "nbbst", size);
             SEARCH_SEQUENTIAL(avltree::AVLTree, "avltree", size);
             SEARCH_SEQUENTIAL(lfmst::MultiwaySearchTree, "lfmst", size);
@@ -754,6 +807,7 @@ void search_sequential_bench(){
 
         for(int i = 0; i < REPEAT; ++i){
             SEARCH_SEQUENTIAL(skiplist::SkipList, "skiplist", size);
+            SEARCH_SEQUENTIAL(skiplist::PackedSkipList, "packed-skiplist", size);
             //The nbbst is far too slow SEARCH_SEQUENTIAL(nbbst::NBBST, "nbbst", size);
             SEARCH_SEQUENTIAL(avltree::AVLTree, "avltree", size);
             SEARCH_SEQUENTIAL(lfmst::MultiwaySearchTree, "lfmst", size);
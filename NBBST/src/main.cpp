@@ -1,5 +1,6 @@
 #include <iostream>
 #include <getopt.h>
+#include <string>
 
 #include "test.hpp"
 #include "bench.hpp"
@@ -20,12 +21,31 @@ int main(int argc, const char* argv[]) {
     
     t = 0;              //default nbbt, lfmst, cbtree mode (reduce stats)
     
+    bool f = false;     //default tree sized at runtime
+    
+    //The tests and the full benchmark are launched on their own
+    if(argc == 2){
+        std::string arg = argv[1];
+
+        if(arg == "-test"){
+            test();
+            return 0;
+        } else if(arg == "-perf"){
+            bench();
+            return 0;
+        } else if(arg == "-all"){
+            test();
+            bench();
+            return 0;
+        }
+    }
+
     fprintf(stderr,"\n(NOT!) DeltaTree\n===============\n\n");
 
   	int myopt;
   
  while( EOF != myopt ) {
-        myopt = getopt(argc,(char **)argv,"r:t:n:i:u:s:d:h:");
+        myopt = getopt(argc,(char **)argv,"r:t:n:i:u:s:d:fh:");
         switch( myopt ) {
     
             case 'r': r = atoi( optarg ); break;
@@ -34,14 +54,17 @@ int main(int argc, const char* argv[]) {
             case 'u': u = atoi( optarg ); break;
             case 's': s = atoi( optarg ); break;
             case 't': t = atof( optarg ); break;
+            case 'f': f = true; break;
             case 'h': fprintf(stderr,"Accepted parameters\n");
                 fprintf(stderr,"-r <NUM>    : Range size\n");
                 fprintf(stderr,"-u <0..100> : Update ratio. 0 = Only search; 100 = Only updates\n");
                 fprintf(stderr,"-i <NUM>    : Initial tree size (inital pre-filled element count)\n");
                 fprintf(stderr,"-n <NUM>    : Number of threads\n");
                 fprintf(stderr,"-s <NUM>    : Random seed. 0 = using time as seed\n");
+                fprintf(stderr,"-f          : Use the tree with the thread count fixed at compile time (1, 2, 4, 8, 16 or 32 threads)\n");
                 fprintf(stderr,"-v <0,1,2,3>: Concurrent tree type. 0 = Non-Blocking Binary Search Tree (default); 1 = Optimistic AVL Tree; 2 = Lock Free Multiway Search Tree; 3 = Counter Based Tree\n");
-                fprintf(stderr,"-h          : This help\n\n");
+                fprintf(stderr,"-h          : This help\n");
+                fprintf(stderr,"-test, -perf, -all : Alone, launch the tests, the full benchmark or both\n\n");
                 fprintf(stderr,"Benchmark output format: \n\"0: range, insert ratio, delete ratio, #threads, attempted insert, attempted delete, attempted search, effective insert, effective delete, effective search, time (in msec)\"\n\n");
                 exit(0);
         }
@@ -52,6 +75,7 @@ int main(int argc, const char* argv[]) {
     fprintf(stderr,"- Number of threads n:\t %d\n", n);
     fprintf(stderr,"- Initial tree size i:\t %d\n", i);
     fprintf(stderr,"- Random seed s:\t %d\n", s);
+    fprintf(stderr,"- Threads fixed at compile time f: %s\n", f ? "yes" : "no");
     fprintf(stderr,"- Concurrent tree type t:%d = ", t);
     
     if(t == 0){
@@ -74,29 +98,7 @@ int main(int argc, const char* argv[]) {
 	else
 		srand(s);
 
-    start_benchmark(i, r, u, n, t);
+    start_benchmark(i, r, u, n, t, f);
     
-/*
-
-    //By default launch perf test
-    if(argc == 1){
-        bench();
-    } else if(argc == 2) {
-        std::string arg = argv[1];
-
-        if(arg == "-perf"){
-            bench();
-        } else if(arg == "-test"){
-            test();
-        } else if(arg == "-all"){
-            test();
-            bench();
-        } else {
-            std::cout << "Unrecognized option " << arg << std::endl;
-        }
-    } else {
-        std::cout << "Too many arguments" << std::endl;
-    }
-*/
     return 0;
 }
@@ -1,62 +1,17 @@
 #include <malloc.h>
-#include <pthread.h>
-#include <unordered_map>
 
-static void* (*old_malloc_hook)(size_t, const void*);
-static void (*old_free_hook)(void*, const void*);
-
-static unsigned long allocated = 0;
-
-static bool end = false;
-static std::unordered_map<void*, size_t> sizes;
-
-static void* rqmalloc_hook(size_t size, const void* source);
-static void rqfree_hook(void* memory, const void* source);
-
-static void* rqmalloc_hook(size_t size, const void* /* source*/){
-    void* result;
-    
-    __malloc_hook = old_malloc_hook;
-    __free_hook = old_free_hook;
-    
-    result = malloc(size);
-
-    old_malloc_hook = __malloc_hook;
-    old_free_hook = __free_hook;
-
-    if(!end){
-        sizes[result] = size;
-        allocated += size;
-    }
-
-    __malloc_hook = rqmalloc_hook;
-    __free_hook = rqfree_hook;
-
-    return result;
-}
-
-static void rqfree_hook(void* memory, const void* /* source */){
-    __malloc_hook = old_malloc_hook;
-    __free_hook = old_free_hook;
-    
-    free(memory);
-
-    old_malloc_hook = __malloc_hook;
-    old_free_hook = __free_hook;
-    
-    if(!end){
-        allocated -= sizes[memory];
-    }
-
-    __malloc_hook = rqmalloc_hook;
-    __free_hook = rqfree_hook;
-}
-
-void memory_init(){
-    old_malloc_hook = __malloc_hook;
-    old_free_hook = __free_hook;
-    __malloc_hook = rqmalloc_hook;
-    __free_hook = rqfree_hook;
+/*
+ * The bytes in use in the heap, whether the trees allocate with new, malloc or posix_memalign. 
+ * The benchmark runs in a single thread, so everything comes from the main arena. 
+ */
+static unsigned long heap_usage(){
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+    struct mallinfo2 info = mallinfo2();
+#else
+    struct mallinfo info = mallinfo();
+#endif
+
+    return info.uordblks + info.hblkhd;
 }
 
 #include <string>
@@ -65,11 +20,15 @@ void memory_init(){
 #include <sstream>
 #include <algorithm>
 #include <set>
+#include <random>
+#include <limits>
+#include <functional>
 
 #include "Results.hpp"
 
 //Include all the trees implementations
 #include "skiplist/SkipList.hpp"
+#include "skiplist/PackedSkipList.hpp"
 #include "nbbst/NBBST.hpp"
 #include "avltree/AVLTree.hpp"
 #include "lfmst/MultiwaySearchTree.hpp"
@@ -93,7 +52,7 @@ void memory(const std::string& name, unsigned int size, Results& results){
     random_shuffle(elements.begin(), elements.end());
 
     //For now on, count all the allocations
-    allocated = 0;
+    unsigned long start = heap_usage();
 
     Tree* alloc_tree = new Tree();
     Tree& tree = *alloc_tree;
@@ -103,7 +62,7 @@ void memory(const std::string& name, unsigned int size, Results& results){
         tree.add(elements[i]);
     }
     
-    unsigned long usage = allocated;
+    unsigned long usage = heap_usage() - start;
     
     std::cout << name << "-" << size << " is using " << (usage / 1024) << " KB" << std::endl;
     results.add_result(name, (usage / 1024.0));
@@ -145,7 +104,7 @@ void memory_high(const std::string& name, unsigned int size, Results& results){
     random_shuffle(vector_elements.begin(), vector_elements.end());
 
     //For now on, count all the allocations
-    allocated = 0;
+    unsigned long start = heap_usage();
 
     Tree* alloc_tree = new Tree();
     Tree& tree = *alloc_tree;
@@ -154,7 +113,7 @@ void memory_high(const std::string& name, unsigned int size, Results& results){
         tree.add(i);
     }
 
-    unsigned long usage = allocated;
+    unsigned long usage = heap_usage() - start;
     
     std::cout << name << "-" << size << " is using " << (usage / 1024) << " KB" << std::endl;
     results.add_result(name, (usage / 1024.0));
@@ -171,8 +130,6 @@ void memory_high(const std::string& name, unsigned int size, Results& results){
  * Launch the memory tests depending on the arguments
  */
 int main(int argc, const char* argv[]) {
-    memory_init();
-
     std::vector<unsigned int> little_sizes = {1000, 10000, 100000};
     std::vector<unsigned int> big_sizes = {1000000, 10000000};
 
@@ -192,6 +149,7 @@ int main(int argc, const char* argv[]) {
 
             for(auto size : little_sizes){
                 memory<skiplist::SkipList<int, 32>>("skiplist", size, results);
+                memory<skiplist::PackedSkipList<int, 32>>("packed-skiplist", size, results);
                 memory<nbbst::NBBST<int, 32>>("nbbst", size, results);
                 memory<lfmst::MultiwaySearchTree<int, 32>>("lfmst", size, results);
                 memory<avltree::AVLTree<int, 32>>("avltree", size, results);
@@ -205,6 +163,7 @@ int main(int argc, const char* argv[]) {
 
             for(auto size : big_sizes){
                 memory<skiplist::SkipList<int, 32>>("skiplist", size, results);
+                memory<skiplist::PackedSkipList<int, 32>>("packed-skiplist", size, results);
                 memory<nbbst::NBBST<int, 32>>("nbbst", size, results);
                 memory<lfmst::MultiwaySearchTree<int, 32>>("lfmst", size, results);
                 memory<avltree::AVLTree<int, 32>>("avltree", size, results);
@@ -221,6 +180,7 @@ int main(int argc, const char* argv[]) {
 
             for(auto size : little_sizes){
                 memory_high<skiplist::SkipList<int, 32>>("skiplist", size, results);
+                memory_high<skiplist::PackedSkipList<int, 32>>("packed-skiplist", size, results);
                 memory_high<nbbst::NBBST<int, 32>>("nbbst", size, results);
                 memory_high<lfmst::MultiwaySearchTree<int, 32>>("lfmst", size, results);
                 memory_high<avltree::AVLTree<int, 32>>("avltree", size, results);
@@ -234,6 +194,7 @@ int main(int argc, const char* argv[]) {
 
             for(auto size : big_sizes){
                 memory_high<skiplist::SkipList<int, 32>>("skiplist", size, results);
+                memory_high<skiplist::PackedSkipList<int, 32>>("packed-skiplist", size, results);
                 memory_high<nbbst::NBBST<int, 32>>("nbbst", size, results);
                 memory_high<lfmst::MultiwaySearchTree<int, 32>>("lfmst", size, results);
                 memory_high<avltree::AVLTree<int, 32>>("avltree", size, results);
@@ -246,7 +207,5 @@ int main(int argc, const char* argv[]) {
         }
     }
 
-    end = true;
-
     return 0;
 }
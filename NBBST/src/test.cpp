@@ -10,6 +10,11 @@
 #include <functional>
 #include <thread>
 #include <algorithm>
+#include <atomic>
+#include <set>
+#include <map>
+#include <limits>
+#include <memory>
 
 #include <sys/time.h>
 
@@ -95,10 +100,11 @@ int pthread_barrier_wait(pthread_barrier_t *barrier)
 #include "tree_type_traits.hpp"
 
 //Include all the trees implementations
-//#include "skiplist/SkipList.hpp"
+#include "skiplist/SkipList.hpp"
+#include "skiplist/PackedSkipList.hpp"
 #include "nbbst/NBBST.hpp"
 //#include "avltree/AVLTree.hpp"
-//#include "lfmst/MultiwaySearchTree.hpp"
+#include "lfmst/MultiwaySearchTree.hpp"
 //#include "cbtree/CBTree.hpp"
 
 #define __THREAD_PINNING 1
@@ -125,7 +131,7 @@ void testST(const std::string& name){
 
     thread_num = 0;
     
-    T tree;
+    T tree(1);
     
     std::mt19937_64 engine(time(NULL));
 
@@ -221,12 +227,12 @@ void testST(const std::string& name){
 
 /*!
  * Launch the multithreaded tests on the given tree type. 
- * \param T The type of tree to test.
- * \param Threads The number of threads. 
+ * \param T The type of tree to test, sized at runtime.
+ * \param threads The number of threads. 
  */
-template<typename T, unsigned int Threads>
-void testMT(){
-    T tree;
+template<typename T>
+void testMT(unsigned int threads){
+    T tree(threads);
 
     DEBUG("Insert and remove sequential numbers from the tree")
 
@@ -237,9 +243,9 @@ void testMT(){
     }
 
     std::vector<std::thread> pool;
-    for(unsigned int i = 0; i < Threads; ++i){
+    for(unsigned int i = 0; i < threads; ++i){
         pool.push_back(std::thread([sequential_nodes, &tree, i](){
-            thread_num = i;
+            register_thread();
 
             //Insert sequential numbers
             for(unsigned int j = i * sequential_nodes; j < (i + 1) * sequential_nodes; ++j){
@@ -254,6 +260,8 @@ void testMT(){
                 assert(tree.remove(j));   
                 assert(!tree.contains(j));
             }
+
+            unregister_thread();
         }));
     }
 
@@ -262,14 +270,16 @@ void testMT(){
     
     DEBUG("Verify that all the numbers have been removed correctly")
     
-    for(unsigned int i = 0; i < Threads; ++i){
-        pool.push_back(std::thread([sequential_nodes, &tree, i](){
-            thread_num = i;
+    for(unsigned int i = 0; i < threads; ++i){
+        pool.push_back(std::thread([sequential_nodes, &tree, threads, i](){
+            register_thread();
 
             //Verify that every numbers has been removed correctly
-            for(unsigned int j = 0; j < Threads * sequential_nodes; ++j){
+            for(unsigned int j = 0; j < threads * sequential_nodes; ++j){
                 assert(!tree.contains(j));
             }
+
+            unregister_thread();
         }));
     }
 
@@ -283,7 +293,7 @@ void testMT(){
     
     DEBUG("Compute the fixed points")
 
-    while(fixed_points.size() < Threads){
+    while(fixed_points.size() < threads){
         auto value = fixed_distribution(fixed_engine);
         
         if(std::find(fixed_points.begin(), fixed_points.end(), value) == fixed_points.end()){
@@ -295,9 +305,9 @@ void testMT(){
     
     DEBUG("Make some operations by ensuring that the fixed points are not modified")
 
-    for(unsigned int i = 0; i < Threads; ++i){
+    for(unsigned int i = 0; i < threads; ++i){
         pool.push_back(std::thread([&tree, &fixed_points, i](){
-            thread_num = i;
+            register_thread();
 
             std::vector<int> rand;
             
@@ -331,6 +341,8 @@ void testMT(){
             for(auto& value : rand){
                 tree.remove(value);
             }
+
+            unregister_thread();
         }));
     }
 
@@ -338,7 +350,269 @@ void testMT(){
 
     for_each(fixed_points.begin(), fixed_points.end(), [&tree](int value){tree.remove(value);});
     
-    std::cout << "Test with " << Threads << " threads passed succesfully" << std::endl;
+    std::cout << "Test with " << threads << " threads passed succesfully" << std::endl;
+}
+
+/*!
+ * Test the range queries of the given tree type, first against a reference set, then while the 
+ * other threads update the tree. 
+ * \param T The type of tree to test.
+ * \param Threads The number of threads, the first one makes the range queries. 
+ */
+template<typename T, unsigned int Threads>
+void testRange(const std::string& name){
+    std::cout << "Test range queries with " << Threads << " threads " << name << std::endl;
+
+    thread_num = 0;
+
+    T tree;
+    std::set<int> reference;
+    std::vector<int> keys;
+
+    std::mt19937_64 engine(time(NULL));
+    std::uniform_int_distribution<int> distribution(0, ST_N - 1);
+    auto generator = std::bind(distribution, engine);
+
+    DEBUG("Compare ranges with a reference set")
+
+    for(unsigned int i = 0; i < ST_N; ++i){
+        int number = generator();
+
+        if(i % 3 == 0){
+            assert(tree.remove(number) == (reference.erase(number) == 1));
+        } else {
+            assert(tree.add(number) == reference.insert(number).second);
+        }
+
+        if(i % 1000 == 0){
+            int low = generator();
+            int high = low + generator() / 10;
+
+            tree.range(low, high, keys);
+            assert(std::equal(keys.begin(), keys.end(), reference.lower_bound(low)));
+            assert(keys.size() == (std::size_t) std::distance(reference.lower_bound(low), reference.upper_bound(high)));
+        }
+    }
+
+    tree.range(std::numeric_limits<int>::min(), std::numeric_limits<int>::max(), keys);
+    assert(keys.size() == reference.size() && std::equal(keys.begin(), keys.end(), reference.begin()));
+
+    DEBUG("Range queries while tokens are moved down")
+
+    //Each updater keeps a token at low or at high, and only moves it down by inserting the new
+    //position before removing the old one: a walk that is not atomic can miss it
+    const int low = -(int) Threads;
+    const int high = ST_N + Threads;
+    std::atomic<unsigned int> running(Threads - 1);
+
+    for(unsigned int i = 1; i < Threads; ++i){
+        assert(tree.add(high + i));
+    }
+
+    std::vector<std::thread> pool;
+    for(unsigned int i = 1; i < Threads; ++i){
+        pool.push_back(std::thread([&tree, &running, low, high, i](){
+            thread_num = i;
+
+            std::mt19937_64 engine(time(0) + i);
+            std::uniform_int_distribution<int> distribution(0, ST_N - 1);
+            auto generator = std::bind(distribution, engine);
+
+            for(int n = 0; n < 100000; ++n){
+                if(n % 2){
+                    tree.add(generator());
+                } else {
+                    tree.remove(generator());
+                }
+
+                assert(tree.add(low + i));
+                assert(tree.remove(high + i));
+                assert(tree.add(high + i));
+                assert(tree.remove(low + i));
+            }
+
+            --running;
+        }));
+    }
+
+    while(running > 0){
+        tree.range(low, high + Threads, keys);
+
+        std::vector<unsigned int> tokens(Threads, 0);
+        for(std::size_t j = 0; j < keys.size(); ++j){
+            assert(j == 0 || keys[j - 1] < keys[j]);
+
+            if(keys[j] < 0){
+                ++tokens[keys[j] - low];
+            } else if(keys[j] > high){
+                ++tokens[keys[j] - high];
+            }
+        }
+
+        for(unsigned int i = 1; i < Threads; ++i){
+            assert(tokens[i] == 1 || tokens[i] == 2);
+        }
+    }
+
+    for_each(pool.begin(), pool.end(), [](std::thread& t){t.join();});
+
+    DEBUG("Range queries while the updates never stop")
+
+    //The updaters only stop once the queries are done, so a query has to end while they go on
+    std::atomic<bool> stop(false);
+    pool.clear();
+
+    for(unsigned int i = 1; i < Threads; ++i){
+        pool.push_back(std::thread([&tree, &stop, low, high, i](){
+            thread_num = i;
+
+            while(!stop){
+                assert(tree.add(low + i));
+                assert(tree.remove(high + i));
+                assert(tree.add(high + i));
+                assert(tree.remove(low + i));
+            }
+        }));
+    }
+
+    for(unsigned int n = 0; n < 1000; ++n){
+        tree.range(low, high + Threads, keys);
+
+        std::vector<unsigned int> tokens(Threads, 0);
+        for(std::size_t j = 0; j < keys.size(); ++j){
+            if(keys[j] < 0){
+                ++tokens[keys[j] - low];
+            } else if(keys[j] > high){
+                ++tokens[keys[j] - high];
+            }
+        }
+
+        for(unsigned int i = 1; i < Threads; ++i){
+            assert(tokens[i] == 1 || tokens[i] == 2);
+        }
+    }
+
+    stop = true;
+    for_each(pool.begin(), pool.end(), [](std::thread& t){t.join();});
+
+    std::cout << "Test passed successfully" << std::endl;
+}
+
+/*!
+ * Test a tree mapping keys of any type to int values, against a reference map. 
+ * \param T The type of tree to test.
+ * \param K The type of key.
+ * \param name The name of the test. 
+ * \param key Gives the key of a random number. 
+ * \param extremes Keys that must be accepted like any other. 
+ */
+template<typename T, typename K, typename Key>
+void testValues(const std::string& name, Key key, const std::vector<K>& extremes){
+    std::cout << "Test keys and values " << name << std::endl;
+
+    thread_num = 0;
+
+    T tree(1);
+    std::map<K, int> reference;
+    std::vector<K> keys;
+    int value;
+
+    std::mt19937_64 engine(time(NULL));
+
+    DEBUG("Insert keys with their value")
+
+    for(unsigned int i = 0; i < ST_N + extremes.size(); ++i){
+        K k = i < extremes.size() ? extremes[i] : key(engine());
+
+        if(reference.insert(std::make_pair(k, i)).second){
+            assert(!tree.contains(k));
+            assert(tree.add(k, i));
+        } else {
+            assert(!tree.add(k, i));
+        }
+    }
+
+    DEBUG("Find the values")
+
+    for(auto& entry : reference){
+        assert(tree.find(entry.first, value));
+        assert(value == entry.second);
+    }
+
+    tree.range(reference.begin()->first, reference.rbegin()->first, keys);
+    assert(keys.size() == reference.size());
+
+    for(std::size_t i = 0; i < keys.size(); ++i){
+        assert(i == 0 || keys[i - 1] < keys[i]);
+        assert(reference.count(keys[i]));
+    }
+
+    DEBUG("Remove every other key")
+
+    bool removed = false;
+    for(auto& entry : reference){
+        if((removed = !removed)){
+            assert(tree.remove(entry.first));
+            assert(!tree.find(entry.first, value));
+        } else {
+            assert(tree.find(entry.first, value));
+            assert(value == entry.second);
+        }
+    }
+
+    removed = false;
+    for(auto& entry : reference){
+        if(!(removed = !removed)){
+            assert(tree.remove(entry.first));
+        }
+
+        assert(!tree.contains(entry.first));
+    }
+
+    std::cout << "Test passed successfully" << std::endl;
+}
+
+/*!
+ * Compare the batched lookups of the given structure with its single lookups. 
+ * \param T The type of the structure.
+ * \param name The name of the structure being tested. 
+ */
+template<typename T>
+void testBatch(const std::string& name){
+    std::cout << "Test batched lookups " << name << std::endl;
+
+    thread_num = 0;
+
+    T tree(1);
+
+    std::mt19937_64 engine(time(NULL));
+    std::uniform_int_distribution<int> distribution(std::numeric_limits<int>::min(), std::numeric_limits<int>::max());
+
+    std::vector<int> values;
+    for(unsigned int i = 0; i < ST_N; ++i){
+        values.push_back(distribution(engine));
+    }
+
+    DEBUG("Insert every other value")
+
+    for(unsigned int i = 0; i < values.size(); i += 2){
+        tree.add(values[i]);
+    }
+
+    std::unique_ptr<bool[]> results(new bool[values.size()]);
+
+    //Fewer values than lookups in flight, then a count that is not a multiple of it
+    for(std::size_t count : {static_cast<std::size_t>(0), static_cast<std::size_t>(1), static_cast<std::size_t>(5), values.size() - 3}){
+        DEBUG("Look for " << count << " values at once")
+
+        tree.contains(&values[0], count, results.get());
+
+        for(std::size_t i = 0; i < count; ++i){
+            assert(results[i] == tree.contains(values[i]));
+        }
+    }
+
+    std::cout << "Test passed successfully" << std::endl;
 }
 
 /*!
@@ -350,14 +624,9 @@ void testMT(){
     std::cout << "Test with 1 threads" << std::endl;\
     testST<type<int, 1>>(name);\
     std::cout << "Test multi-threaded (with " << MT_N << " elements) " << name << std::endl;\
-    testMT<type<int, 2>, 2>();\
-    testMT<type<int, 3>, 3>();\
-    testMT<type<int, 4>, 4>();\
-    testMT<type<int, 6>, 6>();\
-    testMT<type<int, 8>, 8>();\
-    testMT<type<int, 12>, 12>();\
-    testMT<type<int, 16>, 16>();\
-    testMT<type<int, 32>, 32>();
+    for(unsigned int threads : {2, 3, 4, 6, 8, 12, 16, 32}){\
+        testMT<type<int, DynamicThreads>>(threads);\
+    }
 
 /*!
  * Test all the different versions.
@@ -365,10 +634,20 @@ void testMT(){
 void test(){
     std::cout << "Tests the different versions" << std::endl;
 
-    //TEST(skiplist::SkipList, "SkipList")
+    TEST(skiplist::SkipList, "SkipList")
+    TEST(skiplist::PackedSkipList, "Packed SkipList")
     TEST(nbbst::NBBST, "Non-Blocking Binary Search Tree")
+    testRange<nbbst::NBBST<int, 2>, 2>("Non-Blocking Binary Search Tree");
+    testRange<nbbst::NBBST<int, 4>, 4>("Non-Blocking Binary Search Tree");
+    testValues<nbbst::NBBST<long, 1, int>, long>("64-bit keys", 
+            [](unsigned long random){ return static_cast<long>(random); },
+            {std::numeric_limits<long>::min(), std::numeric_limits<long>::max(), 0});
+    testValues<nbbst::NBBST<fixed_string<16>, 1, int>, fixed_string<16>>("16-byte string keys", 
+            [](unsigned long random){ return fixed_string<16>(std::to_string(random % (ST_N * 10))); },
+            {fixed_string<16>(""), fixed_string<16>("\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff")});
     //TEST(avltree::AVLTree, "Optimistic AVL Tree")
-    //TEST(lfmst::MultiwaySearchTree, "Lock Free Multiway Search Tree");
+    TEST(lfmst::MultiwaySearchTree, "Lock Free Multiway Search Tree")
+    testBatch<lfmst::MultiwaySearchTree<int, 1>>("Lock Free Multiway Search Tree");
     //TEST(cbtree::CBTree, "Counter Based Tree");
 }
 
@@ -432,7 +711,7 @@ struct arg_bench {
     int threads;
 };
 
-template<typename T, unsigned int Threads>
+template<typename T>
 int benchmark(unsigned int threads, int size, float ins, float del, int initial){
     long *inputs;
     int *ops;
@@ -451,7 +730,7 @@ int benchmark(unsigned int threads, int size, float ins, float del, int initial)
     prepare_randintp(ins, del);
     
     
-    T tree;
+    T tree(threads);
     
     /* Fill in value based on initial number */
     if(initial > 0){
@@ -505,14 +784,14 @@ int benchmark(unsigned int threads, int size, float ins, float del, int initial)
             int threads = args[i].threads;
             long ncores = sysconf( _SC_NPROCESSORS_ONLN );
             int midcores = (int)ncores/2;
+            int core = i;
 
             if(threads > midcores && threads < ncores){
                 if(i >= (threads/2))
-                    thread_num = i - (threads/2) + midcores;
-                else
-                    thread_num = i;
-            }else
-                    thread_num = i;
+                    core = i - (threads/2) + midcores;
+            }
+
+            thread_num = i;
             
             //std::cout << "Done: " << i << " thread" << std::endl;
             
@@ -527,11 +806,11 @@ int benchmark(unsigned int threads, int size, float ins, float del, int initial)
 #if (__THREAD_PINNING == 1)
             cpu_set_t cpuset;
             CPU_ZERO(&cpuset);
-            CPU_SET(thread_num, &cpuset);
+            CPU_SET(core, &cpuset);
             
             pthread_t current_thread = pthread_self();
             
-            fprintf(stdout, "Pinning to core %d... %s\n", thread_num, pthread_setaffinity_np(current_thread, sizeof(cpu_set_t), &cpuset)==0?"Success":"Failed");
+            fprintf(stdout, "Pinning to core %d... %s\n", core, pthread_setaffinity_np(current_thread, sizeof(cpu_set_t), &cpuset)==0?"Success":"Failed");
 #endif
 #endif
             pthread_barrier_wait(&bench_barrier);
@@ -631,39 +910,26 @@ pcm_bench_print();
     return 0;
 }
 
-void start_benchmark(int initial, int key_size, int updaterate, int num_thread, int treetype){
+void start_benchmark(int initial, int key_size, int updaterate, int num_thread, int treetype, bool fixed_threads){
     
     float update = (float)updaterate/2;
     
     if(treetype == 0){
         //std::cout << "Non-Blocking Binary Search Tree" << std::endl;
+        if(!fixed_threads){
+            benchmark<nbbst::NBBST<int, DynamicThreads>>(num_thread, key_size, update, update, initial);
+            return;
+        }
+
+        //The thread count fixed at compile time, to compare against
         switch(num_thread){
-            case 1: benchmark<nbbst::NBBST<int, 1>, 1>(1, key_size, update, update, initial); break;
-            case 2: benchmark<nbbst::NBBST<int, 2>, 2>(2, key_size, update, update, initial); break;
-            case 3: benchmark<nbbst::NBBST<int, 3>, 3>(3, key_size, update, update, initial); break;
-            case 4: benchmark<nbbst::NBBST<int, 4>, 4>(4, key_size, update, update, initial); break;
-            case 5: benchmark<nbbst::NBBST<int, 5>, 5>(5, key_size, update, update, initial); break;
-            case 6: benchmark<nbbst::NBBST<int, 6>, 6>(6, key_size, update, update, initial); break;
-            case 7: benchmark<nbbst::NBBST<int, 7>, 7>(7, key_size, update, update, initial); break;
-            case 8: benchmark<nbbst::NBBST<int, 8>, 8>(8, key_size, update, update, initial); break;
-            case 9: benchmark<nbbst::NBBST<int, 9>, 9>(9, key_size, update, update, initial); break;
-            case 10: benchmark<nbbst::NBBST<int, 10>, 10>(10, key_size, update, update, initial); break;
-            case 11: benchmark<nbbst::NBBST<int, 11>, 11>(11, key_size, update, update, initial); break;
-            case 12: benchmark<nbbst::NBBST<int, 12>, 12>(12, key_size, update, update, initial); break;
-            case 13: benchmark<nbbst::NBBST<int, 13>, 13>(13, key_size, update, update, initial); break;
-            case 14: benchmark<nbbst::NBBST<int, 14>, 14>(14, key_size, update, update, initial); break;
-            case 15: benchmark<nbbst::NBBST<int, 15>, 15>(15, key_size, update, update, initial); break;
-            case 16: benchmark<nbbst::NBBST<int, 16>, 16>(16, key_size, update, update, initial); break;
-            case 17: benchmark<nbbst::NBBST<int, 17>, 17>(17, key_size, update, update, initial); break;
-            case 18: benchmark<nbbst::NBBST<int, 18>, 18>(18, key_size, update, update, initial); break;
-            case 19: benchmark<nbbst::NBBST<int, 19>, 19>(19, key_size, update, update, initial); break;
-            case 20: benchmark<nbbst::NBBST<int, 20>, 20>(20, key_size, update, update, initial); break;
-            case 21: benchmark<nbbst::NBBST<int, 21>, 21>(21, key_size, update, update, initial); break;
-            case 22: benchmark<nbbst::NBBST<int, 22>, 22>(22, key_size, update, update, initial); break;
-            case 23: benchmark<nbbst::NBBST<int, 23>, 23>(23, key_size, update, update, initial); break;
-            case 24: benchmark<nbbst::NBBST<int, 24>, 24>(24, key_size, update, update, initial); break;
-            default: break;
+            case 1: benchmark<nbbst::NBBST<int, 1>>(1, key_size, update, update, initial); break;
+            case 2: benchmark<nbbst::NBBST<int, 2>>(2, key_size, update, update, initial); break;
+            case 4: benchmark<nbbst::NBBST<int, 4>>(4, key_size, update, update, initial); break;
+            case 8: benchmark<nbbst::NBBST<int, 8>>(8, key_size, update, update, initial); break;
+            case 16: benchmark<nbbst::NBBST<int, 16>>(16, key_size, update, update, initial); break;
+            case 32: benchmark<nbbst::NBBST<int, 32>>(32, key_size, update, update, initial); break;
+            default: std::cout << "No tree with " << num_thread << " threads fixed at compile time" << std::endl; break;
         }
     }
 }
-
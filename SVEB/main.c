@@ -28,7 +28,7 @@ int main(int argc, char **argv ) {
     int myopt = 0;
 
     float  d;
-    int s, u, n, i, t, r, v;       //Various parameters
+    int s, u, n, i, t, r, v, p;    //Various parameters
     
     
     //myname = argv[0];
@@ -39,6 +39,7 @@ int main(int argc, char **argv ) {
     u = 10;             //default update rate
     s = 0;              //default seed
     n = 1;              //default number of thread
+    p = 0;              //default rebuild threads (one per core)
     d = (float)1/2;     //default density
     
     v=0;                //default valgrind mode (reduce stats)
@@ -49,7 +50,7 @@ int main(int argc, char **argv ) {
     fprintf(stderr,"Use -h switch for help.\n\n");
     
     while( EOF != myopt ) {
-        myopt = getopt(argc,argv,"r:t:n:i:u:s:d:v:hb:");
+        myopt = getopt(argc,argv,"r:t:n:i:u:s:d:v:p:hb:");
         switch( myopt ) {
             case 'r': r = atoi( optarg ); break;
             case 'n': n = atoi( optarg ); break;
@@ -59,6 +60,7 @@ int main(int argc, char **argv ) {
             case 's': s = atoi( optarg ); break;
             case 'd': d = atof( optarg ); break;
             case 'v': v = atof( optarg ); break;
+            case 'p': p = atoi( optarg ); break;
             case 'h': fprintf(stderr,"Accepted parameters\n");
                 fprintf(stderr,"-r <NUM>    : Range size\n");
                 fprintf(stderr,"-u <0..100> : Update ratio. 0 = Only search; 100 = Only updates\n");
@@ -66,6 +68,7 @@ int main(int argc, char **argv ) {
                 fprintf(stderr,"-t <NUM>    : VEB  size\n");
                 fprintf(stderr,"-n <NUM>    : Number of threads\n");
                 fprintf(stderr,"-s <NUM>    : Random seed. 0 = using time as seed\n");
+                fprintf(stderr,"-p <NUM>    : Threads rebuilding the array on a resize. 0 = one per core\n");
                 fprintf(stderr,"-h          : This help\n\n");
                 fprintf(stderr,"Benchmark output format: \n\"0: range, insert ratio, delete ratio, #threads, attempted insert, attempted delete, attempted search, effective insert, effective delete, effective search, time (in msec)\"\n\n");
                 exit(0);
@@ -86,6 +89,7 @@ int main(int argc, char **argv ) {
 
 
 
+    set_rebuild_threads(p);
     init_tree(t);
 
 #if !defined(__TEST)
@@ -69,8 +69,6 @@ extern int optind, opterr, optopt;
 
 
 
-volatile domain res;
-
 int n;
 
 
@@ -145,10 +143,38 @@ typedef struct li {
 } levelinfo;
 
 levelinfo *myli;
-int *anc;
-int bf;
 
-int h;
+/*
+ Traversal state of one operation. Each search and insert keeps its own
+ (on the stack), so they share no file-scope state and can run
+ concurrently as far as the array allows.
+ */
+typedef struct veb_ctx {
+    int h;          /* levels left below the current node */
+    int bf;         /* path from the root as bits, the root is 1 */
+    int anc[40];    /* addresses on the path, by height */
+    int level;      /* insert_rec's height for the density thresholds */
+    int lh, rh;     /* range of helper[] being collected / rebuilt */
+    int key;        /* key being inserted */
+    int was_in;     /* insert found the key present */
+    domain res;     /* value at the last search result */
+} veb_ctx;
+
+/* Moves ctx down to the left (right = 0) or right child, returns its address */
+static inline int veb_down(veb_ctx *ctx, int right) {
+    ctx->h--;
+    ctx->bf = 2 * ctx->bf + right;
+    return ctx->anc[ctx->h] = (myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p];
+}
+
+/* Whether the node ctx is on has a non-empty left or right subtree */
+static inline int veb_has_child(const veb_ctx *ctx, int right) {
+    int h = ctx->h - 1, bf = 2 * ctx->bf + right, ad;
+
+    if( h <= 0 ) return 0;
+    ad = (myli[h].bs*(bf&myli[h].ts))+myli[h].ts+ctx->anc[myli[h].p];
+    return ad < size && val[ad] != MAXINT;
+}
 
 void init_height(int top, int bot) {
     int me = (top+bot+1) / 2;
@@ -170,13 +196,205 @@ void initialize_depth( int nn ) {
     myli[0].ts = 0;
     myli[0].bs = 0;
 
-    if(!anc) anc = malloc( 40 * sizeof( int ) );
-    if( !anc ) exit(23);
-
     init_height( max_dep,0);
 }
 
 
+#ifdef SVEB_SEQLOCK
+/*
+ Sequence lock mode: writers still serialize on global_lock, but readers
+ take no lock. A writer makes veb_seq odd while it moves keys around in
+ val (rebalancing a subtree, deleting); filling an empty slot is a single
+ store and needs no bump. Readers search a snapshot and retry when
+ veb_seq moved under them.
+
+ A resize builds the new array off to the side while readers go on with
+ the old one, which nothing writes to anymore, and then publishes a new
+ layout (array, size, depth and level table). The replaced layout is
+ freed as soon as every reader that was searching has left, which the
+ writer waits for: each reader thread has a slot whose time is odd while
+ it is inside a search (same scheme as citrus' URCU).
+ */
+typedef struct veb_layout {
+    domain *val;
+    int size;
+    int max_dep;
+    levelinfo *myli;
+} veb_layout;
+
+#define VEB_MAX_THREADS 512
+#define VEB_CACHE_LINE 64
+
+struct veb_reader {
+    volatile unsigned long time;
+    volatile int used;
+} __attribute__ ((aligned(VEB_CACHE_LINE)));
+
+static veb_layout *veb_cur;
+static volatile unsigned int veb_seq;
+
+static struct veb_reader veb_readers[VEB_MAX_THREADS];
+static volatile int veb_nreaders = 0;
+static __thread struct veb_reader *veb_self = NULL;
+static pthread_key_t veb_key;
+static pthread_once_t veb_key_once = PTHREAD_ONCE_INIT;
+
+static void veb_reader_exit(void *arg) {
+    struct veb_reader *r = arg;
+
+    __atomic_store_n(&r->used, 0, __ATOMIC_RELEASE);
+}
+
+static void veb_key_init(void) {
+    pthread_key_create(&veb_key, veb_reader_exit);
+}
+
+static struct veb_reader *veb_register(void) {
+    int i, n;
+
+    pthread_once(&veb_key_once, veb_key_init);
+
+    for (i = 0; i < VEB_MAX_THREADS; i++) {
+        if (veb_readers[i].used || !__sync_bool_compare_and_swap(&veb_readers[i].used, 0, 1))
+            continue;
+        while ((n = veb_nreaders) <= i && !__sync_bool_compare_and_swap(&veb_nreaders, n, i + 1))
+            ;
+        veb_self = &veb_readers[i];
+        pthread_setspecific(veb_key, veb_self);
+        return veb_self;
+    }
+    fprintf(stderr,"bailing out with code %d\n", 25 ),printf("# error %d\n", 25 ),exit( 25 ) ;
+}
+
+static inline struct veb_reader *veb_enter(void) {
+    struct veb_reader *r = veb_self ? veb_self : veb_register();
+
+    /* Must be visible before we read veb_cur */
+    __atomic_store_n(&r->time, r->time + 1, __ATOMIC_SEQ_CST);
+    return r;
+}
+
+static inline void veb_leave(struct veb_reader *r) {
+    __atomic_store_n(&r->time, r->time + 1, __ATOMIC_RELEASE);
+}
+
+/* Waits until every reader inside a search has left it */
+static void veb_synchronize(void) {
+    unsigned long snap[VEB_MAX_THREADS];
+    int i, n = veb_nreaders;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (i = 0; i < n; i++)
+        snap[i] = veb_readers[i].time;
+
+    for (i = 0; i < n; i++) {
+        if (!(snap[i] & 1))
+            continue;
+        while (veb_readers[i].time == snap[i])
+            __asm__ __volatile__ ("" ::: "memory");
+    }
+}
+
+static inline void veb_write_begin(void) {
+    __atomic_store_n(&veb_seq, veb_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void veb_write_end(void) {
+    __atomic_store_n(&veb_seq, veb_seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline unsigned int veb_read_begin(void) {
+    unsigned int v;
+
+    while ((v = __atomic_load_n(&veb_seq, __ATOMIC_ACQUIRE)) & 1)
+        __asm__ __volatile__ ("" ::: "memory");
+    return v;
+}
+
+static inline int veb_read_retry(unsigned int v) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&veb_seq, __ATOMIC_RELAXED) != v;
+}
+
+static void veb_free_layout(veb_layout *l) {
+    free(l->val);
+    free(l->myli);
+    free(l);
+}
+
+/*
+ Called by the writer once val, size and myli describe a new array.
+ Readers take no lock, so waiting for them under global_lock is safe.
+ */
+static void veb_publish(void) {
+    veb_layout *l = malloc(sizeof(veb_layout)), *old = veb_cur;
+
+    if( !l ) fprintf(stderr,"bailing out with code %d\n", 24 ),printf("# error %d\n", 24 ),exit( 24 ) ;
+    l->val = val;
+    l->size = size;
+    l->max_dep = max_dep;
+    l->myli = myli;
+    __atomic_store_n(&veb_cur, l, __ATOMIC_RELEASE);
+
+    if (old) {
+        veb_synchronize();
+        veb_free_layout(old);
+    }
+}
+
+static void veb_free_layouts(void) {
+    if (veb_cur)
+        veb_free_layout(veb_cur);
+    veb_cur = NULL;
+    val = NULL;
+    myli = NULL;
+}
+
+/*
+ search() on a layout snapshot. Whatever the writer does to the array
+ contents, the walk only depends on the layout, so it never leaves the
+ array; the result is checked by the caller against veb_seq.
+ */
+static int veb_search_snapshot(veb_ctx *ctx, const veb_layout *l, domain key) {
+    const levelinfo *li = l->myli;
+    const domain *v = l->val;
+    int ad = 0, last_right = 0;
+
+    ctx->h = l->max_dep; ctx->bf = 1; ctx->anc[l->max_dep] = 0;
+    while (ad < l->size && ctx->h > 0) {
+        if (key < v[ad]) {
+            ctx->bf = ctx->bf * 2;
+        } else {
+            last_right = ad;
+            ctx->bf = 2 * ctx->bf + 1;
+        }
+        ctx->h--;
+        ad = ctx->anc[ctx->h] = (li[ctx->h].bs * (ctx->bf & li[ctx->h].ts)) + li[ctx->h].ts + ctx->anc[li[ctx->h].p];
+    }
+    return v[last_right] == key;
+}
+
+static int veb_contains(domain key) {
+    struct veb_reader *r = veb_enter();
+    veb_ctx ctx;
+    unsigned int v;
+    int found;
+
+    do {
+        v = veb_read_begin();
+        found = veb_search_snapshot(&ctx, __atomic_load_n(&veb_cur, __ATOMIC_ACQUIRE), key);
+    } while (veb_read_retry(v));
+
+    veb_leave(r);
+    return found;
+}
+#else
+#define veb_write_begin()
+#define veb_write_end()
+#endif
+
+
 
 # 141 "implicit.c"
 
@@ -265,20 +483,20 @@ void initialize_depth( int nn ) {
 
 
 
-void impl_fill_al_rec ( int ad) {
-    if( ! (  ad  < size && h > 0)  ) return;
+void impl_fill_al_rec (veb_ctx *ctx, int ad) {
+    if( ! (  ad  < size && ctx->h > 0)  ) return;
 
 
-    h--; ; ;
-    impl_fill_al_rec ( (bf=bf*2,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) );
-    h++;bf=bf>>1; ; ;
+    ctx->h--; ; ;
+    impl_fill_al_rec ( ctx, (ctx->bf=ctx->bf*2,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) );
+    ctx->h++;ctx->bf=ctx->bf>>1; ; ;
 
 
     ;val[ ad ] = nextvalue++; ;
 
-    h--; ; ;
-    impl_fill_al_rec ( (bf=2*bf+1,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) );
-    h++;bf=bf>>1; ; ;
+    ctx->h--; ; ;
+    impl_fill_al_rec ( ctx, (ctx->bf=2*ctx->bf+1,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) );
+    ctx->h++;ctx->bf=ctx->bf>>1; ; ;
 
 
 
@@ -286,9 +504,10 @@ void impl_fill_al_rec ( int ad) {
 }
 
 void impl_fill () {
+    veb_ctx ctx_local, *ctx = &ctx_local;
     nextvalue=0;size=n;fprintf(stderr,"starting fill %d\n", n); ;
-    h=max_dep;bf=1;anc[max_dep]=0; ;
-    impl_fill_al_rec ( 0  );
+    ctx->h=max_dep;ctx->bf=1;ctx->anc[max_dep]=0; ;
+    impl_fill_al_rec ( ctx, 0  );
     ;
 }
 
@@ -387,20 +606,20 @@ void impl_fill () {
 
 
 
-void impl_acc_al_rec ( int ad) {
-    if( ! (  ad  < size && h > 0)  ) return;
+void impl_acc_al_rec (veb_ctx *ctx, int ad) {
+    if( ! (  ad  < size && ctx->h > 0)  ) return;
 
 
-    h--; ; ;
-    impl_acc_al_rec ( (bf=bf*2,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) );
-    h++;bf=bf>>1; ; ;
+    ctx->h--; ; ;
+    impl_acc_al_rec ( ctx, (ctx->bf=ctx->bf*2,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) );
+    ctx->h++;ctx->bf=ctx->bf>>1; ; ;
 
 
     ;val[ ad ]++; ;
 
-    h--; ; ;
-    impl_acc_al_rec ( (bf=2*bf+1,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) );
-    h++;bf=bf>>1; ; ;
+    ctx->h--; ; ;
+    impl_acc_al_rec ( ctx, (ctx->bf=2*ctx->bf+1,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) );
+    ctx->h++;ctx->bf=ctx->bf>>1; ; ;
 
 
 
@@ -408,9 +627,10 @@ void impl_acc_al_rec ( int ad) {
 }
 
 void impl_acc_all () {
+    veb_ctx ctx_local, *ctx = &ctx_local;
     ;
-    h=max_dep;bf=1;anc[max_dep]=0; ;
-    impl_acc_al_rec ( 0  );
+    ctx->h=max_dep;ctx->bf=1;ctx->anc[max_dep]=0; ;
+    impl_acc_al_rec ( ctx, 0  );
     ;
 }
 
@@ -440,36 +660,36 @@ void impl_acc_all () {
 
 
 
-int search( domain key ) {
+int search(veb_ctx *ctx, domain key) {
 
     int ad= 0 ;
 
     int last_right= 0 ;
 
-    h=max_dep;bf=1;anc[max_dep]=0; ;
+    ctx->h=max_dep;ctx->bf=1;ctx->anc[max_dep]=0; ;
 
 # 274 "implicit.c"
 
-    while( (  ad  < size && h > 0)  ) {
+    while( (  ad  < size && ctx->h > 0)  ) {
 
         ;
         if( ( key <val[ ad ])  ) {
-            h--; ;
-            ad = (bf=bf*2,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) ;
+            ctx->h--; ;
+            ad = (ctx->bf=ctx->bf*2,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) ;
             continue;
         }
         else {
 
             last_right=ad;
-            h--; ;
-            ad= (bf=2*bf+1,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) ;
+            ctx->h--; ;
+            ad= (ctx->bf=2*ctx->bf+1,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) ;
         }
     }
 
 
 
     ;
-    res = val[last_right];
+    ctx->res = val[last_right];
 
 
     return last_right;
@@ -481,13 +701,14 @@ int search( domain key ) {
 
 
 void test_all_searches() {
+    veb_ctx ctx;
     int i,it;
 
 
     for(i=0;i<n;i++) {
 
 
-        it  = search(i);
+        it  = search(&ctx, i);
 
         ;
         if( val[it] != i ) fprintf(stderr,"bailing out with code %d\n", 36 ),printf("# error %d\n", 36 ),exit( 36 ) ;
@@ -503,221 +724,322 @@ void test_all_searches() {
 }
 
 
-int lh,rh;
 int keys=0;
 int *helper;
-int key;
-int was_in;
 
 
 
 
 
-void rebuild( int node ) {
+void rebuild(veb_ctx *ctx, int node) {
     int m,x;
-    if( ! (  node  < size && h > 0)  ) {
-        if( lh <= rh ) fprintf(stderr, "loosing things in rebuild!\n");
+    if( ! (  node  < size && ctx->h > 0)  ) {
+        if( ctx->lh <= ctx->rh ) fprintf(stderr, "loosing things in rebuild!\n");
         return;
     }
-    if( lh > rh ) {
-        h--; ;
-        rebuild( (bf=bf*2,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p])  );
-        h++;bf=bf>>1; ;
+    if( ctx->lh > ctx->rh ) {
+        ctx->h--; ;
+        rebuild( ctx, (ctx->bf=ctx->bf*2,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p])  );
+        ctx->h++;ctx->bf=ctx->bf>>1; ;
 
 
         val[node] = MAXINT ;
-        h--; ;
-        rebuild( (bf=2*bf+1,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p])  );
-        h++;bf=bf>>1; ;
+        ctx->h--; ;
+        rebuild( ctx, (ctx->bf=2*ctx->bf+1,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p])  );
+        ctx->h++;ctx->bf=ctx->bf>>1; ;
         return;
     }
 
-    m = (lh+rh) /2;
-    x=rh;
+    m = (ctx->lh+ctx->rh) /2;
+    x=ctx->rh;
 
-    rh=m-1;
-    h--; ;
-    rebuild( (bf=bf*2,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p])  );
-    h++;bf=bf>>1; ;
-    rh=x;
+    ctx->rh=m-1;
+    ctx->h--; ;
+    rebuild( ctx, (ctx->bf=ctx->bf*2,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p])  );
+    ctx->h++;ctx->bf=ctx->bf>>1; ;
+    ctx->rh=x;
 
     ; ;
     val[node] = helper[m];
-    lh=m+1;
-    h--; ;
-    rebuild( (bf=2*bf+1,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p])  );
-    h++;bf=bf>>1; ;
+    ctx->lh=m+1;
+    ctx->h--; ;
+    rebuild( ctx, (ctx->bf=2*ctx->bf+1,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p])  );
+    ctx->h++;ctx->bf=ctx->bf>>1; ;
+
+}
+
 
+
+/*
+ Parallel rebuild. Below some height the two subtrees of a node are
+ rebuilt from disjoint ranges of helper into disjoint slots of val, so
+ the top levels are filled here and every subtree underneath becomes a
+ task with its own copy of the context. The tasks are shared out to
+ rebuild_threads workers (0: one per core) started for the rebuild;
+ the caller works along. Small subtrees are rebuilt serially.
+ */
+#define VEB_PAR_MIN_HEIGHT 16   /* 64K slots */
+#define VEB_TASKS_PER_THREAD 4
+
+static int rebuild_threads = 0;
+
+void set_rebuild_threads(int t) {
+    rebuild_threads = t;
 }
 
+typedef struct veb_task {
+    veb_ctx ctx;
+    int node;
+} veb_task;
 
+typedef struct veb_rebuild_job {
+    veb_task *tasks;
+    int ntasks;
+    volatile int next;
+} veb_rebuild_job;
 
-int level;
-int l_count(int node) {
+static void rebuild_split(veb_ctx *ctx, int node, int depth, veb_task *tasks, int *ntasks) {
+    int m,x;
+
+    if( depth == 0 || ! (  node  < size && ctx->h > 0) || ctx->lh > ctx->rh ) {
+        tasks[*ntasks].ctx = *ctx;
+        tasks[*ntasks].node = node;
+        (*ntasks)++;
+        return;
+    }
+    m = (ctx->lh+ctx->rh) /2;
+    x=ctx->rh;
+    ctx->rh=m-1;
+    ctx->h--; ;
+    rebuild_split( ctx, (ctx->bf=ctx->bf*2,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]), depth-1, tasks, ntasks );
+    ctx->h++;ctx->bf=ctx->bf>>1; ;
+    ctx->rh=x;
+    val[node] = helper[m];
+    ctx->lh=m+1;
+    ctx->h--; ;
+    rebuild_split( ctx, (ctx->bf=2*ctx->bf+1,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]), depth-1, tasks, ntasks );
+    ctx->h++;ctx->bf=ctx->bf>>1; ;
+}
+
+static void *rebuild_worker(void *arg) {
+    veb_rebuild_job *job = arg;
+    int i;
+
+    while( (i = __sync_fetch_and_add(&job->next, 1)) < job->ntasks )
+        rebuild( &job->tasks[i].ctx, job->tasks[i].node );
+    return NULL;
+}
+
+void rebuild_par(veb_ctx *ctx, int node) {
+    veb_rebuild_job job;
+    pthread_t *workers;
+    int i, depth, threads = rebuild_threads;
+
+    if( threads <= 0 ) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if( threads <= 1 || ctx->h < VEB_PAR_MIN_HEIGHT ) {
+        rebuild( ctx, node );
+        return;
+    }
+
+    for( depth = 0; (1 << depth) < threads * VEB_TASKS_PER_THREAD; depth++ ) ;
+
+    job.tasks = malloc( (1 << depth) * sizeof( veb_task ) );
+    workers = malloc( (threads - 1) * sizeof( pthread_t ) );
+    if( !job.tasks || !workers ) fprintf(stderr,"bailing out with code %d\n", 25 ),printf("# error %d\n", 25 ),exit( 25 ) ;
+    job.ntasks = 0;
+    job.next = 0;
+
+    rebuild_split( ctx, node, depth, job.tasks, &job.ntasks );
+
+    for( i = 0; i < threads - 1; i++ )
+        if( pthread_create(&workers[i], NULL, rebuild_worker, &job) ) break;
+    rebuild_worker( &job );
+    while( i-- > 0 )
+        pthread_join(workers[i], NULL);
+
+    free(workers);
+    free(job.tasks);
+}
+
+int l_count(veb_ctx *ctx, int node) {
     int c;
 
-    if( ! (  node  < size && h > 0)  ) return 0;
+    if( ! (  node  < size && ctx->h > 0)  ) return 0;
     ;
     if( MAXINT  == val[node] ) return 0;
 
-    h--; ;
-    c=l_count((bf=2*bf+1,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) );
-    h++;bf=bf>>1; ;
-    lh--;
+    ctx->h--; ;
+    c=l_count(ctx, (ctx->bf=2*ctx->bf+1,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) );
+    ctx->h++;ctx->bf=ctx->bf>>1; ;
+    ctx->lh--;
 
     ; ;
-    helper[lh] = val[node];
-    val[node] = -3;
-    c++;
-    h--; ;
-    c += l_count((bf=bf*2,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) );
-    h++;bf=bf>>1; ;
+    helper[ctx->lh] = val[node];
+        c++;
+    ctx->h--; ;
+    c += l_count(ctx, (ctx->bf=ctx->bf*2,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) );
+    ctx->h++;ctx->bf=ctx->bf>>1; ;
     return c;
 }
-int r_count(int node) {
+int r_count(veb_ctx *ctx, int node) {
     int c;
 
-    if( ! (  node  < size && h > 0)  ) return 0;
+    if( ! (  node  < size && ctx->h > 0)  ) return 0;
     if( MAXINT  == val[node] ) return 0;
 
-    h--; ;
-    c=r_count((bf=bf*2,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) );
-    h++;bf=bf>>1; ;
-    rh++;
+    ctx->h--; ;
+    c=r_count(ctx, (ctx->bf=ctx->bf*2,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) );
+    ctx->h++;ctx->bf=ctx->bf>>1; ;
+    ctx->rh++;
     ; ;
-    helper[rh] = val[node];
-    val[node] = -2;
-
+    helper[ctx->rh] = val[node];
+    
     c++;
-    h--; ;
-    c += r_count((bf=2*bf+1,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) );
-    h++;bf=bf>>1; ;
+    ctx->h--; ;
+    c += r_count(ctx, (ctx->bf=2*ctx->bf+1,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) );
+    ctx->h++;ctx->bf=ctx->bf>>1; ;
     return c;
 }
-int insert_rec(int node ) {
+int insert_rec(veb_ctx *ctx, int node) {
 
-    if( ! (  node  < size && h > 0)  ) {
-        lh=rh=size;
+    if( ! (  node  < size && ctx->h > 0)  ) {
+        ctx->lh=ctx->rh=size;
         ;
-        helper[size] = key;
+        helper[size] = ctx->key;
 
         return 1;
     }
     ;
     if( MAXINT  == val[node] ) {
-        val[node]=key;
+        val[node]=ctx->key;
 
         return 0;
     }
 
-    if( key < val[node] ) {
+    if( ctx->key < val[node] ) {
         int c;
-        h--; ;
-        level--;
-        c = insert_rec((bf=bf*2,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) );
-        level++;
-        h++;bf=bf>>1; ;
+        ctx->h--; ;
+        ctx->level--;
+        c = insert_rec(ctx, (ctx->bf=ctx->bf*2,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) );
+        ctx->level++;
+        ctx->h++;ctx->bf=ctx->bf>>1; ;
         if( 0 == c ) return 0;
 
         ; ;
-        rh++;helper[rh] = val[node];
-        val[node] = -4;
-
+        ctx->rh++;helper[ctx->rh] = val[node];
+        
 
-        h--; ;
-        c += r_count( (bf=2*bf+1,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p])  );
-        h++;bf=bf>>1; ;
+        ctx->h--; ;
+        c += r_count( ctx, (ctx->bf=2*ctx->bf+1,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p])  );
+        ctx->h++;ctx->bf=ctx->bf>>1; ;
         c++;
 
 
 
-        if( c <= ((float) (1<<level)-1)*(1.0-((((float)level)/max_dep)*0.6)) ) {
-            rebuild( node );
+        if( c <= ((float) (1<<ctx->level)-1)*(1.0-((((float)ctx->level)/max_dep)*0.6)) ) {
+            veb_write_begin();
+            rebuild_par( ctx, node );
+            veb_write_end();
             return 0;
         }
         return c;
     }
     ;
-    if( val[node] < key ) {
+    if( val[node] < ctx->key ) {
         int c;
-        h--; ;
-        level--;
-        c = insert_rec((bf=2*bf+1,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) );
-        level++;
-        h++;bf=bf>>1; ;
+        ctx->h--; ;
+        ctx->level--;
+        c = insert_rec(ctx, (ctx->bf=2*ctx->bf+1,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) );
+        ctx->level++;
+        ctx->h++;ctx->bf=ctx->bf>>1; ;
         if( 0 == c ) return 0;
 
         ; ;
-        lh--;helper[lh] = val[node];
-        val[node] = -5;
-
+        ctx->lh--;helper[ctx->lh] = val[node];
+        
 
 
-        h--; ;
-        c += l_count( (bf=bf*2,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p])  );
-        h++;bf=bf>>1; ;
+        ctx->h--; ;
+        c += l_count( ctx, (ctx->bf=ctx->bf*2,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p])  );
+        ctx->h++;ctx->bf=ctx->bf>>1; ;
         c++;
 
 
 
-        if( c <= ((float) (1<<level)-1)*(1.0-((((float)level)/max_dep)*0.6)) ) {
-            rebuild( node );
+        if( c <= ((float) (1<<ctx->level)-1)*(1.0-((((float)ctx->level)/max_dep)*0.6)) ) {
+            veb_write_begin();
+            rebuild_par( ctx, node );
+            veb_write_end();
             return 0;
         }
         return c;
     }
 
 
-    was_in = -1;
+    ctx->was_in = -1;
     keys--;
     return 0;
 }
 
-int insert(int ky) {
+/* Empty tree of new_size slots for the keys in helper[lh..rh] of ctx */
+static void veb_resize(veb_ctx *ctx, int new_size) {
 
-    pthread_spin_lock(&global_lock);
+    size = new_size;
+#ifdef SVEB_SEQLOCK
+    /* The old level table and array stay with their layout */
+    myli = NULL;
+#endif
+    initialize_depth(size);
 
-    int c;
-    h=max_dep;bf=1;anc[max_dep]=0; ;
-    key=ky;
-    level=max_dep;
-    was_in = 0;
-    keys++;
 
+    //fprintf(stderr,"resize to: %d max_depth %d, members: %d density %f\n", size,max_dep,keys, ((float)keys)/size);
 
-    c =insert_rec( 0  );
 
-    if( was_in ) {
-        pthread_spin_unlock(&global_lock);
-        return 0;
-    }
-    if( c ) {
+#ifndef SVEB_SEQLOCK
+    if(val) free(val);
+#endif
+    val = malloc( (size+2)* sizeof ( domain ));
 
-        size=(size+1)*2 -1;
-        initialize_depth(size);
 
 
-        //fprintf(stderr,"resize to: %d max_depth %d, members: %d(%d) density %f\n", size,max_dep,c,keys, ((float)c)/n);
 
+    if( !val ) fprintf(stderr,"bailing out with code %d\n", 21 ),printf("# error %d\n", 21 ),exit( 21 ) ;
+    {int i; for(i=0;i<size+2;i++) val[i]= MAXINT ;}
 
-        if(val) free(val);
-        val = malloc( (size+2)* sizeof ( domain ));
+    ctx->h=max_dep;ctx->bf=1;ctx->anc[max_dep]=0; ;
+    rebuild_par( ctx, 0  );
 
 
 
+    if(helper) free(helper);
+    helper = malloc( 2* size* sizeof ( domain ));
+    if( !helper ) fprintf(stderr,"bailing out with code %d\n", 211 ),printf("# error %d\n", 211 ),exit( 211 ) ;
+#ifdef SVEB_SEQLOCK
+    veb_publish();
+#endif
+}
 
-        if( !val ) fprintf(stderr,"bailing out with code %d\n", 21 ),printf("# error %d\n", 21 ),exit( 21 ) ;
-        {int i; for(i=0;i<size+2;i++) val[i]= MAXINT ;}
+int insert(int ky) {
+    veb_ctx ctx_local, *ctx = &ctx_local;
+    int c;
 
-        h=max_dep;bf=1;anc[max_dep]=0; ;
-        rebuild( 0  );
+    pthread_spin_lock(&global_lock);
+
+    ctx->h=max_dep;ctx->bf=1;ctx->anc[max_dep]=0; ;
+    ctx->key=ky;
+    ctx->level=max_dep;
+    ctx->was_in = 0;
+    keys++;
 
 
+    c =insert_rec( ctx, 0  );
 
-        if(helper) free(helper);
-        helper = malloc( 2* size* sizeof ( domain ));
-        if( !helper ) fprintf(stderr,"bailing out with code %d\n", 211 ),printf("# error %d\n", 211 ),exit( 211 ) ;
+    if( ctx->was_in ) {
+        pthread_spin_unlock(&global_lock);
+        return 0;
     }
+    if( c )
+        veb_resize(ctx, (size+1)*2 -1);
 
     pthread_spin_unlock(&global_lock);
 
@@ -807,20 +1129,20 @@ int e;
 
 
 
-void impl_report_al_rec ( int ad) {
-    if( ! (  ad  < size && h > 0)  ) return;
+void impl_report_al_rec (veb_ctx *ctx, int ad) {
+    if( ! (  ad  < size && ctx->h > 0)  ) return;
 
 
-    h--; ;depth++; ;
-    impl_report_al_rec ( (bf=bf*2,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) );
-    h++;bf=bf>>1; ;depth--; ;
+    ctx->h--; ;depth++; ;
+    impl_report_al_rec ( ctx, (ctx->bf=ctx->bf*2,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) );
+    ctx->h++;ctx->bf=ctx->bf>>1; ;depth--; ;
 
 
     {fprintf(stderr,"<%2d>",depth);for(e=0;e<depth;e++) fprintf(stderr," .");if(val[ ad ]== MAXINT ) fprintf(stderr,"  +"); else fprintf(stderr,"%3d",val[ ad ]);for(;e<16;e++) fprintf(stderr," -");fprintf(stderr,"<%d>\n",  ad  );} ;
 
-    h--; ;depth++; ;
-    impl_report_al_rec ( (bf=2*bf+1,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) );
-    h++;bf=bf>>1; ;depth--; ;
+    ctx->h--; ;depth++; ;
+    impl_report_al_rec ( ctx, (ctx->bf=2*ctx->bf+1,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) );
+    ctx->h++;ctx->bf=ctx->bf>>1; ;depth--; ;
 
 
 
@@ -828,9 +1150,10 @@ void impl_report_al_rec ( int ad) {
 }
 
 void impl_report_al () {
+    veb_ctx ctx_local, *ctx = &ctx_local;
     ;
-    h=max_dep;bf=1;anc[max_dep]=0; ;
-    impl_report_al_rec ( 0  );
+    ctx->h=max_dep;ctx->bf=1;ctx->anc[max_dep]=0; ;
+    impl_report_al_rec ( ctx, 0  );
     ;
 }
 
@@ -933,20 +1256,20 @@ int sum_path=0;
 
 
 
-void impl_report_depth_rec ( int ad) {
-    if( ! (  ad  < size && h > 0)  ) return;
+void impl_report_depth_rec (veb_ctx *ctx, int ad) {
+    if( ! (  ad  < size && ctx->h > 0)  ) return;
 
 
-    h--; ;depth++; ;
-    impl_report_depth_rec ( (bf=bf*2,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) );
-    h++;bf=bf>>1; ;depth--; ;
+    ctx->h--; ;depth++; ;
+    impl_report_depth_rec ( ctx, (ctx->bf=ctx->bf*2,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) );
+    ctx->h++;ctx->bf=ctx->bf>>1; ;depth--; ;
 
 
     {sum_path=sum_path+depth;if(depth>maxd)maxd=depth;} ;
 
-    h--; ;depth++; ;
-    impl_report_depth_rec ( (bf=2*bf+1,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) );
-    h++;bf=bf>>1; ;depth--; ;
+    ctx->h--; ;depth++; ;
+    impl_report_depth_rec ( ctx, (ctx->bf=2*ctx->bf+1,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) );
+    ctx->h++;ctx->bf=ctx->bf>>1; ;depth--; ;
 
 
 
@@ -954,9 +1277,10 @@ void impl_report_depth_rec ( int ad) {
 }
 
 void impl_report_depth () {
+    veb_ctx ctx_local, *ctx = &ctx_local;
     ;
-    h=max_dep;bf=1;anc[max_dep]=0; ;
-    impl_report_depth_rec ( 0  );
+    ctx->h=max_dep;ctx->bf=1;ctx->anc[max_dep]=0; ;
+    impl_report_depth_rec ( ctx, 0  );
     ;
 }
 
@@ -1071,20 +1395,20 @@ void impl_report_depth () {
 
 
 
-void test_walk_rec ( int ad) {
-    if( ! (  ad  < size && h > 0)  ) return;
+void test_walk_rec (veb_ctx *ctx, int ad) {
+    if( ! (  ad  < size && ctx->h > 0)  ) return;
 
 
-    h--; ; ;
-    test_walk_rec ( (bf=bf*2,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) );
-    h++;bf=bf>>1; ; ;
+    ctx->h--; ; ;
+    test_walk_rec ( ctx, (ctx->bf=ctx->bf*2,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) );
+    ctx->h++;ctx->bf=ctx->bf>>1; ; ;
 
 
     { ;if(val[ ad ]!= MAXINT ){if(nextvalue!=val[ ad ])fprintf(stderr,"bailing out with code %d\n", 345 ),printf("# error %d\n", 345 ),exit( 345 ) ;nextvalue++;}} ;
 
-    h--; ; ;
-    test_walk_rec ( (bf=2*bf+1,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) );
-    h++;bf=bf>>1; ; ;
+    ctx->h--; ; ;
+    test_walk_rec ( ctx, (ctx->bf=2*ctx->bf+1,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) );
+    ctx->h++;ctx->bf=ctx->bf>>1; ; ;
 
 
 
@@ -1092,9 +1416,10 @@ void test_walk_rec ( int ad) {
 }
 
 void test_rec_walk () {
+    veb_ctx ctx_local, *ctx = &ctx_local;
     nextvalue=0; ;
-    h=max_dep;bf=1;anc[max_dep]=0; ;
-    test_walk_rec ( 0  );
+    ctx->h=max_dep;ctx->bf=1;ctx->anc[max_dep]=0; ;
+    test_walk_rec ( ctx, 0  );
     if(nextvalue!=keys) fprintf(stderr,"bailing out with code %d\n", 335 ),printf("# error %d\n", 335 ),exit( 335 ) ;fprintf(stderr,"passed recursive walk test\n"); ;
 }
 
@@ -1220,10 +1545,11 @@ void test_rec_walk () {
 
 
 void test_it_walk () {
+    veb_ctx ctx_local, *ctx = &ctx_local;
     int ad = 0 ;
 
     nextvalue=0; ;
-    h=max_dep;bf=1;anc[max_dep]=0; ;
+    ctx->h=max_dep;ctx->bf=1;ctx->anc[max_dep]=0; ;
 
 
 
@@ -1238,21 +1564,21 @@ descent:
 
 
 
-    while( (  ad  < size && h > 0)  ) {
-        h--; ; ;
-        ad = (bf=bf*2,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) ;
+    while( (  ad  < size && ctx->h > 0)  ) {
+        ctx->h--; ; ;
+        ad = (ctx->bf=ctx->bf*2,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) ;
     }
 
-    h++;bf=bf>>1; ; ;
-    ad = (anc[h]) ;
+    ctx->h++;ctx->bf=ctx->bf>>1; ; ;
+    ad = (ctx->anc[ctx->h]) ;
 
 doit:
 
     { ;if(val[ ad ]!= MAXINT ){if(nextvalue!=val[ ad ])fprintf(stderr,"bailing out with code %d\n", 348 ),printf("# error %d\n", 348 ),exit( 348 ) ;nextvalue++;}} ;
 
-    h--; ; ;
-    ad = (bf=2*bf+1,anc[h]=(myli[h].bs*(bf&myli[h].ts))+myli[h].ts+anc[myli[h].p]) ;
-    if( (  ad  < size && h > 0)  )
+    ctx->h--; ; ;
+    ad = (ctx->bf=2*ctx->bf+1,ctx->anc[ctx->h]=(myli[ctx->h].bs*(ctx->bf&myli[ctx->h].ts))+myli[ctx->h].ts+ctx->anc[myli[ctx->h].p]) ;
+    if( (  ad  < size && ctx->h > 0)  )
         goto descent;
 
 
@@ -1260,21 +1586,21 @@ doit:
 
 
 
-    h++;bf=bf>>1; ; ;
-    ad = (anc[h]) ;
+    ctx->h++;ctx->bf=ctx->bf>>1; ; ;
+    ad = (ctx->anc[ctx->h]) ;
 
 
-    while( (bf&1)  ) {
+    while( (ctx->bf&1)  ) {
 
-        h++;bf=bf>>1; ; ;
-        ad = (anc[h]) ;
+        ctx->h++;ctx->bf=ctx->bf>>1; ; ;
+        ad = (ctx->anc[ctx->h]) ;
         if( ad <= 0  ) {
             if(nextvalue!=keys) fprintf(stderr,"bailing out with code %d\n", 936 ),printf("# error %d\n", 936 ),exit( 936 ) ;  fprintf(stderr,"passed iterative walk\n"); ;
             return;
         }
     }
-    h++;bf=bf>>1; ; ;
-    ad = (anc[h]) ;
+    ctx->h++;ctx->bf=ctx->bf>>1; ; ;
+    ad = (ctx->anc[ctx->h]) ;
 
 
 
@@ -1327,6 +1653,9 @@ void init_memory() {
 
     initialize_depth(size);
 
+#ifdef SVEB_SEQLOCK
+    veb_publish();
+#endif
 }
 
 
@@ -1430,6 +1759,7 @@ void time_searches() {
     long int r=0;
     float it_time;
     float time_per_action=0.0,max_tpa=0.0,min_tpa=-1.0;
+    veb_ctx ctx;
     int expct;
 
     expct=1;
@@ -1468,7 +1798,7 @@ void time_searches() {
 
             startt = times(&buf);
 
-            while( run>0 && r>=0 ) {search( MAXINT * drand48() ); ; r++;   } ;
+            while( run>0 && r>=0 ) {search( &ctx, MAXINT * drand48() ); ; r++;   } ;
 
             getitimer(ITIMER_REAL, &mygtval);
             searcht = times(&buf) - startt;
@@ -1565,32 +1895,80 @@ void time_inserts(int k) {
     fflush(stdout);
 }
 
-int delete_node(int key) {
-    int it;
-    
+/* Tree under 1/8 full: rebuild it at half the size */
+static void veb_shrink(void) {
+    veb_ctx ctx_local, *ctx = &ctx_local;
+
+    ctx->h=max_dep;ctx->bf=1;ctx->anc[max_dep]=0; ;
+    ctx->lh = 0;
+    ctx->rh = -1;
+    r_count(ctx, 0);
+    veb_resize(ctx, (size+1)/2 -1);
+}
+
+/*
+ An empty slot stands for an empty subtree, so only a node without
+ children can be emptied. The key is overwritten by its in-order
+ neighbour from a non-empty subtree, which is removed in turn further
+ down, until a childless node is reached. Shrinking keeps the density,
+ and with it the gaps inserts rely on, within bounds.
+ */
+int delete_node(int ky) {
+    veb_ctx ctx_local, *ctx = &ctx_local;
+    int ad = 0, next, right;
+
     pthread_spin_lock(&global_lock);
-    
-    it  = search(key);
-    
+
+    ctx->h=max_dep;ctx->bf=1;ctx->anc[max_dep]=0; ;
+    while( ad < size && ctx->h > 0 && val[ad] != MAXINT && val[ad] != ky )
+        ad = veb_down(ctx, val[ad] < ky);
+
+    if( !( ad < size && ctx->h > 0 ) || val[ad] != ky ) {
+        pthread_spin_unlock(&global_lock);
+        return 0;
+    }
+
+    veb_write_begin();
+    while( 1 ) {
+        /* Predecessor: left once, then right; or successor the other way */
+        if( veb_has_child(ctx, 0) ) right = 0;
+        else if( veb_has_child(ctx, 1) ) right = 1;
+        else break;
+
+        next = veb_down(ctx, right);
+        while( veb_has_child(ctx, !right) )
+            next = veb_down(ctx, !right);
+        val[ad] = val[next];
+        ad = next;
+    }
+    val[ad] = MAXINT;
+    keys--;
+    veb_write_end();
+
+    if( size > 7 && keys < size / 8 )
+        veb_shrink();
+
     pthread_spin_unlock(&global_lock);
-    
-    
-    if(val[it] == key) return 1;
-    else return 0;
-    
-};
+
+    return 1;
+}
 
 int search_test(domain key) {
-    int it;
+    veb_ctx ctx;
+    int it, found;
+
+#ifdef SVEB_SEQLOCK
+    return veb_contains(key);
+#endif
     
     pthread_spin_lock(&global_lock);
     
-    it  = search(key);
+    it  = search(&ctx, key);
+    found = val[it] == key;
     
     pthread_spin_unlock(&global_lock);
     
-    if(val[it] == key) return 1;
-    else return 0;
+    return found;
 }
 
 int init_tree( int t) {
@@ -1610,6 +1988,19 @@ int init_tree( int t) {
     return 1;
 }
 
+void free_tree(void) {
+
+#ifdef SVEB_SEQLOCK
+    veb_free_layouts();
+#endif
+    if(val) free(val);
+    if(helper) free(helper);
+
+    val = NULL;
+    helper = NULL;
+    keys = 0;
+}
+
 void initial_add (int num, int range) {
     int i = 0, j = 0;
     
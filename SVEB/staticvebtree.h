@@ -20,9 +20,13 @@ typedef int domain;
 extern domain *val;
 
 int init_tree(int t);
+void free_tree(void);
 int insert(int ky);
 int search_test(domain key);
 int delete_node(int ky);
 void initial_add (int num, int range);
 
+/* Threads for rebuilding the array on a resize, 0 = one per core */
+void set_rebuild_threads(int t);
+
 #endif
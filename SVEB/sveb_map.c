@@ -0,0 +1,68 @@
+/*
+ sveb_map.c
+
+ This is part of the tree library
+
+ Copyright 2015 Ibrahim Umar (UiT the Arctic University of Norway)
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+
+#include "staticvebtree.h"
+#include "map.h"
+
+/*
+ map.h backend for the static vEB tree. The tree is all global state,
+ so there is only one per process. MAXINT marks an empty slot.
+ */
+
+static void *sveb_map_alloc(int nthreads)
+{
+	init_tree(1023);
+	return &val;
+}
+
+static void sveb_map_free(void *tree)
+{
+	free_tree();
+}
+
+static void *sveb_map_lookup(void *tree, map_key_t key)
+{
+	return search_test(key) ? MAP_PRESENT : NULL;
+}
+
+static int sveb_map_insert(void *tree, map_key_t key, void *data)
+{
+	return insert(key);
+}
+
+static int sveb_map_remove(void *tree, map_key_t key)
+{
+	return delete_node(key);
+}
+
+const struct map_ops sveb_map_ops = {
+	.name		= "sveb",
+	.flags		= MAP_SINGLETON | MAP_DELETE,
+	.max_key	= INT_MAX - 1,
+	.alloc		= sveb_map_alloc,
+	.free		= sveb_map_free,
+	.thread_init	= NULL,
+	.lookup		= sveb_map_lookup,
+	.insert		= sveb_map_insert,
+	.remove		= sveb_map_remove,
+};
@@ -0,0 +1,38 @@
+#!/bin/sh
+
+# CBTree in-node search variants and inner key formats across node
+# orders. The order is picked at run time (-o), so each variant is built
+# only once; page, l1 and l2 are the auto-sized orders.
+# Output: search, inner, order, node bytes, then the usual benchmark line (last field is msec)
+#
+# Usage: ./cbtree-search.sh [initial] [threads] [update]
+
+initial=${1:-1000000}
+threads=${2:-4}
+update=${3:-20}
+range=$((initial*2))
+
+SEARCHES="LINEAR BINARY SIMD"
+INNERS="PACKED FULL"
+ORDERS="8 16 32 64 128 256 336 512 1024 page l1 l2"
+
+script_dir=$(cd $(dirname $0) && pwd)
+cd "$script_dir/../CBTree"
+
+for search in $SEARCHES
+do
+	for inner in $INNERS
+	do
+		make clean >/dev/null 2>&1
+		make prep CBTree SEARCH=$search INNER=$inner >/dev/null 2>&1 || continue
+		for order in $ORDERS
+		do
+			out=$(./CBTree -o $order -s 1 -i $initial -r $range -n $threads -u $update 2>&1)
+			size=$(echo "$out" | sed -n 's/^Node size: \([0-9]*\) bytes (order \([0-9]*\))/\2, \1/p')
+			result=$(echo "$out" | grep "^0:")
+			echo "$search, $inner, $size, $result"
+		done
+	done
+done
+
+make clean >/dev/null 2>&1
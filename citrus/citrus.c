@@ -1,234 +1,483 @@
-#include <stdlib.h>
-#include <stdio.h>
-#include <pthread.h>
-#include "citrus.h" 
-#include "urcu.h"
-
-/**
- * Copyright 2014 Maya Arbel (mayaarl [at] cs [dot] technion [dot] ac [dot] il).
- * 
- * This file is part of Citrus. 
- * 
- * Citrus is free software: you can redistribute it and/or modify
- * it under the terms of the GNU General Public License as published by
- * the Free Software Foundation, either version 3 of the License, or
- * (at your option) any later version.
- * 
- * This program is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU General Public License for more details.
- * 
- * You should have received a copy of the GNU General Public License
- * along with this program.  If not, see <http://www.gnu.org/licenses/>.
- * 
- * Author Maya Arbel
- */
-
-/*struct node_t {
-    int key;
-    struct node_t* child[2];
-	pthread_mutex_t lock;
-	bool marked;
-    int tag[2];
-	int value; 
-	};*/
-
-
-node NEWNode(int key){
-    node NEW = (node) malloc(sizeof(struct node_t));
-	if( NEW==NULL){
-		printf("out of memory\n");
-		exit(1); 
-	}    
-	NEW->key=key;
-    NEW->marked= false;
-    NEW->child[0]=NULL;
-    NEW->child[1]=NULL;
-    NEW->tag[0]=0;
-    NEW->tag[1]=0;
-    if (pthread_mutex_init(&(NEW->lock), NULL) != 0){
-        printf("\n mutex init failed\n");
-    }
-    return NEW;
-}
-
-node init(){
-    node root = NEWNode(infinity);
-	root->child[0]=NEWNode(infinity);
-    return root;
-}
-
-
-int contains(node root, int key ){
-	urcu_read_lock();
-    node curr = root->child[0];
-    int ckey = curr->key ;
-    while (curr != NULL && ckey != key){
-        if (ckey > key)
-            curr = curr->child[0];
-        if (ckey < key)
-            curr = curr->child[1];
-		if (curr!=NULL) 
-                ckey = curr->key ;
-    }
-	urcu_read_unlock();
-    if (curr == NULL) return -1;
-    return 1;
-}
-
-bool validate(node prev,int tag ,node curr, int direction){
-	bool result;     
-	if (curr==NULL){
-        result = (!(prev->marked) &&  (prev->child[direction]==curr) && (prev->tag[direction]==tag));
-    }
-	else {
-		result = (!(prev->marked) && !(curr->marked) && prev->child[direction]==curr);
-	}
-	return result;
-}
-
-bool insert(node root, int key, int value){
-    while(true){    
-		urcu_read_lock();
-        node prev = root;
-        node curr = root->child[0];
-        int direction = 0;
-        int ckey = curr->key;
-        int tag; 
-        while (curr != NULL && ckey != key){
-            prev = curr;
-            if (ckey > key){
-                curr = curr->child[0];
-                direction = 0;
-            }
-            if (ckey < key){
-                curr = curr->child[1];
-                direction = 1;
-            }
-            if (curr!=NULL) 
-                ckey = curr->key ;
-        }
-        tag = prev->tag[direction];
-		urcu_read_unlock();
-        if (curr!=NULL) return false;
-        pthread_mutex_lock(&(prev->lock));
-        if( validate(prev,tag,curr,direction) ){
-            node NEW = NEWNode(key); 
-			prev->child[direction]=NEW;
-
-            pthread_mutex_unlock(&(prev->lock));
-            return true;
-        }
-        pthread_mutex_unlock(&(prev->lock));
-    }
-}
-
-
-bool delete_node(node root, int key){
-    while(true){
-		urcu_read_lock();    
-        node prev = root;
-        node curr = root->child[0];
-        int direction = 0;
-        int ckey = curr->key;
-        while (curr != NULL && ckey != key){
-            prev = curr;
-            if (ckey > key){
-                curr = curr->child[0];
-                direction = 0;
-            }
-            if (ckey < key){
-                curr = curr->child[1];
-                direction = 1;
-            }
-            if (curr!=NULL) 
-                ckey = curr->key ;
-        }
-        if (curr==NULL){
-            urcu_read_unlock();
-            return false;
-        }         
-		urcu_read_unlock();
-        pthread_mutex_lock(&(prev->lock));
-        pthread_mutex_lock(&(curr->lock));
-        if( !validate(prev,0,curr,direction) ){
-            pthread_mutex_unlock(&(prev->lock));
-            pthread_mutex_unlock(&(curr->lock));
-            continue;
-        }
-        if (curr->child[0] == NULL) {
-            curr->marked=true;
-            prev->child[direction]=curr->child[1];
-            if(prev->child[direction] == NULL){
-                prev->tag[direction]++;
-            }
-            pthread_mutex_unlock(&(prev->lock));
-            pthread_mutex_unlock(&(curr->lock));
-            return true;
-        }
-        if (curr->child[1] == NULL){
-            curr->marked=true;
-            prev->child[direction]=curr->child[0]; 
-            if(prev->child[direction] == NULL){
-                prev->tag[direction]++;
-            }
-            pthread_mutex_unlock(&(prev->lock));
-            pthread_mutex_unlock(&(curr->lock));
-            return true;
-        }
-		node prevSucc = curr;
-        node succ = curr->child[1]; 
-        
-            node next = succ->child[0];
-            while ( next!= NULL){
-                prevSucc = succ;
-                succ = next;
-                next = next->child[0];
-            }		
-        int succDirection = 1; 
-        if (prevSucc != curr){
-            pthread_mutex_lock(&(prevSucc->lock));
-            succDirection = 0;
-        } 		
-        pthread_mutex_lock(&(succ->lock));
-        if (validate(prevSucc,0,succ, succDirection) && validate(succ,succ->tag[0],NULL, 0)){
-            curr->marked=true;
-            node NEW = NEWNode(succ->key);
-            NEW->child[0]=curr->child[0];
-            NEW->child[1]=curr->child[1];
-            pthread_mutex_lock(&(NEW->lock)); 
-            prev->child[direction]=NEW;  
-            urcu_synchronize();
-            if(prev->child[direction] == NULL){
-                prev->tag[direction]++;
-            }
-            succ->marked=true;            
-			if (prevSucc == curr){
-                NEW->child[1]=succ->child[1];
-                if(NEW->child[1] == NULL){
-                    NEW->tag[1]++;
-                }
-            }
-            else{
-                prevSucc->child[0]=succ->child[1];
-                if(prevSucc->child[1] == NULL){
-                    prevSucc->tag[1]++;
-                }
-            }
-			pthread_mutex_unlock(&(prev->lock));
-            pthread_mutex_unlock(&(NEW->lock));            
-			pthread_mutex_unlock(&(curr->lock));  	
-            if (prevSucc != curr)
-                pthread_mutex_unlock(&(prevSucc->lock));	
-            pthread_mutex_unlock(&(succ->lock));
-            return true; 
-        }
-        pthread_mutex_unlock(&(prev->lock));
-        pthread_mutex_unlock(&(curr->lock));
-        if (prevSucc != curr)
-            pthread_mutex_unlock(&(prevSucc->lock));				
-        pthread_mutex_unlock(&(succ->lock));
-    }
-}
-
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "citrus.h" 
+#include "urcu.h"
+
+/**
+ * Copyright 2014 Maya Arbel (mayaarl [at] cs [dot] technion [dot] ac [dot] il).
+ * 
+ * This file is part of Citrus. 
+ * 
+ * Citrus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * Author Maya Arbel
+ */
+
+/*struct node_t {
+    skey_t key;
+    struct node_t* child[2];
+	pthread_mutex_t lock;
+	bool marked;
+    int tag[2];
+	sval_t value; 
+	};*/
+
+
+/*
+ Nodes come from per-thread pools carved out of shared chunks, so their
+ mutexes are initialized once and the memory stays a node until the
+ tree is destroyed. Unlinked nodes are handed to urcu_call() and go
+ back on the deleting thread's free list after a grace period. A pool
+ keeps at most POOL_MAX nodes and moves the extra ones to a shared list
+ that empty pools refill from before carving a new chunk; an exiting
+ thread runs its pending callbacks and hands its whole pool over. The
+ generation drops pools left over from a previous tree.
+ */
+#define NODE_CHUNK 256
+#define POOL_MAX (2 * NODE_CHUNK)
+
+typedef struct node_chunk {
+    struct node_chunk* next;
+    struct node_t nodes[NODE_CHUNK];
+} node_chunk;
+
+typedef struct node_pool {
+    node free;                  /* linked through child[0] */
+    int count;
+    unsigned long gen;
+} node_pool;
+
+static node_chunk* volatile chunks = NULL;
+static unsigned long pool_gen = 0;
+static __thread node_pool pool;
+
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+static node shared_free = NULL;
+static pthread_key_t pool_key;
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+
+static void pool_exit(void* arg);
+
+static void pool_key_init(){
+    pthread_key_create(&pool_key, pool_exit);
+}
+
+static inline node_pool* pool_self(){
+    if (pool.gen != pool_gen){
+        pool.free = NULL;
+        pool.count = 0;
+        pool.gen = pool_gen;
+        pthread_once(&pool_key_once, pool_key_init);
+        pthread_setspecific(pool_key, &pool);
+    }
+    return &pool;
+}
+
+/* Moves the first count nodes of p to the shared list */
+static void pool_spill(node_pool* p, int count){
+    node first = p->free, last = first;
+    int j;
+    for (j = 1; j < count; j++)
+        last = last->child[0];
+    p->free = last->child[0];
+    p->count -= count;
+
+    pthread_mutex_lock(&shared_lock);
+    last->child[0] = shared_free;
+    shared_free = first;
+    pthread_mutex_unlock(&shared_lock);
+}
+
+static node pool_refill(node_pool* p){
+    node_chunk* chunk;
+    node n;
+    int j;
+
+    pthread_mutex_lock(&shared_lock);
+    while (p->count < NODE_CHUNK && (n = shared_free) != NULL){
+        shared_free = n->child[0];
+        n->child[0] = p->free;
+        p->free = n;
+        p->count++;
+    }
+    pthread_mutex_unlock(&shared_lock);
+    if (p->free != NULL)
+        return p->free;
+
+    chunk = (node_chunk*) malloc(sizeof(node_chunk));
+	if( chunk==NULL){
+		printf("out of memory\n");
+		exit(1); 
+	}
+    for (j = 0; j < NODE_CHUNK; j++){
+        if (pthread_mutex_init(&(chunk->nodes[j].lock), NULL) != 0){
+            printf("\n mutex init failed\n");
+        }
+        chunk->nodes[j].child[0] = j + 1 < NODE_CHUNK ? &chunk->nodes[j+1] : NULL;
+    }
+    do {
+        chunk->next = chunks;
+    } while (!__sync_bool_compare_and_swap(&chunks, chunk->next, chunk));
+    p->free = &chunk->nodes[0];
+    p->count = NODE_CHUNK;
+    return p->free;
+}
+
+static void recycle(void* arg){
+    node_pool* p = pool_self();
+    node n = (node) arg;
+    n->child[0] = p->free;
+    p->free = n;
+    if (++p->count > POOL_MAX)
+        pool_spill(p, NODE_CHUNK);
+}
+
+/* Thread exit: the callbacks still queued refer to this tree's nodes */
+static void pool_exit(void* arg){
+    node_pool* p = (node_pool*) arg;
+    if (p->gen != pool_gen)
+        return;
+    urcu_barrier();
+    if (p->count > 0)
+        pool_spill(p, p->count);
+}
+
+/* Called outside any read-side section and without node locks held */
+static inline void retire(node n){
+    urcu_call(recycle, n);
+}
+
+node NEWNode(skey_t key, sval_t value){
+    node_pool* p = pool_self();
+    node NEW = p->free;
+    if (NEW == NULL)
+        NEW = pool_refill(p);
+    p->free = NEW->child[0];
+    p->count--;
+	NEW->key=key;
+    NEW->value=value;
+    NEW->marked= false;
+    NEW->child[0]=NULL;
+    NEW->child[1]=NULL;
+    NEW->tag[0]=0;
+    NEW->tag[1]=0;
+    return NEW;
+}
+
+node init(){
+    pool_gen++;
+    node root = NEWNode(infinity, 0);
+	root->child[0]=NEWNode(infinity, 0);
+    return root;
+}
+
+/*
+ No thread may be inside the tree, and every other thread that used it
+ must have exited or called urcu_unregister(), so that no callback
+ queue still points into the chunks.
+ */
+void destroy(node root){
+    node_chunk* chunk;
+    node_chunk* next;
+    int j;
+    urcu_barrier();
+    chunk = chunks;
+    while (chunk != NULL){
+        next = chunk->next;
+        for (j = 0; j < NODE_CHUNK; j++)
+            pthread_mutex_destroy(&(chunk->nodes[j].lock));
+        free(chunk);
+        chunk = next;
+    }
+    chunks = NULL;
+    shared_free = NULL;
+    pool_gen++;
+}
+
+/*
+ Writers stay in their read-side section until the nodes they found are
+ locked and validated, so none of them can be recycled in between. They
+ must not block in there, a deleter holding the lock may be waiting for
+ the section to end: on contention the caller drops its other locks and
+ waits the holder out here, outside the section, before starting over.
+ */
+static void wait_node(node n){
+    urcu_read_unlock();
+    pthread_mutex_lock(&(n->lock));
+    pthread_mutex_unlock(&(n->lock));
+}
+
+
+int contains(node root, skey_t key ){
+	urcu_read_lock();
+    node curr = root->child[0];
+    skey_t ckey = curr->key ;
+    while (curr != NULL && ckey != key){
+        if (ckey > key)
+            curr = curr->child[0];
+        if (ckey < key)
+            curr = curr->child[1];
+		if (curr!=NULL) 
+                ckey = curr->key ;
+    }
+	urcu_read_unlock();
+    if (curr == NULL) return -1;
+    return 1;
+}
+
+/* Whether key is present, its value goes to *value */
+bool get(node root, skey_t key, sval_t* value){
+	urcu_read_lock();
+    node curr = root->child[0];
+    skey_t ckey = curr->key ;
+    while (curr != NULL && ckey != key){
+        if (ckey > key)
+            curr = curr->child[0];
+        if (ckey < key)
+            curr = curr->child[1];
+        if (curr!=NULL)
+                ckey = curr->key ;
+    }
+    if (curr != NULL)
+        *value = curr->value;
+    urcu_read_unlock();
+    return curr != NULL;
+}
+
+bool validate(node prev,int tag ,node curr, int direction){
+	bool result;     
+	if (curr==NULL){
+        result = (!(prev->marked) &&  (prev->child[direction]==curr) && (prev->tag[direction]==tag));
+    }
+	else {
+		result = (!(prev->marked) && !(curr->marked) && prev->child[direction]==curr);
+	}
+	return result;
+}
+
+/*
+ With update set a present key gets the new value, written under the
+ node's lock so that a delete copying the node (the successor of a two
+ child delete) cannot lose it. The old value goes to *old and *found
+ is set.
+ */
+static bool insert_node(node root, skey_t key, sval_t value, bool update, sval_t* old, bool* found){
+    while(true){    
+		urcu_read_lock();
+        node prev = root;
+        node curr = root->child[0];
+        int direction = 0;
+        skey_t ckey = curr->key;
+        int tag; 
+        while (curr != NULL && ckey != key){
+            prev = curr;
+            if (ckey > key){
+                curr = curr->child[0];
+                direction = 0;
+            }
+            if (ckey < key){
+                curr = curr->child[1];
+                direction = 1;
+            }
+            if (curr!=NULL) 
+                ckey = curr->key ;
+        }
+        tag = prev->tag[direction];
+        if (curr!=NULL && !update){
+            urcu_read_unlock();
+            return false;
+        }
+        if (curr!=NULL){
+            if (pthread_mutex_trylock(&(curr->lock)) != 0){
+                wait_node(curr);
+                continue;
+            }
+            if (curr->marked){
+                pthread_mutex_unlock(&(curr->lock));
+                urcu_read_unlock();
+                continue;
+            }
+            *old = curr->value;
+            *found = true;
+            curr->value = value;
+            pthread_mutex_unlock(&(curr->lock));
+            urcu_read_unlock();
+            return false;
+        }
+        if (pthread_mutex_trylock(&(prev->lock)) != 0){
+            wait_node(prev);
+            continue;
+        }
+        if( validate(prev,tag,curr,direction) ){
+            urcu_read_unlock();
+            node NEW = NEWNode(key, value); 
+			prev->child[direction]=NEW;
+
+            pthread_mutex_unlock(&(prev->lock));
+            return true;
+        }
+        pthread_mutex_unlock(&(prev->lock));
+        urcu_read_unlock();
+    }
+}
+
+bool insert(node root, skey_t key, sval_t value){
+    return insert_node(root, key, value, false, NULL, NULL);
+}
+
+bool upsert(node root, skey_t key, sval_t value, sval_t* old){
+    bool found = false;
+    insert_node(root, key, value, true, old, &found);
+    return found;
+}
+
+
+bool delete_node(node root, skey_t key){
+    while(true){
+		urcu_read_lock();    
+        node prev = root;
+        node curr = root->child[0];
+        int direction = 0;
+        skey_t ckey = curr->key;
+        while (curr != NULL && ckey != key){
+            prev = curr;
+            if (ckey > key){
+                curr = curr->child[0];
+                direction = 0;
+            }
+            if (ckey < key){
+                curr = curr->child[1];
+                direction = 1;
+            }
+            if (curr!=NULL) 
+                ckey = curr->key ;
+        }
+        if (curr==NULL){
+            urcu_read_unlock();
+            return false;
+        }         
+        if (pthread_mutex_trylock(&(prev->lock)) != 0){
+            wait_node(prev);
+            continue;
+        }
+        if (pthread_mutex_trylock(&(curr->lock)) != 0){
+            pthread_mutex_unlock(&(prev->lock));
+            wait_node(curr);
+            continue;
+        }
+        if( !validate(prev,0,curr,direction) ){
+            pthread_mutex_unlock(&(prev->lock));
+            pthread_mutex_unlock(&(curr->lock));
+            urcu_read_unlock();
+            continue;
+        }
+        if (curr->child[0] == NULL) {
+            curr->marked=true;
+            prev->child[direction]=curr->child[1];
+            if(prev->child[direction] == NULL){
+                prev->tag[direction]++;
+            }
+            pthread_mutex_unlock(&(prev->lock));
+            pthread_mutex_unlock(&(curr->lock));
+            urcu_read_unlock();
+            retire(curr);
+            return true;
+        }
+        if (curr->child[1] == NULL){
+            curr->marked=true;
+            prev->child[direction]=curr->child[0]; 
+            if(prev->child[direction] == NULL){
+                prev->tag[direction]++;
+            }
+            pthread_mutex_unlock(&(prev->lock));
+            pthread_mutex_unlock(&(curr->lock));
+            urcu_read_unlock();
+            retire(curr);
+            return true;
+        }
+		node prevSucc = curr;
+        node succ = curr->child[1]; 
+        
+            node next = succ->child[0];
+            while ( next!= NULL){
+                prevSucc = succ;
+                succ = next;
+                next = next->child[0];
+            }		
+        int succDirection = 1; 
+        if (prevSucc != curr){
+            if (pthread_mutex_trylock(&(prevSucc->lock)) != 0){
+                pthread_mutex_unlock(&(prev->lock));
+                pthread_mutex_unlock(&(curr->lock));
+                wait_node(prevSucc);
+                continue;
+            }
+            succDirection = 0;
+        } 		
+        if (pthread_mutex_trylock(&(succ->lock)) != 0){
+            pthread_mutex_unlock(&(prev->lock));
+            pthread_mutex_unlock(&(curr->lock));
+            if (prevSucc != curr)
+                pthread_mutex_unlock(&(prevSucc->lock));
+            wait_node(succ);
+            continue;
+        }
+        if (validate(prevSucc,0,succ, succDirection) && validate(succ,succ->tag[0],NULL, 0)){
+            /* All nodes used from here on are locked and validated */
+            urcu_read_unlock();
+            curr->marked=true;
+            node NEW = NEWNode(succ->key, succ->value);
+            NEW->child[0]=curr->child[0];
+            NEW->child[1]=curr->child[1];
+            pthread_mutex_lock(&(NEW->lock)); 
+            prev->child[direction]=NEW;  
+            /*
+             Readers still in the old subtree must be able to find succ
+             until they are done, so succ is unlinked after a grace
+             period. Only NEW and the succ end are written after it.
+             */
+            pthread_mutex_unlock(&(prev->lock));
+			pthread_mutex_unlock(&(curr->lock));  	
+            urcu_synchronize();
+            succ->marked=true;            
+			if (prevSucc == curr){
+                NEW->child[1]=succ->child[1];
+                if(NEW->child[1] == NULL){
+                    NEW->tag[1]++;
+                }
+            }
+            else{
+                prevSucc->child[0]=succ->child[1];
+                if(prevSucc->child[1] == NULL){
+                    prevSucc->tag[1]++;
+                }
+            }
+            pthread_mutex_unlock(&(NEW->lock));            
+            if (prevSucc != curr)
+                pthread_mutex_unlock(&(prevSucc->lock));	
+            pthread_mutex_unlock(&(succ->lock));
+            retire(curr);
+            retire(succ);
+            return true; 
+        }
+        pthread_mutex_unlock(&(prev->lock));
+        pthread_mutex_unlock(&(curr->lock));
+        if (prevSucc != curr)
+            pthread_mutex_unlock(&(prevSucc->lock));				
+        pthread_mutex_unlock(&(succ->lock));
+        urcu_read_unlock();
+    }
+}
+
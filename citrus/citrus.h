@@ -1,47 +1,59 @@
-#ifndef _DICTIONARY_H_
-#define _DICTIONARY_H_
-#include <stdbool.h>
-
-/**
- * Copyright 2014 Maya Arbel (mayaarl [at] cs [dot] technion [dot] ac [dot] il).
- * 
- * This file is part of Citrus. 
- * 
- * Citrus is free software: you can redistribute it and/or modify
- * it under the terms of the GNU General Public License as published by
- * the Free Software Foundation, either version 3 of the License, or
- * (at your option) any later version.
- * 
- * This program is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU General Public License for more details.
- * 
- * You should have received a copy of the GNU General Public License
- * along with this program.  If not, see <http://www.gnu.org/licenses/>.
- * 
- * Author Maya Arbel
- */
-
-
-#define infinity 2147483647 
-
-typedef struct node_t {
-  int key;
-  struct node_t* child[2];
-  pthread_mutex_t lock;
-  bool marked;
-  int tag[2];
-  int value;
-} node_t;
-
-typedef struct node_t* node;
-
-node init();
-
-int contains(node root, int key);
-bool insert(node root, int key, int value);
-bool delete_node(node root, int key);
-
-#endif
-
+#ifndef _DICTIONARY_H_
+#define _DICTIONARY_H_
+#include <stdbool.h>
+
+/**
+ * Copyright 2014 Maya Arbel (mayaarl [at] cs [dot] technion [dot] ac [dot] il).
+ * 
+ * This file is part of Citrus. 
+ * 
+ * Citrus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * Author Maya Arbel
+ */
+
+
+#include <stdint.h>
+
+typedef int64_t skey_t;
+typedef intptr_t sval_t;
+
+#define infinity INT64_MAX 
+
+typedef struct node_t {
+  skey_t key;
+  struct node_t* child[2];
+  pthread_mutex_t lock;
+  bool marked;
+  int tag[2];
+  sval_t value;
+} node_t;
+
+typedef struct node_t* node;
+
+node init();
+void destroy(node root);
+
+int contains(node root, skey_t key);
+/* Whether key is present, its value goes to *value */
+bool get(node root, skey_t key, sval_t* value);
+/* Only inserts an absent key */
+bool insert(node root, skey_t key, sval_t value);
+/* Inserts or replaces. Returns whether key was present, the replaced
+ * value then goes to *old */
+bool upsert(node root, skey_t key, sval_t value, sval_t* old);
+bool delete_node(node root, skey_t key);
+
+#endif
+
@@ -0,0 +1,77 @@
+/*
+ citrus_map.c
+
+ This is part of the tree library
+
+ Copyright 2015 Ibrahim Umar (UiT the Arctic University of Norway)
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "citrus.h"
+#include "urcu.h"
+#include "map.h"
+
+/*
+ map.h backend for Citrus, the data pointer is kept as the node value.
+ The URCU table is global, so there is one tree per process and every
+ thread must be registered before touching it.
+ */
+
+static void *citrus_map_alloc(int nthreads)
+{
+	initURCU(nthreads);
+	return init();
+}
+
+static void citrus_map_free(void *tree)
+{
+	destroy(tree);
+}
+
+static void citrus_map_thread_init(void *tree, int tid)
+{
+	urcu_register(tid);
+}
+
+static void *citrus_map_lookup(void *tree, map_key_t key)
+{
+	sval_t value;
+
+	return get(tree, key, &value) ? (void*) value : NULL;
+}
+
+static int citrus_map_insert(void *tree, map_key_t key, void *data)
+{
+	return insert(tree, key, (sval_t) data);
+}
+
+static int citrus_map_remove(void *tree, map_key_t key)
+{
+	return delete_node(tree, key);
+}
+
+const struct map_ops citrus_map_ops = {
+	.name		= "citrus",
+	.flags		= MAP_VALUES | MAP_DELETE | MAP_SINGLETON,
+	.max_key	= infinity - 1,
+	.alloc		= citrus_map_alloc,
+	.free		= citrus_map_free,
+	.thread_init	= citrus_map_thread_init,
+	.lookup		= citrus_map_lookup,
+	.insert		= citrus_map_insert,
+	.remove		= citrus_map_remove,
+};
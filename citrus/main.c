@@ -37,7 +37,7 @@
 #include "bench.h"
 
 /* Re-entrant version of rand_range(r) */
-inline long rand_range_re1(unsigned int *seed, long r) {
+static inline long rand_range_re1(unsigned int *seed, long r) {
 	int m = RAND_MAX;
 	int d, v = 0;
 
@@ -58,7 +58,7 @@ inline long rand_range_re1(unsigned int *seed, long r) {
 }
 
 
-inline void *xmalloc(size_t size) {
+static inline void *xmalloc(size_t size) {
 	void *p = malloc(size);
 	if (p == NULL) {
 		perror("malloc");
@@ -134,6 +134,7 @@ int main(int argc, char **argv)
 	root = init(); // initialize the tree
 
 	initURCU(n); // initialize RCU with specific numthreads
+	urcu_register(0); // the populating thread reads as thread 0
 
 	global_seed = rand();
 
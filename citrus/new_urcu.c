@@ -1,109 +1,221 @@
-#include <stdlib.h>
-#include "urcu.h"
-#include <stdio.h>
-#include <assert.h>
-
-/**
- * Copyright 2014 Maya Arbel (mayaarl [at] cs [dot] technion [dot] ac [dot] il).
- * 
- * This file is part of Citrus. 
- * 
- * Citrus is free software: you can redistribute it and/or modify
- * it under the terms of the GNU General Public License as published by
- * the Free Software Foundation, either version 3 of the License, or
- * (at your option) any later version.
- * 
- * This program is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU General Public License for more details.
- * 
- * You should have received a copy of the GNU General Public License
- * along with this program.  If not, see <http://www.gnu.org/licenses/>.
- * 
- * Authors Maya Arbel and Adam Morrison 
- */
-
-int threads; 
-rcu_node** urcu_table;
-
-void initURCU(int num_threads){
-   rcu_node** result = (rcu_node**) malloc(sizeof(rcu_node)*num_threads);
-   int i;
-   rcu_node* NEW;
-   threads = num_threads; 
-   for( i=0; i<threads ; i++){
-        NEW = (rcu_node*) malloc(sizeof(rcu_node));
-        NEW->time = 1; 
-        *(result + i) = NEW;
-    }
-    urcu_table =  result;
-    printf("initializing URCU finished, node_size: %zd\n", sizeof(rcu_node));
-    return; 
-}
-
-__thread long* times = NULL; 
-__thread int i; 
-
-void urcu_register(int id){
-    times = (long*) malloc(sizeof(long)*threads);
-    i = id; 
-    if (times == NULL ){
-        printf("malloc failed\n");
-        exit(1);
-    }
-}
-void urcu_unregister(){
-    free(times);
-}
-
-void urcu_read_lock(){
-    assert(urcu_table[i]!= NULL);
-    __sync_add_and_fetch(&urcu_table[i]->time, 1);
-}
-
-static inline void set_bit(int nr, volatile unsigned long *addr){
-#ifdef __arm__
-do{
-	u_int cpsr_save, tmp;
-
-    	__asm volatile(					\
-                        "mrs  %0, cpsr;"                \
-                         "orr  %1, %0, %2;"             \
-                         "msr  cpsr_all, %1;"           \
-                         : "=r" (cpsr_save), "=r" (tmp) \
-                         : "I" (1 << 7)         	\
-                         : "cc" );               	\
-	*addr |= (1 << nr);
-	__asm volatile(                			\
-                         "msr  cpsr_all, %0"     	\
-                         : /* no output */       	\
-                         : "r" (cpsr_save)       	\
-                         : "cc" );               	\
-} while(0);
-#else
-    asm("btsl %1,%0" : "+m" (*addr) : "Ir" (nr));
-#endif
-}
-
-void urcu_read_unlock(){
-    assert(urcu_table[i]!= NULL);
-    set_bit(0, &urcu_table[i]->time);
-}
-
-void urcu_synchronize(){
-    int i; 
-    //read old counters
-    for( i=0; i<threads ; i++){
-        times[i] = urcu_table[i]->time;
-    }
-    for( i=0; i<threads ; i++){
-        if (times[i] & 1) continue;
-        while(1){
-            unsigned long t = urcu_table[i]->time;
-            if (t & 1 || t > times[i]){
-                break; 
-            }
-        }
-    }
-} 
+#include <stdlib.h>
+#include "urcu.h"
+#include <stdio.h>
+#include <assert.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#ifdef __NR_membarrier
+#include <linux/membarrier.h>
+#endif
+
+/**
+ * Copyright 2014 Maya Arbel (mayaarl [at] cs [dot] technion [dot] ac [dot] il).
+ * 
+ * This file is part of Citrus. 
+ * 
+ * Citrus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * Authors Maya Arbel and Adam Morrison 
+ */
+
+int threads; 
+rcu_node* urcu_table = NULL;
+
+/*
+ Readers publish their counter with a plain store. Where the kernel
+ has private expedited membarrier(), urcu_synchronize() makes every
+ running thread of the process execute a full barrier before it reads
+ the counters and readers get away with a compiler barrier; otherwise
+ each reader pays a fence.
+ */
+int urcu_reader_fence = 1;
+__thread rcu_node* urcu_me = NULL;
+
+/*
+ Grace periods are shared. gp_seq is odd while one thread scans
+ urcu_table; a caller only needs a scan that started after it arrived,
+ so concurrent callers wait on one scan instead of each running their
+ own, and callbacks queued with urcu_call() are run in batches once a
+ grace period that started after the batch was closed has ended.
+ */
+static volatile unsigned long gp_seq = 0;
+static unsigned long urcu_gen = 0;
+
+#define URCU_CB_BATCH 128
+
+typedef struct urcu_cb {
+    void (*func)(void*);
+    void* arg;
+} urcu_cb;
+
+typedef struct urcu_queue {
+    urcu_cb cbs[2][URCU_CB_BATCH];   /* one filling, one waiting */
+    int n[2];
+    int cur;
+    unsigned long target;            /* gp_seq the waiting batch needs */
+    unsigned long gen;
+} urcu_queue;
+
+static void membarrier_init(){
+#ifdef __NR_membarrier
+    long cmds = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0);
+    if (cmds > 0 && (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED)
+        && syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0)
+        urcu_reader_fence = 0;
+#endif
+}
+
+/* Pairs with the reader side of urcu_read_lock() */
+static inline void gp_fence(){
+#ifdef __NR_membarrier
+    if (!urcu_reader_fence){
+        syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+        return;
+    }
+#endif
+    __sync_synchronize();
+}
+
+void initURCU(int num_threads){
+   rcu_node* result;
+   int i;
+   threads = num_threads; 
+   if (posix_memalign((void**) &result, URCU_PAD, sizeof(rcu_node)*threads) != 0){
+        printf("malloc failed\n");
+        exit(1);
+   }
+   for( i=0; i<threads ; i++){
+        result[i].time = 1; 
+    }
+    free(urcu_table);
+    urcu_table =  result;
+    urcu_gen++;
+    membarrier_init();
+    printf("initializing URCU finished, node_size: %zd\n", sizeof(rcu_node));
+    return; 
+}
+
+__thread long* times = NULL; 
+
+/* A thread that exits still registered is unregistered on its way out */
+static pthread_key_t urcu_key;
+static pthread_once_t urcu_key_once = PTHREAD_ONCE_INIT;
+
+static void urcu_exit(void* arg){
+    urcu_unregister();
+}
+
+static void urcu_key_init(){
+    pthread_key_create(&urcu_key, urcu_exit);
+}
+
+void urcu_register(int id){
+    free(times);
+    times = (long*) malloc(sizeof(long)*threads);
+    urcu_me = &urcu_table[id]; 
+    if (times == NULL ){
+        printf("malloc failed\n");
+        exit(1);
+    }
+    pthread_once(&urcu_key_once, urcu_key_init);
+    pthread_setspecific(urcu_key, times);
+}
+void urcu_unregister(){
+    urcu_barrier();
+    if (times == NULL) return;
+    free(times);
+    times = NULL;
+    pthread_setspecific(urcu_key, NULL);
+}
+
+static void gp_scan(){
+    int i; 
+    gp_fence();
+    //read old counters
+    for( i=0; i<threads ; i++){
+        times[i] = __atomic_load_n(&urcu_table[i].time, __ATOMIC_ACQUIRE);
+    }
+    for( i=0; i<threads ; i++){
+        if (times[i] & 1) continue;
+        while(1){
+            unsigned long t = __atomic_load_n(&urcu_table[i].time, __ATOMIC_ACQUIRE);
+            if (t & 1 || t > times[i]){
+                break; 
+            }
+        }
+    }
+}
+
+/* End of the first grace period to start after now */
+static inline unsigned long gp_target(){
+    __sync_synchronize();
+    return (gp_seq + 3) & ~1UL;
+}
+
+static void gp_wait(unsigned long target){
+    unsigned long s;
+    while ((s = gp_seq) < target){
+        if (!(s & 1) && __sync_bool_compare_and_swap(&gp_seq, s, s + 1)){
+            gp_scan();
+            __sync_synchronize();
+            gp_seq = s + 2;
+        }
+        else sched_yield();
+    }
+}
+
+void urcu_synchronize(){
+    gp_wait(gp_target());
+} 
+
+static __thread urcu_queue queue;
+
+static void run_batch(urcu_cb* cbs, int n){
+    int j;
+    for (j = 0; j < n; j++)
+        cbs[j].func(cbs[j].arg);
+}
+
+void urcu_call(void (*func)(void*), void* arg){
+    urcu_queue* q = &queue;
+    int prev;
+    if (q->gen != urcu_gen){
+        //callbacks of a previous instance, their memory is gone
+        q->n[0] = q->n[1] = 0;
+        q->gen = urcu_gen;
+    }
+    q->cbs[q->cur][q->n[q->cur]].func = func;
+    q->cbs[q->cur][q->n[q->cur]].arg = arg;
+    if (++q->n[q->cur] < URCU_CB_BATCH) return;
+    //the batch before has usually had its grace period by now
+    prev = !q->cur;
+    if (q->n[prev]){
+        gp_wait(q->target);
+        run_batch(q->cbs[prev], q->n[prev]);
+        q->n[prev] = 0;
+    }
+    q->target = gp_target();
+    q->cur = prev;
+}
+
+void urcu_barrier(){
+    urcu_queue* q = &queue;
+    if (q->gen != urcu_gen || (!q->n[0] && !q->n[1])) return;
+    urcu_synchronize();
+    run_batch(q->cbs[!q->cur], q->n[!q->cur]);
+    run_batch(q->cbs[q->cur], q->n[q->cur]);
+    q->n[0] = q->n[1] = 0;
+}
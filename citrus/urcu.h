@@ -1,76 +1,114 @@
-#ifndef _URCU_H_
-#define _URCU_H_
-
-/**
- * Copyright 2014 Maya Arbel (mayaarl [at] cs [dot] technion [dot] ac [dot] il).
- * 
- * This file is part of Citrus. 
- * 
- * Citrus is free software: you can redistribute it and/or modify
- * it under the terms of the GNU General Public License as published by
- * the Free Software Foundation, either version 3 of the License, or
- * (at your option) any later version.
- * 
- * This program is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU General Public License for more details.
- * 
- * You should have received a copy of the GNU General Public License
- * along with this program.  If not, see <http://www.gnu.org/licenses/>.
- * 
- * Authors Maya Arbel and Adam Morrison 
- */
-
-#if !defined(EXTERNAL_RCU)
-
-typedef struct rcu_node_t {
-    volatile long time; 
-    char p[184];
-} rcu_node;
-
-void initURCU(int num_threads);
-void urcu_read_lock();
-void urcu_read_unlock();
-void urcu_synchronize(); 
-void urcu_register(int id);
-void urcu_unregister();
-
-#else
-
-#include "urcu.h"
-
-static inline void initURCU(int num_threads)
-{
-    rcu_init();
-}
-
-static inline void urcu_register(int id)
-{
-    rcu_register_thread();
-}
-
-static inline void urcu_unregister()
-{
-    rcu_unregister_thread();
-}
-
-static inline void urcu_read_lock()
-{
-    rcu_read_lock();
-}
-
-static inline void urcu_read_unlock()
-{
-    rcu_read_unlock();
-}
-
-static inline void urcu_synchronize()
-{
-    synchronize_rcu();
-}
-
-#endif  /* EXTERNAL RCU */ 
-
-#endif
-
+#ifndef _URCU_H_
+#define _URCU_H_
+
+/**
+ * Copyright 2014 Maya Arbel (mayaarl [at] cs [dot] technion [dot] ac [dot] il).
+ * 
+ * This file is part of Citrus. 
+ * 
+ * Citrus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * Authors Maya Arbel and Adam Morrison 
+ */
+
+#if !defined(EXTERNAL_RCU)
+
+#define URCU_PAD 128
+
+/* One per thread, alone on an adjacent pair of cache lines */
+typedef struct rcu_node_t {
+    volatile long time; 
+    char p[URCU_PAD - sizeof(long)];
+} __attribute__ ((aligned(URCU_PAD))) rcu_node;
+
+extern __thread rcu_node* urcu_me;
+extern int urcu_reader_fence;
+
+void initURCU(int num_threads);
+void urcu_synchronize(); 
+/* Run func(arg) after a grace period, called outside read-side sections */
+void urcu_call(void (*func)(void*), void* arg);
+/* Run this thread's pending callbacks now */
+void urcu_barrier();
+void urcu_register(int id);
+/* Runs the pending callbacks, done by a registered thread that exits */
+void urcu_unregister();
+
+/*
+ The counter is odd outside a read-side section and only written by
+ its owner, so both ends are plain stores. Entering must be visible
+ before the section's loads, see urcu_reader_fence in new_urcu.c.
+ */
+static inline void urcu_read_lock()
+{
+    urcu_me->time = urcu_me->time + 1;
+    if (urcu_reader_fence)
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    else
+        __asm__ __volatile__ ("" ::: "memory");
+}
+
+static inline void urcu_read_unlock()
+{
+    __atomic_store_n(&urcu_me->time, urcu_me->time + 1, __ATOMIC_RELEASE);
+}
+
+#else
+
+#include "urcu.h"
+
+static inline void initURCU(int num_threads)
+{
+    rcu_init();
+}
+
+static inline void urcu_register(int id)
+{
+    rcu_register_thread();
+}
+
+static inline void urcu_unregister()
+{
+    rcu_unregister_thread();
+}
+
+static inline void urcu_read_lock()
+{
+    rcu_read_lock();
+}
+
+static inline void urcu_read_unlock()
+{
+    rcu_read_unlock();
+}
+
+static inline void urcu_synchronize()
+{
+    synchronize_rcu();
+}
+
+static inline void urcu_call(void (*func)(void*), void* arg)
+{
+    synchronize_rcu();
+    func(arg);
+}
+
+static inline void urcu_barrier()
+{
+}
+
+#endif  /* EXTERNAL RCU */ 
+
+#endif
+
@@ -201,21 +201,12 @@ void* do_bench (void* arguments)
         //--For a completely random values (original)
         ops = pool[rand_range_re(&args->seed, MAX_POOL) - 1];
         val = rand_range_re(&args->seed2, b_size);
-#ifdef LFBST
-        switch (ops){
-            case 1: ret = BENCH_INSERT(&root[args->rank], val); break;
-            case 2: ret = BENCH_DELETE(&root[args->rank], val); break;
-            case 3: ret = BENCH_SEARCH(&root[args->rank], val); break;
-            default: exit(0); break;
-        }
-#else
 	switch (ops){
             case 1: ret = BENCH_INSERT(root, val); break;
             case 2: ret = BENCH_DELETE(root, val); break;
             case 3: ret = BENCH_SEARCH(root, val); break;
             default: exit(0); break;
         }
-#endif
         cont++;
         counter[ops-1]++;
         if(ret)
@@ -247,6 +238,10 @@ void* do_bench (void* arguments)
 	args->timer = (end.tv_sec * 1000 + end.tv_usec / 1000) - (start.tv_sec * 1000 + start.tv_usec / 1000);
 #endif
 
+#ifdef RCUT
+	urcu_unregister();
+#endif
+
 	pthread_exit((void*) arguments);
 }
 
@@ -510,12 +505,12 @@ void* do_test (void* args){
     pthread_barrier_wait(&bench_barrier);
     
     for (i = start; i < end; i++){
-#ifdef LFBST
-		BENCH_INSERT(&untest[myid], bulk[i]);
-#else		
         BENCH_INSERT(untest,  bulk[i]);
-#endif
 	}
+
+#ifdef RCUT
+	urcu_unregister();
+#endif
     pthread_exit((void*) args);
 }
 
@@ -567,11 +562,7 @@ void testpar(data_t root, int updaterate, int num_thread, int random){
     //report_all((*untest->root)->a);
     
     for(i = 0; i < allkey; i++){
-#ifdef LFBST
-		if(BENCH_SEARCH(&root[0], bulk[i]) < 1){
-#else		
 		if(BENCH_SEARCH(root, bulk[i]) < 1){
-#endif
     		count++;
 		}
     }
@@ -603,11 +594,7 @@ void testseq(data_t root, int random){
   gettimeofday(&st, NULL);
 
   for(i = 0; i < MAXITER; i++){
-#ifdef LFBST
-	BENCH_INSERT(&root[0], values[i]);
-#else		
         BENCH_INSERT(root,  values[i]);
-#endif
   }
 
   gettimeofday(&ed, NULL);
@@ -619,11 +606,7 @@ void testseq(data_t root, int random){
   gettimeofday(&st, NULL);
 
   for(i = 0; i < MAXITER; i++){
-#ifdef LFBST
-		if(BENCH_SEARCH(&root[0], values[i]) < 1){
-#else		
 		if(BENCH_SEARCH(root, values[i]) < 1){
-#endif
             count++;
         }
   }
@@ -115,11 +115,11 @@
 #include "../LFBST/operations.h"
 
 
-#define data_t thread_data_t*
+#define data_t lfbst_t*
 
-#define BENCH_SEARCH(root, x)  search(root, x)
-#define BENCH_DELETE(root, x)  delete_node(root, x)
-#define BENCH_INSERT(root, x)  insert(root, x)
+#define BENCH_SEARCH(root, x)  lfbst_search(root, x)
+#define BENCH_DELETE(root, x)  lfbst_delete(root, x)
+#define BENCH_INSERT(root, x)  lfbst_insert(root, x)
 
 #endif
 
@@ -132,7 +132,7 @@
 
 #define BENCH_SEARCH(root, x)  contains(root, x)
 #define BENCH_DELETE(root, x)  delete_node(root, x)
-#define BENCH_INSERT(root, x)  insert(root, x, NULL)
+#define BENCH_INSERT(root, x)  insert(root, x, 0)
 
 #endif
 
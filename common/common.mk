@@ -12,6 +12,8 @@ GEM5_DIR := ../m5
 
 CMN_INC	:= ../common
 
+OBJCOPY ?= objcopy
+
 ARCH:=$(shell uname -m)
 
 #Addon (default) files
@@ -73,6 +75,10 @@ PROF_OBJS += ${SRCPROF:.c=.o.prof} ${SRCS:.c=.o.prof} ${ADDONS:.c=.o.prof}
 PROF_CCFLAGS += ${ADDFLAG}
 PROF_LDFLAGS += ${ADDLD} ${PROFLIB}
 
+#Generic map backend (see map.h): one relocatable object that only exports ${MAP_OPS}
+
+MAP_OBJS := ${MAP_SRCS:.c=.o.map} ${CMN_INC}/locks.o.map
+
 #Precompiled objects
 ifdef PREC
 PREC_ENE := ${PREC}.ene
@@ -82,7 +88,7 @@ endif
 
 #BUILD ----------------------------------------------------
 
-.PHONY: all clean prep lib
+.PHONY: all clean prep lib map
 
 all:: prep ${TARGET} ${TARGET}.pcm ${TARGET}.profile 
 
@@ -115,6 +121,18 @@ ${PROF_OBJS}: %.o.prof: %.c
 	${CC} ${PROF_CCFLAGS} ${CCFLAGS} ${TREE} -o $@ -c $< 
 
 
+#Map
+
+map: prep ${TARGET}.map.o
+
+${TARGET}.map.o: ${MAP_OBJS}
+	${LD} -r -d -o $@ $^ ${PREC}
+	${OBJCOPY} --keep-global-symbol=${MAP_OPS} $@
+
+${MAP_OBJS}: %.o.map: %.c
+	${CC} ${CCFLAGS} ${TREE} -DNOT_STANDALONE -o $@ -c $< 
+
+
 #Simulator
 #
 #${TARGET}.sim: ${SIM_OBJS}
@@ -136,4 +154,4 @@ ${PROF_OBJS}: %.o.prof: %.c
 
 
 clean:: 
-	-rm -f *~ *.a ${OBJS} ${TEST_OBJS} ${PREC} ${PREC}.ene ${PREC}.prof ${SIM_OBJS} ${ENE_OBJS} ${PROF_OBJS} ${TARGET} ${TARGET}.test ${TARGET}.sim ${TARGET}.profile ${TARGET}.pcm 
+	-rm -f *~ *.a ${OBJS} ${TEST_OBJS} ${PREC} ${PREC}.ene ${PREC}.prof ${SIM_OBJS} ${ENE_OBJS} ${PROF_OBJS} ${TARGET} ${TARGET}.test ${TARGET}.sim ${TARGET}.profile ${TARGET}.pcm ${MAP_OBJS} ${TARGET}.map.o
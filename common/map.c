@@ -0,0 +1,517 @@
+/*
+ map.c
+
+ This is part of the tree library
+
+ Copyright 2015 Ibrahim Umar (UiT the Arctic University of Norway)
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "map.h"
+
+#define CACHE_LINE 64
+
+/* Retired cells are freed in batches, one grace period per batch */
+#define MAP_LIMBO_BATCH 128
+
+/*
+ The trees only give us insert-if-absent, lookup and remove, so values
+ are kept in a cell that the tree stores as its data pointer. Updates
+ are a CAS on the cell, and a remove first swings the cell to MAP_TOMB
+ (which is its linearization point) before unlinking the key from the
+ tree. A tombstoned cell is never revived; a put that finds one waits
+ until the remover has unlinked the key and then inserts a fresh cell.
+
+ Backends without MAP_DELETE keep the key and its cell forever, and a
+ NULL cell value stands for an absent key.
+ */
+struct map_cell {
+	void * volatile		val;
+	map_key_t		key;
+	struct map_cell *	next;
+};
+
+static char map_tomb;
+#define MAP_TOMB ((void*) &map_tomb)
+
+/*
+ Per-thread slot. `time` is odd while the thread is inside an operation
+ (same scheme as citrus' URCU); `count` is this thread's share of the
+ map size.
+ */
+struct map_thread {
+	volatile unsigned long	time;
+	long			count;
+	struct map_cell *	limbo;
+	int			nlimbo;
+} __attribute__ ((aligned(CACHE_LINE)));
+
+struct map {
+	const struct map_ops *	ops;
+	void *			tree;
+	int			nthreads;
+	struct map_thread *	threads;
+};
+
+static __thread int map_tid = -1;
+
+
+/*---------------------- BACKEND REGISTRY ----------------------*/
+
+/* Backends that are not linked in resolve to NULL */
+extern const struct map_ops cbtree_map_ops __attribute__ ((weak));
+extern const struct map_ops greenbst_map_ops __attribute__ ((weak));
+extern const struct map_ops deltatree_map_ops __attribute__ ((weak));
+extern const struct map_ops bluebst_map_ops __attribute__ ((weak));
+extern const struct map_ops bsttk_map_ops __attribute__ ((weak));
+extern const struct map_ops lfbst_map_ops __attribute__ ((weak));
+extern const struct map_ops citrus_map_ops __attribute__ ((weak));
+extern const struct map_ops sveb_map_ops __attribute__ ((weak));
+
+static const struct map_ops *map_registry(int i)
+{
+	switch (i) {
+	case 0: return &cbtree_map_ops;
+	case 1: return &greenbst_map_ops;
+	case 2: return &deltatree_map_ops;
+	case 3: return &bluebst_map_ops;
+	case 4: return &bsttk_map_ops;
+	case 5: return &lfbst_map_ops;
+	case 6: return &citrus_map_ops;
+	case 7: return &sveb_map_ops;
+	default: return NULL;
+	}
+}
+
+#define MAP_REGISTRY_SIZE 8
+
+/*
+ Backends flagged MAP_SINGLETON keep their tree in globals, so a second
+ live instance would share (and corrupt) the first one's state.
+ */
+static const struct map_ops *map_singletons[MAP_REGISTRY_SIZE];
+static volatile int map_singletons_lock;
+
+static int map_singleton_claim(const struct map_ops *ops)
+{
+	int i, free_slot = -1, ret = 0;
+
+	while (__sync_lock_test_and_set(&map_singletons_lock, 1))
+		;
+	for (i = 0; i < MAP_REGISTRY_SIZE; i++) {
+		if (map_singletons[i] == ops)
+			goto out;
+		if (map_singletons[i] == NULL && free_slot < 0)
+			free_slot = i;
+	}
+	if (free_slot >= 0) {
+		map_singletons[free_slot] = ops;
+		ret = 1;
+	}
+out:
+	__sync_lock_release(&map_singletons_lock);
+	return ret;
+}
+
+static void map_singleton_release(const struct map_ops *ops)
+{
+	int i;
+
+	while (__sync_lock_test_and_set(&map_singletons_lock, 1))
+		;
+	for (i = 0; i < MAP_REGISTRY_SIZE; i++)
+		if (map_singletons[i] == ops)
+			map_singletons[i] = NULL;
+	__sync_lock_release(&map_singletons_lock);
+}
+
+int map_backend_count(void)
+{
+	int i, n = 0;
+
+	for (i = 0; i < MAP_REGISTRY_SIZE; i++)
+		if (map_registry(i))
+			n++;
+	return n;
+}
+
+const struct map_ops *map_backend(int i)
+{
+	int j;
+
+	for (j = 0; j < MAP_REGISTRY_SIZE; j++)
+		if (map_registry(j) && i-- == 0)
+			return map_registry(j);
+	return NULL;
+}
+
+const struct map_ops *map_backend_find(const char *name)
+{
+	int i;
+	const struct map_ops *ops;
+
+	for (i = 0; (ops = map_backend(i)); i++)
+		if (strcmp(ops->name, name) == 0)
+			return ops;
+	return NULL;
+}
+
+
+/*---------------------- GRACE PERIODS ----------------------*/
+
+static inline struct map_thread *map_self(map_t *map)
+{
+	assert(map_tid >= 0 && map_tid < map->nthreads);
+	return &map->threads[map_tid];
+}
+
+static inline void map_enter(struct map_thread *t)
+{
+	/* Must be visible before we read any tree/cell pointer */
+	__atomic_store_n(&t->time, t->time + 1, __ATOMIC_SEQ_CST);
+}
+
+static void map_synchronize(map_t *map)
+{
+	unsigned long snap[MAP_MAX_THREADS];
+	int i;
+
+	for (i = 0; i < map->nthreads; i++)
+		snap[i] = map->threads[i].time;
+
+	for (i = 0; i < map->nthreads; i++) {
+		if (!(snap[i] & 1))
+			continue;
+		while (map->threads[i].time == snap[i])
+			__asm__ __volatile__ ("" ::: "memory");
+	}
+}
+
+static void map_reclaim(map_t *map, struct map_thread *t)
+{
+	struct map_cell *c, *next;
+
+	map_synchronize(map);
+
+	for (c = t->limbo; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	t->limbo = NULL;
+	t->nlimbo = 0;
+}
+
+static inline void map_leave(map_t *map, struct map_thread *t)
+{
+	__atomic_store_n(&t->time, t->time + 1, __ATOMIC_RELEASE);
+
+	if (t->nlimbo >= MAP_LIMBO_BATCH)
+		map_reclaim(map, t);
+}
+
+static inline void map_retire(struct map_thread *t, struct map_cell *c)
+{
+	c->next = t->limbo;
+	t->limbo = c;
+	t->nlimbo++;
+}
+
+static struct map_cell *map_cell_new(map_key_t key, void *val)
+{
+	struct map_cell *c = malloc(sizeof(struct map_cell));
+
+	if (c == NULL) {
+		perror("Map cell creation.");
+		exit(EXIT_FAILURE);
+	}
+	c->val = val;
+	c->key = key;
+	c->next = NULL;
+	return c;
+}
+
+/*
+ Readers of some trees (CBTree) may race with a writer shifting a leaf
+ and hand back the neighbouring slot; the cell remembers its key so we
+ can tell and look again. Cells are never freed inside an operation.
+ */
+static inline struct map_cell *map_lookup(map_t *map, map_key_t key)
+{
+	struct map_cell *c;
+
+	do {
+		c = map->ops->lookup(map->tree, key);
+	} while (c && c->key != key);
+
+	return c;
+}
+
+
+/*---------------------- MAP ----------------------*/
+
+map_t *map_create_ops(const struct map_ops *ops, int nthreads)
+{
+	map_t *map;
+
+	if (ops == NULL || nthreads < 1 || nthreads > MAP_MAX_THREADS)
+		return NULL;
+
+	if ((ops->flags & MAP_SINGLETON) && !map_singleton_claim(ops))
+		return NULL;
+
+	map = malloc(sizeof(map_t));
+	if (map == NULL)
+		goto fail;
+
+	if (posix_memalign((void**) &map->threads, CACHE_LINE,
+			   nthreads * sizeof(struct map_thread))) {
+		free(map);
+		goto fail;
+	}
+	memset(map->threads, 0, nthreads * sizeof(struct map_thread));
+
+	map->ops = ops;
+	map->nthreads = nthreads;
+	map->tree = ops->alloc(nthreads);
+
+	if (map->tree == NULL) {
+		free(map->threads);
+		free(map);
+		goto fail;
+	}
+	return map;
+
+fail:
+	if (ops->flags & MAP_SINGLETON)
+		map_singleton_release(ops);
+	return NULL;
+}
+
+map_t *map_create(const char *name, int nthreads)
+{
+	return map_create_ops(map_backend_find(name), nthreads);
+}
+
+void map_destroy(map_t *map)
+{
+	int i;
+
+	/* Caller guarantees that no thread is inside the map */
+	for (i = 0; i < map->nthreads; i++)
+		map_reclaim(map, &map->threads[i]);
+
+	map->ops->free(map->tree);
+	if (map->ops->flags & MAP_SINGLETON)
+		map_singleton_release(map->ops);
+	free(map->threads);
+	free(map);
+}
+
+void map_thread_init(map_t *map, int tid)
+{
+	assert(tid >= 0 && tid < map->nthreads);
+
+	map_tid = tid;
+	if (map->ops->thread_init)
+		map->ops->thread_init(map->tree, tid);
+}
+
+const char *map_name(map_t *map)
+{
+	return map->ops->name;
+}
+
+unsigned map_flags(map_t *map)
+{
+	return map->ops->flags;
+}
+
+map_key_t map_max_key(map_t *map)
+{
+	return map->ops->max_key;
+}
+
+void *map_get(map_t *map, map_key_t key)
+{
+	struct map_thread *t;
+	struct map_cell *c;
+	void *val = NULL;
+
+	if (!(map->ops->flags & MAP_VALUES))
+		return map->ops->lookup(map->tree, key) ? MAP_PRESENT : NULL;
+
+	t = map_self(map);
+	map_enter(t);
+
+	c = map_lookup(map, key);
+	if (c) {
+		val = c->val;
+		if (val == MAP_TOMB)
+			val = NULL;
+	}
+
+	map_leave(map, t);
+	return val;
+}
+
+void *map_put(map_t *map, map_key_t key, void *val)
+{
+	struct map_thread *t;
+	struct map_cell *c, *fresh = NULL;
+	void *old;
+
+	assert(val != NULL);
+
+	t = map_self(map);
+
+	if (!(map->ops->flags & MAP_VALUES)) {
+		if (!map->ops->insert(map->tree, key, MAP_PRESENT))
+			return MAP_PRESENT;
+		t->count++;
+		return NULL;
+	}
+
+	map_enter(t);
+
+	while (1) {
+		c = map_lookup(map, key);
+		if (c) {
+			old = c->val;
+			/* Being removed, wait until the key is unlinked */
+			if (old == MAP_TOMB)
+				continue;
+			if (__sync_bool_compare_and_swap(&c->val, old, val)) {
+				if (old == NULL)
+					t->count++;
+				break;
+			}
+			continue;
+		}
+
+		if (fresh == NULL)
+			fresh = map_cell_new(key, val);
+
+		if (map->ops->insert(map->tree, key, fresh)) {
+			fresh = NULL;
+			old = NULL;
+			t->count++;
+			break;
+		}
+	}
+
+	map_leave(map, t);
+
+	/* Never published, no grace period needed */
+	if (fresh)
+		free(fresh);
+
+	return old;
+}
+
+int map_compare_and_update(map_t *map, map_key_t key, void *expected, void *val)
+{
+	struct map_thread *t;
+	struct map_cell *c;
+	int ret;
+
+	assert(expected != NULL && val != NULL);
+
+	if (!(map->ops->flags & MAP_VALUES))
+		return expected == MAP_PRESENT && map->ops->lookup(map->tree, key);
+
+	t = map_self(map);
+	map_enter(t);
+
+	/* expected is never NULL or MAP_TOMB, so a removed cell cannot match */
+	c = map_lookup(map, key);
+	ret = c && __sync_bool_compare_and_swap(&c->val, expected, val);
+
+	map_leave(map, t);
+	return ret;
+}
+
+void *map_remove(map_t *map, map_key_t key)
+{
+	struct map_thread *t;
+	struct map_cell *c;
+	void *old;
+
+	t = map_self(map);
+
+	if (!(map->ops->flags & MAP_VALUES)) {
+		if (!(map->ops->flags & MAP_DELETE))
+			return NULL;
+		if (!map->ops->remove(map->tree, key))
+			return NULL;
+		t->count--;
+		return MAP_PRESENT;
+	}
+
+	map_enter(t);
+
+	while (1) {
+		c = map_lookup(map, key);
+		if (c == NULL) {
+			old = NULL;
+			break;
+		}
+
+		old = c->val;
+		/* Someone else removed it first */
+		if (old == MAP_TOMB || old == NULL) {
+			old = NULL;
+			break;
+		}
+
+		if (!(map->ops->flags & MAP_DELETE)) {
+			if (__sync_bool_compare_and_swap(&c->val, old, NULL)) {
+				t->count--;
+				break;
+			}
+			continue;
+		}
+
+		if (__sync_bool_compare_and_swap(&c->val, old, MAP_TOMB)) {
+			/*
+			 A remove racing with a restructure of the tree can
+			 fail while the key is still there. The cell may only
+			 be retired once the tree no longer reaches it.
+			 */
+			while (!map->ops->remove(map->tree, key) &&
+			       map_lookup(map, key) == c)
+				;
+			map_retire(t, c);
+			t->count--;
+			break;
+		}
+	}
+
+	map_leave(map, t);
+	return old;
+}
+
+long map_size(map_t *map)
+{
+	long size = 0;
+	int i;
+
+	for (i = 0; i < map->nthreads; i++)
+		size += map->threads[i].count;
+	return size;
+}
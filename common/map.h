@@ -0,0 +1,128 @@
+/*
+ map.h
+
+ This is part of the tree library
+
+ Copyright 2015 Ibrahim Umar (UiT the Arctic University of Norway)
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+/*
+ Generic, runtime-selectable ordered map.
+
+ Unlike map_select.h, which binds one tree at compile time through
+ macros, every tree here exports a `struct map_ops` table and a single
+ process can create maps on any backend by name:
+
+     map_t *m = map_create("cbtree", nthreads);
+     map_thread_init(m, tid);            // once per worker thread
+     map_put(m, key, value);
+     map_get(m, key);
+     map_remove(m, key);
+     map_destroy(m);
+
+ Keys are in [1, map_max_key(m)]. Values are non-NULL pointers; NULL
+ always means "absent". Backends that only implement a set (no data
+ slot per key) are flagged without MAP_VALUES: there map_get returns
+ MAP_PRESENT for a present key and stored values are discarded.
+
+ Each backend is built as one relocatable object (`make map` in the
+ tree directory) that exports nothing but its ops table, so trees with
+ clashing symbol names can be linked into the same binary.
+ */
+
+#ifndef map_h
+#define map_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uintptr_t map_key_t;
+
+/* Returned by set-only backends in place of a stored value */
+#define MAP_PRESENT	((void*) 1)
+
+/* Backend capability flags */
+#define MAP_VALUES	0x1	/* tree stores a data pointer per key */
+#define MAP_DELETE	0x2	/* tree physically removes keys */
+#define MAP_SINGLETON	0x4	/* at most one instance per process */
+
+/* Maximum number of threads a map can be created for */
+#define MAP_MAX_THREADS 256
+
+/*
+ Per-tree primitives. `lookup` returns the data pointer stored under
+ the key (or any non-NULL value for set-only trees), `insert` only
+ succeeds when the key is absent, `remove` returns 1 when the key was
+ found and removed. `thread_init` may be NULL.
+ */
+struct map_ops {
+	const char *	name;
+	unsigned	flags;
+	map_key_t	max_key;
+
+	void *	(*alloc)(int nthreads);
+	void	(*free)(void *tree);
+	void	(*thread_init)(void *tree, int tid);
+
+	void *	(*lookup)(void *tree, map_key_t key);
+	int	(*insert)(void *tree, map_key_t key, void *data);
+	int	(*remove)(void *tree, map_key_t key);
+};
+
+typedef struct map map_t;
+
+/* Backend registry */
+int map_backend_count(void);
+const struct map_ops *map_backend(int i);
+const struct map_ops *map_backend_find(const char *name);
+
+map_t *map_create(const char *name, int nthreads);
+map_t *map_create_ops(const struct map_ops *ops, int nthreads);
+void map_destroy(map_t *map);
+
+/* Must be called by every thread (tid in [0, nthreads)) before use */
+void map_thread_init(map_t *map, int tid);
+
+const char *map_name(map_t *map);
+unsigned map_flags(map_t *map);
+map_key_t map_max_key(map_t *map);
+
+/* Value of key, or NULL */
+void *map_get(map_t *map, map_key_t key);
+
+/* Upsert. Returns the replaced value, or NULL if key was inserted */
+void *map_put(map_t *map, map_key_t key, void *val);
+
+/* Replace the value of key only if it is currently `expected` */
+int map_compare_and_update(map_t *map, map_key_t key, void *expected, void *val);
+
+/*
+ Returns the removed value, or NULL if key was absent. Value backends
+ without MAP_DELETE only clear the value; set-only backends without it
+ cannot remove at all.
+ */
+void *map_remove(map_t *map, map_key_t key);
+
+/* Number of keys (exact when quiescent) */
+long map_size(map_t *map);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -30,8 +30,6 @@
 
 #include "../CBTree/common.h"
 
-extern pthread_spinlock_t global_lock;
-
 #define MAP_T 			node**
 
 #define MAP_ALLOC(x,y) 		cbtree_alloc()
@@ -41,6 +39,13 @@ extern pthread_spinlock_t global_lock;
 #define MAP_REMOVE(root,x)	delete_par(*root, x)
 #define	MAP_INSERT(root, x, y)	insert_par(root, x, y)
 
+/* Ordered scans, CBTree only */
+#define MAP_RANGE(root, lo, hi, keys, vals, max)	range_par(*root, lo, hi, keys, vals, max)
+#define MAP_CURSOR_T		cbtree_cursor*
+#define MAP_CURSOR_OPEN(root, lo, hi)	cbtree_cursor_open(root, lo, hi)
+#define MAP_CURSOR_NEXT(c, k, v)	cbtree_cursor_next(c, k, v)
+#define MAP_CURSOR_CLOSE(c)		cbtree_cursor_close(c)
+
 
 #endif
 
@@ -79,6 +84,68 @@ extern pthread_spinlock_t global_lock;
 
 #endif
 
+#ifdef MAP_USE_CITRUS
+
+#include <pthread.h>
+#include "../citrus/citrus.h"
+#include "../citrus/urcu.h"
+
+/*
+ The URCU table is global, so one tree per process. x is the number of
+ threads; each of them registers with MAP_THREAD_INIT before use (the
+ allocating thread is registered as 0).
+ */
+static inline node citrus_alloc(int nthreads)
+{
+    initURCU(nthreads > 0 ? nthreads : 1);
+    urcu_register(0);
+    return init();
+}
+
+/* The pointer macros below have NULL for an absent key */
+static inline void* citrus_get(node root, skey_t key)
+{
+    sval_t value;
+    return get(root, key, &value) ? (void*) value : NULL;
+}
+
+static inline void* citrus_upsert(node root, skey_t key, void* value)
+{
+    sval_t old;
+    return upsert(root, key, (sval_t) value, &old) ? (void*) old : NULL;
+}
+
+#define MAP_T node
+
+#define MAP_ALLOC(x,y) citrus_alloc(x)
+#define MAP_FREE(x) destroy(x)
+#define MAP_THREAD_INIT(root, tid) urcu_register(tid)
+
+#define MAP_GET(root, x)		citrus_get(root, x)
+#define MAP_CONTAINS(root, x)   (contains(root, x) == 1)
+#define MAP_REMOVE(root, x)		delete_node(root, x)
+#define MAP_INSERT(root, x, y)  insert(root, x, (sval_t) (y))
+#define MAP_UPSERT(root, x, y)  citrus_upsert(root, x, (void*) (y))
+
+#endif
+
+#ifdef MAP_USE_LFBST
+
+#include "../LFBST/lfbst.h"
+
+/* A set: no MAP_GET. Threads register on their first operation. */
+#define MAP_T lfbst_t*
+
+#define MAP_ALLOC(x,y) lfbst_create()
+#define MAP_FREE(x) lfbst_destroy(x)
+#define MAP_THREAD_INIT(root, tid) lfbst_thread_init(root)
+
+#define MAP_CONTAINS(root, x)   lfbst_search(root, x)
+#define MAP_REMOVE(root, x)		lfbst_delete(root, x)
+#define MAP_INSERT(root, x, y)  lfbst_insert(root, x)
+
+#endif
+
 #ifdef MAP_USE_BBST
 
 data_t bbst_alloc(int a, int b)
@@ -23,6 +23,7 @@ int main ()
 	for (i = 0; i < numData; i++)
 		printf("%ld: %d\n", i+1, MAP_CONTAINS(cbtreePtr, i+1));
 
+#ifdef MAP_GET
 	for (i = 0; i < numData; i++){
 		char *a = (char*) MAP_GET(cbtreePtr, i+1);
 		if(!a)
@@ -30,6 +31,29 @@ int main ()
 		else
 			printf("key %ld: , value %c\n", i+1, *a);
 	}
+#endif
+
+#ifdef MAP_RANGE
+	{
+		uintptr_t keys[8], key;
+		void *vals[8], *val;
+		int n, j;
+		MAP_CURSOR_T cursor;
+
+		n = MAP_RANGE(cbtreePtr, 10, 50, keys, vals, 8);
+		printf("range [10, 50], first %d:", n);
+		for (j = 0; j < n; j++)
+			printf(" %lu=%c", (unsigned long) keys[j], *(char*) vals[j]);
+		printf("\n");
+
+		cursor = MAP_CURSOR_OPEN(cbtreePtr, 90, 200);
+		printf("cursor [90, 200]:");
+		while (MAP_CURSOR_NEXT(cursor, &key, &val))
+			printf(" %lu=%c", (unsigned long) key, *(char*) val);
+		printf("\n");
+		MAP_CURSOR_CLOSE(cursor);
+	}
+#endif
 
 	for (i = 0; i < numData; i++)
 		MAP_REMOVE(cbtreePtr, i+1);
@@ -0,0 +1,409 @@
+/*
+ map_test.c
+
+ Conformance and performance test for the generic map interface (map.h).
+ Runs every backend linked into the binary, or only the one given by -m.
+
+ This is part of the tree library
+
+ Copyright 2015 Ibrahim Umar (UiT the Arctic University of Norway)
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "map.h"
+
+#define V(x)	((void*) (uintptr_t) (x))
+
+static int nthreads = 4;
+static long range = 100000;
+static long nops = 1000000;
+static int update = 20;
+
+static pthread_barrier_t barrier;
+
+/*
+ Backends that do not pass conformance yet. Their failures are reported
+ but do not fail the run, so the exit status still catches regressions
+ in the others.
+ */
+static const char *known_failing[] = { "greenbst", "bluebst", "deltatree" };
+
+struct worker {
+	pthread_t	pid;
+	int		tid;
+	map_t *		map;
+	map_key_t	range;
+	unsigned	seed;
+	long		errors;
+	long		count;
+	long		ops;
+};
+
+static inline map_key_t rand_key(unsigned *seed, map_key_t r)
+{
+	return (rand_r(seed) % r) + 1;
+}
+
+/* Set-only backends without MAP_DELETE cannot remove at all */
+static inline int can_remove(map_t *map)
+{
+	return map_flags(map) & (MAP_VALUES | MAP_DELETE);
+}
+
+static inline void *expect(map_t *map, void *val)
+{
+	if (val == NULL || (map_flags(map) & MAP_VALUES))
+		return val;
+	return MAP_PRESENT;
+}
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "  FAIL %s:%d: ", __FILE__, __LINE__); \
+		fprintf(stderr, __VA_ARGS__); \
+		fputc('\n', stderr); \
+		errors++; \
+	} \
+} while (0)
+
+
+/*-------------------- Single thread, against a reference array --------------------*/
+
+static long test_seq(map_t *map, map_key_t r)
+{
+	void **ref = calloc(r + 1, sizeof(void*));
+	unsigned seed = 1;
+	long errors = 0, size = 0, i;
+	map_key_t k;
+	void *got, *old;
+
+	map_thread_init(map, 0);
+
+	for (i = 0; i < nops; i++) {
+		k = rand_key(&seed, r);
+		old = ref[k];
+
+		switch (rand_r(&seed) % 5) {
+		case 0: /* put */
+		case 1:
+			got = map_put(map, k, V(i + 1));
+			CHECK(got == expect(map, old), "put %lu returned %p, expected %p", k, got, old);
+			if (!old)
+				size++;
+			ref[k] = expect(map, V(i + 1));
+			break;
+		case 2: /* compare and update */
+			got = old ? old : V(1);
+			if (map_compare_and_update(map, k, got, V(i + 1)) != (old != NULL))
+				CHECK(0, "compare_and_update %lu", k);
+			else if (old)
+				ref[k] = expect(map, V(i + 1));
+			break;
+		case 3: /* remove */
+			if (!can_remove(map))
+				break;
+			got = map_remove(map, k);
+			CHECK(got == old, "remove %lu returned %p, expected %p", k, got, old);
+			if (old)
+				size--;
+			ref[k] = NULL;
+			break;
+		default:
+			got = map_get(map, k);
+			CHECK(got == old, "get %lu returned %p, expected %p", k, got, old);
+		}
+
+		if (errors > 10)
+			break;
+	}
+
+	for (k = 1; k <= r && errors <= 10; k++)
+		CHECK(map_get(map, k) == ref[k], "final get %lu", k);
+
+	CHECK(map_size(map) == size, "size %ld, expected %ld", map_size(map), size);
+
+	free(ref);
+	return errors;
+}
+
+
+/*-------------------- Threads on interleaved keys --------------------*/
+
+static void *do_stripe(void *arg)
+{
+	struct worker *w = arg;
+	map_t *map = w->map;
+	map_key_t stripe = w->range / nthreads, k;
+	void **ref = calloc(stripe + 1, sizeof(void*));
+	long errors = 0, i, j;
+	void *got, *old;
+
+	map_thread_init(map, w->tid);
+	pthread_barrier_wait(&barrier);
+
+	/* Key j of this thread is j * nthreads + tid, neighbours belong to others */
+	for (i = 0; i < nops / nthreads; i++) {
+		j = rand_r(&w->seed) % stripe + 1;
+		k = (j - 1) * nthreads + w->tid + 1;
+		old = ref[j];
+
+		switch (rand_r(&w->seed) % 4) {
+		case 0:
+			got = map_put(map, k, V(i + 1));
+			CHECK(got == expect(map, old), "put %lu returned %p, expected %p", k, got, old);
+			ref[j] = expect(map, V(i + 1));
+			break;
+		case 1:
+			if (!can_remove(map))
+				break;
+			got = map_remove(map, k);
+			CHECK(got == old, "remove %lu returned %p, expected %p", k, got, old);
+			ref[j] = NULL;
+			break;
+		default:
+			got = map_get(map, k);
+			CHECK(got == old, "get %lu returned %p, expected %p", k, got, old);
+		}
+
+		if (errors > 10)
+			break;
+	}
+
+	for (j = 1; j <= (long) stripe; j++)
+		if (ref[j])
+			w->count++;
+
+	w->errors = errors;
+	free(ref);
+	return NULL;
+}
+
+/*-------------------- Shared counter through compare_and_update --------------------*/
+
+static void *do_counter(void *arg)
+{
+	struct worker *w = arg;
+	long i;
+	void *v;
+
+	map_thread_init(w->map, w->tid);
+	pthread_barrier_wait(&barrier);
+
+	for (i = 0; i < nops / nthreads / 10; i++) {
+		do {
+			v = map_get(w->map, 1);
+		} while (!map_compare_and_update(w->map, 1, v, V((uintptr_t) v + 1)));
+		w->ops++;
+	}
+	return NULL;
+}
+
+static long run_workers(map_t *map, map_key_t r, void *(*fn)(void*), struct worker *w)
+{
+	int i;
+
+	pthread_barrier_init(&barrier, NULL, nthreads);
+
+	for (i = 0; i < nthreads; i++) {
+		memset(&w[i], 0, sizeof(struct worker));
+		w[i].tid = i;
+		w[i].map = map;
+		w[i].range = r;
+		w[i].seed = i + 1;
+		pthread_create(&w[i].pid, NULL, fn, &w[i]);
+	}
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(w[i].pid, NULL);
+
+	pthread_barrier_destroy(&barrier);
+	return 0;
+}
+
+static long test_par(map_t *map, map_key_t r)
+{
+	struct worker w[nthreads];
+	long errors = 0, count = 0, ops = 0;
+	void *v;
+	int i;
+
+	run_workers(map, r, do_stripe, w);
+
+	for (i = 0; i < nthreads; i++) {
+		errors += w[i].errors;
+		count += w[i].count;
+	}
+	CHECK(map_size(map) == count, "size %ld, expected %ld", map_size(map), count);
+
+	if (!(map_flags(map) & MAP_VALUES))
+		return errors;
+
+	map_thread_init(map, 0);
+	map_put(map, 1, V(1));
+
+	run_workers(map, r, do_counter, w);
+
+	for (i = 0; i < nthreads; i++)
+		ops += w[i].ops;
+
+	map_thread_init(map, 0);
+	v = map_get(map, 1);
+	CHECK(v == V(ops + 1), "counter %lu, expected %ld", (uintptr_t) v, ops + 1);
+
+	return errors;
+}
+
+
+/*-------------------- Throughput --------------------*/
+
+static void *do_bench(void *arg)
+{
+	struct worker *w = arg;
+	map_key_t k;
+	long i;
+	int op;
+
+	map_thread_init(w->map, w->tid);
+	pthread_barrier_wait(&barrier);
+
+	for (i = 0; i < nops / nthreads; i++) {
+		k = rand_key(&w->seed, w->range);
+		op = rand_r(&w->seed) % 200;
+
+		if (op < update)
+			map_put(w->map, k, V(k));
+		else if (op < 2 * update)
+			map_remove(w->map, k);
+		else
+			map_get(w->map, k);
+	}
+	w->ops = i;
+	return NULL;
+}
+
+static void bench(map_t *map, map_key_t r)
+{
+	struct worker w[nthreads];
+	struct timeval st, ed;
+	unsigned seed = 7;
+	long i, ops = 0;
+	double usec;
+
+	map_thread_init(map, 0);
+	for (i = 0; i < (long) r / 2; i++)
+		map_put(map, rand_key(&seed, r), V(i + 1));
+
+	gettimeofday(&st, NULL);
+	run_workers(map, r, do_bench, w);
+	gettimeofday(&ed, NULL);
+
+	for (i = 0; i < nthreads; i++)
+		ops += w[i].ops;
+
+	usec = (ed.tv_sec - st.tv_sec) * 1000000.0 + ed.tv_usec - st.tv_usec;
+	printf("  bench: %ld ops, %d%% updates, %d threads, %.0f usec, %.2f Mops/s\n",
+	       ops, update, nthreads, usec, ops / usec);
+}
+
+
+static int is_known_failing(const struct map_ops *ops)
+{
+	unsigned i;
+
+	for (i = 0; i < sizeof(known_failing) / sizeof(known_failing[0]); i++)
+		if (strcmp(ops->name, known_failing[i]) == 0)
+			return 1;
+	return 0;
+}
+
+static long run(const struct map_ops *ops)
+{
+	map_key_t r = range < (long) ops->max_key ? range : ops->max_key;
+	long errors = 0;
+	map_t *map;
+
+	printf("%s:\n", ops->name);
+	fflush(stdout);
+
+	map = map_create_ops(ops, nthreads);
+	errors += test_seq(map, r);
+	map_destroy(map);
+
+	map = map_create_ops(ops, nthreads);
+	errors += test_par(map, r);
+	map_destroy(map);
+
+	if (errors && is_known_failing(ops)) {
+		printf("  conformance: FAILED (known)\n");
+		errors = 0;
+	} else
+		printf("  conformance: %s\n", errors ? "FAILED" : "ok");
+	fflush(stdout);
+
+	map = map_create_ops(ops, nthreads);
+	bench(map, r);
+	map_destroy(map);
+
+	return errors;
+}
+
+int main(int argc, char **argv)
+{
+	const struct map_ops *ops;
+	const char *name = NULL;
+	long errors = 0;
+	int i, opt;
+
+	while ((opt = getopt(argc, argv, "m:n:r:o:u:h")) != -1) {
+		switch (opt) {
+		case 'm': name = optarg; break;
+		case 'n': nthreads = atoi(optarg); break;
+		case 'r': range = atol(optarg); break;
+		case 'o': nops = atol(optarg); break;
+		case 'u': update = atoi(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-m backend] [-n threads] [-r range] [-o ops] [-u update %%]\n", argv[0]);
+			fprintf(stderr, "Backends:");
+			for (i = 0; (ops = map_backend(i)); i++)
+				fprintf(stderr, " %s", ops->name);
+			fprintf(stderr, "\n");
+			exit(opt == 'h' ? 0 : 1);
+		}
+	}
+
+	if (nthreads < 1 || nthreads > MAP_MAX_THREADS || range < nthreads) {
+		fprintf(stderr, "Bad parameters\n");
+		exit(1);
+	}
+
+	if (name) {
+		if (!(ops = map_backend_find(name))) {
+			fprintf(stderr, "No backend %s\n", name);
+			exit(1);
+		}
+		errors = run(ops);
+	} else {
+		for (i = 0; (ops = map_backend(i)); i++)
+			errors += run(ops);
+	}
+
+	return errors ? 1 : 0;
+}
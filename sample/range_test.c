@@ -0,0 +1,186 @@
+/*
+ range_test.c
+
+ Range scans of the lock-free BST (LFBST) against writers that never
+ stop. Even keys are always present. Each writer owns a class of odd
+ keys and moves a token through it, inserting the new position before
+ deleting the old one, so every snapshot holds one or two keys of each
+ class. A scan that misses an even key, holds no token or too many of
+ a class, or does not finish in time fails the test.
+
+ This is part of the tree library
+
+ Copyright 2015 Ibrahim Umar (UiT the Arctic University of Norway)
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "../LFBST/lfbst.h"
+
+static int nwriters = 3;
+static long nkeys = 20000;		/* even keys 2 .. 2 * nkeys */
+static int nscans = 200;
+static int timeout = 60;
+
+static lfbst_t *tree;
+static volatile int stop;
+
+struct writer {
+	pthread_t	pid;
+	int		id;
+	unsigned	seed;
+	long		moves;
+};
+
+/* The j-th odd key of writer w's class */
+static inline size_t token_key(int w, long j)
+{
+	return 2 * (j * nwriters + w) + 1;
+}
+
+static void *do_writer(void *arg)
+{
+	struct writer *w = arg;
+	long slots = nkeys / nwriters, cur = 0, next;
+
+	lfbst_thread_init(tree);
+
+	while (!stop) {
+		next = rand_r(&w->seed) % slots;
+		if (next == cur)
+			continue;
+		lfbst_insert(tree, token_key(w->id, next));
+		lfbst_delete(tree, token_key(w->id, cur));
+		cur = next;
+		w->moves++;
+	}
+
+	lfbst_thread_exit(tree);
+	return NULL;
+}
+
+static void on_timeout(int sig)
+{
+	fprintf(stderr, "FAIL: scans did not finish within %d s\n", timeout);
+	_exit(1);
+}
+
+static long check(const size_t *keys, int n, int *tokens)
+{
+	long errors = 0, evens = 0;
+	int i;
+
+	memset(tokens, 0, nwriters * sizeof(int));
+	for (i = 0; i < n; i++) {
+		if (i > 0 && keys[i] <= keys[i - 1])
+			errors++;
+		if (keys[i] % 2 == 0)
+			evens++;
+		else
+			tokens[((keys[i] - 1) / 2) % nwriters]++;
+	}
+	if (evens != nkeys)
+		errors++;
+	for (i = 0; i < nwriters; i++)
+		if (tokens[i] < 1 || tokens[i] > 2)
+			errors++;
+	return errors;
+}
+
+int main(int argc, char **argv)
+{
+	struct writer *w;
+	struct timeval st, ed;
+	size_t *keys;
+	int *tokens;
+	long errors = 0, moves = 0;
+	double usec, worst = 0, total = 0;
+	int i, n, opt;
+
+	while ((opt = getopt(argc, argv, "w:k:s:t:h")) != -1) {
+		switch (opt) {
+		case 'w': nwriters = atoi(optarg); break;
+		case 'k': nkeys = atol(optarg); break;
+		case 's': nscans = atoi(optarg); break;
+		case 't': timeout = atoi(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-w writers] [-k even keys] [-s scans] [-t timeout s]\n", argv[0]);
+			exit(opt == 'h' ? 0 : 1);
+		}
+	}
+
+	if (nwriters < 1 || nkeys < 2 * nwriters || nscans < 1) {
+		fprintf(stderr, "Bad parameters\n");
+		exit(1);
+	}
+
+	tree = lfbst_create();
+	for (i = 1; i <= nkeys; i++)
+		lfbst_insert(tree, 2 * i);
+
+	keys = malloc((2 * nkeys + 1) * sizeof(size_t));
+	tokens = malloc(nwriters * sizeof(int));
+	w = calloc(nwriters, sizeof(struct writer));
+
+	/* Every writer has its token in before the first scan */
+	for (i = 0; i < nwriters; i++) {
+		w[i].id = i;
+		w[i].seed = i + 1;
+		lfbst_insert(tree, token_key(i, 0));
+		pthread_create(&w[i].pid, NULL, do_writer, &w[i]);
+	}
+
+	signal(SIGALRM, on_timeout);
+	alarm(timeout);
+
+	for (i = 0; i < nscans; i++) {
+		gettimeofday(&st, NULL);
+		n = lfbst_range(tree, 1, 2 * nkeys + 1, keys, 2 * nkeys + 1);
+		gettimeofday(&ed, NULL);
+
+		usec = (ed.tv_sec - st.tv_sec) * 1000000.0 + ed.tv_usec - st.tv_usec;
+		total += usec;
+		if (usec > worst)
+			worst = usec;
+
+		if (check(keys, n, tokens)) {
+			fprintf(stderr, "FAIL: scan %d is not a snapshot (%d keys)\n", i, n);
+			errors++;
+		}
+	}
+
+	alarm(0);
+	stop = 1;
+	for (i = 0; i < nwriters; i++) {
+		pthread_join(w[i].pid, NULL);
+		moves += w[i].moves;
+	}
+
+	printf("lfbst: %d scans of %ld keys against %d writers (%ld moves), %.0f usec avg, %.0f usec worst: %s\n",
+	       nscans, nkeys, nwriters, moves, total / nscans, worst, errors ? "FAILED" : "ok");
+
+	lfbst_destroy(tree);
+	free(keys);
+	free(tokens);
+	free(w);
+	return errors ? 1 : 0;
+}